@@ -15,18 +15,29 @@
 #ifndef TCMALLOC_ALLOCATION_SAMPLING_H_
 #define TCMALLOC_ALLOCATION_SAMPLING_H_
 
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
 #include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <memory>
 #include <utility>
 
+#include "absl/base/internal/cycleclock.h"
 #include "absl/debugging/stacktrace.h"
+#include "absl/types/span.h"
 #include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/guarded_allocations.h"
+#include "tcmalloc/internal/allocation_trace.h"
+#include "tcmalloc/internal/frame_pointer_unwinder.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/pagemap.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/sampled_span_pool.h"
 #include "tcmalloc/sampler.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stack_trace_table.h"
@@ -258,6 +269,37 @@ inline size_t ShouldSampleAllocation(size_t size) {
   return GetThreadSampler()->RecordAllocation(size);
 }
 
+// Captures the caller's stack, as absl::GetStackTrace() would.
+ABSL_ATTRIBUTE_ALWAYS_INLINE inline int GetSampledStackTrace(void** result,
+                                                             int max_depth,
+                                                             int skip_count) {
+  if (Parameters::fast_unwind_sampled_stacks()) {
+    return GetStackTraceFromFramePointers(result, max_depth, skip_count);
+  }
+  return absl::GetStackTrace(result, max_depth, skip_count);
+}
+
+// Adds an event to the active allocation trace.  If stack is nullptr, the
+// innermost frames of the current stack are hashed instead.
+template <typename State>
+ABSL_ATTRIBUTE_NOINLINE static void RecordAllocationTraceEvent(
+    State& state, AllocationTraceEvent::Type type, const void* ptr,
+    size_t size, size_t alignment, const StackTrace* stack) {
+  uint32_t stack_hash;
+  if (stack != nullptr) {
+    stack_hash = AllocationTracer::HashStack(
+        absl::MakeConstSpan(stack->stack, stack->depth));
+  } else {
+    void* frames[AllocationTracer::kAllModeStackDepth];
+    const int depth =
+        GetSampledStackTrace(frames, AllocationTracer::kAllModeStackDepth, 1);
+    stack_hash =
+        AllocationTracer::HashStack(absl::MakeConstSpan(frames, depth));
+  }
+  state.allocation_tracer().Record(type, ptr, size, alignment, stack_hash,
+                                   subtle::percpu::GetCurrentCpu());
+}
+
 template <typename State>
 ABSL_ATTRIBUTE_NOINLINE static inline void FreeProxyObject(State& state,
                                                            void* ptr,
@@ -309,7 +351,8 @@ static sized_ptr_t SampleifyAllocation(State& state, Policy policy,
   stack_trace.proxy = nullptr;
   stack_trace.requested_size = requested_size;
   // Grab the stack trace outside the heap lock.
-  stack_trace.depth = absl::GetStackTrace(stack_trace.stack, kMaxStackDepth, 0);
+  stack_trace.depth =
+      GetSampledStackTrace(stack_trace.stack, kMaxStackDepth, 0);
 
   // requested_alignment = 1 means 'small size table alignment was used'
   // Historically this is reported as requested_alignment = 0
@@ -339,7 +382,8 @@ static sized_ptr_t SampleifyAllocation(State& state, Policy policy,
     if (alloc_with_status.status == Profile::Sample::GuardedStatus::Guarded) {
       ASSERT(IsSampledMemory(alloc_with_status.alloc));
       const PageId p = PageIdContaining(alloc_with_status.alloc);
-      absl::base_internal::SpinLockHolder h(&pageheap_lock);
+      // Neither needs pageheap_lock: the span allocator has its own lock, and
+      // the pagemap entries for guarded pages were created up front.
       span = Span::New(p, num_pages);
       state.pagemap().Set(p, span);
       // If we report capacity back from a size returning allocation, we can not
@@ -352,7 +396,8 @@ static sized_ptr_t SampleifyAllocation(State& state, Policy policy,
         stack_trace.allocated_size = requested_size;
       }
       capacity = requested_size;
-    } else if ((span = state.page_allocator().New(
+    } else if ((span = state.sampled_span_pool().Pop(num_pages)) == nullptr &&
+               (span = state.page_allocator().New(
                     num_pages, {1, AccessDensityPrediction::kSparse},
                     MemoryTag::kSampled)) == nullptr) {
       capacity = stack_trace.allocated_size;
@@ -408,6 +453,14 @@ static sized_ptr_t SampleifyAllocation(State& state, Policy policy,
 
   state.deallocation_samples.ReportMalloc(stack_trace);
 
+  if (ABSL_PREDICT_FALSE(state.allocation_tracer().recording_sampled())) {
+    RecordAllocationTraceEvent(
+        state, AllocationTraceEvent::Type::kAllocate,
+        (alloc_with_status.alloc != nullptr) ? alloc_with_status.alloc
+                                             : span->start_address(),
+        requested_size, stack_trace.requested_alignment, &stack_trace);
+  }
+
   // The SampledAllocation object is visible to readers after this. Readers only
   // care about its various metadata (e.g. stack trace, weight) to generate the
   // heap profile, and won't need any information from Span::Sample() next.
@@ -466,6 +519,11 @@ inline void MaybeUnsampleAllocation(State& state, void* ptr, Span* span) {
 
     state.deallocation_samples.ReportFree(sampled_alloc_handle);
 
+    if (ABSL_PREDICT_FALSE(state.allocation_tracer().recording_sampled())) {
+      RecordAllocationTraceEvent(state, AllocationTraceEvent::Type::kFree, ptr,
+                                 allocated_size, 0, nullptr);
+    }
+
     if (proxy) {
       const auto policy = CppPolicy().InSameNumaPartitionAs(proxy);
       size_t size_class;
@@ -490,10 +548,36 @@ static sized_ptr_t SampleLargeAllocation(State& state, Policy policy,
                              span);
 }
 
+// Times a load from the first cache line of an object that was just handed
+// out, and reports whether it missed to the size class's adaptive prefetching.
+template <typename State>
+inline void ProbeFirstTouch(State& state, size_t size_class, const void* ptr) {
+  if (state.sizemap().alloc_prefetch(size_class) != AllocPrefetch::kAdaptive) {
+    return;
+  }
+#if defined(__x86_64__)
+  // Comfortably above a last-level cache hit, but below a trip to DRAM.
+  static const uint64_t miss_cycles =
+      absl::base_internal::CycleClock::Frequency() * 50e-9;
+  // Unlike rdtsc, rdtscp waits for the load to complete.
+  unsigned int aux;
+  const uint64_t start = __rdtscp(&aux);
+  (void)*static_cast<const volatile char*>(ptr);
+  const uint64_t end = __rdtscp(&aux);
+  state.sizemap().RecordSampledTouch(size_class, end - start >= miss_cycles);
+  state.cpu_cache().UpdatePrefetch(size_class);
+#else
+  // Without a cheap, precise cycle counter there is no feedback, and adaptive
+  // size classes do not prefetch.
+  (void)ptr;
+#endif
+}
+
 template <typename State, typename Policy>
 static sized_ptr_t SampleSmallAllocation(State& state, Policy policy,
                                          size_t requested_size, size_t weight,
                                          size_t size_class, sized_ptr_t res) {
+  ProbeFirstTouch(state, size_class, res.p);
   return SampleifyAllocation(state, policy, requested_size, weight, size_class,
                              res.p, nullptr);
 }
@@ -14,8 +14,10 @@
 
 #include "tcmalloc/arena.h"
 
+#include <algorithm>
 #include <new>
 
+#include "absl/base/internal/spinlock.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/system-alloc.h"
@@ -25,17 +27,14 @@ namespace tcmalloc {
 namespace tcmalloc_internal {
 
 void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
+  absl::base_internal::SpinLockHolder h(&lock_);
   size_t align = static_cast<size_t>(alignment);
   ASSERT(align > 0);
-  {  // First we need to move up to the correct alignment.
-    const int misalignment = reinterpret_cast<uintptr_t>(free_area_) % align;
-    const int alignment_bytes = misalignment != 0 ? align - misalignment : 0;
-    free_area_ += alignment_bytes;
-    free_avail_ -= alignment_bytes;
-    bytes_allocated_ += alignment_bytes;
-  }
+  // The padding needed to move up to the correct alignment.
+  const size_t misalignment = reinterpret_cast<uintptr_t>(free_area_) % align;
+  const size_t alignment_bytes = misalignment != 0 ? align - misalignment : 0;
   char* result;
-  if (free_avail_ < bytes) {
+  if (free_avail_ < alignment_bytes + bytes) {
     size_t ask = bytes > kAllocIncrement ? bytes : kAllocIncrement;
     // TODO(b/171081864): Arena allocations should be made relatively
     // infrequently.  Consider tagging this memory with sampled objects which
@@ -53,7 +52,10 @@ void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
       tag = MemoryTag::kNormal;
     }
 
-    auto [ptr, actual_size] = SystemAlloc(ask, kPageSize, tag);
+    // Blocks are page aligned, so only alignments larger than a page (e.g.,
+    // hugepage-aligned per-CPU slabs) need to be passed down.
+    auto [ptr, actual_size] =
+        SystemAlloc(ask, std::max<size_t>(align, kPageSize), tag);
     free_area_ = reinterpret_cast<char*>(ptr);
     if (ABSL_PREDICT_FALSE(free_area_ == nullptr)) {
       Crash(kCrash, __FILE__, __LINE__,
@@ -70,6 +72,10 @@ void* Arena::Alloc(size_t bytes, std::align_val_t alignment) {
     blocks_++;
 
     free_avail_ = actual_size;
+  } else {
+    free_area_ += alignment_bytes;
+    free_avail_ -= alignment_bytes;
+    bytes_allocated_ += alignment_bytes;
   }
 
   ASSERT(reinterpret_cast<uintptr_t>(free_area_) % align == 0);
@@ -21,6 +21,8 @@
 #include <new>
 
 #include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
 
@@ -52,14 +54,15 @@ class Arena {
   constexpr Arena() {}
 
   // Returns a properly aligned byte array of length "bytes".  Crashes if
-  // allocation fails.  Requires pageheap_lock is held.
+  // allocation fails.
   ABSL_ATTRIBUTE_RETURNS_NONNULL void* Alloc(
       size_t bytes, std::align_val_t alignment = kAlignment)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+      ABSL_LOCKS_EXCLUDED(lock_);
 
   // Updates the stats for allocated and non-resident bytes.
   void UpdateAllocatedAndNonresident(int64_t allocated, int64_t nonresident)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+      ABSL_LOCKS_EXCLUDED(lock_) {
+    absl::base_internal::SpinLockHolder h(&lock_);
     ASSERT(static_cast<int64_t>(bytes_allocated_) + allocated >= 0);
     bytes_allocated_ += allocated;
     ASSERT(static_cast<int64_t>(bytes_nonresident_) + nonresident >= 0);
@@ -67,7 +70,8 @@ class Arena {
   }
 
   // Returns statistics about memory allocated and managed by this Arena.
-  ArenaStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  ArenaStats stats() const ABSL_LOCKS_EXCLUDED(lock_) {
+    absl::base_internal::SpinLockHolder h(&lock_);
     ArenaStats s;
     s.bytes_allocated = bytes_allocated_;
     s.bytes_unallocated = free_avail_;
@@ -81,20 +85,26 @@ class Arena {
   // How much to allocate from system at a time
   static constexpr int kAllocIncrement = 128 << 10;
 
+  // The arena has its own lock, ordered after pageheap_lock (see common.h), so
+  // that allocating metadata does not contend with the page heap.
+  mutable absl::base_internal::SpinLock lock_ ABSL_ACQUIRED_AFTER(
+      pageheap_lock){absl::kConstInit,
+                     absl::base_internal::SCHEDULE_KERNEL_ONLY};
+
   // Free area from which to carve new objects
-  char* free_area_ ABSL_GUARDED_BY(pageheap_lock) = nullptr;
-  size_t free_avail_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  char* free_area_ ABSL_GUARDED_BY(lock_) = nullptr;
+  size_t free_avail_ ABSL_GUARDED_BY(lock_) = 0;
 
   // Total number of bytes allocated from this arena
-  size_t bytes_allocated_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  size_t bytes_allocated_ ABSL_GUARDED_BY(lock_) = 0;
   // The number of bytes that are unused and unavailable for future allocations
   // because they are at the end of a discarded arena block.
-  size_t bytes_unavailable_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  size_t bytes_unavailable_ ABSL_GUARDED_BY(lock_) = 0;
   // The number of bytes on the arena that have been MADV_DONTNEEDed away. Note
   // that these bytes are disjoint from the ones counted in `bytes_allocated`.
-  size_t bytes_nonresident_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  size_t bytes_nonresident_ ABSL_GUARDED_BY(lock_) = 0;
   // Total number of blocks/free areas managed by this Arena.
-  size_t blocks_ ABSL_GUARDED_BY(pageheap_lock) = 0;
+  size_t blocks_ ABSL_GUARDED_BY(lock_) = 0;
 
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
@@ -16,7 +16,10 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <new>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -41,6 +44,22 @@ TEST(Arena, AlignedAlloc) {
   }
 }
 
+TEST(Arena, HugePageAlignedAlloc) {
+  Arena arena;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  // Leave the current block misaligned, so that the next allocation cannot be
+  // carved from it.
+  ASSERT_NE(arena.Alloc(7), nullptr);
+  const ArenaStats before = arena.stats();
+
+  void* ptr = arena.Alloc(kHugePageSize, Align(kHugePageSize));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kHugePageSize, 0);
+  const ArenaStats after = arena.stats();
+  EXPECT_EQ(after.bytes_allocated, before.bytes_allocated + kHugePageSize);
+  EXPECT_EQ(after.bytes_unavailable, before.bytes_unallocated);
+  EXPECT_EQ(after.blocks, before.blocks + 1);
+}
+
 TEST(Arena, Stats) {
   Arena arena;
 
@@ -153,6 +172,37 @@ TEST(Arena, BytesImpending) {
   EXPECT_EQ(stats.bytes_allocated, 100);
 }
 
+TEST(Arena, ConcurrentAlloc) {
+  // The Arena does its own locking, so callers need not hold pageheap_lock.
+  Arena arena;
+  constexpr int kThreads = 4;
+  constexpr int kAllocs = 10000;
+  constexpr size_t kSize = 24;
+  std::vector<std::vector<uintptr_t>> results(kThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      for (int j = 0; j < kAllocs; ++j) {
+        results[i].push_back(
+            reinterpret_cast<uintptr_t>(arena.Alloc(kSize, Align(8))));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::vector<uintptr_t> all;
+  for (const auto& r : results) {
+    all.insert(all.end(), r.begin(), r.end());
+  }
+  std::sort(all.begin(), all.end());
+  for (size_t i = 1; i < all.size(); ++i) {
+    EXPECT_GE(all[i] - all[i - 1], kSize);
+  }
+  EXPECT_EQ(arena.stats().bytes_allocated, kThreads * kAllocs * kSize);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -13,135 +13,276 @@
 // limitations under the License.
 
 #include <errno.h>
+#include <stdint.h>
 
 #include <algorithm>
 
 #include "absl/base/internal/sysinfo.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "tcmalloc/background_scheduler.h"
+#include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/global_stats.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/page_allocator.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/release_queue.h"
 #include "tcmalloc/static_vars.h"
 
-// Release memory to the system at a constant rate.
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// A miss storm is a per-CPU cache miss rate at least kMissStormFactor times
+// its recent average, and at least kMinMissStormRate misses per second.
+constexpr double kMissStormFactor = 2;
+constexpr double kMinMissStormRate = 1000;
+
+// While per-CPU caches are active, the background thread wakes up at least
+// this often to look for CPUs that left the allowed set, however long the
+// scheduler would let it sleep.
+constexpr absl::Duration kDisallowedCpuCheckPeriod = absl::Seconds(1);
+
+uint64_t CpuCacheMisses() {
+  const auto stats = tc_globals.cpu_cache().GetTotalCacheMissStats();
+  return stats.underflows + stats.overflows;
+}
+
+#ifndef TCMALLOC_SMALL_BUT_SLOW
+uint64_t TransferCacheBytes() {
+  uint64_t bytes = 0;
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    bytes += tc_globals.transfer_cache().tc_length(size_class) *
+             tc_globals.sizemap().class_to_size(size_class);
+  }
+  return bytes;
+}
+
+uint64_t TransferCacheMisses() {
+  uint64_t misses = 0;
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    const TransferCacheStats stats =
+        tc_globals.transfer_cache().GetStats(size_class);
+    misses += stats.insert_misses + stats.remove_misses;
+  }
+  return misses;
+}
+#endif
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+
+// Runs each background action at the cadence chosen by the
+// BackgroundScheduler, sleeping in between.
 void MallocExtension_Internal_ProcessBackgroundActions() {
+  using ::tcmalloc::MallocExtension;
+  using ::tcmalloc::tcmalloc_internal::BackgroundAction;
+  using ::tcmalloc::tcmalloc_internal::BackgroundScheduler;
+  using ::tcmalloc::tcmalloc_internal::BackgroundSignals;
+  using ::tcmalloc::tcmalloc_internal::PageAllocator;
   using ::tcmalloc::tcmalloc_internal::Parameters;
   using ::tcmalloc::tcmalloc_internal::tc_globals;
+  namespace internal = ::tcmalloc::tcmalloc_internal;
 
-  tcmalloc::MallocExtension::MarkThreadIdle();
+  MallocExtension::MarkThreadIdle();
 
+  BackgroundScheduler& scheduler = tc_globals.background_scheduler();
   absl::Time prev_time = absl::Now();
-  constexpr absl::Duration kSleepTime = absl::Seconds(1);
-
-  // Reclaim inactive per-cpu caches once per kCpuCacheReclaimPeriod.
-  //
-  // We use a longer 30 sec reclaim period to make sure that caches are indeed
-  // idle. Reclaim drains entire cache, as opposed to cache shuffle for instance
-  // that only shrinks a cache by a few objects at a time. So, we might have
-  // larger performance degradation if we use a shorter reclaim interval and
-  // drain caches that weren't supposed to.
-  constexpr absl::Duration kCpuCacheReclaimPeriod = absl::Seconds(30);
-  absl::Time last_reclaim = absl::Now();
-
-  // Shuffle per-cpu caches once per kCpuCacheShufflePeriod.
-  constexpr absl::Duration kCpuCacheShufflePeriod = absl::Seconds(5);
-  absl::Time last_shuffle = absl::Now();
-
-  constexpr absl::Duration kSizeClassResizePeriod = absl::Seconds(2);
-  absl::Time last_size_class_resize = absl::Now();
-
-  // See if we should resize the slab once per kCpuCacheSlabResizePeriod. This
-  // period is coprime to kCpuCacheShufflePeriod and kCpuCacheReclaimPeriod.
-  constexpr absl::Duration kCpuCacheSlabResizePeriod = absl::Seconds(29);
-  absl::Time last_slab_resize_check = absl::Now();
+  absl::Time last_release = prev_time;
+  scheduler.Start(prev_time);
 
+  // Benefit inputs that are cumulative counters; each action is credited with
+  // the change since it last ran.
+  int64_t prev_soft_limit_hits =
+      tc_globals.page_allocator().limit_hits(PageAllocator::kSoft);
+  bool have_misses = false;
+  uint64_t prev_misses = 0;
+  double miss_rate_average = 0;
+  uint64_t misses_at_shuffle = 0;
+  uint64_t misses_at_slab_resize = 0;
+  uint64_t prev_num_resizes = 0;
 #ifndef TCMALLOC_SMALL_BUT_SLOW
-  // We reclaim unused objects from the transfer caches once per
-  // kTransferCacheResizePeriod.
-  constexpr absl::Duration kTransferCachePlunderPeriod = absl::Seconds(5);
-  absl::Time last_transfer_cache_plunder_check = absl::Now();
-
-  // Resize transfer caches once per kTransferCacheResizePeriod.
-  constexpr absl::Duration kTransferCacheResizePeriod = absl::Seconds(2);
-  absl::Time last_transfer_cache_resize_check = absl::Now();
+  uint64_t prev_transfer_cache_misses = internal::TransferCacheMisses();
 #endif
 
   while (true) {
-    absl::Time now = absl::Now();
+    const absl::Time now = absl::Now();
+    const bool per_cpu = MallocExtension::PerCpuCachesActive();
+
+    BackgroundSignals signals;
+    const int64_t soft_limit_hits =
+        tc_globals.page_allocator().limit_hits(PageAllocator::kSoft);
+    signals.memory_pressure = soft_limit_hits != prev_soft_limit_hits;
+    prev_soft_limit_hits = soft_limit_hits;
+
+    uint64_t misses = 0;
+    if (per_cpu) {
+      misses = internal::CpuCacheMisses();
+      const double elapsed = absl::ToDoubleSeconds(now - prev_time);
+      if (have_misses && elapsed > 0) {
+        const double rate = (misses - prev_misses) / elapsed;
+        signals.miss_storm =
+            rate >= internal::kMinMissStormRate &&
+            rate >= internal::kMissStormFactor * miss_rate_average;
+        miss_rate_average = 0.75 * miss_rate_average + 0.25 * rate;
+      }
+      prev_misses = misses;
+      have_misses = true;
+    }
+    prev_time = now;
+
+    // Runs action if it is due, crediting it with the benefit fn reports.
+    // Actions that do not apply to the running configuration are skipped, so
+    // that the scheduler does not keep waking up for them.
+    auto run = [&](BackgroundAction action, bool applies, auto fn) {
+      if (!applies) {
+        scheduler.Skip(action);
+        return;
+      }
+      if (!scheduler.Due(action, now)) return;
+      const absl::Time start = absl::Now();
+      const uint64_t benefit = fn();
+      const absl::Time end = absl::Now();
+      scheduler.Record(action, end, end - start, benefit, signals);
+    };
 
     // We follow the cache hierarchy in TCMalloc from outermost (per-CPU) to
     // innermost (the page heap).  Freeing up objects at one layer can help aid
     // memory coalescing for inner caches.
 
-    if (tcmalloc::MallocExtension::PerCpuCachesActive()) {
+    if (per_cpu) {
       // Accelerate fences as part of this operation by registering this thread
       // with rseq.  While this is not strictly required to succeed, we do not
       // expect an inconsistent state for rseq (some threads registered and some
       // threads unable to).
       CHECK_CONDITION(tcmalloc::tcmalloc_internal::subtle::percpu::IsFast());
 
-      // Try to reclaim per-cpu caches once every kCpuCacheReclaimPeriod
-      // when enabled.
-      if (now - last_reclaim >= kCpuCacheReclaimPeriod) {
-        tc_globals.cpu_cache().TryReclaimingCaches();
-        last_reclaim = now;
-      }
+      // The caches of CPUs taken away from us, e.g., by a cpuset update, hold
+      // memory nothing is likely to use again, so they are drained within
+      // kDisallowedCpuCheckPeriod rather than after the reclaim period.  This
+      // costs a sched_getaffinity call per iteration.
+      tc_globals.cpu_cache().DrainDisallowedCpus();
 
-      if (now - last_shuffle >= kCpuCacheShufflePeriod) {
-        tc_globals.cpu_cache().ShuffleCpuCaches();
-        last_shuffle = now;
-      }
+    }
 
-      if (Parameters::resize_cpu_cache_size_classes() &&
-          now - last_size_class_resize >= kSizeClassResizePeriod) {
-        tc_globals.cpu_cache().ResizeSizeClasses();
-        last_size_class_resize = now;
-      }
+    // Reclaim drains entire caches, as opposed to shuffling which only
+    // shrinks a cache by a few objects at a time, so its base period is long
+    // enough to be sure that caches are indeed idle.
+    run(BackgroundAction::kCpuCacheReclaim, per_cpu, [] {
+      const uint64_t before = tc_globals.cpu_cache().GetNumReclaims();
+      tc_globals.cpu_cache().TryReclaimingCaches();
+      return tc_globals.cpu_cache().GetNumReclaims() - before;
+    });
 
-      // See if we need to grow the slab once every kCpuCacheSlabResizePeriod
-      // when enabled.
-      if (Parameters::per_cpu_caches_dynamic_slab_enabled() &&
-          now - last_slab_resize_check >= kCpuCacheSlabResizePeriod) {
-        tc_globals.cpu_cache().ResizeSlabIfNeeded();
-        last_slab_resize_check = now;
-      }
-    }
+    // Shuffling and slab resizing act on the misses seen since they last
+    // ran; with none, there is nothing for them to do.
+    run(BackgroundAction::kCpuCacheShuffle, per_cpu, [&] {
+      tc_globals.cpu_cache().ShuffleCpuCaches();
+      const uint64_t benefit = misses - misses_at_shuffle;
+      misses_at_shuffle = misses;
+      return benefit;
+    });
+
+    run(BackgroundAction::kSizeClassResize,
+        per_cpu && Parameters::resize_cpu_cache_size_classes(), [&] {
+          tc_globals.cpu_cache().ResizeSizeClasses();
+          const uint64_t num_resizes = tc_globals.cpu_cache().GetNumResizes();
+          const uint64_t benefit = num_resizes - prev_num_resizes;
+          prev_num_resizes = num_resizes;
+          return benefit;
+        });
+
+    run(BackgroundAction::kSlabResize,
+        per_cpu && Parameters::per_cpu_caches_dynamic_slab_enabled(), [&] {
+          tc_globals.cpu_cache().ResizeSlabIfNeeded();
+          const uint64_t benefit = misses - misses_at_slab_resize;
+          misses_at_slab_resize = misses;
+          return benefit;
+        });
 
     tc_globals.sharded_transfer_cache().Plunder();
 
 #ifndef TCMALLOC_SMALL_BUT_SLOW
     // Try to plunder and reclaim unused objects from transfer caches.
-    if (now - last_transfer_cache_plunder_check >=
-        kTransferCachePlunderPeriod) {
+    run(BackgroundAction::kTransferCachePlunder, true, [] {
+      const uint64_t before = internal::TransferCacheBytes();
       tc_globals.transfer_cache().TryPlunder();
-      last_transfer_cache_plunder_check = now;
-    }
+      const uint64_t after = internal::TransferCacheBytes();
+      return before > after ? before - after : 0;
+    });
 
-    if (now - last_transfer_cache_resize_check >= kTransferCacheResizePeriod) {
+    run(BackgroundAction::kTransferCacheResize, true, [&] {
       tc_globals.transfer_cache().TryResizingCaches();
-      last_transfer_cache_resize_check = now;
-    }
+      const uint64_t transfer_cache_misses = internal::TransferCacheMisses();
+      const uint64_t benefit =
+          transfer_cache_misses - prev_transfer_cache_misses;
+      prev_transfer_cache_misses = transfer_cache_misses;
+      return benefit;
+    });
+#else
+    scheduler.Skip(BackgroundAction::kTransferCachePlunder);
+    scheduler.Skip(BackgroundAction::kTransferCacheResize);
 #endif
 
-    // If time goes backwards, we would like to cap the release rate at 0.
-    ssize_t bytes_to_release =
-        static_cast<size_t>(Parameters::background_release_rate()) *
-        absl::ToDoubleSeconds(now - prev_time);
-    bytes_to_release = std::max<ssize_t>(bytes_to_release, 0);
-
-    // If release rate is set to 0, do not release memory to system. However, if
-    // we want to release free and backed hugepages from HugeRegion,
-    // ReleaseMemoryToSystem should be able to release those pages to the
-    // system even with bytes_to_release = 0.
-    if (bytes_to_release > 0 || Parameters::release_pages_from_huge_region()) {
-      tcmalloc::MallocExtension::ReleaseMemoryToSystem(bytes_to_release);
+    run(BackgroundAction::kRelease, true, [&] {
+      // If time goes backwards, we would like to cap the release rate at 0.
+      ssize_t bytes_to_release =
+          static_cast<size_t>(Parameters::background_release_rate()) *
+          absl::ToDoubleSeconds(now - last_release);
+      bytes_to_release = std::max<ssize_t>(bytes_to_release, 0);
+      last_release = now;
+
+      // If release rate is set to 0, do not release memory to system. However,
+      // if we want to release free and backed hugepages from HugeRegion,
+      // ReleaseMemoryToSystem should be able to release those pages to the
+      // system even with bytes_to_release = 0.
+      if (bytes_to_release > 0 ||
+          Parameters::release_pages_from_huge_region()) {
+        return MallocExtension_Internal_ReleaseMemoryToSystem(
+            bytes_to_release);
+      }
+      return size_t{0};
+    });
+
+    run(BackgroundAction::kHugepageCollapse, true,
+        [] { return tc_globals.page_allocator().CollapseHugepages(); });
+
+    // Keep the stats snapshot fresh, so that monitoring reads of the common
+    // properties rarely have to compute them under pageheap_lock.
+    if (Parameters::stats_snapshot_staleness() > absl::ZeroDuration()) {
+      internal::RefreshStatsSnapshot();
     }
 
-    prev_time = now;
-    absl::SleepFor(kSleepTime);
+    absl::Duration sleep = scheduler.TimeUntilNextAction(absl::Now());
+    if (per_cpu) {
+      sleep = std::min(sleep, internal::kDisallowedCpuCheckPeriod);
+    }
+    absl::SleepFor(sleep);
+  }
+}
+
+// Issues the releases queued on the ReleaseQueue, sleeping until Enqueue()
+// wakes it whenever it finds none.
+void MallocExtension_Internal_ProcessReleaseQueue() {
+  using ::tcmalloc::MallocExtension;
+  using ::tcmalloc::tcmalloc_internal::ReleaseQueue;
+  using ::tcmalloc::tcmalloc_internal::tc_globals;
+
+  MallocExtension::MarkThreadIdle();
+
+  ReleaseQueue& queue = tc_globals.page_allocator().release_queue();
+  queue.AddWorker();
+
+  while (true) {
+    // Read before draining, so that a range queued after the drain has looked
+    // at the queue keeps the wait from blocking.
+    const uint32_t epoch = queue.enqueue_epoch();
+    if (queue.Drain() > 0) continue;
+    queue.WaitForEnqueue(epoch);
   }
 }
@@ -0,0 +1,310 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_BACKGROUND_SCHEDULER_H_
+#define TCMALLOC_BACKGROUND_SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/malloc_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+using BackgroundAction = MallocExtension::BackgroundAction;
+
+inline constexpr int kNumBackgroundActions =
+    static_cast<int>(BackgroundAction::kHugepageCollapse) + 1;
+
+// Conditions the background thread observed since its previous wakeup.
+struct BackgroundSignals {
+  // The page heap had to shrink to stay under its soft limit.
+  bool memory_pressure = false;
+  // Per-CPU caches missed much more often than they have recently.
+  bool miss_storm = false;
+};
+
+// Decides when each action of ProcessBackgroundActions runs next.
+//
+// Every action has a base period.  A run that accomplishes nothing (returns
+// no memory, finds no misses to react to) doubles the action's effective
+// period, up to kMaxBackoff times the base, so idle processes rarely wake up.
+// A productive run halves it back towards the base.  Memory pressure, for the
+// actions that return memory, and miss storms, for the actions that move cache
+// capacity around, drop it to 1/kMaxSpeedup of the base.
+//
+// All mutations happen on the background thread; the atomics only allow
+// stats and the base periods to be read and set from elsewhere.
+class BackgroundScheduler {
+ public:
+  static constexpr int kMaxBackoff = 8;
+  static constexpr int kMaxSpeedup = 4;
+
+  // Bounds on how long the background thread sleeps between wakeups.
+  static constexpr absl::Duration kMinSleep = absl::Milliseconds(100);
+  static constexpr absl::Duration kMaxSleep = absl::Seconds(30);
+
+  constexpr BackgroundScheduler() = default;
+
+  static absl::string_view ActionName(BackgroundAction action);
+
+  // Unknown actions are disabled.
+  absl::Duration base_period(BackgroundAction action) const {
+    if (!IsValid(action)) return absl::InfiniteDuration();
+    const int64_t ns =
+        state(action).base_period_ns.load(std::memory_order_relaxed);
+    return ns == kDisabled ? absl::InfiniteDuration() : absl::Nanoseconds(ns);
+  }
+  // Returns false, and leaves the period unchanged, if action is unknown or
+  // period is not positive.
+  bool set_base_period(BackgroundAction action, absl::Duration period) {
+    if (!IsValid(action) || period <= absl::ZeroDuration()) return false;
+    ActionState& s = state(action);
+    s.base_period_ns.store(ToNanos(period), std::memory_order_relaxed);
+    // Restart adaptation from the new base.
+    s.period_ns.store(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  // The period the action currently runs at.
+  absl::Duration period(BackgroundAction action) const {
+    const int64_t ns = state(action).period_ns.load(std::memory_order_relaxed);
+    return ns == 0 ? base_period(action) : absl::Nanoseconds(ns);
+  }
+
+  // Marks all actions as having just run, so that none is due before its
+  // period elapses.
+  void Start(absl::Time now);
+
+  // Returns true if action is enabled and its period has elapsed since it last
+  // ran.
+  bool Due(BackgroundAction action, absl::Time now) const;
+
+  // Records a run of action that finished at now, took cost, and achieved
+  // benefit (an action-specific count of bytes returned or misses acted
+  // upon; zero if it found nothing to do).  Adjusts the action's period.
+  void Record(BackgroundAction action, absl::Time now, absl::Duration cost,
+              uint64_t benefit, BackgroundSignals signals);
+
+  // Records that action does not apply to the running configuration (e.g., a
+  // per-CPU cache action while per-CPU caches are off).  Until it next runs,
+  // the background thread does not wake up for it.
+  void Skip(BackgroundAction action);
+
+  // Returns how long the background thread can sleep before an action that
+  // applies is due.
+  absl::Duration TimeUntilNextAction(absl::Time now) const;
+
+  void Print(Printer* out) const;
+  void PrintInPbtxt(PbtxtRegion* region) const;
+
+ private:
+  static constexpr int64_t kDisabled = INT64_MAX;
+  static constexpr int64_t kSecondNs = 1000 * 1000 * 1000;
+
+  struct ActionState {
+    std::atomic<int64_t> base_period_ns{0};
+    // Zero until the first adjustment: the action runs at its base period.
+    std::atomic<int64_t> period_ns{0};
+    std::atomic<uint64_t> runs{0};
+    std::atomic<int64_t> cost_ns{0};
+    std::atomic<uint64_t> benefit{0};
+    // Only accessed by the background thread.
+    absl::Time last_run;
+    bool skipped = false;
+  };
+
+  static int64_t ToNanos(absl::Duration d) {
+    return d == absl::InfiniteDuration() ? kDisabled
+                                         : absl::ToInt64Nanoseconds(d);
+  }
+
+  static bool IsValid(BackgroundAction action) {
+    return static_cast<int>(action) >= 0 &&
+           static_cast<int>(action) < kNumBackgroundActions;
+  }
+  static bool RespondsToMemoryPressure(BackgroundAction action);
+  static bool RespondsToMisses(BackgroundAction action);
+
+  ActionState& state(BackgroundAction action) {
+    return actions_[static_cast<int>(action)];
+  }
+  const ActionState& state(BackgroundAction action) const {
+    return actions_[static_cast<int>(action)];
+  }
+
+  bool enabled(BackgroundAction action) const {
+    return state(action).base_period_ns.load(std::memory_order_relaxed) !=
+           kDisabled;
+  }
+
+  ActionState actions_[kNumBackgroundActions] = {
+      {30 * kSecondNs},  // kCpuCacheReclaim
+      {5 * kSecondNs},  // kCpuCacheShuffle
+      {2 * kSecondNs},  // kSizeClassResize
+      {29 * kSecondNs},  // kSlabResize
+      {5 * kSecondNs},  // kTransferCachePlunder
+      {2 * kSecondNs},  // kTransferCacheResize
+      {1 * kSecondNs},  // kRelease
+      {10 * kSecondNs},  // kHugepageCollapse
+  };
+};
+
+inline absl::string_view BackgroundScheduler::ActionName(
+    BackgroundAction action) {
+  switch (action) {
+    case BackgroundAction::kCpuCacheReclaim:
+      return "cpu_cache_reclaim";
+    case BackgroundAction::kCpuCacheShuffle:
+      return "cpu_cache_shuffle";
+    case BackgroundAction::kSizeClassResize:
+      return "size_class_resize";
+    case BackgroundAction::kSlabResize:
+      return "slab_resize";
+    case BackgroundAction::kTransferCachePlunder:
+      return "transfer_cache_plunder";
+    case BackgroundAction::kTransferCacheResize:
+      return "transfer_cache_resize";
+    case BackgroundAction::kRelease:
+      return "release";
+    case BackgroundAction::kHugepageCollapse:
+      return "hugepage_collapse";
+  }
+  ASSUME(false);
+  return "";
+}
+
+inline bool BackgroundScheduler::RespondsToMemoryPressure(
+    BackgroundAction action) {
+  return action == BackgroundAction::kCpuCacheReclaim ||
+         action == BackgroundAction::kTransferCachePlunder ||
+         action == BackgroundAction::kRelease;
+}
+
+inline bool BackgroundScheduler::RespondsToMisses(BackgroundAction action) {
+  return action == BackgroundAction::kCpuCacheShuffle ||
+         action == BackgroundAction::kSizeClassResize ||
+         action == BackgroundAction::kSlabResize ||
+         action == BackgroundAction::kTransferCacheResize;
+}
+
+inline void BackgroundScheduler::Start(absl::Time now) {
+  for (ActionState& s : actions_) {
+    s.last_run = now;
+  }
+}
+
+inline bool BackgroundScheduler::Due(BackgroundAction action,
+                                     absl::Time now) const {
+  if (!enabled(action)) return false;
+  return now - state(action).last_run >= period(action);
+}
+
+inline void BackgroundScheduler::Record(BackgroundAction action,
+                                        absl::Time now, absl::Duration cost,
+                                        uint64_t benefit,
+                                        BackgroundSignals signals) {
+  ActionState& s = state(action);
+  s.last_run = now;
+  s.skipped = false;
+  s.runs.fetch_add(1, std::memory_order_relaxed);
+  s.cost_ns.fetch_add(absl::ToInt64Nanoseconds(cost),
+                      std::memory_order_relaxed);
+  s.benefit.fetch_add(benefit, std::memory_order_relaxed);
+
+  const absl::Duration base = base_period(action);
+  absl::Duration next = period(action);
+  if ((signals.memory_pressure && RespondsToMemoryPressure(action)) ||
+      (signals.miss_storm && RespondsToMisses(action))) {
+    next = base / kMaxSpeedup;
+  } else if (benefit > 0) {
+    next = std::max(next / 2, base);
+  } else {
+    next = std::min(next * 2, base * kMaxBackoff);
+  }
+  s.period_ns.store(std::max<int64_t>(absl::ToInt64Nanoseconds(next), 1),
+                    std::memory_order_relaxed);
+}
+
+inline void BackgroundScheduler::Skip(BackgroundAction action) {
+  state(action).skipped = true;
+}
+
+inline absl::Duration BackgroundScheduler::TimeUntilNextAction(
+    absl::Time now) const {
+  absl::Duration sleep = kMaxSleep;
+  for (int i = 0; i < kNumBackgroundActions; ++i) {
+    const auto action = static_cast<BackgroundAction>(i);
+    // A skipped action never runs, so it would stay overdue and keep the
+    // sleep at kMinSleep.
+    if (!enabled(action) || state(action).skipped) continue;
+    sleep = std::min(sleep, state(action).last_run + period(action) - now);
+  }
+  return std::clamp(sleep, kMinSleep, kMaxSleep);
+}
+
+inline void BackgroundScheduler::Print(Printer* out) const {
+  out->printf("------------------------------------------------\n");
+  out->printf("Background actions: period (base), runs, cost, benefit\n");
+  out->printf("------------------------------------------------\n");
+  for (int i = 0; i < kNumBackgroundActions; ++i) {
+    const auto action = static_cast<BackgroundAction>(i);
+    const ActionState& s = state(action);
+    if (!enabled(action)) {
+      out->printf("%-24s disabled\n", ActionName(action));
+      continue;
+    }
+    out->printf(
+        "%-24s %8s (%8s) %10u runs %12s %16u\n", ActionName(action),
+        absl::FormatDuration(period(action)),
+        absl::FormatDuration(base_period(action)),
+        s.runs.load(std::memory_order_relaxed),
+        absl::FormatDuration(
+            absl::Nanoseconds(s.cost_ns.load(std::memory_order_relaxed))),
+        s.benefit.load(std::memory_order_relaxed));
+  }
+}
+
+inline void BackgroundScheduler::PrintInPbtxt(PbtxtRegion* region) const {
+  for (int i = 0; i < kNumBackgroundActions; ++i) {
+    const auto action = static_cast<BackgroundAction>(i);
+    const ActionState& s = state(action);
+    auto entry = region->CreateSubRegion("background_action");
+    entry.PrintRaw("action", ActionName(action));
+    entry.PrintBool("enabled", enabled(action));
+    if (!enabled(action)) continue;
+    entry.PrintI64("period_ns", absl::ToInt64Nanoseconds(period(action)));
+    entry.PrintI64("base_period_ns",
+                   absl::ToInt64Nanoseconds(base_period(action)));
+    entry.PrintI64("runs", s.runs.load(std::memory_order_relaxed));
+    entry.PrintI64("cost_ns", s.cost_ns.load(std::memory_order_relaxed));
+    entry.PrintI64("benefit", s.benefit.load(std::memory_order_relaxed));
+  }
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_BACKGROUND_SCHEDULER_H_
@@ -0,0 +1,151 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/background_scheduler.h"
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr BackgroundAction kRelease = BackgroundAction::kRelease;
+constexpr BackgroundAction kShuffle = BackgroundAction::kCpuCacheShuffle;
+
+class BackgroundSchedulerTest : public ::testing::Test {
+ protected:
+  BackgroundSchedulerTest() { scheduler_.Start(now_); }
+
+  // Advances the clock to when action is next due, and runs it.
+  void RunNext(BackgroundAction action, uint64_t benefit,
+               BackgroundSignals signals = {}) {
+    now_ += scheduler_.period(action);
+    ASSERT_TRUE(scheduler_.Due(action, now_));
+    scheduler_.Record(action, now_, absl::Microseconds(1), benefit, signals);
+  }
+
+  BackgroundScheduler scheduler_;
+  absl::Time now_ = absl::UnixEpoch();
+};
+
+TEST_F(BackgroundSchedulerTest, DefaultsToBasePeriod) {
+  EXPECT_EQ(scheduler_.period(kRelease), absl::Seconds(1));
+  EXPECT_EQ(scheduler_.base_period(kRelease), absl::Seconds(1));
+  EXPECT_FALSE(scheduler_.Due(kRelease, now_ + absl::Milliseconds(999)));
+  EXPECT_TRUE(scheduler_.Due(kRelease, now_ + absl::Seconds(1)));
+  EXPECT_EQ(scheduler_.TimeUntilNextAction(now_), absl::Seconds(1));
+}
+
+TEST_F(BackgroundSchedulerTest, BacksOffWhenIdle) {
+  const absl::Duration base = scheduler_.base_period(kRelease);
+  RunNext(kRelease, 0);
+  EXPECT_EQ(scheduler_.period(kRelease), 2 * base);
+  for (int i = 0; i < 10; ++i) {
+    RunNext(kRelease, 0);
+  }
+  EXPECT_EQ(scheduler_.period(kRelease),
+            BackgroundScheduler::kMaxBackoff * base);
+
+  // Productive runs return towards the base period.
+  RunNext(kRelease, 4096);
+  EXPECT_EQ(scheduler_.period(kRelease),
+            BackgroundScheduler::kMaxBackoff / 2 * base);
+  for (int i = 0; i < 10; ++i) {
+    RunNext(kRelease, 4096);
+  }
+  EXPECT_EQ(scheduler_.period(kRelease), base);
+}
+
+TEST_F(BackgroundSchedulerTest, SpeedsUpOnSignals) {
+  const absl::Duration release_base = scheduler_.base_period(kRelease);
+  const absl::Duration shuffle_base = scheduler_.base_period(kShuffle);
+
+  // Misses do not affect release; memory pressure does.
+  RunNext(kRelease, 4096, {.miss_storm = true});
+  EXPECT_EQ(scheduler_.period(kRelease), release_base);
+  RunNext(kRelease, 4096, {.memory_pressure = true});
+  EXPECT_EQ(scheduler_.period(kRelease),
+            release_base / BackgroundScheduler::kMaxSpeedup);
+
+  RunNext(kShuffle, 0, {.memory_pressure = true});
+  EXPECT_EQ(scheduler_.period(kShuffle), 2 * shuffle_base);
+  RunNext(kShuffle, 0, {.miss_storm = true});
+  EXPECT_EQ(scheduler_.period(kShuffle),
+            shuffle_base / BackgroundScheduler::kMaxSpeedup);
+}
+
+TEST_F(BackgroundSchedulerTest, SetBasePeriod) {
+  RunNext(kRelease, 0);
+  scheduler_.set_base_period(kRelease, absl::Seconds(3));
+  EXPECT_EQ(scheduler_.period(kRelease), absl::Seconds(3));
+
+  scheduler_.set_base_period(kRelease, absl::InfiniteDuration());
+  EXPECT_EQ(scheduler_.base_period(kRelease), absl::InfiniteDuration());
+  EXPECT_FALSE(scheduler_.Due(kRelease, absl::InfiniteFuture()));
+}
+
+TEST_F(BackgroundSchedulerTest, RejectsInvalidPeriods) {
+  const absl::Duration base = scheduler_.base_period(kRelease);
+  EXPECT_FALSE(scheduler_.set_base_period(kRelease, absl::ZeroDuration()));
+  EXPECT_FALSE(scheduler_.set_base_period(kRelease, -absl::Seconds(1)));
+  EXPECT_FALSE(scheduler_.set_base_period(kRelease, -absl::InfiniteDuration()));
+  EXPECT_EQ(scheduler_.base_period(kRelease), base);
+
+  const auto unknown = static_cast<BackgroundAction>(kNumBackgroundActions);
+  EXPECT_FALSE(scheduler_.set_base_period(unknown, absl::Seconds(1)));
+  EXPECT_EQ(scheduler_.base_period(unknown), absl::InfiniteDuration());
+}
+
+TEST_F(BackgroundSchedulerTest, SleepIsBounded) {
+  for (int i = 0; i < kNumBackgroundActions; ++i) {
+    scheduler_.set_base_period(static_cast<BackgroundAction>(i),
+                               absl::InfiniteDuration());
+  }
+  EXPECT_EQ(scheduler_.TimeUntilNextAction(now_),
+            BackgroundScheduler::kMaxSleep);
+
+  scheduler_.set_base_period(kRelease, absl::Milliseconds(1));
+  EXPECT_EQ(scheduler_.TimeUntilNextAction(now_),
+            BackgroundScheduler::kMinSleep);
+}
+
+TEST_F(BackgroundSchedulerTest, SkippedActionsDoNotShortenSleep) {
+  for (int i = 0; i < kNumBackgroundActions; ++i) {
+    const auto action = static_cast<BackgroundAction>(i);
+    if (action != kRelease && action != kShuffle) {
+      scheduler_.set_base_period(action, absl::InfiniteDuration());
+    }
+  }
+
+  // Shuffling is overdue, but does not apply, e.g., because per-CPU caches
+  // are off.
+  now_ += absl::Minutes(1);
+  scheduler_.Skip(kShuffle);
+  EXPECT_TRUE(scheduler_.Due(kShuffle, now_));
+  RunNext(kRelease, 4096);
+  EXPECT_EQ(scheduler_.TimeUntilNextAction(now_),
+            scheduler_.period(kRelease));
+
+  // Once it runs again, the scheduler waits for it as before.
+  scheduler_.Record(kShuffle, now_, absl::Microseconds(1), 1, {});
+  now_ += scheduler_.period(kShuffle);
+  EXPECT_EQ(scheduler_.TimeUntilNextAction(now_),
+            BackgroundScheduler::kMinSleep);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
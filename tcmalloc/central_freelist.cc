@@ -16,9 +16,14 @@
 
 #include <stdint.h>
 
+#include <new>
+
+#include "tcmalloc/experiment.h"
+#include "tcmalloc/experiment_config.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/prefetch.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/pagemap.h"
@@ -63,8 +68,8 @@ Span* StaticForwarder::AllocateSpan(int size_class,
                                     SpanAllocInfo span_alloc_info,
                                     Length pages_per_span) {
   const MemoryTag tag = MemoryTagFromSizeClass(size_class);
-  Span* span =
-      tc_globals.page_allocator().New(pages_per_span, span_alloc_info, tag);
+  Span* span = tc_globals.page_allocator().NewForSizeClass(
+      size_class, pages_per_span, span_alloc_info, tag);
   if (ABSL_PREDICT_FALSE(span == nullptr)) {
     return nullptr;
   }
@@ -75,6 +80,25 @@ Span* StaticForwarder::AllocateSpan(int size_class,
   return span;
 }
 
+int StaticForwarder::NumShards() {
+  if (!IsExperimentActive(Experiment::TCMALLOC_SHARDED_CENTRAL_FREELIST)) {
+    return 1;
+  }
+  return tc_globals.cache_topology().shard_count();
+}
+
+int StaticForwarder::CurrentShard() {
+  const int cpu = subtle::percpu::RseqCpuId();
+  if (cpu < 0) {
+    return 0;
+  }
+  return tc_globals.cache_topology().GetL3FromCpuId(cpu);
+}
+
+void* StaticForwarder::Alloc(size_t size, std::align_val_t alignment) {
+  return tc_globals.arena().Alloc(size, alignment);
+}
+
 static void ReturnSpansToPageHeap(MemoryTag tag, absl::Span<Span*> free_spans,
                                   size_t objects_per_span)
     ABSL_LOCKS_EXCLUDED(pageheap_lock) {
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <new>
 
 #include "absl/base/attributes.h"
 #include "absl/base/const_init.h"
@@ -55,6 +56,13 @@ class StaticForwarder {
   static void DeallocateSpans(int size_class, size_t objects_per_span,
                               absl::Span<Span*> free_spans)
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Used by ShardedCentralFreeList.
+  static int NumShards();
+  static int CurrentShard();
+  // Allocates from the Arena, which takes its own lock.  Callers may hold
+  // pageheap_lock, which is ordered before it.
+  static void* Alloc(size_t size, std::align_val_t alignment);
 };
 
 // Specifies number of nonempty_ lists that keep track of non-empty spans.
@@ -90,11 +98,36 @@ class CentralFreeList {
   // REQUIRES: batch.size() > 0 && batch.size() <= kMaxObjectsToMove.
   void InsertRange(absl::Span<void*> batch) ABSL_LOCKS_EXCLUDED(lock_);
 
+  // Like InsertRange(batch), for a caller that has already looked up the span
+  // of each object: spans[i] holds batch[i].  Clobbers spans.
+  void InsertRange(absl::Span<void*> batch, Span** spans)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
   // Fill a prefix of batch[0..N-1] with up to N elements removed from central
   // freelist.  Return the number of elements removed.
   ABSL_MUST_USE_RESULT int RemoveRange(void** batch, int N)
       ABSL_LOCKS_EXCLUDED(lock_);
 
+  // Like RemoveRange, but only hands out objects from spans the freelist
+  // already holds, and never allocates a new span.
+  ABSL_MUST_USE_RESULT int RemoveCachedRange(void** batch, int N)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Like RemoveCachedRange, but gives up and returns false, rather than
+  // waiting, if another thread holds lock_.  Otherwise stores the number of
+  // elements removed in *removed.
+  ABSL_MUST_USE_RESULT bool TryRemoveCachedRange(void** batch, int N,
+                                                 int* removed)
+      ABSL_LOCKS_EXCLUDED(lock_);
+
+  // Allocates a new span for this size class from the forwarder.
+  Span* AllocateSpan();
+
+  // Fills a prefix of batch[0..N-1] from span, which was returned by
+  // AllocateSpan(), and keeps the rest of its objects.  Returns the number of
+  // elements placed in batch.
+  int AdoptSpan(Span* span, void** batch, int N) ABSL_LOCKS_EXCLUDED(lock_);
+
   // Returns the number of free objects in cache.
   size_t length() const { return static_cast<size_t>(counter_.value()); }
 
@@ -123,9 +156,14 @@ class CentralFreeList {
   Forwarder& forwarder() { return forwarder_; }
 
  private:
-  // Release an object to spans.
+  // Reports span utilization across its shards.
+  template <typename>
+  friend class ShardedCentralFreeList;
+
+  // Release an object, whose freelist index in span is idx, to spans.
   // Returns object's span if it become completely free.
-  Span* ReleaseToSpans(void* object, Span* span, size_t object_size)
+  Span* ReleaseToSpans(void* object, Span::ObjIdx idx, Span* span,
+                       size_t object_size)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
   // Populate cache by fetching from the page heap.
@@ -134,8 +172,16 @@ class CentralFreeList {
   // freelist. Returns the number of elements removed.
   int Populate(void** batch, int N) ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
-  // Allocate a span from the forwarder.
-  Span* AllocateSpan();
+  // Starts tracking a newly allocated span, from which `removed` objects have
+  // been handed out.
+  void AddPopulatedSpan(Span* span, size_t removed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Fill a prefix of batch[0..N-1] with up to N elements removed from the
+  // spans in nonempty_.  Returns the number of elements removed, which is less
+  // than N only if nonempty_ ran out.  Does not update counter_.
+  int RemoveFromNonEmptySpans(void** batch, int N)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
   // Parses nonempty_ lists and returns span from the list with the lowest
   // possible index.
@@ -276,6 +322,7 @@ inline void CentralFreeList<Forwarder>::Init(size_t size_class)
 
 template <class Forwarder>
 inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(void* object,
+                                                        Span::ObjIdx idx,
                                                         Span* span,
                                                         size_t object_size) {
   if (ABSL_PREDICT_FALSE(span->FreelistEmpty(object_size))) {
@@ -291,7 +338,7 @@ inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(void* object,
 #ifdef TCMALLOC_SMALL_BUT_SLOW
   // We maintain a single nonempty list for small-but-slow. Also, we do not
   // collect histogram stats due to performance issues.
-  if (ABSL_PREDICT_TRUE(span->FreelistPush(object, object_size))) {
+  if (ABSL_PREDICT_TRUE(span->FreelistPush(object, idx, object_size))) {
     return nullptr;
   }
   nonempty_.remove(span);
@@ -299,7 +346,7 @@ inline Span* CentralFreeList<Forwarder>::ReleaseToSpans(void* object,
 #else
   const uint8_t prev_index = span->nonempty_index();
   const uint8_t prev_bitwidth = absl::bit_width(span->Allocated());
-  if (ABSL_PREDICT_FALSE(!span->FreelistPush(object, object_size))) {
+  if (ABSL_PREDICT_FALSE(!span->FreelistPush(object, idx, object_size))) {
     // Update the histogram as the span is full and will be removed from the
     // nonempty_ list.
     RecordSpanUtil(prev_bitwidth, /*increase=*/false);
@@ -390,7 +437,13 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
   // First, map objects to spans and prefetch spans outside of our mutex
   // (to reduce critical section size and cache misses).
   forwarder_.MapObjectsToSpans(batch, spans);
+  InsertRange(batch, spans);
+}
 
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch,
+                                                    Span** spans) {
+  ASSERT(!batch.empty() && batch.size() <= kMaxObjectsToMove);
   if (objects_per_span_ == 1) {
     // If there is only 1 object per span, skip CentralFreeList entirely.
     forwarder_.DeallocateSpans(size_class_, objects_per_span_,
@@ -398,6 +451,13 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
     return;
   }
 
+  // Use local copy of variable to ensure that it is not reloaded.
+  const size_t object_size = object_size_;
+
+  // Convert objects to freelist indices before taking our mutex, too.
+  Span::ObjIdx idx[kMaxObjectsToMove];
+  Span::BatchPtrToIdx(batch, spans, object_size, idx);
+
   // Safe to store free spans into freed up space in span array.
   Span** free_spans = spans;
   int free_count = 0;
@@ -405,11 +465,9 @@ inline void CentralFreeList<Forwarder>::InsertRange(absl::Span<void*> batch) {
   // Then, release all individual objects into spans under our mutex
   // and collect spans that become completely free.
   {
-    // Use local copy of variable to ensure that it is not reloaded.
-    size_t object_size = object_size_;
     absl::base_internal::SpinLockHolder h(&lock_);
     for (int i = 0; i < batch.size(); ++i) {
-      Span* span = ReleaseToSpans(batch[i], spans[i], object_size);
+      Span* span = ReleaseToSpans(batch[i], idx[i], spans[i], object_size);
       if (ABSL_PREDICT_FALSE(span)) {
         free_spans[free_count] = span;
         free_count++;
@@ -441,15 +499,46 @@ inline int CentralFreeList<Forwarder>::RemoveRange(void** batch, int N) {
     return 1;
   }
 
+  absl::base_internal::SpinLockHolder h(&lock_);
+  int result = RemoveFromNonEmptySpans(batch, N);
+  if (result < N) {
+    result += Populate(batch + result, N - result);
+  }
+  UpdateObjectCounts(-result);
+  return result;
+}
+
+template <class Forwarder>
+inline int CentralFreeList<Forwarder>::RemoveCachedRange(void** batch, int N) {
+  ASSUME(N > 0);
+  absl::base_internal::SpinLockHolder h(&lock_);
+  const int result = RemoveFromNonEmptySpans(batch, N);
+  UpdateObjectCounts(-result);
+  return result;
+}
+
+template <class Forwarder>
+inline bool CentralFreeList<Forwarder>::TryRemoveCachedRange(void** batch,
+                                                             int N,
+                                                             int* removed) {
+  ASSUME(N > 0);
+  if (!lock_.TryLock()) return false;
+  *removed = RemoveFromNonEmptySpans(batch, N);
+  UpdateObjectCounts(-*removed);
+  lock_.Unlock();
+  return true;
+}
+
+template <class Forwarder>
+inline int CentralFreeList<Forwarder>::RemoveFromNonEmptySpans(void** batch,
+                                                               int N) {
   // Use local copy of variable to ensure that it is not reloaded.
   size_t object_size = object_size_;
   int result = 0;
-  absl::base_internal::SpinLockHolder h(&lock_);
 
   do {
     Span* span = FirstNonEmptySpan();
     if (ABSL_PREDICT_FALSE(!span)) {
-      result += Populate(batch + result, N - result);
       break;
     }
 
@@ -489,7 +578,6 @@ inline int CentralFreeList<Forwarder>::RemoveRange(void** batch, int N) {
 #endif
     result += here;
   } while (result < N);
-  UpdateObjectCounts(-result);
   return result;
 }
 
@@ -509,10 +597,31 @@ inline int CentralFreeList<Forwarder>::Populate(void** batch, int N)
 
   int result = span->BuildFreelist(object_size_, objects_per_span_, batch, N);
   ASSERT(result > 0);
-  // This is a cheaper check than using FreelistEmpty().
-  bool span_empty = result == objects_per_span_;
 
   lock_.Lock();
+  AddPopulatedSpan(span, result);
+  return result;
+}
+
+template <class Forwarder>
+inline int CentralFreeList<Forwarder>::AdoptSpan(Span* span, void** batch,
+                                                 int N) {
+  ASSUME(N > 0);
+  ASSERT(objects_per_span_ > 1);
+  int result = span->BuildFreelist(object_size_, objects_per_span_, batch, N);
+  ASSERT(result > 0);
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  AddPopulatedSpan(span, result);
+  UpdateObjectCounts(-result);
+  return result;
+}
+
+template <class Forwarder>
+inline void CentralFreeList<Forwarder>::AddPopulatedSpan(Span* span,
+                                                         size_t removed) {
+  // This is a cheaper check than using FreelistEmpty().
+  bool span_empty = removed == objects_per_span_;
 
 #ifdef TCMALLOC_SMALL_BUT_SLOW
   // We do not collect histogram stats for small-but-slow. Moreover, we maintain
@@ -531,7 +640,6 @@ inline int CentralFreeList<Forwarder>::Populate(void** batch, int N)
   }
 #endif
   RecordSpanAllocated();
-  return result;
 }
 
 template <class Forwarder>
@@ -607,9 +715,297 @@ inline void CentralFreeList<Forwarder>::PrintSpanUtilStatsInPbtxt(
   }
 }
 
+// Lets the shards of a ShardedCentralFreeList share their parent's forwarder.
+template <typename Forwarder>
+class ShardForwarder {
+ public:
+  constexpr ShardForwarder() = default;
+
+  void Bind(Forwarder* forwarder) { forwarder_ = forwarder; }
+
+  static size_t class_to_size(int size_class) {
+    return Forwarder::class_to_size(size_class);
+  }
+  static Length class_to_pages(int size_class) {
+    return Forwarder::class_to_pages(size_class);
+  }
+  void MapObjectsToSpans(absl::Span<void*> batch, Span** spans) {
+    forwarder_->MapObjectsToSpans(batch, spans);
+  }
+  Span* AllocateSpan(int size_class, SpanAllocInfo span_alloc_info,
+                     Length pages_per_span) {
+    return forwarder_->AllocateSpan(size_class, span_alloc_info,
+                                    pages_per_span);
+  }
+  void DeallocateSpans(int size_class, size_t objects_per_span,
+                       absl::Span<Span*> free_spans) {
+    forwarder_->DeallocateSpans(size_class, objects_per_span, free_spans);
+  }
+
+ private:
+  Forwarder* forwarder_ = nullptr;
+};
+
+// Upper bound on the number of shards of a ShardedCentralFreeList.
+inline constexpr int kMaxShards = 16;
+
+// Splits a size class's CentralFreeList into shards, each with its own lock,
+// so that transfer cache misses do not all contend on one lock.  There are as
+// many shards as L3 caches, but shards are not tied to caches.
+//
+// Spans do not have room to record which shard they belong to, so a span's
+// shard is derived from its address: spans are striped across the shards
+// by address, and inserted objects go to the shard of their span.  Removal
+// starts at the shard numbered after the calling CPU's L3 cache, so that
+// callers on different caches usually start on different locks, and moves on
+// to the others, first without waiting for busy locks, and then waiting for
+// them.  Only if every shard is out of objects is a new span allocated, and
+// it goes to the shard its address maps to.
+//
+// With a single shard, every call goes straight to the underlying
+// CentralFreeList.
+template <typename ForwarderT>
+class ShardedCentralFreeList {
+ public:
+  using Forwarder = ForwarderT;
+
+  constexpr ShardedCentralFreeList() = default;
+
+  ShardedCentralFreeList(const ShardedCentralFreeList&) = delete;
+  ShardedCentralFreeList& operator=(const ShardedCentralFreeList&) = delete;
+
+  void Init(size_t size_class);
+
+  // REQUIRES: batch.size() > 0 && batch.size() <= kMaxObjectsToMove.
+  void InsertRange(absl::Span<void*> batch);
+
+  ABSL_MUST_USE_RESULT int RemoveRange(void** batch, int N);
+
+  size_t length() const;
+  size_t OverheadBytes() const;
+  size_t NumSpansInList(int n);
+  SpanStats GetSpanStats() const;
+  size_t NumSpansWith(uint16_t bitwidth) const;
+
+  void PrintSpanUtilStats(Printer* out) const;
+  void PrintSpanUtilStatsInPbtxt(PbtxtRegion* region) const;
+
+  int num_shards() const { return num_shards_; }
+
+  Forwarder& forwarder() { return forwarder_; }
+
+ private:
+  using Shard = CentralFreeList<ShardForwarder<Forwarder>>;
+
+  Shard& shard(int i) {
+    ASSERT(i >= 0 && i < num_shards_);
+    return i == 0 ? first_shard_ : other_shards_[i - 1];
+  }
+  const Shard& shard(int i) const {
+    ASSERT(i >= 0 && i < num_shards_);
+    return i == 0 ? first_shard_ : other_shards_[i - 1];
+  }
+
+  int ShardFor(const Span* span) const {
+    return (span->first_page().index() / pages_per_span_) % num_shards_;
+  }
+
+  Shard first_shard_;
+  Shard* other_shards_ = nullptr;
+  int num_shards_ = 1;
+  size_t size_class_ = 0;
+  size_t pages_per_span_ = 1;
+
+  ABSL_ATTRIBUTE_NO_UNIQUE_ADDRESS Forwarder forwarder_;
+};
+
+template <class Forwarder>
+inline void ShardedCentralFreeList<Forwarder>::Init(size_t size_class) {
+  size_class_ = size_class;
+  pages_per_span_ =
+      std::max<size_t>(Forwarder::class_to_pages(size_class).raw_num(), 1);
+  const size_t object_size = Forwarder::class_to_size(size_class);
+  const size_t objects_per_span =
+      Length(pages_per_span_).in_bytes() / (object_size ? object_size : 1);
+
+  first_shard_.forwarder().Bind(&forwarder_);
+  first_shard_.Init(size_class);
+
+  // Single-object spans never sit in the central freelist, so there is no
+  // lock to split.
+  num_shards_ = objects_per_span > 1
+                    ? std::clamp(forwarder_.NumShards(), 1, kMaxShards)
+                    : 1;
+  if (num_shards_ == 1) return;
+
+  other_shards_ = static_cast<Shard*>(
+      forwarder_.Alloc(sizeof(Shard) * (num_shards_ - 1),
+                       std::align_val_t{alignof(Shard)}));
+  for (int i = 0; i < num_shards_ - 1; ++i) {
+    new (&other_shards_[i]) Shard();
+    other_shards_[i].forwarder().Bind(&forwarder_);
+    other_shards_[i].Init(size_class);
+  }
+}
+
+template <class Forwarder>
+inline void ShardedCentralFreeList<Forwarder>::InsertRange(
+    absl::Span<void*> batch) {
+  if (num_shards_ == 1) {
+    first_shard_.InsertRange(batch);
+    return;
+  }
+
+  CHECK_CONDITION(!batch.empty() && batch.size() <= kMaxObjectsToMove);
+  Span* spans[kMaxObjectsToMove];
+  forwarder_.MapObjectsToSpans(batch, spans);
+
+  // Bucket the objects by shard.
+  uint8_t owner[kMaxObjectsToMove];
+  int start[kMaxShards + 1] = {0};
+  for (size_t i = 0; i < batch.size(); ++i) {
+    owner[i] = ShardFor(spans[i]);
+    ++start[owner[i] + 1];
+  }
+  for (int i = 0; i < num_shards_; ++i) {
+    start[i + 1] += start[i];
+  }
+  void* objects[kMaxObjectsToMove];
+  Span* object_spans[kMaxObjectsToMove];
+  int next[kMaxShards];
+  std::copy(start, start + num_shards_, next);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const int j = next[owner[i]]++;
+    objects[j] = batch[i];
+    object_spans[j] = spans[i];
+  }
+
+  for (int i = 0; i < num_shards_; ++i) {
+    const int n = start[i + 1] - start[i];
+    if (n == 0) continue;
+    shard(i).InsertRange({&objects[start[i]], static_cast<size_t>(n)},
+                         &object_spans[start[i]]);
+  }
+}
+
+template <class Forwarder>
+inline int ShardedCentralFreeList<Forwarder>::RemoveRange(void** batch,
+                                                          int N) {
+  if (num_shards_ == 1) {
+    return first_shard_.RemoveRange(batch, N);
+  }
+
+  const int home = forwarder_.CurrentShard() % num_shards_;
+  uint32_t contended = 0;
+  for (int i = 0, s = home; i < num_shards_; ++i, s = (s + 1) % num_shards_) {
+    int removed;
+    if (!shard(s).TryRemoveCachedRange(batch, N, &removed)) {
+      contended |= uint32_t{1} << s;
+    } else if (removed > 0) {
+      return removed;
+    }
+  }
+  for (int i = 0, s = home; contended != 0 && i < num_shards_;
+       ++i, s = (s + 1) % num_shards_) {
+    if ((contended & (uint32_t{1} << s)) == 0) continue;
+    contended &= ~(uint32_t{1} << s);
+    const int removed = shard(s).RemoveCachedRange(batch, N);
+    if (removed > 0) return removed;
+  }
+
+  // Every shard is out of objects.
+  Span* span = shard(home).AllocateSpan();
+  if (ABSL_PREDICT_FALSE(span == nullptr)) {
+    return 0;
+  }
+  return shard(ShardFor(span)).AdoptSpan(span, batch, N);
+}
+
+template <class Forwarder>
+inline size_t ShardedCentralFreeList<Forwarder>::length() const {
+  size_t length = 0;
+  for (int i = 0; i < num_shards_; ++i) {
+    length += shard(i).length();
+  }
+  return length;
+}
+
+template <class Forwarder>
+inline size_t ShardedCentralFreeList<Forwarder>::OverheadBytes() const {
+  size_t overhead = 0;
+  for (int i = 0; i < num_shards_; ++i) {
+    overhead += shard(i).OverheadBytes();
+  }
+  return overhead;
+}
+
+template <class Forwarder>
+inline size_t ShardedCentralFreeList<Forwarder>::NumSpansInList(int n) {
+  size_t spans = 0;
+  for (int i = 0; i < num_shards_; ++i) {
+    spans += shard(i).NumSpansInList(n);
+  }
+  return spans;
+}
+
+template <class Forwarder>
+inline SpanStats ShardedCentralFreeList<Forwarder>::GetSpanStats() const {
+  SpanStats stats;
+  for (int i = 0; i < num_shards_; ++i) {
+    const SpanStats shard_stats = shard(i).GetSpanStats();
+    stats.num_spans_requested += shard_stats.num_spans_requested;
+    stats.num_spans_returned += shard_stats.num_spans_returned;
+    stats.obj_capacity += shard_stats.obj_capacity;
+  }
+  return stats;
+}
+
+template <class Forwarder>
+inline size_t ShardedCentralFreeList<Forwarder>::NumSpansWith(
+    uint16_t bitwidth) const {
+  size_t spans = 0;
+  for (int i = 0; i < num_shards_; ++i) {
+    spans += shard(i).NumSpansWith(bitwidth);
+  }
+  return spans;
+}
+
+template <class Forwarder>
+inline void ShardedCentralFreeList<Forwarder>::PrintSpanUtilStats(
+    Printer* out) const {
+  if (num_shards_ == 1) {
+    first_shard_.PrintSpanUtilStats(out);
+    return;
+  }
+  out->printf("class %3d [ %8zu bytes ] : ", size_class_,
+              Forwarder::class_to_size(size_class_));
+  for (size_t i = 1; i <= Shard::kSpanUtilBucketCapacity; ++i) {
+    out->printf("%6zu < %zu", NumSpansWith(i), 1 << i);
+    if (i < Shard::kSpanUtilBucketCapacity) {
+      out->printf(",");
+    }
+  }
+  out->printf(" (%d shards)\n", num_shards_);
+}
+
+template <class Forwarder>
+inline void ShardedCentralFreeList<Forwarder>::PrintSpanUtilStatsInPbtxt(
+    PbtxtRegion* region) const {
+  if (num_shards_ == 1) {
+    first_shard_.PrintSpanUtilStatsInPbtxt(region);
+    return;
+  }
+  for (size_t i = 1; i <= Shard::kSpanUtilBucketCapacity; ++i) {
+    PbtxtRegion histogram = region->CreateSubRegion("span_util_histogram");
+    histogram.PrintI64("lower_bound", 1 << (i - 1));
+    histogram.PrintI64("upper_bound", 1 << i);
+    histogram.PrintI64("value", NumSpansWith(i));
+  }
+}
+
 }  // namespace central_freelist_internal
 
-using CentralFreeList = central_freelist_internal::CentralFreeList<
+using CentralFreeList = central_freelist_internal::ShardedCentralFreeList<
     central_freelist_internal::StaticForwarder>;
 
 }  // namespace tcmalloc_internal
@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <new>
 #include <vector>
 
 #include "absl/algorithm/container.h"
@@ -127,6 +128,92 @@ BENCHMARK(BM_MixAndReturn)
     ->DenseRange(4096, 28 * 1024, 4096)
     ->DenseRange(32 * 1024, 256 * 1024, 32 * 1024);
 
+// Forces sharding on, with at least a few shards so that the benchmark is
+// meaningful on machines with a single L3 cache.  Shards are allocated from the
+// heap rather than the arena, which needs pageheap_lock.
+class ShardedForwarder : public central_freelist_internal::StaticForwarder {
+ public:
+  static int NumShards() {
+    return std::max<int>(tc_globals.cache_topology().shard_count(), 4);
+  }
+  static void* Alloc(size_t size, std::align_val_t alignment) {
+    return ::operator new(size, alignment);
+  }
+};
+
+using UnshardedCentralFreeList = central_freelist_internal::CentralFreeList<
+    central_freelist_internal::StaticForwarder>;
+using ShardedCentralFreeList =
+    central_freelist_internal::ShardedCentralFreeList<ShardedForwarder>;
+
+// Multi-threaded version of BM_MixAndReturn: every thread fetches its own
+// objects from, and returns them shuffled to, a CentralFreeList shared by all
+// threads, as happens when the transfer caches of many CPUs miss at once.
+template <typename CentralFreeListT>
+void BM_MixAndReturnThreaded(benchmark::State& state) {
+  static CentralFreeListT* cfl;
+
+  size_t object_size = state.range(0);
+  size_t size_class = tc_globals.sizemap().SizeClass(CppPolicy(), object_size);
+  int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+  int num_objects = 16 * 1024 * 1024 / object_size;
+  const int num_batches = num_objects / batch_size;
+  if (state.thread_index() == 0) {
+    cfl = new CentralFreeListT();
+    cfl->Init(size_class);
+  }
+
+  // Allocate an array large enough to hold 16 MiB of objects.
+  std::vector<void*> buffer(num_objects);
+  int64_t items_processed = 0;
+  absl::BitGen rnd;
+
+  while (state.KeepRunningBatch(num_batches)) {
+    int index = 0;
+    while (index < num_objects) {
+      int count = std::min(batch_size, num_objects - index);
+      int got = cfl->RemoveRange(&buffer[index], count);
+      index += got;
+    }
+
+    state.PauseTiming();
+    absl::c_shuffle(buffer, rnd);
+    state.ResumeTiming();
+
+    index = 0;
+    while (index < num_objects) {
+      unsigned int count = std::min(batch_size, num_objects - index);
+      cfl->InsertRange({&buffer[index], count});
+      index += count;
+    }
+    items_processed += index;
+  }
+  state.SetItemsProcessed(items_processed);
+
+  if (state.thread_index() == 0) {
+    // Extra shards of the sharded list are deliberately leaked, as they would
+    // be in the arena.
+    delete cfl;
+    cfl = nullptr;
+  }
+}
+BENCHMARK_TEMPLATE(BM_MixAndReturnThreaded, UnshardedCentralFreeList)
+    ->Arg(8)
+    ->Arg(64)
+    ->Arg(256)
+    ->Arg(1024)
+    ->Arg(4096)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixAndReturnThreaded, ShardedCentralFreeList)
+    ->Arg(8)
+    ->Arg(64)
+    ->Arg(256)
+    ->Arg(1024)
+    ->Arg(4096)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
 // This benchmark holds onto half the allocated objects so that (except for
 // single object spans) spans are never allocated or freed during the
 // benchmark run. This evaluates the performance of just the span handling
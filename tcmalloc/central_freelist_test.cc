@@ -805,6 +805,100 @@ using Env = FakeCentralFreeListEnvironment<
 INSTANTIATE_TYPED_TEST_SUITE_P(CentralFreeList, CentralFreeListTest,
                                ::testing::Types<Env>);
 
+class ShardedCentralFreeListTest : public testing::Test {
+ protected:
+  static constexpr int kSizeClass = 1;
+  static constexpr int kNumShards = 4;
+  static constexpr size_t kObjectsPerSpan =
+      MockStaticForwarder::class_to_pages(kSizeClass).in_bytes() /
+      MockStaticForwarder::class_to_size(kSizeClass);
+
+  ShardedCentralFreeListTest() {
+    cfl_.forwarder().set_num_shards(kNumShards);
+    cfl_.Init(kSizeClass);
+  }
+
+  ~ShardedCentralFreeListTest() override { EXPECT_EQ(cfl_.length(), 0); }
+
+  central_freelist_internal::ShardedCentralFreeList<MockStaticForwarder> cfl_;
+};
+
+TEST_F(ShardedCentralFreeListTest, Shards) {
+  EXPECT_EQ(cfl_.num_shards(), kNumShards);
+}
+
+// Objects cached in one shard are handed out to callers on any other shard
+// before a new span is allocated.
+TEST_F(ShardedCentralFreeListTest, RemovesFromOtherShards) {
+  EXPECT_CALL(cfl_.forwarder(), AllocateSpan).Times(1);
+
+  void* batch[kMaxObjectsToMove];
+  int got = cfl_.RemoveRange(batch, kMaxObjectsToMove);
+  ASSERT_GT(got, 1);
+  cfl_.InsertRange({batch, static_cast<size_t>(got - 1)});
+
+  std::vector<void*> objects = {batch[got - 1]};
+  for (int shard = 0; shard < kNumShards; ++shard) {
+    cfl_.forwarder().set_current_shard(shard);
+    const int n = cfl_.RemoveRange(batch, 1);
+    ASSERT_EQ(n, 1);
+    objects.push_back(batch[0]);
+  }
+
+  EXPECT_CALL(cfl_.forwarder(), DeallocateSpans).Times(1);
+  cfl_.InsertRange(absl::MakeSpan(objects));
+  const SpanStats stats = cfl_.GetSpanStats();
+  EXPECT_EQ(stats.num_spans_requested, 1);
+  EXPECT_EQ(stats.num_spans_returned, 1);
+}
+
+// Spans spread across shards are accounted for, and returned, as a whole.
+TEST_F(ShardedCentralFreeListTest, MultipleSpans) {
+  constexpr size_t kNumSpans = 2 * kNumShards;
+
+  std::vector<void*> objects;
+  void* batch[kMaxObjectsToMove];
+  int shard = 0;
+  while (objects.size() < kNumSpans * kObjectsPerSpan) {
+    cfl_.forwarder().set_current_shard(shard++ % kNumShards);
+    const int got = cfl_.RemoveRange(batch, kMaxObjectsToMove);
+    ASSERT_GT(got, 0);
+    objects.insert(objects.end(), batch, batch + got);
+  }
+  EXPECT_EQ(objects.size(), kNumSpans * kObjectsPerSpan);
+  EXPECT_EQ(cfl_.NumSpansWith(absl::bit_width(kObjectsPerSpan)), kNumSpans);
+
+  SpanStats stats = cfl_.GetSpanStats();
+  EXPECT_EQ(stats.num_spans_requested, kNumSpans);
+  EXPECT_EQ(stats.num_spans_returned, 0);
+
+  absl::BitGen rng;
+  absl::c_shuffle(objects, rng);
+  for (size_t i = 0; i < objects.size(); i += kMaxObjectsToMove) {
+    const size_t n = std::min(objects.size() - i, kMaxObjectsToMove);
+    cfl_.InsertRange({&objects[i], n});
+  }
+
+  stats = cfl_.GetSpanStats();
+  EXPECT_EQ(stats.num_spans_returned, kNumSpans);
+  EXPECT_EQ(stats.obj_capacity, 0);
+}
+
+TEST_F(ShardedCentralFreeListTest, Concurrent) {
+  ThreadManager threads;
+  threads.Start(kNumShards, [&](int) {
+    void* batch[kMaxObjectsToMove];
+    const int got = cfl_.RemoveRange(batch, kMaxObjectsToMove);
+    if (got > 0) {
+      cfl_.InsertRange({batch, static_cast<size_t>(got)});
+    }
+  });
+
+  absl::SleepFor(absl::Seconds(0.1));
+
+  threads.Stop();
+}
+
 }  // namespace unit_tests
 
 }  // namespace
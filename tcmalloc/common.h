@@ -112,6 +112,13 @@ static_assert(sizeof(void*) == 8);
 #error "TCMALLOC_PAGE_SHIFT is an internal macro!"
 #endif
 
+// TCMALLOC_LA57 sizes the address space for 5-level paging (see kAddressBits).
+// A two-level pagemap's root would then need an entry for every 2^15 pages of
+// a 57-bit address space, so these builds use the three-level pagemap.
+#if defined(TCMALLOC_LA57) && !defined(TCMALLOC_USE_PAGEMAP3)
+#define TCMALLOC_USE_PAGEMAP3
+#endif
+
 #if TCMALLOC_PAGE_SHIFT == 12
 inline constexpr size_t kPageShift = 12;
 inline constexpr size_t kNumBaseClasses = 46;
@@ -217,6 +224,15 @@ inline constexpr int kMaxOverages = 3;
 // scavenging code will shrink it down when its contents are not in use.
 inline constexpr int kMaxDynamicFreeListLength = 8192;
 
+// The number of consecutive Scavenge() calls that a per-thread free-list must
+// hold unused objects, without missing, before it is drained entirely and its
+// max_length() may shrink below num_objects_to_move().
+inline constexpr int kMaxIdleScavenges = 2;
+
+// The most batches of num_objects_to_move() that a per-thread free-list which
+// keeps missing fetches from the central free-list at once.
+inline constexpr int kMaxBatchesPerFetch = 4;
+
 enum class MemoryTag : uint8_t {
   // Sampled, infrequently allocated
   kSampled = 0x0,
@@ -276,6 +292,37 @@ inline MemoryTag GetMemoryTag(const void* ptr) {
                                 kTagShift);
 }
 
+// With TCMALLOC_SIZE_CLASS_REGIONS, the upper half of each tag's address range
+// is set aside for spans of small objects, and divided into one region per
+// size class.  An object in that half has its size class in the address bits
+// just below kSizeClassRegionFlag, so free() can find the size class without
+// consulting the pagemap.  Spans that do not fit in their region still come
+// from the lower half, as in other builds.
+#ifdef TCMALLOC_SIZE_CLASS_REGIONS
+inline constexpr bool kSizeClassRegions = true;
+#else
+inline constexpr bool kSizeClassRegions = false;
+#endif
+inline constexpr uintptr_t kSizeClassRegionFlag = uintptr_t{1}
+                                                  << (kTagShift - 1);
+inline constexpr int kSizeClassRegionBits = absl::bit_width(kNumClasses - 1);
+inline constexpr uintptr_t kSizeClassRegionShift =
+    kTagShift - 1 - kSizeClassRegionBits;
+inline constexpr uintptr_t kSizeClassRegionSize = uintptr_t{1}
+                                                  << kSizeClassRegionShift;
+static_assert(!kSizeClassRegions || kSizeClassRegionShift >= 30,
+              "Size class regions need a larger address space");
+
+// Returns the size class of the object at ptr if it is in a size class
+// region, or 0 otherwise.
+inline size_t SizeClassFromAddress(const void* ptr) {
+  if (!kSizeClassRegions) return 0;
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+  if (!(addr & kSizeClassRegionFlag)) return 0;
+  return (addr >> kSizeClassRegionShift) &
+         ((uintptr_t{1} << kSizeClassRegionBits) - 1);
+}
+
 absl::string_view MemoryTagToLabel(MemoryTag tag);
 
 inline constexpr bool IsExpandedSizeClass(unsigned size_class) {
@@ -344,8 +391,27 @@ inline size_t NumaPartitionFromPointer(void* ptr) {
 }
 
 // Linker initialized, so this lock can be accessed at any time.
-// Note: `CpuCache::ResizeInfo::lock` must be taken before the `pageheap_lock`
-// if both are going to be held simultaneously.
+//
+// pageheap_lock guards the page allocators and everything below them (the
+// HugePageAwareAllocator's filler, regions and cache, and PageMap updates).
+// These share the one lock, since PageAllocatorInterface::Delete and
+// ShrinkToUsageLimit may touch any of them, so large allocations and span
+// refills still serialize on it.  Internal metadata has finer-grained locks of
+// its own.  When several are held, they must be acquired in this order:
+//
+//   1. `CpuCache::ResizeInfo::lock`
+//   2. `ReleaseQueue::drain_lock_`, which is never held with pageheap_lock
+//   3. `pageheap_lock`
+//   4. `ReleaseQueue::lock_`, which is held only briefly and nests no other
+//   5. the lock of a `PageHeapAllocator` (e.g., the one behind Span::New)
+//   6. the `Arena` lock
+//   7. the lock in system-alloc.cc, held by SystemAlloc() and friends
+//
+// A PageHeapAllocator may grow from the Arena while holding its lock, and the
+// Arena grows through SystemAlloc() while holding its own.  SystemAlloc() may
+// in turn take the LowLevelAlloc arena lock behind
+// AddressRegionFactory::MallocInternal(), but never a tcmalloc lock.
+// ReleaseQueue::Drain() issues its releases with drain_lock_ held.
 extern absl::base_internal::SpinLock pageheap_lock;
 
 // Evaluates a/b, avoiding division by zero.
@@ -18,9 +18,13 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <limits>
 #include <new>
 #include <tuple>
 #include <utility>
@@ -28,6 +32,7 @@
 #include "absl/algorithm/container.h"
 #include "absl/base/attributes.h"
 #include "absl/base/call_once.h"
+#include "absl/base/const_init.h"
 #include "absl/base/internal/cycleclock.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/internal/sysinfo.h"
@@ -35,6 +40,8 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/container/fixed_array.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/experiment.h"
+#include "tcmalloc/experiment_config.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/percpu.h"
@@ -66,22 +73,44 @@ class AllocationGuardSpinLockHolder {
   AllocationGuard enforce_no_alloc_;
 };
 
+// Returns the CPUs that thread tid (by default, the calling thread) may run
+// on, as the IDs the per-CPU caches use for them.
+static cpu_set_t FillActiveCpuMask(pid_t tid = 0) {
+  cpu_set_t allowed_cpus;
+  if (sched_getaffinity(tid, sizeof(allowed_cpus), &allowed_cpus) != 0) {
+    CPU_ZERO(&allowed_cpus);
+  }
+
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
+  const bool real_cpus = !subtle::percpu::UsingFlatVirtualCpus();
+#else
+  const bool real_cpus = true;
+#endif
+
+  if (real_cpus) {
+    return allowed_cpus;
+  }
+
+  const int virtual_cpu_count = CPU_COUNT(&allowed_cpus);
+  CPU_ZERO(&allowed_cpus);
+  for (int cpu = 0; cpu < virtual_cpu_count; ++cpu) {
+    CPU_SET(cpu, &allowed_cpus);
+  }
+  return allowed_cpus;
+}
+
 // StaticForwarder provides access to the SizeMap and transfer caches.
 //
 // This is a class, rather than namespaced globals, so that it can be mocked for
 // testing.
 class StaticForwarder {
  public:
-  static void* Alloc(size_t size, std::align_val_t alignment)
-      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+  static void* Alloc(size_t size, std::align_val_t alignment) {
     ASSERT(tc_globals.IsInited());
-    absl::base_internal::SpinLockHolder l(&pageheap_lock);
     return tc_globals.arena().Alloc(size, alignment);
   }
-  static void* AllocReportedImpending(size_t size, std::align_val_t alignment)
-      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+  static void* AllocReportedImpending(size_t size, std::align_val_t alignment) {
     ASSERT(tc_globals.IsInited());
-    absl::base_internal::SpinLockHolder l(&pageheap_lock);
     // Negate previous update to allocated that accounted for this allocation.
     tc_globals.arena().UpdateAllocatedAndNonresident(
         -static_cast<int64_t>(size), 0);
@@ -93,10 +122,8 @@ class StaticForwarder {
   }
 
   static void ArenaUpdateAllocatedAndNonresident(int64_t allocated,
-                                                 int64_t nonresident)
-      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+                                                 int64_t nonresident) {
     ASSERT(tc_globals.IsInited());
-    absl::base_internal::SpinLockHolder l(&pageheap_lock);
     tc_globals.arena().UpdateAllocatedAndNonresident(allocated, nonresident);
   }
 
@@ -110,10 +137,24 @@ class StaticForwarder {
     return Parameters::per_cpu_caches_dynamic_slab_enabled();
   }
 
+  static bool hugepage_backed_slabs() {
+    return IsExperimentActive(Experiment::TCMALLOC_HUGEPAGE_CPU_SLABS);
+  }
+
   static bool resize_size_classes_enabled() {
     return Parameters::resize_cpu_cache_size_classes();
   }
 
+  static bool predictive_capacity_enabled() {
+    return Parameters::predictive_cpu_cache_capacity();
+  }
+
+  // The CPUs the process may run on.  This is the main thread's mask, whose
+  // thread ID is the process ID: a cpuset update applies to all threads,
+  // while the calling (background) thread may have been pinned to a few CPUs
+  // that say nothing about where the application's threads run.
+  static cpu_set_t allowed_cpus() { return FillActiveCpuMask(getpid()); }
+
   static double per_cpu_caches_dynamic_slab_grow_threshold() {
     return Parameters::per_cpu_caches_dynamic_slab_grow_threshold();
   }
@@ -134,6 +175,10 @@ class StaticForwarder {
     return tc_globals.sizemap().num_objects_to_move(size_class);
   }
 
+  static size_t prefetch_lines(int size_class) {
+    return tc_globals.sizemap().prefetch_lines(size_class);
+  }
+
   static const NumaTopology<kNumaPartitions, kNumBaseClasses>& numa_topology() {
     return tc_globals.numa_topology();
   }
@@ -168,6 +213,37 @@ inline uint8_t ShiftOffset(uint8_t shift, uint8_t numa_shift) {
   return shift - kInitialPerCpuShift - numa_shift;
 }
 
+// Forecasts of cache misses are kept in fixed point, in units of
+// 1/kDemandScale misses.
+inline constexpr uint64_t kDemandScale = 256;
+// The misses of each interval get a weight of 1/2^kDemandDecayShift in the
+// forecast, so that it follows a change in demand within a few intervals
+// without chasing every spike.
+inline constexpr int kDemandDecayShift = 2;
+
+// Folds the <misses> of the interval that just ended into the exponentially
+// weighted moving average <demand>.  The decay rounds up, so that the forecast
+// of a cache that stopped missing reaches zero.
+inline uint64_t UpdateDemandForecast(uint64_t demand, uint64_t misses) {
+  const uint64_t decay =
+      (demand + (uint64_t{1} << kDemandDecayShift) - 1) >> kDemandDecayShift;
+  return demand - decay + ((misses * kDemandScale) >> kDemandDecayShift);
+}
+
+inline void* ObjectPointer(void* p) { return p; }
+inline void* ObjectPointer(sized_ptr_t res) { return res.p; }
+
+// Prefetches the first lines cache lines of a newly allocated object, so that
+// the caller's initializing stores do not stall on a miss.
+inline ABSL_ATTRIBUTE_ALWAYS_INLINE void PrefetchObjectForWrite(void* p,
+                                                                size_t lines) {
+  ASSERT(lines <= SizeMap::kMaxPrefetchLines);
+  __builtin_prefetch(p, 1, 3);
+  if (lines > 1) {
+    __builtin_prefetch(static_cast<char*>(p) + ABSL_CACHELINE_SIZE, 1, 3);
+  }
+}
+
 struct GetShiftMaxCapacity {
   size_t operator()(size_t size_class) const {
     ASSERT(kMaxPerCpuShift + numa_shift >= shift);
@@ -243,6 +319,56 @@ class CpuCache {
     int max_last_overflow_cpu_id = -1;
   };
 
+  // Describes where the slabs array lives, as it is touched by every
+  // allocation and deallocation and so is a candidate for dTLB misses.
+  struct SlabPlacementStats {
+    bool hugepage_backed = false;
+    // Whether the slabs array starts on a hugepage boundary.
+    bool hugepage_aligned = false;
+    size_t virtual_size = 0;
+    size_t resident_size = 0;
+    // The number of native pages and hugepages the slabs array spans, i.e.,
+    // the number of TLB entries needed to map all of it without and with
+    // transparent hugepages.
+    size_t small_pages_spanned = 0;
+    size_t hugepages_spanned = 0;
+    // Bytes of freshly allocated slabs for which MADV_HUGEPAGE failed.
+    size_t madvise_failed_bytes = 0;
+  };
+
+  // Describes the caches drained by DrainDisallowedCpus().
+  struct DisallowedCpuStats {
+    // The number of changes to the allowed CPU set that drained any cache.
+    size_t events = 0;
+    // The caches drained, the bytes of objects they returned to the backing
+    // cache, and the bytes of their slabs returned to the OS.
+    size_t drained_cpus = 0;
+    uint64_t drained_bytes = 0;
+    uint64_t released_slab_bytes = 0;
+    // The same, for the most recent event.
+    size_t last_event_drained_cpus = 0;
+    uint64_t last_event_drained_bytes = 0;
+    uint64_t last_event_released_slab_bytes = 0;
+  };
+
+  // Describes which cache IDs have been populated.
+  struct PopulatedCpuStats {
+    // Whether caches are indexed by the kernel's dense virtual CPU IDs rather
+    // than by physical CPU.
+    bool virtual_cpus = false;
+    // The caches populated, and one past the highest populated ID.
+    size_t populated_caches = 0;
+    size_t populated_id_limit = 0;
+    // The CPUs this process may currently run on.
+    size_t allowed_cpus = 0;
+    // The slab bytes each cache spans at the current shift.
+    uint64_t slab_bytes_per_cache = 0;
+    // The slab bytes spanned by caches that have never been populated.  This
+    // is address space we have not touched, not resident memory we saved: a
+    // populated cache faults in only the pages it uses.
+    uint64_t unpopulated_slab_bytes = 0;
+  };
+
   // Sets the lower limit on the capacity that can be stolen from the cpu cache.
   static constexpr double kCacheCapacityThreshold = 0.20;
 
@@ -256,6 +382,10 @@ class CpuCache {
   // For testing
   void Deactivate();
 
+  // Reloads whether Allocate() prefetches objects of size_class, after
+  // forwarder().prefetch_lines(size_class) changed.
+  void UpdatePrefetch(size_t size_class);
+
   // Allocate an object of the given size class. When allocation fails
   // (from this cache and after running Refill), Policy::oom_handler(size) is
   // called and its return value is returned from Allocate.
@@ -270,6 +400,19 @@ class CpuCache {
   // Free an object of the given class.
   void Deallocate(void* ptr, size_t size_class);
 
+  // Allocate up to <count> objects of the given size class into <batch>.
+  // Objects are taken from the current cpu's slab in bulk; on underflow the
+  // slab is refilled once (so that its capacity adapts as it would for
+  // single-object allocations) and the remainder is fetched directly from the
+  // backing transfer cache. Returns the number of objects allocated, which is
+  // less than <count> only when the backing cache is out of memory.
+  size_t AllocateBatch(size_t size_class, void** batch, size_t count);
+
+  // Free <count> objects of the given size class. As many objects as fit are
+  // pushed onto the current cpu's slab; the rest are released to the backing
+  // transfer cache.
+  void DeallocateBatch(size_t size_class, void** batch, size_t count);
+
   // Give the number of bytes in <cpu>'s cache
   uint64_t UsedBytes(int cpu) const;
 
@@ -279,8 +422,17 @@ class CpuCache {
   // Whether <cpu>'s cache has ever been populated with objects
   bool HasPopulated(int cpu) const;
 
+  // One past the highest cpu whose cache has ever been populated.  Loops over
+  // populated caches need not look any further.
+  int PopulatedCpuLimit() const;
+
+  PopulatedCpuStats GetPopulatedCpuStats() const;
+
   PerCPUMetadataState MetadataMemoryUsage() const;
 
+  // Reports how the current slabs array is laid out in memory.
+  SlabPlacementStats GetSlabPlacementStats() const;
+
   // Give the number of bytes used in all cpu caches.
   uint64_t TotalUsedBytes() const;
 
@@ -308,6 +460,10 @@ class CpuCache {
   //
   // TODO(vgogte): There are quite a few knobs that we can play around with in
   // ShuffleCpuCaches.
+  //
+  // When the forwarder's predictive_capacity_enabled() is set, the caches are
+  // instead ranked by their forecast misses (see PredictedMisses()), and
+  // capacity is stolen from the caches with the lowest forecast first.
   void ShuffleCpuCaches();
 
   // Tries to reclaim inactive per-CPU caches. It iterates through the set of
@@ -324,6 +480,13 @@ class CpuCache {
   // size classes and attempts to grow up to kMaxSizeClassesToResize number of
   // classes by stealing capacity from rest of them. Per iteration, it resizes
   // size classes for up to kNumCpuCachesToResize number of per-cpu caches.
+  //
+  // When the forwarder's predictive_capacity_enabled() is set, it instead
+  // updates the miss forecast of every size class in every populated cache,
+  // and resizes the kNumCpuCachesToResize caches with the highest forecast.
+  // Within a cache, it grows the size classes whose forecast misses per byte
+  // of a batch are highest, with capacity that is unallocated or taken from
+  // the size classes whose forecast misses per byte are lowest.
   void ResizeSizeClasses();
 
   // Empty out the cache on <cpu>; move all objects to the central
@@ -345,6 +508,14 @@ class CpuCache {
   // Reports total number of times any CPU has been reclaimed.
   uint64_t GetNumReclaims() const;
 
+  // Drains the caches of populated CPUs that were taken out of the set of
+  // CPUs this process may run on since the last call, e.g. because its cpuset
+  // shrank or a CPU went offline, and returns the pages of their slabs that
+  // held objects to the OS.  Returns the number of bytes drained.
+  uint64_t DrainDisallowedCpus();
+
+  DisallowedCpuStats GetDisallowedCpuStats() const;
+
   // When dynamic slab size is enabled, checks if there is a need to resize
   // the slab based on miss-counts and resizes if so.
   void ResizeSlabIfNeeded();
@@ -379,6 +550,14 @@ class CpuCache {
   size_t GetIntervalSizeClassMisses(int cpu, size_t size_class,
                                     PerClassMissType type);
 
+  // Reports the forecast number of misses per ResizeSizeClasses interval for
+  // <size_class> on <cpu>, and the forecast number of underflows and overflows
+  // per ShuffleCpuCaches interval for all of <cpu>'s cache.  Forecasts are
+  // exponentially weighted moving averages of the misses of past intervals,
+  // and are only maintained while predictive capacity is enabled.
+  double PredictedMisses(int cpu, size_t size_class) const;
+  double PredictedMisses(int cpu) const;
+
   // Report statistics
   void Print(Printer* out) const;
   void PrintInPbtxt(PbtxtRegion* region) const;
@@ -441,6 +620,12 @@ class CpuCache {
     // <type>.
     void UpdateIntervalMisses(PerClassMissType type);
 
+    // Folds the <misses> of the interval that just ended into the forecast.
+    void UpdateDemand(size_t misses);
+
+    // Reports the forecast number of misses per interval.
+    double PredictedMisses() const;
+
    private:
     std::atomic<int32_t> state_;
     // state_ layout:
@@ -452,6 +637,8 @@ class CpuCache {
       // number of successive overflows/underflows
       uint32_t successive : 16;
     };
+    // Forecast misses per interval, in units of 1/kDemandScale.
+    std::atomic<uint32_t> demand_;
     PerClassMissCounts misses_;
     static_assert(sizeof(State) == sizeof(std::atomic<int32_t>),
                   "size mismatch");
@@ -496,12 +683,16 @@ class CpuCache {
     // Tracks last time this CPU was reclaimed.  If last underflow/overflow data
     // appears before this point in time, we ignore the CPU.
     std::atomic<int64_t> last_reclaim;
+    // Forecast underflows and overflows per shuffle interval, in units of
+    // 1/kDemandScale.
+    std::atomic<uint64_t> demand;
   };
 
   struct DynamicSlabInfo {
     std::atomic<size_t> grow_count[kNumPossiblePerCpuShifts];
     std::atomic<size_t> shrink_count[kNumPossiblePerCpuShifts];
     std::atomic<size_t> madvise_failed_bytes;
+    std::atomic<size_t> hugepage_madvise_failed_bytes;
   };
 
   // Determines how we distribute memory in the per-cpu cache to the various
@@ -513,6 +704,11 @@ class CpuCache {
 
   GetShiftMaxCapacity GetMaxCapacityFunctor(uint8_t shift) const;
 
+  // Implements Reclaim().  If <released_slab_bytes> is non-null, also returns
+  // the pages of <cpu>'s slab that held objects to the OS, and adds their size
+  // to it.
+  uint64_t ReclaimImpl(int cpu, uint64_t* released_slab_bytes);
+
   // Fetches objects from backing transfer cache.
   int FetchFromBackingCache(size_t size_class, void** batch, size_t count);
 
@@ -582,6 +778,27 @@ class CpuCache {
   // identify the size_class to steal from.
   void StealFromOtherCache(int cpu, int max_populated_cpu, size_t bytes);
 
+  // Shrinks size classes of <src_cpu>'s cache, using the clock-like algorithm
+  // of StealFromOtherCache, until about <bytes> of capacity have been taken
+  // from it.  Returns the number of bytes taken, which the caller must add to
+  // <cpu>'s capacity.
+  size_t StealFromCpu(int cpu, int src_cpu, size_t bytes);
+
+  // The predictive versions of ShuffleCpuCaches and ResizeSizeClasses.
+  void ShuffleCpuCachesByDemand();
+  void ResizeSizeClassesByDemand();
+
+  // Grows the size classes of <cpu>'s cache with the highest forecast misses
+  // per byte.
+  void GrowSizeClassesByDemand(int cpu);
+
+  // Returns the size and alignment of the allocation backing the slabs for
+  // <shift>.  With hugepage-backed slabs, these are rounded up to whole,
+  // aligned hugepages, so that the slabs share their hugepages with no other
+  // memory and MADV_NOHUGEPAGE on a retired slab cannot split one.
+  size_t SlabsAllocSize(subtle::percpu::Shift shift, int num_cpus) const;
+  std::align_val_t SlabsAlignment() const;
+
   // <shift_offset> is the offset of the shift in slabs_by_shift_. Note that we
   // can't calculate this from `shift` directly due to numa shift.
   // Returns the allocated slabs and the number of reused bytes.
@@ -591,6 +808,21 @@ class CpuCache {
 
   Freelist freelist_;
 
+  // One bit per size class, set if forwarder_.prefetch_lines() may be nonzero
+  // for it.  Allocate() reads freelist_'s cache line anyway, so keeping these
+  // next to it means that size classes that do not prefetch never load
+  // prefetch_lines().
+  std::atomic<uint64_t> prefetch_classes_[(kNumClasses + 63) / 64] = {};
+  static_assert(sizeof(Freelist) + sizeof(prefetch_classes_) <=
+                ABSL_CACHELINE_SIZE);
+
+  bool MayPrefetch(size_t size_class) const {
+    return (prefetch_classes_[size_class / 64].load(
+                std::memory_order_relaxed) >>
+            (size_class % 64)) &
+           1;
+  }
+
   // Tracking data for each CPU's cache resizing efforts.
   ResizeInfo* resize_ = nullptr;
 
@@ -606,6 +838,11 @@ class CpuCache {
   // round-robin fashion.
   std::atomic<int> last_cpu_size_class_resize_ = 0;
 
+  // One past the highest cpu whose cache has ever been populated.  With
+  // virtual CPUs, this stays at the number of CPUs we run on concurrently,
+  // which may be well below NumCPUs() on a large machine.
+  std::atomic<int> populated_cpu_limit_ = 0;
+
   // Per-core cache limit in bytes.
   std::atomic<uint64_t> max_per_cpu_cache_size_{kMaxCpuCacheSize};
 
@@ -613,10 +850,21 @@ class CpuCache {
 
   DynamicSlabInfo dynamic_slab_info_{};
 
+  // Whether the slabs are backed by explicitly requested, aligned hugepages.
+  // Fixed at Activate().
+  bool hugepage_slabs_ = false;
+
   // Pointers to allocations for slabs of each shift value for use in
   // ResizeSlabs. This memory is allocated on the arena, and it is nonresident
   // while not in use.
   Freelist::Slabs* slabs_by_shift_[kNumPossiblePerCpuShifts] = {nullptr};
+
+  // The CPUs this process could run on as of the last DrainDisallowedCpus().
+  mutable absl::base_internal::SpinLock allowed_cpus_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  cpu_set_t allowed_cpus_ ABSL_GUARDED_BY(allowed_cpus_lock_) = {};
+  DisallowedCpuStats disallowed_cpu_stats_
+      ABSL_GUARDED_BY(allowed_cpus_lock_);
 };
 
 template <class Forwarder>
@@ -643,7 +891,16 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE auto CpuCache<Forwarder>::Allocate(
       return Policy::to_pointer(ret, size_class);
     }
   };
-  return freelist_.Pop<Policy>(size_class, &Helper::Underflow, this);
+  auto ret = freelist_.Pop<Policy>(size_class, &Helper::Underflow, this);
+  // The caller is likely to initialize the object right away.  Prefetching
+  // does not fault, so this is safe even if allocation failed.
+  if (ABSL_PREDICT_FALSE(MayPrefetch(size_class))) {
+    if (const size_t lines = forwarder_.prefetch_lines(size_class);
+        lines != 0) {
+      PrefetchObjectForWrite(ObjectPointer(ret), lines);
+    }
+  }
+  return ret;
 }
 
 template <class Forwarder>
@@ -666,28 +923,91 @@ CpuCache<Forwarder>::Deallocate(void* ptr, size_t size_class) {
   freelist_.Push(size_class, ptr, Helper::Overflow, this);
 }
 
-static cpu_set_t FillActiveCpuMask() {
-  cpu_set_t allowed_cpus;
-  if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
-    CPU_ZERO(&allowed_cpus);
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::AllocateBatch(size_t size_class,
+                                                 void** batch, size_t count) {
+  ASSERT(size_class > 0);
+  ASSERT(count > 0);
+
+  size_t total = 0;
+  if (BypassCpuCache(size_class)) {
+    auto& sharded = forwarder_.sharded_transfer_cache();
+    while (total < count) {
+      const size_t want = std::min(kMaxObjectsToMove, count - total);
+      const int got = sharded.RemoveRange(size_class, batch + total, want);
+      if (got == 0) break;
+      total += got;
+    }
+    return total;
   }
 
-#ifdef PERCPU_USE_RSEQ
-  const bool real_cpus = !subtle::percpu::UsingFlatVirtualCpus();
-#else
-  const bool real_cpus = true;
-#endif
+  total = freelist_.PopBatch(size_class, batch, count);
+  if (ABSL_PREDICT_TRUE(total == count)) {
+    return total;
+  }
 
-  if (real_cpus) {
-    return allowed_cpus;
+  // Treat the shortfall as a single miss: Refill grows the slab and tops it
+  // up, so that the next batch of this size class is served locally.
+  const int cpu = freelist_.GetCurrentVirtualCpuUnsafe();
+  RecordCacheMissStat(cpu, true);
+  void* ret = Refill(cpu, size_class);
+  if (ABSL_PREDICT_FALSE(ret == nullptr)) {
+    return total;
+  }
+  batch[total++] = ret;
+  if (total < count) {
+    total += freelist_.PopBatch(size_class, batch + total, count - total);
   }
 
-  const int virtual_cpu_count = CPU_COUNT(&allowed_cpus);
-  CPU_ZERO(&allowed_cpus);
-  for (int cpu = 0; cpu < virtual_cpu_count; ++cpu) {
-    CPU_SET(cpu, &allowed_cpus);
+  // Whatever the slab could not hold comes straight from the backing cache
+  // rather than bouncing through the slab.
+  while (total < count) {
+    const size_t want = std::min(kMaxObjectsToMove, count - total);
+    const int got = FetchFromBackingCache(size_class, batch + total, want);
+    if (got == 0) break;
+    total += got;
+  }
+  return total;
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::DeallocateBatch(size_t size_class,
+                                                 void** batch, size_t count) {
+  ASSERT(size_class > 0);
+  ASSERT(count > 0);
+
+  size_t done = 0;
+  if (BypassCpuCache(size_class)) {
+    auto& sharded = forwarder_.sharded_transfer_cache();
+    while (done < count) {
+      const size_t n = std::min(kMaxObjectsToMove, count - done);
+      sharded.InsertRange(size_class, absl::Span<void*>(batch + done, n));
+      done += n;
+    }
+    return;
+  }
+
+  // PushBatch pushes from the end of batch, leaving the objects it could not
+  // push at the start.
+  size_t remaining = count - freelist_.PushBatch(size_class, batch, count);
+  if (ABSL_PREDICT_TRUE(remaining == 0)) {
+    return;
+  }
+
+  // Overflow drains the slab to the backing cache and adjusts its capacity,
+  // exactly as for a single-object overflow; then retry the push.
+  const int cpu = freelist_.GetCurrentVirtualCpuUnsafe();
+  RecordCacheMissStat(cpu, false);
+  Overflow(batch[--remaining], size_class, cpu);
+  if (remaining > 0) {
+    remaining -= freelist_.PushBatch(size_class, batch, remaining);
+  }
+
+  while (done < remaining) {
+    const size_t n = std::min(kMaxObjectsToMove, remaining - done);
+    ReleaseToBackingCache(size_class, absl::Span<void*>(batch + done, n));
+    done += n;
   }
-  return allowed_cpus;
 }
 
 template <class Forwarder>
@@ -831,6 +1151,12 @@ inline void CpuCache<Forwarder>::Activate() {
     }
   }
 
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    UpdatePrefetch(size_class);
+  }
+
+  hugepage_slabs_ = forwarder_.hugepage_backed_slabs();
+
   resize_ = reinterpret_cast<ResizeInfo*>(forwarder_.Alloc(
       sizeof(ResizeInfo) * num_cpus, std::align_val_t{alignof(ResizeInfo)}));
 
@@ -847,6 +1173,11 @@ inline void CpuCache<Forwarder>::Activate() {
     resize_[cpu].last_steal.store(1, std::memory_order_relaxed);
   }
 
+  {
+    absl::base_internal::SpinLockHolder h(&allowed_cpus_lock_);
+    allowed_cpus_ = forwarder_.allowed_cpus();
+  }
+
   Freelist::Slabs* slabs =
       AllocOrReuseSlabs(&forwarder_.Alloc,
                         subtle::percpu::ToShiftType(per_cpu_shift), num_cpus,
@@ -857,6 +1188,24 @@ inline void CpuCache<Forwarder>::Activate() {
                  subtle::percpu::ToShiftType(per_cpu_shift));
 }
 
+template <class Forwarder>
+inline void CpuCache<Forwarder>::UpdatePrefetch(size_t size_class) {
+  ASSERT(size_class < kNumClasses);
+  const uint64_t bit = uint64_t{1} << (size_class % 64);
+  std::atomic<uint64_t>& word = prefetch_classes_[size_class / 64];
+  // Every sampled allocation lands here, and the word shares a cache line
+  // that every CPU's Allocate() reads, so only write it if the bit changes.
+  const bool prefetch = forwarder_.prefetch_lines(size_class) != 0;
+  if (((word.load(std::memory_order_relaxed) & bit) != 0) == prefetch) {
+    return;
+  }
+  if (prefetch) {
+    word.fetch_or(bit, std::memory_order_relaxed);
+  } else {
+    word.fetch_and(~bit, std::memory_order_relaxed);
+  }
+}
+
 template <class Forwarder>
 inline void CpuCache<Forwarder>::Deactivate() {
   int num_cpus = NumCPUs();
@@ -869,6 +1218,7 @@ inline void CpuCache<Forwarder>::Deactivate() {
                 "ResizeInfo is expected to be trivially destructible");
   forwarder_.Dealloc(resize_, sizeof(*resize_) * num_cpus,
                      std::align_val_t{alignof(decltype(*resize_))});
+  populated_cpu_limit_.store(0, std::memory_order_relaxed);
 }
 
 template <class Forwarder>
@@ -1039,6 +1389,13 @@ inline size_t CpuCache<Forwarder>::UpdateCapacity(int cpu, size_t size_class,
         // We update this under the lock so it's guaranteed that the populated
         // CPUs don't change during ResizeSlabs.
         cache->resize_[cpu].populated.store(true, std::memory_order_relaxed);
+        // Other CPUs may be populated concurrently, under their own locks.
+        std::atomic<int>& limit = cache->populated_cpu_limit_;
+        int old_limit = limit.load(std::memory_order_relaxed);
+        while (old_limit <= cpu &&
+               !limit.compare_exchange_weak(old_limit, cpu + 1,
+                                            std::memory_order_relaxed)) {
+        }
       },
       this, cpu);
   size_t batch_length = forwarder_.num_objects_to_move(size_class);
@@ -1121,7 +1478,7 @@ inline void CpuCache<Forwarder>::Grow(int cpu, size_t size_class,
 
 template <class Forwarder>
 inline void CpuCache<Forwarder>::TryReclaimingCaches() {
-  const int num_cpus = NumCPUs();
+  const int num_cpus = PopulatedCpuLimit();
 
   for (int cpu = 0; cpu < num_cpus; ++cpu) {
     // Nothing to reclaim if the cpu is not populated.
@@ -1164,8 +1521,13 @@ struct SizeClassMissStat {
 template <class Forwarder>
 inline void CpuCache<Forwarder>::ResizeSizeClasses() {
   if (!forwarder_.resize_size_classes_enabled()) return;
+  if (forwarder_.predictive_capacity_enabled()) {
+    ResizeSizeClassesByDemand();
+    return;
+  }
 
-  const int num_cpus = NumCPUs();
+  const int num_cpus = PopulatedCpuLimit();
+  if (num_cpus == 0) return;
   // Start resizing from where we left off the last time, and resize size class
   // capacities for up to kNumCpuCachesToResize per-cpu caches.
   int cpu = last_cpu_size_class_resize_.load(std::memory_order_relaxed);
@@ -1207,13 +1569,18 @@ inline void CpuCache<Forwarder>::ResizeSizeClasses() {
           return a.misses > b.misses;
         });
 
+    // The grows are applied together, so that the cache is fenced once
+    // rather than once for each size class.
+    Freelist::OtherCacheResize grows[kMaxSizeClassesToResize];
+    size_t acquired_bytes[kMaxSizeClassesToResize];
+    size_t num_grows = 0;
+    AllocationGuardSpinLockHolder h(&resize_[cpu].lock);
     for (int i = 0; i < kMaxSizeClassesToResize; ++i) {
       // If a size class with largest misses is zero, break. Other size classes
       // should also have suffered zero misses as well.
       if (miss_stats[i].misses == 0) break;
       const size_t size_class_to_grow = miss_stats[i].size_class;
 
-      AllocationGuardSpinLockHolder h(&resize_[cpu].lock);
       // If we are already at a maximum capacity, nothing to grow.
       const size_t can_grow = MaxCapacity(size_class_to_grow) -
                               freelist_.Capacity(cpu, size_class_to_grow);
@@ -1233,14 +1600,8 @@ inline void CpuCache<Forwarder>::ResizeSizeClasses() {
                                          size_class_to_grow)) *
           size;
 
-      size_t acquired_bytes =
+      const size_t acquired =
           Steal(cpu, size_class_to_grow, to_steal_bytes, &to_return);
-      size_t capacity_acquired = acquired_bytes / size;
-
-      size_t actual_increase = freelist_.GrowOtherCache(
-          cpu, size_class_to_grow, capacity_acquired, [&](uint8_t shift) {
-            return GetMaxCapacity(size_class_to_grow, shift);
-          });
 
       // Release any objects recovered when we shrunk capacity above to the
       // backing cache.
@@ -1249,13 +1610,37 @@ inline void CpuCache<Forwarder>::ResizeSizeClasses() {
                               absl::Span<void*>(&(to_return.obj[i]), 1));
       }
 
-      // We might not have been able to grow the size class's capacity by the
-      // amount we stole. Record the leftover in the available capacity of this
-      // per-cpu cache. We do not want to lose the total capacity.
-      size_t actual_increased_bytes = actual_increase * size;
-      if (actual_increased_bytes < acquired_bytes) {
+      if (acquired < size) {
+        // Not enough for an object; return it to the slack.
+        resize_[cpu].available.fetch_add(acquired, std::memory_order_relaxed);
+        continue;
+      }
+      acquired_bytes[num_grows] = acquired;
+      grows[num_grows] = {.cpu = cpu,
+                          .size_class = size_class_to_grow,
+                          .grow = true,
+                          .len = acquired / size};
+      ++num_grows;
+    }
+
+    if (num_grows > 0) {
+      freelist_.ResizeOtherCaches(
+          absl::MakeSpan(grows, num_grows),
+          [this](size_t size_class, uint8_t shift) {
+            return GetMaxCapacity(size_class, shift);
+          },
+          [](size_t, void**, size_t) { ASSERT(false); });
+    }
+
+    // We might not have been able to grow the size classes' capacity by the
+    // amount we stole. Record the leftover in the available capacity of this
+    // per-cpu cache. We do not want to lose the total capacity.
+    for (size_t i = 0; i < num_grows; ++i) {
+      size_t actual_increased_bytes =
+          grows[i].result * forwarder_.class_to_size(grows[i].size_class);
+      if (actual_increased_bytes < acquired_bytes[i]) {
         // return whatever we didn't use to the slack.
-        size_t unused = acquired_bytes - actual_increased_bytes;
+        size_t unused = acquired_bytes[i] - actual_increased_bytes;
         resize_[cpu].available.fetch_add(unused, std::memory_order_relaxed);
       }
     }
@@ -1274,13 +1659,248 @@ inline void CpuCache<Forwarder>::ResizeSizeClasses() {
   last_cpu_size_class_resize_.store(cpu, std::memory_order_relaxed);
 }
 
+template <class Forwarder>
+inline void CpuCache<Forwarder>::ResizeSizeClassesByDemand() {
+  const int num_cpus = PopulatedCpuLimit();
+  absl::FixedArray<std::pair<int, double>> demand(num_cpus);
+
+  // Update the forecasts of every populated cache, so that each forecast
+  // covers intervals of the same length, and rank the caches by them.
+  int num_populated_cpus = 0;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!HasPopulated(cpu)) {
+      continue;
+    }
+    double predicted_misses = 0;
+    for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+      PerClassResizeInfo& info = resize_[cpu].per_class[size_class];
+      info.UpdateDemand(info.GetIntervalMisses(PerClassMissType::kResize));
+      info.UpdateIntervalMisses(PerClassMissType::kResize);
+      predicted_misses += info.PredictedMisses();
+    }
+    demand[num_populated_cpus++] = {cpu, predicted_misses};
+  }
+
+  const int num_cpus_to_resize =
+      std::min(num_populated_cpus, kNumCpuCachesToResize);
+  std::partial_sort(
+      demand.begin(), demand.begin() + num_cpus_to_resize,
+      demand.begin() + num_populated_cpus,
+      [](std::pair<int, double> a, std::pair<int, double> b) {
+        if (a.second == b.second) {
+          return a.first < b.first;
+        }
+        return a.second > b.second;
+      });
+  for (int i = 0; i < num_cpus_to_resize; ++i) {
+    // The remaining caches are not expected to miss at all.
+    if (demand[i].second == 0) break;
+    GrowSizeClassesByDemand(demand[i].first);
+  }
+}
+
+template <class Forwarder>
+inline void CpuCache<Forwarder>::GrowSizeClassesByDemand(int cpu) {
+  constexpr size_t kMaxSizeClassesToResize = 5;
+  // A size class is grown by a batch for each forecast miss, up to this many
+  // batches, so that it catches up with a jump in demand in a few intervals.
+  constexpr size_t kMaxBatchesToGrow = 4;
+  // Capacity only moves to a size class from one whose forecast misses per
+  // byte are at most this fraction of its own, so that two size classes with
+  // similar demand do not trade capacity back and forth.
+  constexpr double kDonorDemandRatio = 0.5;
+
+  struct SizeClassDemand {
+    size_t size_class;
+    // Forecast misses per byte of a batch of objects: roughly the misses that
+    // each byte of capacity given to, or taken from, the size class saves or
+    // costs.
+    double misses_per_byte;
+  };
+  absl::FixedArray<SizeClassDemand> demand(kNumClasses - 1);
+  for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+    const size_t batch_bytes = forwarder_.num_objects_to_move(size_class) *
+                               forwarder_.class_to_size(size_class);
+    const double predicted_misses =
+        resize_[cpu].per_class[size_class].PredictedMisses();
+    demand[size_class - 1] = SizeClassDemand{
+        .size_class = size_class,
+        .misses_per_byte =
+            batch_bytes == 0 ? 0 : predicted_misses / batch_bytes};
+  }
+  std::sort(demand.begin(), demand.end(),
+            [](SizeClassDemand a, SizeClassDemand b) {
+              // In case of a conflict, prefer growing smaller size classes.
+              if (a.misses_per_byte == b.misses_per_byte) {
+                return a.size_class < b.size_class;
+              }
+              return a.misses_per_byte > b.misses_per_byte;
+            });
+
+  // The donors' capacity is taken first and pooled, and then handed out to
+  // the size classes being grown, so that the cache is fenced once for all
+  // the shrinks and once for all the grows, rather than once for each.
+  struct PlannedGrow {
+    size_t size_class;
+    size_t from_available;
+    size_t from_donors;
+  };
+  PlannedGrow planned[kMaxSizeClassesToResize];
+  size_t num_planned = 0;
+  // The objects planned to be taken from each donor, by position in demand.
+  absl::FixedArray<size_t> donor_len(demand.size(), 0);
+  // Any size class may be a donor, so this does not fit on the stack, and we
+  // can't allocate while holding the lock.
+  absl::FixedArray<Freelist::OtherCacheResize> resizes(demand.size());
+
+  AllocationGuardSpinLockHolder h(&resize_[cpu].lock);
+
+  // Donors are taken from the back of demand, lowest forecast first.
+  size_t donor = demand.size();
+  for (size_t i = 0; i < kMaxSizeClassesToResize; ++i) {
+    const SizeClassDemand& grow = demand[i];
+    if (grow.misses_per_byte == 0) break;
+    const size_t size_class_to_grow = grow.size_class;
+
+    const size_t can_grow = MaxCapacity(size_class_to_grow) -
+                            freelist_.Capacity(cpu, size_class_to_grow);
+    if (can_grow == 0) {
+      continue;
+    }
+    const size_t size = forwarder_.class_to_size(size_class_to_grow);
+    const size_t batches = std::clamp<size_t>(
+        std::ceil(resize_[cpu].per_class[size_class_to_grow].PredictedMisses()),
+        1, kMaxBatchesToGrow);
+    const size_t desired_bytes =
+        std::min(can_grow,
+                 batches * forwarder_.num_objects_to_move(size_class_to_grow)) *
+        size;
+
+    // Unallocated capacity costs no misses, so use it first.
+    size_t acquired_bytes = 0;
+    size_t available = resize_[cpu].available.load(std::memory_order_relaxed);
+    while (available > 0) {
+      const size_t can_acquire = std::min(available, desired_bytes);
+      if (resize_[cpu].available.compare_exchange_weak(
+              available, available - can_acquire, std::memory_order_relaxed)) {
+        acquired_bytes = can_acquire;
+        break;
+      }
+    }
+    const size_t from_available = acquired_bytes;
+
+    while (acquired_bytes < desired_bytes && donor > i + 1) {
+      const SizeClassDemand& shrink = demand[donor - 1];
+      if (shrink.misses_per_byte > kDonorDemandRatio * grow.misses_per_byte) {
+        // Every remaining donor has a higher forecast.
+        break;
+      }
+      const size_t source_size_class = shrink.size_class;
+      const size_t capacity =
+          freelist_.Capacity(cpu, source_size_class) - donor_len[donor - 1];
+      if (capacity == 0) {
+        --donor;
+        continue;
+      }
+      // Take at most a batch from a donor at a time: a size class that has
+      // not missed lately may still be using its capacity.
+      const size_t source_size = forwarder_.class_to_size(source_size_class);
+      const size_t want = std::min(
+          {capacity, forwarder_.num_objects_to_move(source_size_class),
+           (desired_bytes - acquired_bytes + source_size - 1) / source_size});
+      donor_len[donor - 1] += want;
+      acquired_bytes += want * source_size;
+      if (acquired_bytes < desired_bytes) {
+        --donor;
+      }
+    }
+    if (acquired_bytes == 0) {
+      continue;
+    }
+    planned[num_planned++] = {.size_class = size_class_to_grow,
+                              .from_available = from_available,
+                              .from_donors = acquired_bytes - from_available};
+  }
+  if (num_planned == 0) {
+    return;
+  }
+
+  size_t num_resizes = 0;
+  for (size_t i = 0; i < demand.size(); ++i) {
+    if (donor_len[i] == 0) continue;
+    resizes[num_resizes++] = {.cpu = cpu,
+                              .size_class = demand[i].size_class,
+                              .grow = false,
+                              .len = donor_len[i]};
+  }
+  size_t pooled_bytes = 0;
+  if (num_resizes > 0) {
+    freelist_.ResizeOtherCaches(
+        absl::MakeSpan(resizes.data(), num_resizes),
+        [](size_t, uint8_t) { return 0; },
+        [this](size_t size_class, void** batch, size_t count) {
+          const size_t batch_length =
+              forwarder_.num_objects_to_move(size_class);
+          for (size_t i = 0; i < count; i += batch_length) {
+            size_t n = std::min(batch_length, count - i);
+            ReleaseToBackingCache(size_class, absl::Span<void*>(batch + i, n));
+          }
+        });
+    for (size_t i = 0; i < num_resizes; ++i) {
+      pooled_bytes +=
+          resizes[i].result * forwarder_.class_to_size(resizes[i].size_class);
+    }
+  }
+
+  // A shrink may fall short of what was planned, so the pool goes to the size
+  // classes with the highest forecast first.
+  size_t acquired_bytes[kMaxSizeClassesToResize];
+  num_resizes = 0;
+  for (size_t i = 0; i < num_planned; ++i) {
+    const size_t from_donors = std::min(planned[i].from_donors, pooled_bytes);
+    pooled_bytes -= from_donors;
+    acquired_bytes[i] = planned[i].from_available + from_donors;
+    resize_[cpu].num_size_class_resizes.fetch_add(1,
+                                                  std::memory_order_relaxed);
+    resizes[num_resizes++] = {
+        .cpu = cpu,
+        .size_class = planned[i].size_class,
+        .grow = true,
+        .len = acquired_bytes[i] /
+               forwarder_.class_to_size(planned[i].size_class)};
+  }
+  freelist_.ResizeOtherCaches(
+      absl::MakeSpan(resizes.data(), num_resizes),
+      [this](size_t size_class, uint8_t shift) {
+        return GetMaxCapacity(size_class, shift);
+      },
+      [](size_t, void**, size_t) { ASSERT(false); });
+
+  // Return what we could not use to the available capacity of this cache,
+  // so that the total capacity is not lost.
+  size_t unused_bytes = pooled_bytes;
+  for (size_t i = 0; i < num_planned; ++i) {
+    unused_bytes += acquired_bytes[i] -
+                    resizes[i].result *
+                        forwarder_.class_to_size(resizes[i].size_class);
+  }
+  if (unused_bytes > 0) {
+    resize_[cpu].available.fetch_add(unused_bytes, std::memory_order_relaxed);
+  }
+}
+
 template <class Forwarder>
 inline void CpuCache<Forwarder>::ShuffleCpuCaches() {
+  if (forwarder_.predictive_capacity_enabled()) {
+    ShuffleCpuCachesByDemand();
+    return;
+  }
+
   // Knobs that we can potentially tune depending on the workloads.
   constexpr double kBytesToStealPercent = 5.0;
   constexpr int kMaxNumStealCpus = 5;
 
-  const int num_cpus = NumCPUs();
+  const int num_cpus = PopulatedCpuLimit();
   absl::FixedArray<std::pair<int, uint64_t>> misses(num_cpus);
 
   // Record the cumulative misses for the caches so that we can select the
@@ -1338,6 +1958,63 @@ inline void CpuCache<Forwarder>::ShuffleCpuCaches() {
   }
 }
 
+template <class Forwarder>
+inline void CpuCache<Forwarder>::ShuffleCpuCachesByDemand() {
+  // The same knobs as ShuffleCpuCaches and StealFromOtherCache, applied to
+  // forecast rather than last-interval misses.
+  constexpr double kBytesToStealPercent = 5.0;
+  constexpr int kMaxNumStealCpus = 5;
+  constexpr double kCacheMissThreshold = 0.80;
+
+  const int num_cpus = PopulatedCpuLimit();
+  absl::FixedArray<std::pair<int, double>> demand(num_cpus);
+  int num_populated_cpus = 0;
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    const CpuCacheMissStats miss_stats =
+        GetAndUpdateIntervalCacheMissStats(cpu, MissCount::kShuffle);
+    if (!HasPopulated(cpu)) {
+      continue;
+    }
+    const uint64_t misses =
+        uint64_t{miss_stats.underflows} + uint64_t{miss_stats.overflows};
+    const uint64_t forecast = UpdateDemandForecast(
+        resize_[cpu].demand.load(std::memory_order_relaxed), misses);
+    // Forecasts are only updated here, on a single thread.
+    resize_[cpu].demand.store(forecast, std::memory_order_relaxed);
+    demand[num_populated_cpus++] = {cpu, PredictedMisses(cpu)};
+  }
+
+  // Unlike ShuffleCpuCaches, sort all the caches, so that we can steal from
+  // the ones with the lowest forecast first instead of round-robin.
+  std::sort(demand.begin(), demand.begin() + num_populated_cpus,
+            [](std::pair<int, double> a, std::pair<int, double> b) {
+              if (a.second == b.second) {
+                return a.first < b.first;
+              }
+              return a.second > b.second;
+            });
+
+  const size_t to_steal = kBytesToStealPercent / 100.0 * CacheLimit();
+  const int num_dest_cpus = std::min(num_populated_cpus, kMaxNumStealCpus);
+  for (int i = 0; i < num_dest_cpus; ++i) {
+    const auto [cpu, dest_misses] = demand[i];
+    if (dest_misses == 0) break;
+
+    size_t acquired = 0;
+    for (int j = num_populated_cpus - 1; j > i && acquired < to_steal; --j) {
+      const auto [src_cpu, src_misses] = demand[j];
+      // Sources are sorted, so no later one qualifies either.
+      if (src_misses > kCacheMissThreshold * dest_misses) break;
+      if (Capacity(src_cpu) < kCacheCapacityThreshold * CacheLimit()) continue;
+      acquired += StealFromCpu(cpu, src_cpu, to_steal - acquired);
+    }
+    if (acquired) {
+      resize_[cpu].available.fetch_add(acquired, std::memory_order_relaxed);
+      resize_[cpu].capacity.fetch_add(acquired, std::memory_order_relaxed);
+    }
+  }
+}
+
 template <class Forwarder>
 inline void CpuCache<Forwarder>::StealFromOtherCache(int cpu,
                                                      int max_populated_cpu,
@@ -1397,103 +2074,7 @@ inline void CpuCache<Forwarder>::StealFromOtherCache(int cpu,
         src_misses.overflows > kCacheMissThreshold * dest_misses.overflows)
       continue;
 
-    size_t start_size_class =
-        resize_[src_cpu].last_steal.load(std::memory_order_relaxed);
-
-    ASSERT(start_size_class < kNumClasses);
-    ASSERT(0 < start_size_class);
-    size_t source_size_class = start_size_class;
-    for (size_t offset = 1; offset < kNumClasses; ++offset) {
-      source_size_class = start_size_class + offset;
-      if (source_size_class >= kNumClasses) {
-        source_size_class -= kNumClasses - 1;
-      }
-      ASSERT(0 < source_size_class);
-      ASSERT(source_size_class < kNumClasses);
-
-      const size_t capacity = freelist_.Capacity(src_cpu, source_size_class);
-      if (capacity == 0) {
-        // Nothing to steal.
-        continue;
-      }
-      const size_t length = freelist_.Length(src_cpu, source_size_class);
-
-      // TODO(vgogte): Currently, scoring is similar to stealing from the
-      // same cpu in CpuCache<Forwarder>::Steal(). Revisit this later to tune
-      // the knobs.
-      const size_t batch_length =
-          forwarder_.num_objects_to_move(source_size_class);
-      size_t size = forwarder_.class_to_size(source_size_class);
-
-      // Clock-like algorithm to prioritize size classes for shrinking.
-      //
-      // Each size class has quiescent ticks counter which is incremented as we
-      // pass it, the counter is reset to 0 in UpdateCapacity on grow.
-      // If the counter value is 0, then we've just tried to grow the size
-      // class, so it makes little sense to shrink it back. The higher counter
-      // value the longer ago we grew the list and the more probable it is that
-      // the full capacity is unused.
-      //
-      // Then, we calculate "shrinking score", the higher the score the less we
-      // we want to shrink this size class. The score is considerably skewed
-      // towards larger size classes: smaller classes are usually used more
-      // actively and we also benefit less from shrinking smaller classes (steal
-      // less capacity). Then, we also avoid shrinking full freelists as we will
-      // need to evict an object and then go to the central freelist to return
-      // it. Then, we also avoid shrinking freelists that are just above batch
-      // size, because shrinking them will disable transfer cache.
-      //
-      // Finally, we shrink if the ticks counter is >= the score.
-      uint32_t qticks = resize_[src_cpu].per_class[source_size_class].Tick();
-      uint32_t score = 0;
-      // Note: the following numbers are based solely on intuition, common sense
-      // and benchmarking results.
-      if (size <= 144) {
-        score = 2 + (length >= capacity) +
-                (length >= batch_length && length < 2 * batch_length);
-      } else if (size <= 1024) {
-        score = 1 + (length >= capacity) +
-                (length >= batch_length && length < 2 * batch_length);
-      } else if (size <= (64 << 10)) {
-        score = (length >= capacity);
-      }
-      if (score > qticks) {
-        continue;
-      }
-
-      // Finally, try to shrink (can fail if we were migrated).
-      // We always shrink by 1 object. The idea is that inactive lists will be
-      // shrunk to zero eventually anyway (or they just would not grow in the
-      // first place), but for active lists it does not make sense to
-      // aggressively shuffle capacity all the time.
-      //
-      // If the list is full, ShrinkOtherCache first tries to pop enough items
-      // to make space and then shrinks the capacity.
-      // TODO(vgogte): Maybe we can steal more from a single list to avoid
-      // frequent locking overhead.
-      {
-        AllocationGuardSpinLockHolder h(&resize_[src_cpu].lock);
-        if (freelist_.ShrinkOtherCache(
-                src_cpu, source_size_class, 1,
-                [this](size_t size_class, void** batch, size_t count) {
-                  const size_t batch_length =
-                      forwarder_.num_objects_to_move(size_class);
-                  for (size_t i = 0; i < count; i += batch_length) {
-                    size_t n = std::min(batch_length, count - i);
-                    ReleaseToBackingCache(size_class,
-                                          absl::Span<void*>(batch + i, n));
-                  }
-                }) == 1) {
-          acquired += size;
-          resize_[src_cpu].capacity.fetch_sub(size, std::memory_order_relaxed);
-        }
-      }
-
-      if (acquired >= bytes) {
-        break;
-      }
-    }
-    resize_[cpu].last_steal.store(source_size_class, std::memory_order_relaxed);
+    acquired += StealFromCpu(cpu, src_cpu, bytes - acquired);
   }
   // Record the last cpu id we stole from, which would provide a hint to the
   // next time we iterate through the cpus for stealing.
@@ -1513,6 +2094,133 @@ inline void CpuCache<Forwarder>::StealFromOtherCache(int cpu,
   }
 }
 
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::StealFromCpu(int cpu, int src_cpu,
+                                                size_t bytes) {
+  // Shrinks are applied in batches, so that src_cpu is fenced once for each
+  // batch rather than once for each size class.  A batch is planned to take
+  // what is left to acquire, and is only followed by another if some of its
+  // shrinks fail.
+  absl::FixedArray<Freelist::OtherCacheResize> resizes(kNumClasses - 1);
+  size_t num_resizes = 0;
+  size_t planned = 0;
+  size_t acquired = 0;
+  auto apply = [&] {
+    AllocationGuardSpinLockHolder h(&resize_[src_cpu].lock);
+    freelist_.ResizeOtherCaches(
+        absl::MakeSpan(resizes.data(), num_resizes),
+        [](size_t, uint8_t) { return 0; },
+        [this](size_t size_class, void** batch, size_t count) {
+          const size_t batch_length =
+              forwarder_.num_objects_to_move(size_class);
+          for (size_t i = 0; i < count; i += batch_length) {
+            size_t n = std::min(batch_length, count - i);
+            ReleaseToBackingCache(size_class, absl::Span<void*>(batch + i, n));
+          }
+        });
+    for (size_t i = 0; i < num_resizes; ++i) {
+      if (resizes[i].result == 1) {
+        const size_t size = forwarder_.class_to_size(resizes[i].size_class);
+        acquired += size;
+        resize_[src_cpu].capacity.fetch_sub(size, std::memory_order_relaxed);
+      }
+    }
+    num_resizes = 0;
+    planned = acquired;
+  };
+
+  size_t start_size_class =
+      resize_[src_cpu].last_steal.load(std::memory_order_relaxed);
+
+  ASSERT(start_size_class < kNumClasses);
+  ASSERT(0 < start_size_class);
+  size_t source_size_class = start_size_class;
+  for (size_t offset = 1; offset < kNumClasses; ++offset) {
+    source_size_class = start_size_class + offset;
+    if (source_size_class >= kNumClasses) {
+      source_size_class -= kNumClasses - 1;
+    }
+    ASSERT(0 < source_size_class);
+    ASSERT(source_size_class < kNumClasses);
+
+    const size_t capacity = freelist_.Capacity(src_cpu, source_size_class);
+    if (capacity == 0) {
+      // Nothing to steal.
+      continue;
+    }
+    const size_t length = freelist_.Length(src_cpu, source_size_class);
+
+    // TODO(vgogte): Currently, scoring is similar to stealing from the
+    // same cpu in CpuCache<Forwarder>::Steal(). Revisit this later to tune
+    // the knobs.
+    const size_t batch_length =
+        forwarder_.num_objects_to_move(source_size_class);
+    size_t size = forwarder_.class_to_size(source_size_class);
+
+    // Clock-like algorithm to prioritize size classes for shrinking.
+    //
+    // Each size class has quiescent ticks counter which is incremented as we
+    // pass it, the counter is reset to 0 in UpdateCapacity on grow.
+    // If the counter value is 0, then we've just tried to grow the size
+    // class, so it makes little sense to shrink it back. The higher counter
+    // value the longer ago we grew the list and the more probable it is that
+    // the full capacity is unused.
+    //
+    // Then, we calculate "shrinking score", the higher the score the less we
+    // we want to shrink this size class. The score is considerably skewed
+    // towards larger size classes: smaller classes are usually used more
+    // actively and we also benefit less from shrinking smaller classes (steal
+    // less capacity). Then, we also avoid shrinking full freelists as we will
+    // need to evict an object and then go to the central freelist to return
+    // it. Then, we also avoid shrinking freelists that are just above batch
+    // size, because shrinking them will disable transfer cache.
+    //
+    // Finally, we shrink if the ticks counter is >= the score.
+    uint32_t qticks = resize_[src_cpu].per_class[source_size_class].Tick();
+    uint32_t score = 0;
+    // Note: the following numbers are based solely on intuition, common sense
+    // and benchmarking results.
+    if (size <= 144) {
+      score = 2 + (length >= capacity) +
+              (length >= batch_length && length < 2 * batch_length);
+    } else if (size <= 1024) {
+      score = 1 + (length >= capacity) +
+              (length >= batch_length && length < 2 * batch_length);
+    } else if (size <= (64 << 10)) {
+      score = (length >= capacity);
+    }
+    if (score > qticks) {
+      continue;
+    }
+
+    // Finally, plan to shrink (can fail if we were migrated).
+    // We always shrink by 1 object. The idea is that inactive lists will be
+    // shrunk to zero eventually anyway (or they just would not grow in the
+    // first place), but for active lists it does not make sense to
+    // aggressively shuffle capacity all the time.
+    //
+    // If the list is full, ResizeOtherCaches first tries to pop enough items
+    // to make space and then shrinks the capacity.
+    resizes[num_resizes++] = {.cpu = src_cpu,
+                              .size_class = source_size_class,
+                              .grow = false,
+                              .len = 1};
+    planned += size;
+
+    if (planned >= bytes) {
+      apply();
+      if (acquired >= bytes) {
+        break;
+      }
+    }
+  }
+  if (num_resizes > 0) {
+    apply();
+  }
+  resize_[cpu].last_steal.store(source_size_class, std::memory_order_relaxed);
+  return acquired;
+}
+
 // There are rather a lot of policy knobs we could tweak here.
 template <class Forwarder>
 inline size_t CpuCache<Forwarder>::Steal(int cpu, size_t dest_size_class,
@@ -1678,11 +2386,69 @@ inline bool CpuCache<Forwarder>::HasPopulated(int target_cpu) const {
   return resize_[target_cpu].populated.load(std::memory_order_relaxed);
 }
 
+template <class Forwarder>
+inline int CpuCache<Forwarder>::PopulatedCpuLimit() const {
+  return populated_cpu_limit_.load(std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+inline auto CpuCache<Forwarder>::GetPopulatedCpuStats() const
+    -> PopulatedCpuStats {
+  PopulatedCpuStats stats;
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
+  stats.virtual_cpus = subtle::percpu::UsingFlatVirtualCpus();
+#endif
+  const int limit = PopulatedCpuLimit();
+  stats.populated_id_limit = limit;
+  for (int cpu = 0; cpu < limit; ++cpu) {
+    stats.populated_caches += HasPopulated(cpu);
+  }
+  const cpu_set_t allowed_cpus = FillActiveCpuMask();
+  stats.allowed_cpus = CPU_COUNT(&allowed_cpus);
+  stats.slab_bytes_per_cache = uint64_t{1} << freelist_.GetShift();
+  stats.unpopulated_slab_bytes =
+      (static_cast<size_t>(NumCPUs()) - stats.populated_caches) *
+      stats.slab_bytes_per_cache;
+  return stats;
+}
+
 template <class Forwarder>
 inline PerCPUMetadataState CpuCache<Forwarder>::MetadataMemoryUsage() const {
   return freelist_.MetadataMemoryUsage();
 }
 
+template <class Forwarder>
+inline auto CpuCache<Forwarder>::GetSlabPlacementStats() const
+    -> SlabPlacementStats {
+  SlabPlacementStats stats;
+  stats.hugepage_backed = hugepage_slabs_;
+  stats.madvise_failed_bytes =
+      dynamic_slab_info_.hugepage_madvise_failed_bytes.load(
+          std::memory_order_relaxed);
+
+  const uint8_t numa_shift = NumaShift(forwarder_.numa_topology());
+  const Freelist::Slabs* slabs =
+      slabs_by_shift_[ShiftOffset(freelist_.GetShift(), numa_shift)];
+  if (slabs == nullptr) return stats;
+
+  const PerCPUMetadataState usage = MetadataMemoryUsage();
+  stats.virtual_size = usage.virtual_size;
+  stats.resident_size = usage.resident_size;
+
+  constexpr size_t kSmallPageSize =
+      static_cast<size_t>(subtle::percpu::kPhysicalPageAlign);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(slabs);
+  const uintptr_t end = begin + stats.virtual_size;
+  const uintptr_t hugepage_begin = begin & ~(kHugePageSize - 1);
+  const uintptr_t hugepage_end =
+      (end + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  stats.hugepage_aligned = begin == hugepage_begin;
+  stats.small_pages_spanned =
+      (stats.virtual_size + kSmallPageSize - 1) / kSmallPageSize;
+  stats.hugepages_spanned = (hugepage_end - hugepage_begin) / kHugePageSize;
+  return stats;
+}
+
 template <class Forwarder>
 inline uint64_t CpuCache<Forwarder>::TotalUsedBytes() const {
   uint64_t total = 0;
@@ -1754,6 +2520,12 @@ struct DrainHandler {
 
 template <class Forwarder>
 inline uint64_t CpuCache<Forwarder>::Reclaim(int cpu) {
+  return ReclaimImpl(cpu, nullptr);
+}
+
+template <class Forwarder>
+inline uint64_t CpuCache<Forwarder>::ReclaimImpl(
+    int cpu, uint64_t* released_slab_bytes) {
   AllocationGuardSpinLockHolder h(&resize_[cpu].lock);
 
   // If we haven't populated this core, freelist_.Drain() will touch the memory
@@ -1764,7 +2536,18 @@ inline uint64_t CpuCache<Forwarder>::Reclaim(int cpu) {
   }
 
   uint64_t bytes = 0;
-  freelist_.Drain(cpu, DrainHandler<CpuCache>{this, &bytes});
+  if (released_slab_bytes == nullptr) {
+    freelist_.Drain(cpu, DrainHandler<CpuCache>{this, &bytes});
+  } else {
+    // As in ResizeSlabIfNeeded(), the pages must not be MADV_REMOVEd, since
+    // threads still on <cpu> may read them.
+    *released_slab_bytes += freelist_.DrainAndRelease(
+        cpu, DrainHandler<CpuCache>{this, &bytes},
+        [](void* start, size_t length) {
+          ErrnoRestorer errno_restorer;
+          madvise(start, length, MADV_DONTNEED);
+        });
+  }
 
   // Record that the reclaim occurred for this CPU.
   resize_[cpu].num_reclaims.store(
@@ -1804,13 +2587,58 @@ inline uint64_t CpuCache<Forwarder>::GetNumReclaims() const {
   return reclaims;
 }
 
+template <class Forwarder>
+inline uint64_t CpuCache<Forwarder>::DrainDisallowedCpus() {
+  const cpu_set_t allowed_cpus = forwarder_.allowed_cpus();
+  // An empty set means that the allowed CPUs could not be determined.
+  if (CPU_COUNT(&allowed_cpus) == 0) return 0;
+
+  absl::base_internal::SpinLockHolder h(&allowed_cpus_lock_);
+  if (CPU_EQUAL(&allowed_cpus, &allowed_cpus_)) return 0;
+
+  size_t drained_cpus = 0;
+  uint64_t drained_bytes = 0;
+  uint64_t released_slab_bytes = 0;
+  const int num_cpus = NumCPUs();
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed_cpus_) || CPU_ISSET(cpu, &allowed_cpus)) {
+      continue;
+    }
+    if (!HasPopulated(cpu)) continue;
+    // Releasing part of a hugepage-backed slab would split its hugepage for
+    // the CPUs that are still in use, so those slabs are only drained.
+    drained_bytes +=
+        ReclaimImpl(cpu, hugepage_slabs_ ? nullptr : &released_slab_bytes);
+    ++drained_cpus;
+  }
+  allowed_cpus_ = allowed_cpus;
+  if (drained_cpus == 0) return 0;
+
+  DisallowedCpuStats& stats = disallowed_cpu_stats_;
+  ++stats.events;
+  stats.drained_cpus += drained_cpus;
+  stats.drained_bytes += drained_bytes;
+  stats.released_slab_bytes += released_slab_bytes;
+  stats.last_event_drained_cpus = drained_cpus;
+  stats.last_event_drained_bytes = drained_bytes;
+  stats.last_event_released_slab_bytes = released_slab_bytes;
+  return drained_bytes;
+}
+
+template <class Forwarder>
+inline auto CpuCache<Forwarder>::GetDisallowedCpuStats() const
+    -> DisallowedCpuStats {
+  absl::base_internal::SpinLockHolder h(&allowed_cpus_lock_);
+  return disallowed_cpu_stats_;
+}
+
 template <class Forwarder>
 inline auto CpuCache<Forwarder>::AllocOrReuseSlabs(
     absl::FunctionRef<void*(size_t, std::align_val_t)> alloc,
     subtle::percpu::Shift shift, int num_cpus, uint8_t shift_offset)
     -> std::pair<Freelist::Slabs*, size_t> {
   Freelist::Slabs*& reused_slabs = slabs_by_shift_[shift_offset];
-  const size_t size = GetSlabsAllocSize(shift, num_cpus);
+  const size_t size = SlabsAllocSize(shift, num_cpus);
   const bool can_reuse = reused_slabs != nullptr;
   if (can_reuse) {
     // Enable huge pages for reused slabs.
@@ -1819,22 +2647,45 @@ inline auto CpuCache<Forwarder>::AllocOrReuseSlabs(
     ErrnoRestorer errno_restorer;
     madvise(reused_slabs, size, MADV_HUGEPAGE);
   } else {
-    reused_slabs = static_cast<Freelist::Slabs*>(
-        alloc(size, subtle::percpu::kPhysicalPageAlign));
+    reused_slabs = static_cast<Freelist::Slabs*>(alloc(size, SlabsAlignment()));
     // MSan does not see writes in assembly.
     ANNOTATE_MEMORY_IS_INITIALIZED(reused_slabs, size);
+    if (hugepage_slabs_) {
+      // Ask for the slabs to be faulted in as hugepages even if THP is only
+      // enabled for madvised regions.
+      ErrnoRestorer errno_restorer;
+      if (madvise(reused_slabs, size, MADV_HUGEPAGE) != 0) {
+        dynamic_slab_info_.hugepage_madvise_failed_bytes.fetch_add(
+            size, std::memory_order_relaxed);
+      }
+    }
   }
   return {reused_slabs, can_reuse ? size : 0};
 }
 
+template <class Forwarder>
+inline size_t CpuCache<Forwarder>::SlabsAllocSize(subtle::percpu::Shift shift,
+                                                  int num_cpus) const {
+  const size_t size = subtle::percpu::GetSlabsAllocSize(shift, num_cpus);
+  if (!hugepage_slabs_) return size;
+  return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+template <class Forwarder>
+inline std::align_val_t CpuCache<Forwarder>::SlabsAlignment() const {
+  return hugepage_slabs_ ? std::align_val_t{kHugePageSize}
+                         : subtle::percpu::kPhysicalPageAlign;
+}
+
 template <class Forwarder>
 void CpuCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   uint8_t per_cpu_shift = freelist_.GetShift();
+  const auto old_shift = subtle::percpu::ToShiftType(per_cpu_shift);
   const uint8_t numa_shift = NumaShift(forwarder_.numa_topology());
 
   const int num_cpus = NumCPUs();
   CpuCacheMissStats total_misses{};
-  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+  for (int cpu = 0, limit = PopulatedCpuLimit(); cpu < limit; ++cpu) {
     total_misses +=
         GetAndUpdateIntervalCacheMissStats(cpu, MissCount::kSlabResize);
   }
@@ -1862,8 +2713,7 @@ void CpuCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   }
 
   const auto new_shift = subtle::percpu::ToShiftType(per_cpu_shift);
-  const int64_t new_slabs_size =
-      subtle::percpu::GetSlabsAllocSize(new_shift, num_cpus);
+  const int64_t new_slabs_size = SlabsAllocSize(new_shift, num_cpus);
   // Account for impending allocation/reusing of new slab so that we can avoid
   // going over memory limit.
   forwarder_.ArenaUpdateAllocatedAndNonresident(new_slabs_size, 0);
@@ -1890,6 +2740,11 @@ void CpuCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   }
   for (int cpu = 0; cpu < num_cpus; ++cpu) resize_[cpu].lock.Unlock();
 
+  // With hugepage-backed slabs, the old allocation extends past the slabs to a
+  // hugepage boundary.
+  const int64_t old_slabs_size = SlabsAllocSize(old_shift, num_cpus);
+  ASSERT(old_slabs_size >= info.old_slabs_size);
+
   // madvise away the old slabs memory.  It is important that we do not
   // MADV_REMOVE the memory, since file-backed pages may SIGSEGV/SIGBUS if
   // another thread sees the previous slab after this point and reads it.
@@ -1899,13 +2754,12 @@ void CpuCache<Forwarder>::ResizeSlabIfNeeded() ABSL_NO_THREAD_SAFETY_ANALYSIS {
   // Note: we use bitwise OR to avoid short-circuiting.
   ErrnoRestorer errno_restorer;
   const bool madvise_failed =
-      madvise(info.old_slabs, info.old_slabs_size, MADV_NOHUGEPAGE) |
-      madvise(info.old_slabs, info.old_slabs_size, MADV_DONTNEED);
+      madvise(info.old_slabs, old_slabs_size, MADV_NOHUGEPAGE) |
+      madvise(info.old_slabs, old_slabs_size, MADV_DONTNEED);
   if (madvise_failed) {
     dynamic_slab_info_.madvise_failed_bytes.fetch_add(
-        info.old_slabs_size, std::memory_order_relaxed);
+        old_slabs_size, std::memory_order_relaxed);
   }
-  const int64_t old_slabs_size = info.old_slabs_size;
   forwarder_.ArenaUpdateAllocatedAndNonresident(-old_slabs_size,
                                                 old_slabs_size - reused_bytes);
 }
@@ -1990,6 +2844,19 @@ size_t CpuCache<Forwarder>::GetIntervalSizeClassMisses(int cpu,
   return resize_[cpu].per_class[size_class].GetIntervalMisses(type);
 }
 
+template <class Forwarder>
+inline double CpuCache<Forwarder>::PredictedMisses(int cpu,
+                                                   size_t size_class) const {
+  return resize_[cpu].per_class[size_class].PredictedMisses();
+}
+
+template <class Forwarder>
+inline double CpuCache<Forwarder>::PredictedMisses(int cpu) const {
+  return static_cast<double>(
+             resize_[cpu].demand.load(std::memory_order_relaxed)) /
+         kDemandScale;
+}
+
 template <class Forwarder>
 inline typename CpuCache<Forwarder>::SizeClassCapacityStats
 CpuCache<Forwarder>::GetSizeClassCapacityStats(size_t size_class) const {
@@ -2153,6 +3020,48 @@ inline void CpuCache<Forwarder>::Print(Printer* out) const {
   out->printf(
       "%12u bytes for which MADVISE_DONTNEED failed\n",
       dynamic_slab_info_.madvise_failed_bytes.load(std::memory_order_relaxed));
+
+  const SlabPlacementStats placement = GetSlabPlacementStats();
+  out->printf("------------------------------------------------\n");
+  out->printf("Per-CPU cache slab placement (hugepage-backed: %s)\n",
+              placement.hugepage_backed ? "yes" : "no");
+  out->printf("------------------------------------------------\n");
+  out->printf(
+      "%12u bytes (%u resident), %s hugepage aligned, spanning %u pages or "
+      "%u hugepages\n",
+      placement.virtual_size, placement.resident_size,
+      placement.hugepage_aligned ? "is" : "not", placement.small_pages_spanned,
+      placement.hugepages_spanned);
+  out->printf("%12u bytes for which MADV_HUGEPAGE failed\n",
+              placement.madvise_failed_bytes);
+
+  const DisallowedCpuStats disallowed = GetDisallowedCpuStats();
+  out->printf("------------------------------------------------\n");
+  out->printf("Per-CPU caches drained after leaving the allowed CPU set\n");
+  out->printf("------------------------------------------------\n");
+  out->printf(
+      "%12u events drained %u caches: %u bytes of objects, %u bytes of slab "
+      "released\n",
+      disallowed.events, disallowed.drained_cpus, disallowed.drained_bytes,
+      disallowed.released_slab_bytes);
+  out->printf(
+      "Last event  drained %u caches: %u bytes of objects, %u bytes of slab "
+      "released\n",
+      disallowed.last_event_drained_cpus, disallowed.last_event_drained_bytes,
+      disallowed.last_event_released_slab_bytes);
+
+  const PopulatedCpuStats populated = GetPopulatedCpuStats();
+  out->printf("------------------------------------------------\n");
+  out->printf("Populated per-CPU caches (virtual CPUs: %s)\n",
+              populated.virtual_cpus ? "yes" : "no");
+  out->printf("------------------------------------------------\n");
+  out->printf(
+      "%12u caches populated, all below ID %u, for %u allowed CPUs; "
+      "%u bytes of slab per cache\n",
+      populated.populated_caches, populated.populated_id_limit,
+      populated.allowed_cpus, populated.slab_bytes_per_cache);
+  out->printf("%12u bytes of slab spanned by unpopulated caches\n",
+              populated.unpopulated_slab_bytes);
 }
 
 template <class Forwarder>
@@ -2211,11 +3120,45 @@ inline void CpuCache<Forwarder>::PrintInPbtxt(PbtxtRegion* region) const {
   region->PrintI64(
       "dynamic_slab_madvise_failed_bytes",
       dynamic_slab_info_.madvise_failed_bytes.load(std::memory_order_relaxed));
+
+  const SlabPlacementStats placement = GetSlabPlacementStats();
+  PbtxtRegion entry = region->CreateSubRegion("slab_placement");
+  entry.PrintBool("hugepage_backed", placement.hugepage_backed);
+  entry.PrintBool("hugepage_aligned", placement.hugepage_aligned);
+  entry.PrintI64("virtual_size", placement.virtual_size);
+  entry.PrintI64("resident_size", placement.resident_size);
+  entry.PrintI64("small_pages_spanned", placement.small_pages_spanned);
+  entry.PrintI64("hugepages_spanned", placement.hugepages_spanned);
+  entry.PrintI64("hugepage_madvise_failed_bytes",
+                 placement.madvise_failed_bytes);
+
+  const DisallowedCpuStats disallowed = GetDisallowedCpuStats();
+  PbtxtRegion drained = region->CreateSubRegion("disallowed_cpu_drains");
+  drained.PrintI64("events", disallowed.events);
+  drained.PrintI64("drained_cpus", disallowed.drained_cpus);
+  drained.PrintI64("drained_bytes", disallowed.drained_bytes);
+  drained.PrintI64("released_slab_bytes", disallowed.released_slab_bytes);
+  drained.PrintI64("last_event_drained_cpus",
+                   disallowed.last_event_drained_cpus);
+  drained.PrintI64("last_event_drained_bytes",
+                   disallowed.last_event_drained_bytes);
+  drained.PrintI64("last_event_released_slab_bytes",
+                   disallowed.last_event_released_slab_bytes);
+
+  const PopulatedCpuStats populated = GetPopulatedCpuStats();
+  PbtxtRegion caches = region->CreateSubRegion("populated_cpu_caches");
+  caches.PrintBool("virtual_cpus", populated.virtual_cpus);
+  caches.PrintI64("populated_caches", populated.populated_caches);
+  caches.PrintI64("populated_id_limit", populated.populated_id_limit);
+  caches.PrintI64("allowed_cpus", populated.allowed_cpus);
+  caches.PrintI64("slab_bytes_per_cache", populated.slab_bytes_per_cache);
+  caches.PrintI64("unpopulated_slab_bytes", populated.unpopulated_slab_bytes);
 }
 
 template <class Forwarder>
 inline void CpuCache<Forwarder>::PerClassResizeInfo::Init() {
   state_.store(0, std::memory_order_relaxed);
+  demand_.store(0, std::memory_order_relaxed);
 }
 
 template <class Forwarder>
@@ -2272,6 +3215,24 @@ inline size_t CpuCache<Forwarder>::PerClassResizeInfo::GetIntervalMisses(
   return total_misses > interval_misses ? total_misses - interval_misses : 0;
 }
 
+template <class Forwarder>
+inline void CpuCache<Forwarder>::PerClassResizeInfo::UpdateDemand(
+    size_t misses) {
+  const uint64_t forecast =
+      UpdateDemandForecast(demand_.load(std::memory_order_relaxed), misses);
+  // Forecasts are only updated by ResizeSizeClasses, on a single thread.
+  demand_.store(
+      std::min<uint64_t>(forecast, std::numeric_limits<uint32_t>::max()),
+      std::memory_order_relaxed);
+}
+
+template <class Forwarder>
+inline double CpuCache<Forwarder>::PerClassResizeInfo::PredictedMisses()
+    const {
+  return static_cast<double>(demand_.load(std::memory_order_relaxed)) /
+         kDemandScale;
+}
+
 template <class Forwarder>
 void CpuCache<Forwarder>::PerClassResizeInfo::UpdateIntervalMisses(
     PerClassMissType type) {
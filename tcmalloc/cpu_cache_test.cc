@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <iterator>
 #include <limits>
 #include <new>
 #include <optional>
@@ -27,13 +28,16 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/algorithm/container.h"
 #include "absl/base/optimization.h"
 #include "absl/random/bit_gen_ref.h"
 #include "absl/random/random.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/affinity.h"
 #include "tcmalloc/internal/optimization.h"
+#include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/internal/sysinfo.h"
 #include "tcmalloc/mock_transfer_cache.h"
 #include "tcmalloc/parameters.h"
@@ -71,6 +75,25 @@ class CpuCachePeer {
   static size_t ResizeInfoSize() {
     return sizeof(typename CpuCache::ResizeInfo);
   }
+
+  template <typename CpuCache>
+  static size_t SizeClassCapacity(const CpuCache& cpu_cache, int cpu,
+                                  size_t size_class) {
+    return cpu_cache.freelist_.Capacity(cpu, size_class);
+  }
+
+  template <typename CpuCache>
+  static bool MayPrefetch(const CpuCache& cpu_cache, size_t size_class) {
+    return cpu_cache.MayPrefetch(size_class);
+  }
+
+  // Returns the offset of the end of the prefetch bits in cpu_cache.
+  template <typename CpuCache>
+  static size_t PrefetchClassesEnd(const CpuCache& cpu_cache) {
+    const auto* end = std::end(cpu_cache.prefetch_classes_);
+    return reinterpret_cast<const char*>(end) -
+           reinterpret_cast<const char*>(&cpu_cache);
+  }
 };
 
 namespace {
@@ -90,14 +113,25 @@ class TestStaticForwarder {
   }
 
   static void* Alloc(size_t size, std::align_val_t alignment) {
-    return mmap(nullptr, size, PROT_READ | PROT_WRITE,
-                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    const size_t align = static_cast<size_t>(alignment);
+    if (align <= GetPageSize()) {
+      return mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    // Over-allocate and trim to honor alignments beyond a page.
+    char* p = static_cast<char*>(mmap(nullptr, size + align,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    char* aligned = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(p) + align - 1) & ~(align - 1));
+    if (aligned != p) munmap(p, aligned - p);
+    munmap(aligned + size, p + align - aligned);
+    return aligned;
   }
 
   void* AllocReportedImpending(size_t size, std::align_val_t alignment) {
     arena_reported_impending_bytes_ -= static_cast<int64_t>(size);
-    return mmap(nullptr, size, PROT_READ | PROT_WRITE,
-                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return Alloc(size, alignment);
   }
 
   static void Dealloc(void* ptr, size_t size, std::align_val_t /*alignment*/) {
@@ -121,8 +155,14 @@ class TestStaticForwarder {
 
   bool per_cpu_caches_dynamic_slab_enabled() { return dynamic_slab_enabled_; }
 
+  bool hugepage_backed_slabs() const { return hugepage_backed_slabs_; }
+
   bool resize_size_classes_enabled() { return resize_size_classes_enabled_; }
 
+  bool predictive_capacity_enabled() { return predictive_capacity_enabled_; }
+
+  cpu_set_t allowed_cpus() const { return allowed_cpus_; }
+
   double per_cpu_caches_dynamic_slab_grow_threshold() {
     return dynamic_slab_ == DynamicSlab::kGrow
                ? -1.0
@@ -145,6 +185,8 @@ class TestStaticForwarder {
     return transfer_cache_.num_objects_to_move(size_class);
   }
 
+  size_t prefetch_lines(int size_class) const { return prefetch_lines_; }
+
   const NumaTopology<kNumaPartitions, kNumBaseClasses>& numa_topology() const {
     return numa_topology_;
   }
@@ -179,8 +221,12 @@ class TestStaticForwarder {
   int64_t arena_reported_impending_bytes_ = 0;
   size_t shrink_to_usage_limit_calls_ = 0;
   bool dynamic_slab_enabled_ = false;
+  bool hugepage_backed_slabs_ = false;
   DynamicSlab dynamic_slab_ = DynamicSlab::kNoop;
   bool resize_size_classes_enabled_ = false;
+  bool predictive_capacity_enabled_ = false;
+  cpu_set_t allowed_cpus_ = cpu_cache_internal::FillActiveCpuMask();
+  size_t prefetch_lines_ = 0;
 
  private:
   NumaTopology<kNumaPartitions, kNumBaseClasses> numa_topology_;
@@ -311,6 +357,41 @@ TEST(CpuCacheTest, ResizeInfoNoFalseSharing) {
   EXPECT_EQ(resize_info_size % ABSL_CACHELINE_SIZE, 0) << resize_info_size;
 }
 
+TEST(CpuCacheTest, PrefetchClasses) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+
+  // Allocate() reads the start of the cache on every call.
+  EXPECT_LE(CpuCachePeer::PrefetchClassesEnd(cache), ABSL_CACHELINE_SIZE);
+
+  const size_t kSizeClass = 2;
+  EXPECT_FALSE(CpuCachePeer::MayPrefetch(cache, kSizeClass));
+
+  // Changes to prefetch_lines() take effect at UpdatePrefetch().
+  cache.forwarder().prefetch_lines_ = 2;
+  EXPECT_FALSE(CpuCachePeer::MayPrefetch(cache, kSizeClass));
+  cache.UpdatePrefetch(kSizeClass);
+  cache.UpdatePrefetch(kNumClasses - 1);
+  EXPECT_TRUE(CpuCachePeer::MayPrefetch(cache, kSizeClass));
+  EXPECT_TRUE(CpuCachePeer::MayPrefetch(cache, kNumClasses - 1));
+  EXPECT_FALSE(CpuCachePeer::MayPrefetch(cache, 1));
+
+  void* ptr = cache.Allocate<NothrowPolicy>(kSizeClass);
+  EXPECT_NE(ptr, nullptr);
+  cache.Deallocate(ptr, kSizeClass);
+
+  cache.forwarder().prefetch_lines_ = 0;
+  cache.UpdatePrefetch(kSizeClass);
+  EXPECT_FALSE(CpuCachePeer::MayPrefetch(cache, kSizeClass));
+  EXPECT_TRUE(CpuCachePeer::MayPrefetch(cache, kNumClasses - 1));
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, Metadata) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -338,6 +419,10 @@ TEST(CpuCacheTest, Metadata) {
   };
 
   EXPECT_EQ(0, count_cores());
+  auto populated = cache.GetPopulatedCpuStats();
+  EXPECT_EQ(populated.populated_caches, 0);
+  EXPECT_EQ(populated.unpopulated_slab_bytes,
+            num_cpus * populated.slab_bytes_per_cache);
 
   int allowed_cpu_id;
   const size_t kSizeClass = 2;
@@ -368,6 +453,12 @@ TEST(CpuCacheTest, Metadata) {
   }
   EXPECT_NE(ptr, nullptr);
   EXPECT_EQ(1, count_cores());
+  // The unpopulated caches' slab is untouched address space, whatever the
+  // populated one has faulted in.
+  populated = cache.GetPopulatedCpuStats();
+  EXPECT_EQ(populated.populated_caches, 1);
+  EXPECT_EQ(populated.unpopulated_slab_bytes,
+            (num_cpus - 1) * populated.slab_bytes_per_cache);
 
   r = cache.MetadataMemoryUsage();
   EXPECT_EQ(r.virtual_size,
@@ -735,6 +826,38 @@ TEST(CpuCacheTest, DynamicSlab) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, HugePageBackedSlabs) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+  CpuCache cache;
+  TestStaticForwarder& forwarder = cache.forwarder();
+  forwarder.dynamic_slab_enabled_ = true;
+  forwarder.hugepage_backed_slabs_ = true;
+
+  cache.Activate();
+
+  const auto check_placement = [&]() {
+    const CpuCache::SlabPlacementStats stats = cache.GetSlabPlacementStats();
+    EXPECT_TRUE(stats.hugepage_backed);
+    EXPECT_TRUE(stats.hugepage_aligned);
+    EXPECT_EQ(stats.virtual_size, cache.MetadataMemoryUsage().virtual_size);
+    EXPECT_EQ(stats.hugepages_spanned,
+              (stats.virtual_size + kHugePageSize - 1) / kHugePageSize);
+    EXPECT_GE(stats.small_pages_spanned, stats.hugepages_spanned);
+  };
+  check_placement();
+
+  // Slabs allocated on resize are hugepage aligned as well.
+  forwarder.dynamic_slab_ = DynamicSlab::kGrow;
+  CpuCachePeer::IncrementCacheMisses(cache);
+  cache.ResizeSlabIfNeeded();
+  EXPECT_EQ(forwarder.arena_reported_impending_bytes_, 0);
+  check_placement();
+
+  cache.Deactivate();
+}
+
 void AllocateThenDeallocate(CpuCache& cache, int cpu, size_t size_class,
                             int ops) {
   std::vector<void*> objects;
@@ -1015,6 +1138,182 @@ TEST(CpuCacheTest, ColdHotCacheShuffleTest) {
   cache.Deactivate();
 }
 
+// One CPU's share of a simulated workload: in each interval, <cpu> allocates
+// and then frees <objects> objects of <size_class>.
+struct SimulatedLoad {
+  int cpu;
+  size_t size_class;
+  int objects;
+};
+
+struct CapacityPolicyResult {
+  // Underflows and overflows during the measured intervals.
+  uint64_t misses = 0;
+  // Capacity of the simulated CPUs that is unallocated, or allocated to size
+  // classes that the measured intervals do not use.
+  uint64_t stranded_bytes = 0;
+};
+
+// Simulates a workload against a fresh cache: <warmup> for kWarmupIntervals
+// intervals, and then <measured> for kMeasuredIntervals intervals, resizing
+// size classes and shuffling the caches between intervals as the background
+// thread does.  This lets us compare how the capacity policies place a fixed
+// budget.
+class CapacityPolicySimulation {
+ public:
+  static constexpr int kWarmupIntervals = 20;
+  static constexpr int kMeasuredIntervals = 30;
+  // Small enough that the warmup fills the caches.
+  static constexpr size_t kCacheLimit = 256 << 10;
+
+  static CapacityPolicyResult Run(bool predictive,
+                                  absl::Span<const SimulatedLoad> warmup,
+                                  absl::Span<const SimulatedLoad> measured) {
+    CpuCache cache;
+    TestStaticForwarder& forwarder = cache.forwarder();
+    forwarder.resize_size_classes_enabled_ = true;
+    forwarder.predictive_capacity_enabled_ = predictive;
+    cache.SetCacheLimit(kCacheLimit);
+    cache.Activate();
+
+    for (int i = 0; i < kWarmupIntervals; ++i) {
+      RunInterval(cache, warmup);
+    }
+    const uint64_t misses_before = TotalMisses(cache);
+    for (int i = 0; i < kMeasuredIntervals; ++i) {
+      RunInterval(cache, measured);
+    }
+
+    CapacityPolicyResult result;
+    result.misses = TotalMisses(cache) - misses_before;
+    for (int cpu = 0; cpu < NumCPUs(); ++cpu) {
+      if (!cache.HasPopulated(cpu)) continue;
+      result.stranded_bytes += cache.Unallocated(cpu);
+      for (size_t size_class = 1; size_class < kNumClasses; ++size_class) {
+        if (Uses(measured, cpu, size_class)) continue;
+        result.stranded_bytes +=
+            CpuCachePeer::SizeClassCapacity(cache, cpu, size_class) *
+            cache.forwarder().class_to_size(size_class);
+      }
+    }
+
+    cache.Deactivate();
+    return result;
+  }
+
+ private:
+  static void RunInterval(CpuCache& cache,
+                          absl::Span<const SimulatedLoad> loads) {
+    for (const SimulatedLoad& load : loads) {
+      ScopedFakeCpuId fake_cpu_id(load.cpu);
+      AllocateThenDeallocate(cache, load.cpu, load.size_class, load.objects);
+    }
+    cache.ResizeSizeClasses();
+    cache.ShuffleCpuCaches();
+
+    // Whichever the policy, capacity only moves, within the budget.
+    uint64_t total_capacity = 0;
+    for (int cpu = 0; cpu < NumCPUs(); ++cpu) {
+      EXPECT_EQ(cache.Allocated(cpu) + cache.Unallocated(cpu),
+                cache.Capacity(cpu));
+      total_capacity += cache.Capacity(cpu);
+    }
+    EXPECT_EQ(total_capacity, NumCPUs() * cache.CacheLimit());
+  }
+
+  static uint64_t TotalMisses(const CpuCache& cache) {
+    const CpuCache::CpuCacheMissStats stats = cache.GetTotalCacheMissStats();
+    return uint64_t{stats.underflows} + uint64_t{stats.overflows};
+  }
+
+  static bool Uses(absl::Span<const SimulatedLoad> loads, int cpu,
+                   size_t size_class) {
+    return absl::c_any_of(loads, [&](const SimulatedLoad& load) {
+      return load.cpu == cpu && load.size_class == size_class;
+    });
+  }
+};
+
+// A CPU whose cache is full of large objects starts using small objects as
+// well, needing more capacity than the budget allows.  The heuristic policy
+// waits for the clock to pass over the full large size class before it shrinks
+// it, while the predictive one takes capacity from it at once because it is
+// not forecast to miss, and so misses less.
+TEST(CpuCacheTest, CapacityPolicySimulation) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  constexpr int kHotCpu = 0;
+  constexpr size_t kSmallClass = 1;
+  constexpr size_t kLargeClass = 2;
+  const SimulatedLoad warmup[] = {
+      {.cpu = kHotCpu, .size_class = kLargeClass, .objects = 128},
+  };
+  const SimulatedLoad measured[] = {
+      {.cpu = kHotCpu, .size_class = kSmallClass, .objects = 4096},
+      {.cpu = kHotCpu, .size_class = kLargeClass, .objects = 16},
+  };
+
+  const CapacityPolicyResult heuristic =
+      CapacityPolicySimulation::Run(/*predictive=*/false, warmup, measured);
+  const CapacityPolicyResult predictive =
+      CapacityPolicySimulation::Run(/*predictive=*/true, warmup, measured);
+  ::testing::Test::RecordProperty("heuristic_misses", heuristic.misses);
+  ::testing::Test::RecordProperty("heuristic_stranded_bytes",
+                                  heuristic.stranded_bytes);
+  ::testing::Test::RecordProperty("predictive_misses", predictive.misses);
+  ::testing::Test::RecordProperty("predictive_stranded_bytes",
+                                  predictive.stranded_bytes);
+
+  EXPECT_LT(predictive.misses, heuristic.misses);
+  EXPECT_LE(predictive.stranded_bytes, heuristic.stranded_bytes);
+}
+
+// Like ColdHotCacheShuffleTest, with the caches ranked by their forecast
+// misses.
+TEST(CpuCacheTest, PredictiveShuffleTest) {
+  if (!subtle::percpu::IsFast() || NumCPUs() < 2) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.forwarder().predictive_capacity_enabled_ = true;
+  cache.Activate();
+
+  constexpr int hot_cpu_id = 0;
+  constexpr int cold_cpu_id = 1;
+  constexpr int kMaxStealTries = 1000;
+  const size_t size_class = 2;
+  const size_t max_cpu_cache_size = Parameters::max_per_cpu_cache_size();
+
+  for (int num_tries = 0;
+       num_tries < kMaxStealTries &&
+       cache.Capacity(cold_cpu_id) >
+           CpuCache::kCacheCapacityThreshold * max_cpu_cache_size;
+       ++num_tries) {
+    ColdCacheOperations(cache, cold_cpu_id, size_class);
+    HotCacheOperations(cache, hot_cpu_id);
+    cache.ShuffleCpuCaches();
+
+    EXPECT_EQ(cache.Allocated(cold_cpu_id) + cache.Unallocated(cold_cpu_id),
+              cache.Capacity(cold_cpu_id));
+    EXPECT_EQ(cache.Allocated(hot_cpu_id) + cache.Unallocated(hot_cpu_id),
+              cache.Capacity(hot_cpu_id));
+  }
+
+  EXPECT_GT(cache.PredictedMisses(hot_cpu_id),
+            cache.PredictedMisses(cold_cpu_id));
+  EXPECT_GT(cache.Capacity(cold_cpu_id),
+            CpuCache::kCacheCapacityThreshold * max_cpu_cache_size -
+                cache.forwarder().class_to_size(size_class));
+  EXPECT_GT(cache.Capacity(hot_cpu_id), max_cpu_cache_size);
+  EXPECT_EQ(cache.Capacity(cold_cpu_id) + cache.Capacity(hot_cpu_id),
+            2 * max_cpu_cache_size);
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, ReclaimCpuCache) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -1133,6 +1432,78 @@ TEST(CpuCacheTest, ReclaimCpuCache) {
   cache.Deactivate();
 }
 
+TEST(CpuCacheTest, DrainDisallowedCpus) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  constexpr int kCpu = 0;
+  const int num_cpus = NumCPUs();
+  CpuCache cache;
+  cpu_set_t& allowed_cpus = cache.forwarder().allowed_cpus_;
+  CPU_ZERO(&allowed_cpus);
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    CPU_SET(cpu, &allowed_cpus);
+  }
+  const cpu_set_t all_cpus = allowed_cpus;
+  cache.Activate();
+
+  // Leaves enough objects in kCpu's cache to span several pages of its slab.
+  auto fill_cache = [&cache]() {
+    constexpr size_t kPtrs = 1024;
+    std::vector<void*> ptrs(kPtrs);
+    ScopedFakeCpuId fake_cpu_id(kCpu);
+    for (size_t size_class = 1; size_class <= 2; ++size_class) {
+      for (auto& ptr : ptrs) {
+        ptr = cache.Allocate<NothrowPolicy>(size_class);
+      }
+      for (void* ptr : ptrs) {
+        cache.Deallocate(ptr, size_class);
+      }
+    }
+  };
+
+  fill_cache();
+  const uint64_t used_bytes = cache.UsedBytes(kCpu);
+  ASSERT_GT(used_bytes, 0);
+  EXPECT_EQ(cache.DrainDisallowedCpus(), 0);
+
+  // Take kCpu away.  The set must not become empty, as that stands for an
+  // unknown set, so allow a CPU the cache does not have instead.
+  CPU_CLR(kCpu, &allowed_cpus);
+  CPU_SET(num_cpus, &allowed_cpus);
+  EXPECT_EQ(cache.DrainDisallowedCpus(), used_bytes);
+  EXPECT_EQ(cache.UsedBytes(kCpu), 0);
+  EXPECT_EQ(cache.GetNumReclaims(kCpu), 1);
+  EXPECT_EQ(cache.Allocated(kCpu) + cache.Unallocated(kCpu),
+            cache.Capacity(kCpu));
+
+  CpuCache::DisallowedCpuStats stats = cache.GetDisallowedCpuStats();
+  EXPECT_EQ(stats.events, 1);
+  EXPECT_EQ(stats.drained_cpus, 1);
+  EXPECT_EQ(stats.drained_bytes, used_bytes);
+  EXPECT_GT(stats.released_slab_bytes, 0);
+  EXPECT_EQ(stats.last_event_drained_cpus, 1);
+  EXPECT_EQ(stats.last_event_drained_bytes, used_bytes);
+  EXPECT_EQ(stats.last_event_released_slab_bytes, stats.released_slab_bytes);
+
+  // Nothing changed since, so nothing is drained.
+  EXPECT_EQ(cache.DrainDisallowedCpus(), 0);
+  EXPECT_EQ(cache.GetDisallowedCpuStats().events, 1);
+
+  // The released slab still works for threads left on kCpu.
+  fill_cache();
+  EXPECT_GT(cache.UsedBytes(kCpu), 0);
+
+  // Gaining a CPU drains nothing.
+  allowed_cpus = all_cpus;
+  EXPECT_EQ(cache.DrainDisallowedCpus(), 0);
+  EXPECT_GT(cache.UsedBytes(kCpu), 0);
+  EXPECT_EQ(cache.GetDisallowedCpuStats().events, 1);
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, SizeClassCapacityTest) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -1344,6 +1715,31 @@ class CpuCacheEnvironment {
   std::atomic<bool> ready_{false};
 };
 
+TEST(CpuCacheTest, BatchRoundTrip) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  CpuCache cache;
+  cache.Activate();
+
+  // More objects than the slab holds for one size class (at most 2048), so
+  // that each batch only partially fits and the rest goes to or comes from the
+  // backing cache.
+  const size_t kSizeClass = 2;
+  const size_t kCount = 4096;
+  std::vector<void*> batch(kCount);
+  for (int round = 0; round < 3; ++round) {
+    ASSERT_EQ(cache.AllocateBatch(kSizeClass, batch.data(), kCount), kCount);
+    std::vector<void*> sorted = batch;
+    absl::c_sort(sorted);
+    EXPECT_EQ(absl::c_adjacent_find(sorted), sorted.end());
+    cache.DeallocateBatch(kSizeClass, batch.data(), kCount);
+  }
+
+  cache.Deactivate();
+}
+
 TEST(CpuCacheTest, Fuzz) {
   if (!subtle::percpu::IsFast()) {
     return;
@@ -25,6 +25,10 @@ enum class Experiment : int {
   TEST_ONLY_TCMALLOC_SHARDED_TRANSFER_CACHE,
   TEST_ONLY_TCMALLOC_FILLER_CHUNKS_PER_ALLOC,
   TCMALLOC_SHORT_LONG_TERM_SUBRELEASE,
+  TCMALLOC_ALLOC_PREFETCH,
+  TCMALLOC_SHARDED_CENTRAL_FREELIST,
+  TCMALLOC_NUMA_SHARDED_TRANSFER_CACHE,
+  TCMALLOC_HUGEPAGE_CPU_SLABS,
   kMaxExperimentID,
 };
 
@@ -39,6 +43,10 @@ inline constexpr ExperimentConfig experiments[] = {
     {Experiment::TEST_ONLY_TCMALLOC_SHARDED_TRANSFER_CACHE, "TEST_ONLY_TCMALLOC_SHARDED_TRANSFER_CACHE"},
     {Experiment::TEST_ONLY_TCMALLOC_FILLER_CHUNKS_PER_ALLOC, "TEST_ONLY_TCMALLOC_FILLER_CHUNKS_PER_ALLOC"},
     {Experiment::TCMALLOC_SHORT_LONG_TERM_SUBRELEASE, "TCMALLOC_SHORT_LONG_TERM_SUBRELEASE"},
+    {Experiment::TCMALLOC_ALLOC_PREFETCH, "TCMALLOC_ALLOC_PREFETCH"},
+    {Experiment::TCMALLOC_SHARDED_CENTRAL_FREELIST, "TCMALLOC_SHARDED_CENTRAL_FREELIST"},
+    {Experiment::TCMALLOC_NUMA_SHARDED_TRANSFER_CACHE, "TCMALLOC_NUMA_SHARDED_TRANSFER_CACHE"},
+    {Experiment::TCMALLOC_HUGEPAGE_CPU_SLABS, "TCMALLOC_HUGEPAGE_CPU_SLABS"},
 };
 // clang-format on
 
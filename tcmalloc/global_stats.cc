@@ -14,8 +14,11 @@
 
 #include "tcmalloc/global_stats.h"
 
+#include "absl/base/internal/spinlock.h"
 #include "absl/strings/match.h"
 #include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
@@ -24,6 +27,7 @@
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/memory_stats.h"
 #include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/internal/seqlock.h"
 #include "tcmalloc/page_allocator.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/page_heap_allocator.h"
@@ -43,6 +47,38 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+// The values GetNumericProperty() can answer from a snapshot, as of
+// timestamp_ns.  A timestamp of zero means there is no snapshot yet.
+struct StatsSnapshot {
+  int64_t timestamp_ns;
+  uint64_t virtual_memory_used;
+  uint64_t physical_memory_used;
+  uint64_t in_use_by_app;
+  uint64_t peak_memory_usage;
+  BackingStats pageheap;
+  uint64_t arena_bytes_nonresident;
+};
+
+ABSL_CONST_INIT static SeqlockValue<StatsSnapshot> stats_snapshot;
+// Serializes writers of stats_snapshot.  Readers never take it.
+ABSL_CONST_INIT static absl::base_internal::SpinLock stats_snapshot_lock(
+    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+
+static void PublishStatsSnapshot(const TCMallocStats& stats) {
+  // Another thread is publishing stats taken at about the same time.
+  if (!stats_snapshot_lock.TryLock()) return;
+  StatsSnapshot s;
+  s.virtual_memory_used = VirtualMemoryUsed(stats);
+  s.physical_memory_used = PhysicalMemoryUsed(stats);
+  s.in_use_by_app = InUseByApp(stats);
+  s.peak_memory_usage = stats.peak_stats.sampled_application_bytes;
+  s.pageheap = stats.pageheap;
+  s.arena_bytes_nonresident = stats.arena.bytes_nonresident;
+  s.timestamp_ns = absl::GetCurrentTimeNanos();
+  stats_snapshot.Store(s);
+  stats_snapshot_lock.Unlock();
+}
+
 // Get stats into "r".  Also, if class_count != NULL, class_count[k]
 // will be set to the total number of objects of size class k in the
 // central cache, transfer cache, and per-thread and per-CPU caches.
@@ -80,15 +116,18 @@ void ExtractStats(TCMallocStats* r, uint64_t* class_count,
     }
   }
 
+  r->sampled_span_pool_bytes = tc_globals.sampled_span_pool().bytes();
+
   // Add stats from per-thread heaps
   r->thread_bytes = 0;
+  // The metadata allocators have their own locks.
+  r->span_stats = tc_globals.span_allocator().stats();
+  r->stack_stats = tc_globals.sampledallocation_allocator().stats();
+  r->linked_sample_stats = tc_globals.linked_sample_allocator().stats();
   {  // scope
     absl::base_internal::SpinLockHolder h(&pageheap_lock);
     ThreadCache::GetThreadStats(&r->thread_bytes, class_count);
     r->tc_stats = ThreadCache::HeapStats();
-    r->span_stats = tc_globals.span_allocator().stats();
-    r->stack_stats = tc_globals.sampledallocation_allocator().stats();
-    r->linked_sample_stats = tc_globals.linked_sample_allocator().stats();
     r->metadata_bytes = tc_globals.metadata_bytes();
     r->pagemap_bytes = tc_globals.pagemap().bytes();
     r->pageheap = tc_globals.page_allocator().stats();
@@ -136,6 +175,12 @@ void ExtractStats(TCMallocStats* r, uint64_t* class_count,
                           r->percpu_metadata_bytes_res;
     }
   }
+
+  // The snapshot's properties are all defined without residence information.
+  if (!report_residence &&
+      Parameters::stats_snapshot_staleness() > absl::ZeroDuration()) {
+    PublishStatsSnapshot(*r);
+  }
 }
 
 void ExtractTCMallocStats(TCMallocStats* r, bool report_residence) {
@@ -154,7 +199,8 @@ uint64_t InUseByApp(const TCMallocStats& stats) {
   return StatSub(stats.pageheap.system_bytes,
                  stats.thread_bytes + stats.central_bytes +
                      stats.transfer_bytes + stats.per_cpu_bytes +
-                     stats.sharded_transfer_bytes + stats.pageheap.free_bytes +
+                     stats.sharded_transfer_bytes +
+                     stats.sampled_span_pool_bytes + stats.pageheap.free_bytes +
                      stats.pageheap.unmapped_bytes);
 }
 
@@ -181,8 +227,9 @@ uint64_t RequiredBytes(const TCMallocStats& stats) {
 size_t ExternalBytes(const TCMallocStats& stats) {
   return stats.pageheap.free_bytes + stats.central_bytes + stats.per_cpu_bytes +
          stats.sharded_transfer_bytes + stats.transfer_bytes +
-         stats.thread_bytes + stats.metadata_bytes +
-         stats.arena.bytes_unavailable + stats.arena.bytes_unallocated;
+         stats.thread_bytes + stats.sampled_span_pool_bytes +
+         stats.metadata_bytes + stats.arena.bytes_unavailable +
+         stats.arena.bytes_unallocated;
 }
 
 size_t HeapSizeBytes(const BackingStats& stats) {
@@ -198,6 +245,48 @@ size_t SlackBytes(const BackingStats& stats) {
   return stats.free_bytes + stats.unmapped_bytes;
 }
 
+void RefreshStatsSnapshot() {
+  TCMallocStats stats;
+  ExtractTCMallocStats(&stats, false);
+}
+
+// Answers the properties the stats snapshot covers without taking any lock, if
+// the snapshot is recent enough.  Returns false if the caller must compute the
+// property itself.
+static bool GetSnapshotProperty(absl::string_view name, size_t* value) {
+  const absl::Duration staleness = Parameters::stats_snapshot_staleness();
+  if (staleness <= absl::ZeroDuration()) return false;
+  const StatsSnapshot s = stats_snapshot.Load();
+  if (s.timestamp_ns == 0 || absl::GetCurrentTimeNanos() - s.timestamp_ns >
+                                 absl::ToInt64Nanoseconds(staleness)) {
+    return false;
+  }
+
+  if (name == "generic.virtual_memory_used") {
+    *value = s.virtual_memory_used;
+  } else if (name == "generic.physical_memory_used") {
+    *value = s.physical_memory_used;
+  } else if (name == "generic.current_allocated_bytes" ||
+             name == "generic.bytes_in_use_by_app") {
+    *value = s.in_use_by_app;
+  } else if (name == "generic.peak_memory_usage") {
+    *value = s.peak_memory_usage;
+  } else if (name == "generic.heap_size") {
+    *value = HeapSizeBytes(s.pageheap);
+  } else if (name == "tcmalloc.slack_bytes") {
+    *value = SlackBytes(s.pageheap);
+  } else if (name == "tcmalloc.pageheap_free_bytes" ||
+             name == "tcmalloc.page_heap_free") {
+    *value = s.pageheap.free_bytes;
+  } else if (name == "tcmalloc.pageheap_unmapped_bytes" ||
+             name == "tcmalloc.page_heap_unmapped") {
+    *value = s.pageheap.unmapped_bytes + s.arena_bytes_nonresident;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 static int CountAllowedCpus() {
   cpu_set_t allowed_cpus;
   if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
@@ -242,6 +331,7 @@ void DumpStats(Printer* out, int level) {
       "MALLOC: + %12u (%7.1f MiB) Bytes in Sharded cache freelist\n"
       "MALLOC: + %12u (%7.1f MiB) Bytes in transfer cache freelist\n"
       "MALLOC: + %12u (%7.1f MiB) Bytes in thread cache freelists\n"
+      "MALLOC: + %12u (%7.1f MiB) Bytes in sampled span pool\n"
       "MALLOC: + %12u (%7.1f MiB) Bytes in malloc metadata\n"
       "MALLOC: + %12u (%7.1f MiB) Bytes in malloc metadata Arena unallocated\n"
       "MALLOC: + %12u (%7.1f MiB) Bytes in malloc metadata Arena unavailable\n"
@@ -279,6 +369,7 @@ void DumpStats(Printer* out, int level) {
       stats.sharded_transfer_bytes, stats.sharded_transfer_bytes / MiB,
       stats.transfer_bytes, stats.transfer_bytes / MiB,
       stats.thread_bytes, stats.thread_bytes / MiB,
+      stats.sampled_span_pool_bytes, stats.sampled_span_pool_bytes / MiB,
       stats.metadata_bytes, stats.metadata_bytes / MiB,
       stats.arena.bytes_unallocated, stats.arena.bytes_unallocated / MiB,
       stats.arena.bytes_unavailable, stats.arena.bytes_unavailable / MiB,
@@ -402,6 +493,7 @@ void DumpStats(Printer* out, int level) {
     tc_globals.page_allocator().Print(out, MemoryTag::kSampled);
     tc_globals.page_allocator().Print(out, MemoryTag::kCold);
     tc_globals.guardedpage_allocator().Print(out);
+    tc_globals.background_scheduler().Print(out);
 
     uint64_t soft_limit_bytes =
         tc_globals.page_allocator().limit(PageAllocator::kSoft);
@@ -448,8 +540,22 @@ void DumpStats(Printer* out, int level) {
         Parameters::separate_allocs_for_few_and_many_objects_spans());
     out->printf("PARAMETER tcmalloc_resize_cpu_cache_size_classes %d\n",
                 Parameters::resize_cpu_cache_size_classes() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_predictive_cpu_cache_capacity %d\n",
+                Parameters::predictive_cpu_cache_capacity() ? 1 : 0);
     out->printf("PARAMETER tcmalloc_filler_chunks_per_alloc %d\n",
                 Parameters::chunks_per_alloc());
+    out->printf(
+        "PARAMETER tcmalloc_sharded_transfer_cache_remote_steal_threshold "
+        "%d\n",
+        Parameters::sharded_transfer_cache_remote_steal_threshold());
+    out->printf("PARAMETER tcmalloc_stats_snapshot_staleness %s\n",
+                absl::FormatDuration(Parameters::stats_snapshot_staleness()));
+    out->printf("PARAMETER tcmalloc_fast_unwind_sampled_stacks %d\n",
+                Parameters::fast_unwind_sampled_stacks() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_realloc_remap %d\n",
+                Parameters::realloc_remap() ? 1 : 0);
+    out->printf("PARAMETER tcmalloc_huge_dedicated_threshold %zu\n",
+                Parameters::huge_dedicated_threshold());
   }
 }
 
@@ -477,6 +583,7 @@ void DumpStatsInPbtxt(Printer* out, int level) {
                   stats.sharded_transfer_bytes);
   region.PrintI64("transfer_cache_freelist", stats.transfer_bytes);
   region.PrintI64("thread_cache_freelists", stats.thread_bytes);
+  region.PrintI64("sampled_span_pool", stats.sampled_span_pool_bytes);
   region.PrintI64("malloc_metadata", stats.metadata_bytes);
   region.PrintI64("malloc_metadata_arena_unavailable",
                   stats.arena.bytes_unavailable);
@@ -592,6 +699,7 @@ void DumpStatsInPbtxt(Printer* out, int level) {
     auto gwp_asan = region.CreateSubRegion("gwp_asan");
     tc_globals.guardedpage_allocator().PrintInPbtxt(&gwp_asan);
   }
+  tc_globals.background_scheduler().PrintInPbtxt(&region);
 
   region.PrintI64("memory_release_failures", SystemReleaseErrors());
 
@@ -622,8 +730,20 @@ void DumpStatsInPbtxt(Printer* out, int level) {
                   Parameters::separate_allocs_for_few_and_many_objects_spans());
   region.PrintBool("tcmalloc_resize_cpu_cache_size_classes",
                    Parameters::resize_cpu_cache_size_classes());
+  region.PrintBool("tcmalloc_predictive_cpu_cache_capacity",
+                   Parameters::predictive_cpu_cache_capacity());
   region.PrintI64("tcmalloc_filler_chunks_per_alloc",
                   Parameters::chunks_per_alloc());
+  region.PrintI64("tcmalloc_sharded_transfer_cache_remote_steal_threshold",
+                  Parameters::sharded_transfer_cache_remote_steal_threshold());
+  region.PrintI64(
+      "tcmalloc_stats_snapshot_staleness_ns",
+      absl::ToInt64Nanoseconds(Parameters::stats_snapshot_staleness()));
+  region.PrintBool("tcmalloc_fast_unwind_sampled_stacks",
+                   Parameters::fast_unwind_sampled_stacks());
+  region.PrintBool("tcmalloc_realloc_remap", Parameters::realloc_remap());
+  region.PrintI64("tcmalloc_huge_dedicated_threshold",
+                  Parameters::huge_dedicated_threshold());
 }
 
 bool GetNumericProperty(const char* name_data, size_t name_size,
@@ -639,6 +759,18 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (name == "tcmalloc.per_cpu_caches_populated") {
+    *value = 0;
+    if (tc_globals.CpuCacheActive()) {
+      *value = tc_globals.cpu_cache().GetPopulatedCpuStats().populated_caches;
+    }
+    return true;
+  }
+
+  if (GetSnapshotProperty(name, value)) {
+    return true;
+  }
+
   if (name == "generic.virtual_memory_used") {
     TCMallocStats stats;
     ExtractTCMallocStats(&stats, false);
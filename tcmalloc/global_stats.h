@@ -35,6 +35,7 @@ struct TCMallocStats {
   uint64_t metadata_bytes;             // Bytes alloced for metadata
   uint64_t sharded_transfer_bytes;     // Bytes in per-CCX cache
   uint64_t per_cpu_bytes;              // Bytes in per-CPU cache
+  uint64_t sampled_span_pool_bytes;    // Bytes in freed sampled spans
   uint64_t pagemap_root_bytes_res;     // Resident bytes of pagemap root node
   uint64_t percpu_metadata_bytes_res;  // Resident bytes of the per-CPU metadata
   AllocatorStats tc_stats;             // ThreadCache objects
@@ -70,6 +71,10 @@ void DumpStatsInPbtxt(Printer* out, int level);
 
 bool GetNumericProperty(const char* name_data, size_t name_size, size_t* value);
 
+// Takes a fresh snapshot of the properties GetNumericProperty() can answer
+// without locking, if Parameters::stats_snapshot_staleness() enables it.
+void RefreshStatsSnapshot();
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
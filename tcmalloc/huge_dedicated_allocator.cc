@@ -0,0 +1,178 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/huge_dedicated_allocator.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/stats.h"
+#include "tcmalloc/system-alloc.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+Span* HugeDedicatedAllocator::New(Length n, MemoryTag tag) {
+  const HugeLength hl = HLFromPages(n);
+  // Mapping and collapsing can take a while for the sizes we see here, so do
+  // both before taking pageheap_lock.
+  void* ptr = SystemAllocHugepages(hl.in_bytes(), tag);
+  const bool collapsed =
+      ptr != nullptr && SystemCollapse(ptr, hl.in_bytes());
+
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (ptr != nullptr &&
+        tc_globals.pagemap().Ensure(PageIdContaining(ptr), hl.in_pages())) {
+      return Track(ptr, n, collapsed);
+    }
+    ++fallbacks_;
+  }
+  if (ptr != nullptr) {
+    SystemFreeHugepages(ptr, hl.in_bytes());
+  }
+  return nullptr;
+}
+
+Span* HugeDedicatedAllocator::Track(void* ptr, Length n, bool collapsed) {
+  const HugeLength hl = HLFromPages(n);
+  const PageId p = PageIdContaining(ptr);
+  if (collapsed) {
+    ++collapses_;
+  } else {
+    ++collapse_failures_;
+  }
+
+  Span* span = Span::New(p, n);
+  tc_globals.pagemap().Set(p, span);
+  tc_globals.pagemap().SetHugepage(p, this);
+
+  ++live_spans_;
+  ++allocs_;
+  mapped_ += hl;
+  if (mapped_ > peak_mapped_) peak_mapped_ = mapped_;
+  slack_ += hl.in_pages() - n;
+  tc_globals.page_allocator().ShrinkToUsageLimit(n);
+  return span;
+}
+
+bool HugeDedicatedAllocator::Owns(const Span* span) const {
+  return tc_globals.pagemap().GetHugepage(span->first_page()) == this;
+}
+
+void HugeDedicatedAllocator::Delete(Span* span) {
+  ASSERT(Contains(span));
+  const PageId p = span->first_page();
+  const HugeLength hl = HLFromPages(span->num_pages());
+  ASSERT(live_spans_ > 0);
+  --live_spans_;
+  ++frees_;
+  mapped_ -= hl;
+  slack_ -= hl.in_pages() - span->num_pages();
+
+  // The range can be mapped again as soon as it is unmapped, possibly by
+  // HugePageAwareAllocator, which reads the hugepage entry for its own use.
+  tc_globals.pagemap().SetHugepage(p, nullptr);
+  tc_globals.pagemap().Set(p, nullptr);
+  Span::Delete(span);
+
+  // Until it is unmapped, the range cannot be mapped again, so nothing else
+  // can come to use it.
+  const int i = num_pending_unmaps_.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(i == kMaxPendingUnmaps)) {
+    SystemFreeHugepages(p.start_addr(), hl.in_bytes());
+    return;
+  }
+  pending_unmaps_[i] = {p.start_addr(), hl.in_bytes()};
+  num_pending_unmaps_.store(i + 1, std::memory_order_relaxed);
+}
+
+void HugeDedicatedAllocator::UnmapDeletedSlow() {
+  Mapping unmaps[kMaxPendingUnmaps];
+  int n;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    n = num_pending_unmaps_.load(std::memory_order_relaxed);
+    std::copy_n(pending_unmaps_, n, unmaps);
+    num_pending_unmaps_.store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < n; ++i) {
+    SystemFreeHugepages(unmaps[i].start, unmaps[i].length);
+  }
+}
+
+bool HugeDedicatedAllocator::TryGrow(Span* span, Length n) {
+  ASSERT(Contains(span));
+  const Length old_n = span->num_pages();
+  ASSERT(n > old_n);
+  const HugeLength hl = HLFromPages(old_n);
+  if (n > hl.in_pages()) return false;
+  span->set_num_pages(n);
+  slack_ -= n - old_n;
+  return true;
+}
+
+BackingStats HugeDedicatedAllocator::stats() const {
+  BackingStats stats;
+  stats.system_bytes = mapped_.in_bytes();
+  stats.free_bytes = slack_.in_bytes();
+  stats.unmapped_bytes = 0;
+  return stats;
+}
+
+void HugeDedicatedAllocator::Print(Printer* out) {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  if (allocs_ == 0 && Parameters::huge_dedicated_threshold() == 0) return;
+
+  out->printf("------------------------------------------------\n");
+  out->printf(
+      "HugeDedicated: %lld live allocations (%lld allocated, %lld freed), "
+      "%lld fell back to the page heap\n",
+      live_spans_, allocs_, frees_, fallbacks_);
+  out->printf(
+      "HugeDedicated: %zu hugepages mapped (peak %zu), %zu pages of slack\n",
+      mapped_.raw_num(), peak_mapped_.raw_num(), slack_.raw_num());
+  out->printf("HugeDedicated: %lld mappings collapsed, %lld not collapsed\n",
+              collapses_, collapse_failures_);
+}
+
+void HugeDedicatedAllocator::PrintInPbtxt(PbtxtRegion* region) {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  region->PrintI64("live_allocations", live_spans_);
+  region->PrintI64("allocations", allocs_);
+  region->PrintI64("frees", frees_);
+  region->PrintI64("fallbacks", fallbacks_);
+  region->PrintI64("mapped_bytes", mapped_.in_bytes());
+  region->PrintI64("peak_mapped_bytes", peak_mapped_.in_bytes());
+  region->PrintI64("slack_bytes", slack_.in_bytes());
+  region->PrintI64("collapses", collapses_);
+  region->PrintI64("collapse_failures", collapse_failures_);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
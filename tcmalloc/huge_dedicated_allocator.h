@@ -0,0 +1,154 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_HUGE_DEDICATED_ALLOCATOR_H_
+#define TCMALLOC_HUGE_DEDICATED_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_pages.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/parameters.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/stats.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Gives each large allocation at or above
+// Parameters::huge_dedicated_threshold() a mapping of its own, a whole number
+// of hugepages long and hugepage-aligned.  The mapping is advised with
+// MADV_HUGEPAGE and collapsed with MADV_COLLAPSE where the kernel allows, is
+// never shared with (or donated to) the HugePageFiller, and goes back to the
+// OS with one munmap after Delete, once pageheap_lock is dropped.  This trades
+// the slack a HugeRegion or the filler would reuse for predictable backing,
+// which suits large buffers that are freed as a whole.
+//
+// A span from here is recognized by the pagemap's hugepage entry for its first
+// hugepage, which points at the allocator (HugePageAwareAllocator keeps its
+// trackers there for its own hugepages).
+class HugeDedicatedAllocator {
+ public:
+  constexpr HugeDedicatedAllocator() = default;
+
+  HugeDedicatedAllocator(const HugeDedicatedAllocator&) = delete;
+  HugeDedicatedAllocator& operator=(const HugeDedicatedAllocator&) = delete;
+
+  // Returns true if an allocation of n pages, aligned to align pages, should
+  // come from New().
+  static bool ShouldUse(Length n, Length align, MemoryTag tag) {
+    const size_t threshold = Parameters::huge_dedicated_threshold();
+    // Contains() relies on spans from here being at least a hugepage long.
+    if (ABSL_PREDICT_TRUE(threshold == 0) ||
+        n.in_bytes() < std::max(threshold, kHugePageSize)) {
+      return false;
+    }
+    // Sampled spans must stay with the sampled allocator, and cold ones are
+    // not worth hugepages.
+    return align <= kPagesPerHugePage &&
+           (tag == MemoryTag::kNormalP0 || tag == MemoryTag::kNormalP1);
+  }
+
+  // Returns a span of n pages at the start of a mapping of n pages rounded up
+  // to a whole number of hugepages, or nullptr if the mapping failed, in which
+  // case the caller should fall back to the regular page allocator.  The span
+  // is in the pagemap.
+  Span* New(Length n, MemoryTag tag) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns true if span was allocated by New().
+  bool Contains(const Span* span) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    // Spans from here are at least a hugepage long, which keeps this to one
+    // comparison for the small spans that are most of the deletes.
+    return live_spans_ != 0 && span->num_pages() >= kPagesPerHugePage &&
+           Owns(span);
+  }
+
+  // Deletes span, leaving its mapping for UnmapDeleted() to unmap.
+  // REQUIRES: Contains(span)
+  void Delete(Span* span) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Unmaps the mappings of the spans deleted so far.  Called after Delete(),
+  // once pageheap_lock is dropped, since munmap of a large mapping is slow.
+  void UnmapDeleted() ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    if (ABSL_PREDICT_TRUE(
+            num_pending_unmaps_.load(std::memory_order_relaxed) == 0)) {
+      return;
+    }
+    UnmapDeletedSlow();
+  }
+
+  // Grows span to n pages if they fit in its mapping.
+  // REQUIRES: Contains(span)
+  bool TryGrow(Span* span, Length n)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // The slack at the ends of mappings counts as free.  Nothing is unmapped,
+  // since memory goes back to the OS as soon as it is freed.
+  BackingStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  void Print(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  void PrintInPbtxt(PbtxtRegion* region) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+ private:
+  // Mappings of deleted spans, waiting for UnmapDeleted().  Delete() unmaps
+  // under the lock instead only if this is full.
+  static constexpr int kMaxPendingUnmaps = 16;
+
+  struct Mapping {
+    void* start;
+    size_t length;
+  };
+
+  // Returns a span of n pages for the pagemap-ensured mapping at ptr.
+  Span* Track(void* ptr, Length n, bool collapsed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  bool Owns(const Span* span) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  void UnmapDeletedSlow() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  Mapping pending_unmaps_[kMaxPendingUnmaps] ABSL_GUARDED_BY(pageheap_lock) =
+      {};
+  // Changed with pageheap_lock held, but read without it by UnmapDeleted().
+  std::atomic<int> num_pending_unmaps_{0};
+
+  int64_t live_spans_ = 0;
+  HugeLength mapped_;
+  HugeLength peak_mapped_;
+  // Pages mapped past the ends of spans, from rounding up to hugepages.
+  Length slack_;
+  int64_t allocs_ = 0;
+  int64_t frees_ = 0;
+  // Allocations that fell back to the regular page allocator because the
+  // mapping failed.
+  int64_t fallbacks_ = 0;
+  int64_t collapses_ = 0;
+  int64_t collapse_failures_ = 0;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_HUGE_DEDICATED_ALLOCATOR_H_
@@ -33,8 +33,10 @@
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/prefetch.h"
+#include "tcmalloc/page_allocator.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/release_queue.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/stats.h"
@@ -162,6 +164,22 @@ Span* StaticForwarder::NewSpan(PageId page, Length length) {
 
 void StaticForwarder::DeleteSpan(Span* span) { Span::Delete(span); }
 
+bool StaticForwarder::ReleasePages(void* ptr, size_t size) {
+  return DeferReleasePages(ptr, size) || SystemRelease(ptr, size);
+}
+
+bool StaticForwarder::DeferReleasePages(void* ptr, size_t size) {
+  return tc_globals.page_allocator().release_queue().Enqueue(ptr, size);
+}
+
+bool StaticForwarder::CollapseHugepage(HugePage p) {
+  // A release still queued from before the hugepage was filled again would
+  // break it up again right after the collapse.
+  tc_globals.page_allocator().release_queue().Fence(p.first_page(),
+                                                    kPagesPerHugePage);
+  return SystemCollapse(p.start_addr(), kHugePageSize);
+}
+
 }  // namespace huge_page_allocator_internal
 
 }  // namespace tcmalloc_internal
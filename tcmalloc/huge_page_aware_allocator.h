@@ -18,7 +18,11 @@
 #include <stddef.h>
 
 #include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/arena.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/huge_allocator.h"
@@ -94,9 +98,16 @@ class StaticForwarder {
     return SystemAlloc(bytes, align, tag);
   }
   // TODO(ckennelly): Accept PageId/Length.
-  static bool ReleasePages(void* ptr, size_t size) {
-    return SystemRelease(ptr, size);
-  }
+  //
+  // Queues the release on the PageAllocator's ReleaseQueue if it is deferring
+  // releases, and otherwise releases the pages right away.
+  static bool ReleasePages(void* ptr, size_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // As ReleasePages, but returns false instead of releasing the pages itself.
+  static bool DeferReleasePages(void* ptr, size_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  static bool CollapseHugepage(HugePage p)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
 };
 
 struct HugePageAwareAllocatorOptions {
@@ -144,6 +155,10 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   void Delete(Span* span, size_t objects_per_span)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
+  // Grow "span" in place to "n" pages if the pages after it are free in
+  // whichever of our allocators it came from.
+  bool TryGrow(Span* span, Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
+
   BackingStats stats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
@@ -165,6 +180,12 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
   Length ReleaseAtLeastNPagesBreakingHugepages(Length n)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Collapses up to kMaxCollapsesPerCall of the filler's subreleased
+  // hugepages that are backed and dense again back into hugepages.  Returns
+  // the number collapsed.
+  size_t CollapseHugepages() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  static constexpr size_t kMaxCollapsesPerCall = 16;
+
   // Prints stats about the page heap to *out.
   void Print(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock) override;
 
@@ -233,7 +254,8 @@ class HugePageAwareAllocator final : public PageAllocatorInterface {
     HugePageAwareAllocator& hpaa_;
   };
 
-  // Calls SystemRelease, but with dropping of pageheap_lock around the call.
+  // Defers the release to the ReleaseQueue if it can, and otherwise calls
+  // SystemRelease, but with dropping of pageheap_lock around the call.
   static ABSL_MUST_USE_RESULT bool UnbackWithoutLock(void* start, size_t length)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
@@ -612,7 +634,7 @@ inline bool HugePageAwareAllocator<Forwarder>::AddRegion() {
   HugeRange r = alloc_.Get(HugeRegion::size());
   if (!r.valid()) return false;
   HugeRegion* region = region_allocator_.New();
-  new (region) HugeRegion(r, MemoryModifyFunction(SystemRelease));
+  new (region) HugeRegion(r, MemoryModifyFunction(&forwarder_.ReleasePages));
   regions_.Contribute(region);
   return true;
 }
@@ -684,7 +706,7 @@ inline void HugePageAwareAllocator<Forwarder>::Delete(Span* span,
       --donated_huge_pages_;
       ASSERT(!pt->abandoned());
 
-      if (pt->released()) {
+      if (pt->released() || pt->collapsing()) {
         --hl;
         ReleaseHugepage(pt);
       } else {
@@ -698,10 +720,62 @@ inline void HugePageAwareAllocator<Forwarder>::Delete(Span* span,
   cache_.Release({hp, hl});
 }
 
+// public
+template <class Forwarder>
+inline bool HugePageAwareAllocator<Forwarder>::TryGrow(Span* span, Length n) {
+  ASSERT(GetMemoryTag(span->start_address()) == tag_);
+  const PageId p = span->first_page();
+  const Length old_n = span->num_pages();
+  ASSERT(n > old_n);
+  const Length extra = n - old_n;
+  const PageId end = p + old_n;
+  bool from_released = false;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    // As in Delete, the span is somewhere in the filler, a region, or a run
+    // of hugepages from the cache.
+    const HugePage hp = HugePageContaining(p);
+    FillerType::Tracker* pt = GetTracker(hp);
+    if (pt != nullptr) {
+      // a) Packed onto a single hugepage: it can grow up to the end of it.
+      if (!filler_.TryExtend(pt, end, extra, &from_released)) return false;
+      if (span->donated()) {
+        pt->set_abandoned_count(pt->abandoned_count() + extra);
+      }
+    } else if (regions_.MaybeExtend(end, extra, &from_released)) {
+      // b) In a region, possibly crossing hugepages.
+    } else {
+      // c) Straight from the HugeCache.  We can only grow into the donated
+      //    slack of our last hugepage, and not all of the way: Delete expects
+      //    a slack-free range to have no tracker.
+      if (!span->donated()) return false;
+      const HugeLength hl = HLFromPages(old_n);
+      if (n >= hl.in_pages()) return false;
+      pt = GetTracker(hp + hl - NHugePages(1));
+      CHECK_CONDITION(pt != nullptr);
+      ASSERT(pt->was_donated());
+      if (!filler_.TryExtend(pt, end, extra, &from_released)) return false;
+      pt->set_abandoned_count(pt->abandoned_count() + extra);
+    }
+
+    span->set_num_pages(n);
+    info_.RecordFree(p, old_n);
+    info_.RecordAlloc(p, n);
+    forwarder_.ShrinkToUsageLimit(extra);
+  }
+  if (from_released) SystemBack(end.start_addr(), extra.in_bytes());
+  return true;
+}
+
 template <class Forwarder>
 inline void HugePageAwareAllocator<Forwarder>::ReleaseHugepage(
     FillerType::Tracker* pt) {
   ASSERT(pt->used_pages() == Length(0));
+  if (ABSL_PREDICT_FALSE(pt->collapsing())) {
+    // CollapseHugepages() is backing the hugepage with the lock dropped, and
+    // releases it once it is done.
+    return;
+  }
   HugeRange r = {pt->location(), NHugePages(1)};
   SetTracker(pt->location(), nullptr);
 
@@ -960,9 +1034,43 @@ HugePageAwareAllocator<Forwarder>::ReleaseAtLeastNPagesBreakingHugepages(
                               /*hit_limit=*/true);
 }
 
+template <class Forwarder>
+inline size_t HugePageAwareAllocator<Forwarder>::CollapseHugepages() {
+  FillerType::Tracker* candidates[kMaxCollapsesPerCall];
+  size_t n;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    n = filler_.TakeCollapseCandidates(absl::MakeSpan(candidates));
+  }
+
+  size_t collapsed = 0;
+  for (size_t i = 0; i < n; ++i) {
+    // MADV_COLLAPSE copies the hugepage, so we must not hold the lock for it.
+    // In the meantime the filler does not subrelease the candidate, and
+    // should it be freed, ReleaseHugepage() leaves it to us, so that the
+    // HugeCache cannot release it either.
+    FillerType::Tracker* pt = candidates[i];
+    const int64_t start = absl::base_internal::CycleClock::Now();
+    const bool success = forwarder_.CollapseHugepage(pt->location());
+    const absl::Duration elapsed = absl::Seconds(
+        (absl::base_internal::CycleClock::Now() - start) /
+        absl::base_internal::CycleClock::Frequency());
+
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    filler_.RecordCollapse(pt, success, elapsed);
+    if (pt->used_pages() == Length(0)) {
+      // Nothing but the collapse was using the tracker any more.
+      ReleaseHugepage(pt);
+    }
+    if (success) ++collapsed;
+  }
+  return collapsed;
+}
+
 template <class Forwarder>
 inline bool HugePageAwareAllocator<Forwarder>::UnbackWithoutLock(
     void* start, size_t length) {
+  if (Forwarder::DeferReleasePages(start, length)) return true;
   pageheap_lock.Unlock();
   const bool ret = SystemRelease(start, length);
   pageheap_lock.Lock();
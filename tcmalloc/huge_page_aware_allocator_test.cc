@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <limits>
 #include <new>
 #include <string>
@@ -173,6 +174,22 @@ class HugePageAwareAllocatorTest
     }
   }
 
+  // Tries to grow span in place to n pages, keeping stats in step.
+  bool TryGrow(Span* span, Length n) {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    CHECK_CONDITION(ids_.contains(span));
+    const Length old_n = span->num_pages();
+    const bool grown = allocator_->TryGrow(span, n);
+    if (grown) {
+      EXPECT_EQ(span->num_pages(), n);
+      total_ += n - old_n;
+    } else {
+      EXPECT_EQ(span->num_pages(), old_n);
+    }
+    CheckStats();
+    return grown;
+  }
+
   // Mostly small things, some large ones.
   std::pair<Length, SpanAllocInfo> RandomAllocSize(absl::BitGenRef rng) {
     Length n;
@@ -1055,6 +1072,87 @@ TEST_P(HugePageAwareAllocatorTest, DonationAccounting) {
   EXPECT_EQ(donated, NHugePages(0));
 }
 
+TEST_P(HugePageAwareAllocatorTest, TryGrowOnFiller) {
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  Span* a = New(Length(2), kSpanInfo);
+  EXPECT_TRUE(TryGrow(a, Length(4)));
+
+  Span* b = New(Length(1), kSpanInfo);
+  ASSERT_EQ(b->first_page(), a->first_page() + a->num_pages());
+  EXPECT_FALSE(TryGrow(a, Length(5)));
+
+  Delete(b, kSpanInfo.objects_per_span);
+  EXPECT_TRUE(TryGrow(a, Length(5)));
+  Delete(a, kSpanInfo.objects_per_span);
+}
+
+TEST_P(HugePageAwareAllocatorTest, TryGrowDonated) {
+  static constexpr Length kSlack = Length(4);
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  HugeLength donated_huge_pages;
+  Length abandoned_pages;
+  auto RefreshStats = [&]() {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    donated_huge_pages = allocator_->DonatedHugePages();
+    abandoned_pages = allocator_->AbandonedPages();
+  };
+
+  Span* large = New(kPagesPerHugePage - kSlack, kSpanInfo);
+  ASSERT_TRUE(large->donated());
+  EXPECT_TRUE(TryGrow(large, kPagesPerHugePage - kSlack / 2));
+  RefreshStats();
+  EXPECT_EQ(donated_huge_pages, NHugePages(1));
+  EXPECT_EQ(abandoned_pages, Length(0));
+
+  // A small allocation in the rest of the slack keeps the donation alive, and
+  // the whole grown span is abandoned once it is freed.
+  Span* small = New(Length(1), kSpanInfo);
+  ASSERT_EQ(small->first_page(), large->first_page() + large->num_pages());
+  EXPECT_FALSE(TryGrow(large, large->num_pages() + Length(1)));
+  Delete(large, kSpanInfo.objects_per_span);
+  RefreshStats();
+  EXPECT_EQ(donated_huge_pages, NHugePages(1));
+  EXPECT_EQ(abandoned_pages, kPagesPerHugePage - kSlack / 2);
+
+  Delete(small, kSpanInfo.objects_per_span);
+  RefreshStats();
+  EXPECT_EQ(donated_huge_pages, NHugePages(0));
+  EXPECT_EQ(abandoned_pages, Length(0));
+}
+
+TEST_P(HugePageAwareAllocatorTest, TryGrowDonatedMultipleHugePages) {
+  static constexpr Length kSlack = Length(4);
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  HugeLength donated_huge_pages;
+  Length abandoned_pages;
+  auto RefreshStats = [&]() {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    donated_huge_pages = allocator_->DonatedHugePages();
+    abandoned_pages = allocator_->AbandonedPages();
+  };
+
+  Span* large = New(2 * kPagesPerHugePage - kSlack, kSpanInfo);
+  ASSERT_TRUE(large->donated());
+  EXPECT_TRUE(TryGrow(large, 2 * kPagesPerHugePage - kSlack / 2));
+  // The span may not take over all of its last hugepage.
+  EXPECT_FALSE(TryGrow(large, 2 * kPagesPerHugePage));
+  RefreshStats();
+  EXPECT_EQ(donated_huge_pages, NHugePages(1));
+  EXPECT_EQ(abandoned_pages, Length(0));
+
+  // Only the part of the span on the donated hugepage is abandoned.
+  Span* small = New(Length(1), kSpanInfo);
+  Delete(large, kSpanInfo.objects_per_span);
+  RefreshStats();
+  EXPECT_EQ(donated_huge_pages, NHugePages(1));
+  EXPECT_EQ(abandoned_pages, kPagesPerHugePage - kSlack / 2);
+
+  Delete(small, kSpanInfo.objects_per_span);
+  RefreshStats();
+  EXPECT_EQ(donated_huge_pages, NHugePages(0));
+  EXPECT_EQ(abandoned_pages, Length(0));
+}
+
 // We'd like to test OOM behavior but this, err, OOMs. :)
 // (Usable manually in controlled environments.
 TEST_P(HugePageAwareAllocatorTest, DISABLED_OOM) {
@@ -1458,6 +1556,83 @@ INSTANTIATE_TEST_SUITE_P(
     testing::Values(HugeRegionUsageOption::kDefault,
                     HugeRegionUsageOption::kUseForAllLargeAllocs));
 
+// Runs a hook in place of MADV_COLLAPSE, while pageheap_lock is not held.
+class CollapseHookForwarder
+    : public huge_page_allocator_internal::StaticForwarder {
+ public:
+  static bool CollapseHugepage(HugePage p) {
+    on_collapse(p);
+    return true;
+  }
+
+  static std::function<void(HugePage)> on_collapse;
+};
+
+std::function<void(HugePage)> CollapseHookForwarder::on_collapse;
+
+TEST(HugePageAwareAllocatorCollapseTest, FreedWhileCollapsing) {
+  using Allocator =
+      huge_page_allocator_internal::HugePageAwareAllocator<
+          CollapseHookForwarder>;
+  // As above, the allocator cannot be destroyed cleanly.
+  void* p = malloc(sizeof(Allocator));
+  HugePageAwareAllocatorOptions options;
+  options.tag = MemoryTag::kNormal;
+  Allocator* allocator = new (p) Allocator(options);
+
+  const Length half = kPagesPerHugePage / 2;
+  const SpanAllocInfo kSpanInfo = {1, AccessDensityPrediction::kSparse};
+  auto release = [&](Length n) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    return allocator->ReleaseAtLeastNPages(n);
+  };
+  auto del = [&](Span* span) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    allocator->Delete(span, kSpanInfo.objects_per_span);
+  };
+
+  // Fill a hugepage again after subreleasing half of it.
+  Span* a = allocator->New(half, kSpanInfo);
+  Span* b = allocator->New(half, kSpanInfo);
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+  ASSERT_EQ(HugePageContaining(a->first_page()),
+            HugePageContaining(b->first_page()));
+  const HugePage hp = HugePageContaining(a->first_page());
+  del(a);
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    ASSERT_EQ(allocator->ReleaseAtLeastNPagesBreakingHugepages(half), half);
+  }
+  a = allocator->New(half, kSpanInfo);
+  ASSERT_EQ(HugePageContaining(a->first_page()), hp);
+
+  // Free the whole hugepage while it is being collapsed.  It must not reach
+  // the HugeCache, which would release it, until the collapse is done.
+  int collapses = 0;
+  CollapseHookForwarder::on_collapse = [&](HugePage collapsing) {
+    ++collapses;
+    EXPECT_EQ(collapsing, hp);
+    del(a);
+    del(b);
+    EXPECT_EQ(release(kPagesPerHugePage), Length(0));
+  };
+  EXPECT_EQ(allocator->CollapseHugepages(), 1);
+  EXPECT_EQ(collapses, 1);
+  CollapseHookForwarder::on_collapse = nullptr;
+
+  // Now the collapsed hugepage is free, and backed, in the cache.
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    const BackingStats stats = allocator->stats();
+    EXPECT_EQ(stats.free_bytes + stats.unmapped_bytes, stats.system_bytes);
+    EXPECT_GE(stats.free_bytes, kHugePageSize);
+  }
+  EXPECT_EQ(release(kPagesPerHugePage), kPagesPerHugePage);
+
+  free(p);
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
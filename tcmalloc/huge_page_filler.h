@@ -25,6 +25,7 @@
 #include "absl/base/internal/cycleclock.h"
 #include "absl/base/optimization.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/hinted_tracker_lists.h"
 #include "tcmalloc/huge_cache.h"
@@ -787,7 +788,9 @@ class PageTracker : public TList<PageTracker>::Elem {
         was_released_(false),
         abandoned_(false),
         unbroken_(true),
-        free_{} {
+        collapsing_(false),
+        free_{},
+        was_released_link_(this) {
     init_when(when);
 
 #ifndef __ppc64__
@@ -844,6 +847,17 @@ class PageTracker : public TList<PageTracker>::Elem {
   // REQUIRES: p was the result of a previous call to Get(n)
   void Put(PageId p, Length n) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Returns true if [p, p+n) lies on this hugepage and is entirely free.
+  bool IsFree(PageId p, Length n) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // REQUIRES: IsFree(p, n), and p is the end of a live allocation.
+  //
+  // Appends [p, p+n) to the allocation ending at p, returning the number of
+  // previously unbacked pages in that range.  A later Put must cover the
+  // whole extended allocation.
+  Length Extend(PageId p, Length n) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Returns true if any unused pages have been returned-to-system.
   bool released() const { return released_count_ > 0; }
 
@@ -889,6 +903,27 @@ class PageTracker : public TList<PageTracker>::Elem {
   bool empty() const;
 
   bool unbroken() const { return unbroken_; }
+  // Records that the kernel has collapsed the hugepage back together.
+  void set_unbroken() { unbroken_ = true; }
+
+  // Set while the hugepage is being collapsed with pageheap_lock dropped,
+  // during which it must be neither subreleased nor handed back to the
+  // HugeCache.
+  bool collapsing() const { return collapsing_; }
+  void set_collapsing(bool status) { collapsing_ = status; }
+
+  // Links the tracker into the filler's list of hugepages that are fully
+  // backed again after being subreleased, i.e. those that are
+  // was_released().
+  class WasReleasedLink : public TList<WasReleasedLink>::Elem {
+   public:
+    explicit WasReleasedLink(PageTracker* pt) : pt_(pt) {}
+    PageTracker* tracker() const { return pt_; }
+
+   private:
+    PageTracker* const pt_;
+  };
+  WasReleasedLink* was_released_link() { return &was_released_link_; }
 
   // Returns the hugepage whose availability is being tracked.
   HugePage location() const { return location_; }
@@ -932,6 +967,7 @@ class PageTracker : public TList<PageTracker>::Elem {
   // reset it once we measure those pages in abandoned_count_.
   bool abandoned_;
   bool unbroken_;
+  bool collapsing_;
 
   RangeTracker<kPagesPerHugePage.raw_num()> free_;
   // Bitmap of pages based on them being released to the OS.
@@ -953,6 +989,8 @@ class PageTracker : public TList<PageTracker>::Elem {
 
   bool has_dense_spans_ = false;
 
+  WasReleasedLink was_released_link_;
+
   ABSL_MUST_USE_RESULT bool ReleasePages(PageId p, Length n,
                                          MemoryModifyFunction unback) {
     void* ptr = p.start_addr();
@@ -1028,6 +1066,14 @@ class HugePageFiller {
   TrackerType* Put(TrackerType* pt, PageId p, Length n)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Grows the allocation on *pt ending at p by n pages, if [p, p + n) is
+  // free; returns false (and changes nothing) otherwise.  On success, sets
+  // *from_released if any of the new pages had been released to the system.
+  // REQUIRES: pt is owned by this object and p is the end of a live
+  // allocation on it.
+  bool TryExtend(TrackerType* pt, PageId p, Length n, bool* from_released)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Contributes a tracker to the filler. If "donated," then the tracker is
   // marked as having come from the tail of a multi-hugepage allocation, which
   // causes it to be treated slightly differently.
@@ -1111,6 +1157,32 @@ class HugePageFiller {
   static constexpr size_t kCandidatesForReleasingMemory =
       kPagesPerHugePage.raw_num();
 
+  // A subreleased hugepage stays broken into small pages in the kernel even
+  // once all of its pages are backed again.  Such hugepages can be collapsed
+  // back into hugepages (MADV_COLLAPSE) once they are dense: when at most
+  // kMaxFreePagesToCollapse of their pages are free.
+  static constexpr Length kMaxFreePagesToCollapse = kPagesPerHugePage / 8;
+
+  // TakeCollapseCandidates looks at no more than this many hugepages per call,
+  // to bound the time it holds pageheap_lock.
+  static constexpr size_t kMaxCollapseScan = 256;
+
+  // Stores up to out.size() hugepages that are fully backed after being
+  // subreleased, and dense enough to collapse, in out, and marks them as
+  // collapsing().  Returns the number stored.  Each call picks up after the
+  // hugepages the last call looked at, so that hugepages whose collapse keeps
+  // failing do not hold up the others.
+  //
+  // Until RecordCollapse() is called for them, the candidates are not
+  // subreleased, although they can still be allocated from and freed into.
+  size_t TakeCollapseCandidates(absl::Span<TrackerType*> out)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Records an attempt, which took elapsed, to collapse pt, a hugepage
+  // returned by TakeCollapseCandidates, and clears its collapsing() mark.  pt
+  // may have left the filler since, if it was freed.
+  void RecordCollapse(TrackerType* pt, bool success, absl::Duration elapsed)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   void AddSpanStats(SmallSpanStats* small, LargeSpanStats* large,
                     PageAgeHistograms* ages) const;
 
@@ -1180,6 +1252,11 @@ class HugePageFiller {
   const HugePageFillerAllocsOption allocs_for_sparse_and_dense_spans_ =
       HugePageFillerAllocsOption::kUnifiedAllocs;
 
+  // Records that pt is fully backed again after being subreleased, or no
+  // longer so, keeping n_was_released_ and was_released_ in step.
+  void SetWasReleased(TrackerType* pt, AccessDensityPrediction type);
+  void ClearWasReleased(TrackerType* pt);
+
   // RemoveFromFillerList pt from the appropriate PageTrackerList.
   void RemoveFromFillerList(TrackerType* pt);
   // Put pt in the appropriate PageTrackerList.
@@ -1232,6 +1309,14 @@ class HugePageFiller {
   // not reported to ReleasePages calls?
   Length unmapping_unaccounted_;
 
+  // The hugepages that are was_released(), in the order
+  // TakeCollapseCandidates() is to look at them.
+  TList<typename TrackerType::WasReleasedLink> was_released_;
+  // Hugepages collapsed, attempts that failed, and the time spent on both.
+  int64_t num_collapsed_ = 0;
+  int64_t num_collapse_failures_ = 0;
+  absl::Duration collapse_time_ = absl::ZeroDuration();
+
   // Functionality related to time series tracking.
   void UpdateFillerStatsTracker();
   using StatsTrackerType = FillerStatsTracker<600>;
@@ -1272,6 +1357,35 @@ inline void PageTracker::Put(PageId p, Length n) {
   when_denominator_ += n.raw_num();
 }
 
+inline bool PageTracker::IsFree(PageId p, Length n) const {
+  if (p < location_.first_page() ||
+      p + n > location_.first_page() + kPagesPerHugePage) {
+    return false;
+  }
+  size_t index = (p - location_.first_page()).raw_num();
+  size_t free_index, free_n;
+  return free_.NextFreeRange(index, &free_index, &free_n) &&
+         free_index == index && free_n >= n.raw_num();
+}
+
+inline Length PageTracker::Extend(PageId p, Length n) {
+  ASSERT(IsFree(p, n));
+  size_t index = (p - location_.first_page()).raw_num();
+  free_.Extend(index, n.raw_num());
+
+  size_t unbacked = 0;
+  if (ABSL_PREDICT_FALSE(released_count_ > 0)) {
+    unbacked = released_by_page_.CountBits(index, n.raw_num());
+    released_by_page_.ClearRange(index, n.raw_num());
+    ASSERT(released_count_ >= unbacked);
+    released_count_ -= unbacked;
+  }
+
+  ASSERT(released_by_page_.CountBits(0, kPagesPerHugePage.raw_num()) ==
+         released_count_);
+  return Length(unbacked);
+}
+
 inline Length PageTracker::ReleaseFree(MemoryModifyFunction unback) {
   size_t count = 0;
   size_t index = 0;
@@ -1518,8 +1632,7 @@ HugePageFiller<TrackerType>::TryGet(Length n, SpanAllocInfo span_alloc_info) {
   // If it was in a released state earlier, and is about to be full again,
   // record that the state has been toggled back and update the stat counter.
   if (was_released && !pt->released() && !pt->was_released()) {
-    pt->set_was_released(/*status=*/true);
-    ++n_was_released_[type];
+    SetWasReleased(pt, type);
   }
   ASSERT(was_released || page_allocation.previously_unbacked == Length(0));
   (void)was_released;
@@ -1576,12 +1689,7 @@ inline TrackerType* HugePageFiller<TrackerType>::Put(TrackerType* pt, PageId p,
     }
 
     if (pt->was_released()) {
-      pt->set_was_released(/*status=*/false);
-      if (pt->HasDenseSpans()) {
-        --n_was_released_[AccessDensityPrediction::kDense];
-      } else {
-        --n_was_released_[AccessDensityPrediction::kSparse];
-      }
+      ClearWasReleased(pt);
     }
 
     UpdateFillerStatsTracker();
@@ -1592,6 +1700,106 @@ inline TrackerType* HugePageFiller<TrackerType>::Put(TrackerType* pt, PageId p,
   return nullptr;
 }
 
+template <class TrackerType>
+inline bool HugePageFiller<TrackerType>::TryExtend(TrackerType* pt, PageId p,
+                                                   Length n,
+                                                   bool* from_released) {
+  ASSERT(n > Length(0));
+  if (!pt->IsFree(p, n)) return false;
+
+  const AccessDensityPrediction type =
+      pt->HasDenseSpans() ? AccessDensityPrediction::kDense
+                          : AccessDensityPrediction::kSparse;
+  // Growing the donor allocation of a donated hugepage leaves it donated: no
+  // other allocation has landed on it yet.
+  const bool donated = pt->donated();
+  const bool was_released = pt->released();
+  RemoveFromFillerList(pt);
+  const Length unbacked = pt->Extend(p, n);
+  pages_allocated_[type] += n;
+  if (donated) {
+    DonateToFillerList(pt);
+  } else {
+    AddToFillerList(pt);
+  }
+
+  if (was_released && !pt->released() && !pt->was_released()) {
+    SetWasReleased(pt, type);
+  }
+  ASSERT(unmapped_ >= unbacked);
+  unmapped_ -= unbacked;
+  *from_released = unbacked > Length(0);
+  UpdateFillerStatsTracker();
+  return true;
+}
+
+template <class TrackerType>
+inline void HugePageFiller<TrackerType>::SetWasReleased(
+    TrackerType* pt, AccessDensityPrediction type) {
+  ASSERT(!pt->was_released());
+  pt->set_was_released(/*status=*/true);
+  ++n_was_released_[type];
+  was_released_.append(pt->was_released_link());
+}
+
+template <class TrackerType>
+inline void HugePageFiller<TrackerType>::ClearWasReleased(TrackerType* pt) {
+  ASSERT(pt->was_released());
+  pt->set_was_released(/*status=*/false);
+  if (pt->HasDenseSpans()) {
+    --n_was_released_[AccessDensityPrediction::kDense];
+  } else {
+    --n_was_released_[AccessDensityPrediction::kSparse];
+  }
+  was_released_.remove(pt->was_released_link());
+}
+
+template <class TrackerType>
+inline size_t HugePageFiller<TrackerType>::TakeCollapseCandidates(
+    absl::Span<TrackerType*> out) {
+  // Only hugepages that are was_released() can be broken.  Each one looked at
+  // moves to the back of the list, so that those not dense enough yet, and
+  // those whose collapse failed, are considered again after the others.
+  const size_t limit = std::min<size_t>(
+      previously_released_huge_pages().raw_num(), kMaxCollapseScan);
+  size_t n = 0;
+  for (size_t i = 0; i < limit && n < out.size(); ++i) {
+    auto* link = was_released_.first();
+    was_released_.remove(link);
+    was_released_.append(link);
+
+    TrackerType* pt = static_cast<TrackerType*>(link->tracker());
+    ASSERT(pt->was_released());
+    if (pt->released() || pt->collapsing() ||
+        pt->free_pages() > kMaxFreePagesToCollapse) {
+      continue;
+    }
+    pt->set_collapsing(true);
+    out[n++] = pt;
+  }
+  return n;
+}
+
+template <class TrackerType>
+inline void HugePageFiller<TrackerType>::RecordCollapse(
+    TrackerType* pt, bool success, absl::Duration elapsed) {
+  ASSERT(pt->collapsing());
+  pt->set_collapsing(false);
+  collapse_time_ += elapsed;
+  if (!success) {
+    // The kernel either cannot collapse hugepages or is short of them.  The
+    // hugepage stays a candidate for a later pass.
+    ++num_collapse_failures_;
+    return;
+  }
+  ++num_collapsed_;
+  // The hugepage may have been freed while we collapsed it.
+  if (!pt->was_released()) return;
+  ASSERT(!pt->released());
+  ClearWasReleased(pt);
+  pt->set_unbroken();
+}
+
 template <class TrackerType>
 inline void HugePageFiller<TrackerType>::Contribute(
     TrackerType* pt, bool donated, SpanAllocInfo span_alloc_info) {
@@ -1627,6 +1835,8 @@ inline int HugePageFiller<TrackerType>::SelectCandidates(
     absl::Span<TrackerType*> candidates, int current_candidates,
     const PageTrackerLists<N>& tracker_list, size_t tracker_start) {
   auto PushCandidate = [&](TrackerType* pt) {
+    // The collapse in progress would back the pages again.
+    if (ABSL_PREDICT_FALSE(pt->collapsing())) return;
     ASSERT(pt->free_pages() > Length(0));
     ASSERT(pt->free_pages() > pt->released_pages());
 
@@ -2277,6 +2487,14 @@ inline void HugePageFiller<TrackerType>::Print(Printer* out,
       subrelease_stats_.total_hugepages_broken.raw_num(),
       subrelease_stats_.total_pages_subreleased_due_to_limit.raw_num(),
       subrelease_stats_.total_hugepages_broken_due_to_limit.raw_num());
+  out->printf(
+      "HugePageFiller: Since startup, %lld previously released hugepages "
+      "collapsed, %lld collapses failed (%.4f success rate), %.3f ms "
+      "collapsing\n",
+      num_collapsed_, num_collapse_failures_,
+      tcmalloc_internal::safe_div(num_collapsed_,
+                                  num_collapsed_ + num_collapse_failures_),
+      absl::ToDoubleMilliseconds(collapse_time_));
 
   if (!everything) return;
 
@@ -2403,6 +2621,11 @@ inline void HugePageFiller<TrackerType>::PrintInPbtxt(PbtxtRegion* hpaa) const {
   hpaa->PrintI64(
       "filler_num_hugepages_broken_due_to_limit",
       subrelease_stats_.total_hugepages_broken_due_to_limit.raw_num());
+  hpaa->PrintI64("filler_num_hugepages_collapsed", num_collapsed_);
+  hpaa->PrintI64("filler_num_hugepage_collapse_failures",
+                 num_collapse_failures_);
+  hpaa->PrintI64("filler_hugepage_collapse_time_ns",
+                 absl::ToInt64Nanoseconds(collapse_time_));
   // Compute some histograms of fullness.
   using huge_page_filler_internal::UsageInfo;
   UsageInfo usage;
@@ -387,6 +387,46 @@ TEST_F(PageTrackerTest, ReleasingRetainFailure) {
   EXPECT_EQ(tracker_.free_pages(), a1.n + a2.n + a3.n + a4.n);
 }
 
+TEST_F(PageTrackerTest, Extend) {
+  static const Length kAllocSize = kPagesPerHugePage / 4;
+  SpanAllocInfo info = {1, AccessDensityPrediction::kSparse};
+  PAlloc a1 = Get(kAllocSize, info);
+  PAlloc a2 = Get(kAllocSize, info);
+  PAlloc a3 = Get(kAllocSize, info);
+  PAlloc a4 = Get(kAllocSize, info);
+  Put(a2);
+
+  // Growing into backed pages needs nothing from the system.
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    ASSERT_TRUE(tracker_.IsFree(a2.p, Length(1)));
+    EXPECT_EQ(tracker_.Extend(a2.p, Length(1)), Length(0));
+  }
+  a1.n += Length(1);
+  EXPECT_EQ(tracker_.used_pages(), 3 * kAllocSize + Length(1));
+
+  // Release the rest of the gap.  Growing into it reports the pages that must
+  // be backed again.
+  ExpectPages(PAlloc{a1.p + a1.n, kAllocSize - Length(1), info});
+  ReleaseFree();
+  mock_.VerifyAndClear();
+  EXPECT_EQ(tracker_.released_pages(), kAllocSize - Length(1));
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    // a3 is in the way.
+    EXPECT_FALSE(tracker_.IsFree(a1.p + a1.n, kAllocSize));
+    EXPECT_EQ(tracker_.Extend(a1.p + a1.n, Length(2)), Length(2));
+  }
+  a1.n += Length(2);
+  EXPECT_EQ(tracker_.released_pages(), kAllocSize - Length(3));
+  EXPECT_EQ(tracker_.free_pages(), kAllocSize - Length(3));
+
+  Put(a1);
+  Put(a3);
+  Put(a4);
+  EXPECT_TRUE(tracker_.empty());
+}
+
 TEST_F(PageTrackerTest, Defrag) {
   absl::BitGen rng;
   const Length N = absl::GetFlag(FLAGS_page_tracker_defrag_lim);
@@ -805,6 +845,22 @@ class FillerTest : public testing::TestWithParam<
     return r;
   }
 
+  // Tries to grow *p in place by n pages, keeping marks and stats in step.
+  bool TryExtend(PAlloc* p, Length n, bool* from_released) {
+    bool extended;
+    {
+      absl::base_internal::SpinLockHolder l(&pageheap_lock);
+      extended = filler_.TryExtend(p->pt, p->p + p->n, n, from_released);
+    }
+    if (extended) {
+      p->n += n;
+      total_allocated_ += n;
+      Mark(*p);
+    }
+    CheckStats();
+    return extended;
+  }
+
   Length ReleasePages(Length desired, SkipSubreleaseIntervals intervals = {}) {
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     return filler_.ReleasePages(desired, intervals,
@@ -1550,6 +1606,222 @@ TEST_P(FillerTest, CheckPreviouslyReleasedStats) {
   }
 }
 
+TEST_P(FillerTest, CollapseCandidates) {
+  const Length N = kPagesPerHugePage;
+  auto half = Allocate(N / 2);
+  auto tiny1 = AllocateWithSpanAllocInfo(N / 4, half.span_alloc_info);
+  auto tiny2 = AllocateWithSpanAllocInfo(N / 4, half.span_alloc_info);
+  Delete(half);
+  EXPECT_EQ(ReleasePages(kMaxValidPages), N / 2);
+  ASSERT_FALSE(tiny1.pt->unbroken());
+
+  PageTracker* candidates[16];
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    EXPECT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 0);
+  }
+
+  // Filling the hugepage again makes it a candidate.
+  half = AllocateWithSpanAllocInfo(N / 2, half.span_alloc_info);
+  ASSERT_EQ(half.pt, tiny1.pt);
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(1));
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    ASSERT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 1);
+    EXPECT_EQ(candidates[0], tiny1.pt);
+    EXPECT_TRUE(tiny1.pt->collapsing());
+
+    // Once collapsed, the hugepage is no longer a candidate.
+    filler_.RecordCollapse(tiny1.pt, /*success=*/true, absl::Milliseconds(2));
+    EXPECT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 0);
+  }
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(0));
+  EXPECT_TRUE(tiny1.pt->unbroken());
+
+  std::string buffer(1024 * 1024, '\0');
+  {
+    Printer printer(&*buffer.begin(), buffer.size());
+    filler_.Print(&printer, /*everything=*/false);
+    buffer.resize(strlen(buffer.c_str()));
+  }
+  EXPECT_THAT(buffer,
+              testing::HasSubstr(
+                  "HugePageFiller: Since startup, 1 previously released "
+                  "hugepages collapsed, 0 collapses failed (1.0000 success "
+                  "rate), 2.000 ms collapsing"));
+
+  Delete(half);
+  Delete(tiny1);
+  Delete(tiny2);
+}
+
+TEST_P(FillerTest, SparseHugepagesAreNotCollapsed) {
+  const Length N = kPagesPerHugePage;
+  auto big = Allocate(N - Length(1));
+  auto tiny = AllocateWithSpanAllocInfo(Length(1), big.span_alloc_info);
+  Delete(big);
+  EXPECT_EQ(ReleasePages(kMaxValidPages), N - Length(1));
+
+  // Fill the hugepage again, then leave it fully backed but mostly free.
+  big = AllocateWithSpanAllocInfo(N - Length(1), tiny.span_alloc_info);
+  ASSERT_EQ(big.pt, tiny.pt);
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(1));
+  Delete(big);
+  PageTracker* candidates[16];
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    EXPECT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 0);
+  }
+
+  // Once it is dense again, it is a candidate after all.
+  big = AllocateWithSpanAllocInfo(N - Length(2), tiny.span_alloc_info);
+  ASSERT_EQ(big.pt, tiny.pt);
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    ASSERT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 1);
+    EXPECT_EQ(candidates[0], tiny.pt);
+    filler_.RecordCollapse(tiny.pt, /*success=*/false, absl::Milliseconds(1));
+  }
+  Delete(big);
+  Delete(tiny);
+}
+
+TEST_P(FillerTest, FailedCollapsesAreRetriedInTurn) {
+  const Length N = kPagesPerHugePage;
+  // Make three hugepages that are full again after being subreleased.
+  std::vector<PAlloc> allocs;
+  std::vector<PageTracker*> trackers;
+  for (int i = 0; i < 3; ++i) {
+    auto half = Allocate(N / 2);
+    auto rest = AllocateWithSpanAllocInfo(N / 2, half.span_alloc_info);
+    ASSERT_EQ(half.pt, rest.pt);
+    Delete(half);
+    EXPECT_EQ(ReleasePages(kMaxValidPages), N / 2);
+    half = AllocateWithSpanAllocInfo(N / 2, rest.span_alloc_info);
+    ASSERT_EQ(half.pt, rest.pt);
+    allocs.push_back(half);
+    allocs.push_back(rest);
+    trackers.push_back(half.pt);
+  }
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(3));
+
+  // Two at a time, every hugepage comes up in turn, including those whose
+  // collapse failed before.
+  int times_seen[3] = {0, 0, 0};
+  PageTracker* candidates[2];
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    for (int pass = 0; pass < 3; ++pass) {
+      ASSERT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 2);
+      EXPECT_NE(candidates[0], candidates[1]);
+      for (PageTracker* pt : candidates) {
+        for (int i = 0; i < 3; ++i) {
+          if (trackers[i] != pt) continue;
+          ++times_seen[i];
+          filler_.RecordCollapse(trackers[i], /*success=*/false,
+                                 absl::Milliseconds(1));
+        }
+      }
+    }
+  }
+  EXPECT_THAT(times_seen, testing::ElementsAre(2, 2, 2));
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(3));
+
+  for (const auto& alloc : allocs) {
+    Delete(alloc);
+  }
+}
+
+TEST_P(FillerTest, CollapsingHugepagesAreNotSubreleased) {
+  const Length N = kPagesPerHugePage;
+  auto half = Allocate(N / 2);
+  auto rest = AllocateWithSpanAllocInfo(N / 2, half.span_alloc_info);
+  ASSERT_EQ(half.pt, rest.pt);
+  Delete(half);
+  EXPECT_EQ(ReleasePages(kMaxValidPages), N / 2);
+  half = AllocateWithSpanAllocInfo(N / 2, rest.span_alloc_info);
+  ASSERT_EQ(half.pt, rest.pt);
+
+  PageTracker* candidates[1];
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    ASSERT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 1);
+    // It is not offered twice.
+    EXPECT_EQ(filler_.TakeCollapseCandidates(absl::MakeSpan(candidates)), 0);
+  }
+  // While the collapse is backing the hugepage, its free pages stay put.
+  Delete(half);
+  EXPECT_EQ(ReleasePages(kMaxValidPages), Length(0));
+  EXPECT_FALSE(rest.pt->released());
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    filler_.RecordCollapse(rest.pt, /*success=*/true, absl::Milliseconds(1));
+  }
+  EXPECT_TRUE(rest.pt->unbroken());
+  EXPECT_EQ(ReleasePages(kMaxValidPages), N / 2);
+  Delete(rest);
+}
+
+TEST_P(FillerTest, TryExtend) {
+  const Length N = kPagesPerHugePage;
+  SpanAllocInfo info = {1, AccessDensityPrediction::kSparse};
+  PAlloc a = AllocateWithSpanAllocInfo(Length(1), info);
+  PAlloc b = AllocateWithSpanAllocInfo(Length(1), info);
+  ASSERT_EQ(a.pt, b.pt);
+  ASSERT_EQ(b.p, a.p + a.n);
+
+  bool from_released = true;
+  EXPECT_FALSE(TryExtend(&a, Length(1), &from_released));
+  Delete(b);
+  EXPECT_TRUE(TryExtend(&a, Length(3), &from_released));
+  EXPECT_FALSE(from_released);
+  EXPECT_EQ(filler_.pages_allocated(), Length(4));
+  // The allocation cannot grow past the end of its hugepage.
+  EXPECT_FALSE(TryExtend(&a, N - a.n + Length(1), &from_released));
+  EXPECT_EQ(filler_.pages_allocated(), Length(4));
+  EXPECT_TRUE(Delete(a));
+}
+
+TEST_P(FillerTest, TryExtendIntoReleased) {
+  const Length N = kPagesPerHugePage;
+  SpanAllocInfo info = {1, AccessDensityPrediction::kSparse};
+  PAlloc a = AllocateWithSpanAllocInfo(N / 2, info);
+  EXPECT_EQ(ReleasePages(kMaxValidPages), N / 2);
+  EXPECT_EQ(filler_.unmapped_pages(), N / 2);
+
+  bool from_released = false;
+  EXPECT_TRUE(TryExtend(&a, Length(2), &from_released));
+  EXPECT_TRUE(from_released);
+  EXPECT_EQ(filler_.unmapped_pages(), N / 2 - Length(2));
+  EXPECT_TRUE(a.pt->released());
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(0));
+
+  // Claiming the last released pages leaves the hugepage intact, but it still
+  // counts as one that was released.
+  EXPECT_TRUE(TryExtend(&a, N / 2 - Length(2), &from_released));
+  EXPECT_TRUE(from_released);
+  EXPECT_EQ(filler_.unmapped_pages(), Length(0));
+  EXPECT_FALSE(a.pt->released());
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(1));
+  EXPECT_TRUE(Delete(a));
+  EXPECT_EQ(filler_.previously_released_huge_pages(), NHugePages(0));
+}
+
+TEST_P(FillerTest, TryExtendDonated) {
+  SpanAllocInfo info = {1, AccessDensityPrediction::kSparse};
+  PAlloc a = AllocateWithSpanAllocInfo(kPagesPerHugePage - Length(4), info,
+                                       /*donated=*/true);
+  ASSERT_TRUE(a.pt->donated());
+
+  // Growing the donor allocation does not make the hugepage any less donated.
+  bool from_released = true;
+  EXPECT_TRUE(TryExtend(&a, Length(2), &from_released));
+  EXPECT_FALSE(from_released);
+  EXPECT_TRUE(a.pt->donated());
+  EXPECT_EQ(filler_.pages_allocated(), kPagesPerHugePage - Length(2));
+  EXPECT_TRUE(Delete(a));
+}
+
 TEST_P(FillerTest, AvoidArbitraryQuarantineVMGrowth) {
   const Length N = kPagesPerHugePage;
   // Guarantee we have a ton of released pages go empty.
@@ -2870,6 +3142,7 @@ HugePageFiller: 4 hugepages partially released, 0.0254 released
 HugePageFiller: 0.7186 of used pages hugepageable
 HugePageFiller: 0 hugepages were previously released, but later became full.
 HugePageFiller: Since startup, 282 pages subreleased, 5 hugepages broken, (0 pages, 0 hugepages due to reaching tcmalloc limit)
+HugePageFiller: Since startup, 0 previously released hugepages collapsed, 0 collapses failed (0.0000 success rate), 0.000 ms collapsing
 
 HugePageFiller: fullness histograms
 
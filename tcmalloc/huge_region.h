@@ -77,6 +77,12 @@ class HugeRegion : public TList<HugeRegion>::Elem {
   // REQUIRES: [p, p + n) was the result of a previous MaybeGet.
   void Put(PageId p, Length n, bool release);
 
+  // If [p, p + n) is free, append it to the allocation ending at p, setting
+  // *from_released = true iff any of it is currently unbacked.  Returns false
+  // if the range is not available.
+  // REQUIRES: p is the end of a live allocation in this region.
+  bool MaybeExtend(PageId p, Length n, bool* from_released);
+
   // Release any hugepages that are unused but backed.
   HugeLength Release();
 
@@ -164,6 +170,10 @@ class HugeRegionSet {
   // Return an allocation to a region (if one matches!)
   bool MaybePut(PageId p, Length n);
 
+  // Grow the allocation ending at p by n pages, if it lives in one of our
+  // regions and the following pages are free.
+  bool MaybeExtend(PageId p, Length n, bool* from_released);
+
   // Add region to the set.
   void Contribute(Region* region);
 
@@ -277,6 +287,20 @@ inline void HugeRegion::Put(PageId p, Length n, bool release) {
   Dec(p, n, release);
 }
 
+inline bool HugeRegion::MaybeExtend(PageId p, Length n, bool* from_released) {
+  if (!contains(p) || !contains(p + n - Length(1))) return false;
+  const Length index = p - location_.start().first_page();
+  size_t free_index, free_n;
+  if (!tracker_.NextFreeRange(index.raw_num(), &free_index, &free_n) ||
+      free_index != index.raw_num() || free_n < n.raw_num()) {
+    return false;
+  }
+  tracker_.Extend(index.raw_num(), n.raw_num());
+
+  Inc(p, n, from_released);
+  return true;
+}
+
 // Release any hugepages that are unused but backed.
 // TODO(b/199203282): We release all unused but backed pages from the region. We
 // can explore a more sophisticated mechanism similar to Filler, that accounts
@@ -518,6 +542,21 @@ inline bool HugeRegionSet<Region>::MaybePut(PageId p, Length n) {
   return false;
 }
 
+template <typename Region>
+inline bool HugeRegionSet<Region>::MaybeExtend(PageId p, Length n,
+                                               bool* from_released) {
+  for (Region* region : list_) {
+    // p is one past the end of the allocation, so look up its last page.
+    if (region->contains(p - Length(1))) {
+      if (!region->MaybeExtend(p, n, from_released)) return false;
+      Fix(region);
+      return true;
+    }
+  }
+
+  return false;
+}
+
 // Add region to the set.
 template <typename Region>
 inline void HugeRegionSet<Region>::Contribute(Region* region) {
@@ -200,6 +200,37 @@ TEST_F(HugeRegionTest, ReqsBacking) {
   }
 }
 
+TEST_F(HugeRegionTest, Extend) {
+  const Length n = kPagesPerHugePage;
+  bool from_released;
+  Alloc a = Allocate(n / 2, &from_released);
+  EXPECT_TRUE(from_released);
+  Alloc b = Allocate(n / 4, &from_released);
+  EXPECT_FALSE(from_released);
+  Delete(b);
+
+  // Grow a within its hugepage, then across into the next one.
+  EXPECT_TRUE(region_.MaybeExtend(a.p + a.n, n / 4, &from_released));
+  EXPECT_FALSE(from_released);
+  a.n += n / 4;
+  EXPECT_EQ(a.n, region_.used_pages());
+  EXPECT_TRUE(region_.MaybeExtend(a.p + a.n, n, &from_released));
+  EXPECT_TRUE(from_released);
+  a.n += n;
+  EXPECT_EQ(a.n, region_.used_pages());
+  Mark(a);
+
+  // A neighbor blocks further growth.
+  Alloc c = Allocate(Length(1));
+  ASSERT_EQ(a.p + a.n, c.p);
+  EXPECT_FALSE(region_.MaybeExtend(a.p + a.n, Length(1), &from_released));
+  EXPECT_EQ(a.n + c.n, region_.used_pages());
+
+  Delete(c);
+  Delete(a);
+  EXPECT_EQ(Length(0), region_.used_pages());
+}
+
 TEST_F(HugeRegionTest, Release) {
   mock_ = absl::make_unique<StrictMock<MockBackingInterface>>();
   const Length n = kPagesPerHugePage;
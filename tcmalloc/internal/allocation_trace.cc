@@ -0,0 +1,108 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/allocation_trace.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/functional/function_ref.h"
+#include "absl/numeric/bits.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+void AllocationTracer::Init(int num_cpus, void* memory) {
+  ASSERT(!initialized());
+  ASSERT(num_cpus > 0);
+  ASSERT(reinterpret_cast<uintptr_t>(memory) % ABSL_CACHELINE_SIZE == 0);
+  auto* rings = static_cast<AllocationTraceRing*>(memory);
+  for (int cpu = 0; cpu < num_cpus; ++cpu) {
+    new (&rings[cpu]) AllocationTraceRing();
+  }
+  num_cpus_ = num_cpus;
+  rings_.store(rings, std::memory_order_release);
+}
+
+bool AllocationTracer::Start(AllocationTraceState state) {
+  ASSERT(state != AllocationTraceState::kOff);
+  if (!initialized()) return false;
+  AllocationTraceState expected = AllocationTraceState::kOff;
+  return state_.compare_exchange_strong(expected, state,
+                                        std::memory_order_relaxed);
+}
+
+void AllocationTracer::Record(AllocationTraceEvent::Type type, const void* ptr,
+                              size_t size, size_t alignment,
+                              uint32_t stack_hash, int cpu) {
+  AllocationTraceRing* rings = rings_.load(std::memory_order_acquire);
+  if (ABSL_PREDICT_FALSE(rings == nullptr)) return;
+  const int index = cpu < 0 ? 0 : cpu % num_cpus_;
+
+  AllocationTraceEvent event;
+  event.timestamp = absl::base_internal::CycleClock::Now();
+  event.address = reinterpret_cast<uintptr_t>(ptr);
+  event.size = size;
+  event.stack_hash = stack_hash;
+  event.cpu = static_cast<uint16_t>(index);
+  event.type = type;
+  event.alignment_log2 =
+      alignment > 1 ? absl::bit_width(alignment) - 1 : 0;
+  rings[index].Push(event);
+}
+
+uint64_t AllocationTracer::Drain(
+    absl::FunctionRef<void(const AllocationTraceEvent&)> f) {
+  AllocationTraceRing* rings = rings_.load(std::memory_order_acquire);
+  if (rings == nullptr) return 0;
+
+  // Pop events in batches under drain_lock_, which serializes consumers, and
+  // pass them to f after releasing it.
+  constexpr size_t kBatch = 64;
+  AllocationTraceEvent batch[kBatch];
+  uint64_t dropped = 0;
+  for (int cpu = 0; cpu < num_cpus_; ++cpu) {
+    // f may allocate, and so record more events; take at most one ring's
+    // worth so that this terminates.
+    size_t popped = 0;
+    while (popped < AllocationTraceRing::kCapacity) {
+      size_t n = 0;
+      {
+        absl::base_internal::SpinLockHolder h(&drain_lock_);
+        while (n < kBatch && popped + n < AllocationTraceRing::kCapacity &&
+               rings[cpu].Pop(&batch[n])) {
+          ++n;
+        }
+      }
+      for (size_t i = 0; i < n; ++i) {
+        f(batch[i]);
+      }
+      popped += n;
+      if (n < kBatch) break;
+    }
+    dropped += rings[cpu].TakeDropped();
+  }
+  return dropped;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,193 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_ALLOCATION_TRACE_H_
+#define TCMALLOC_INTERNAL_ALLOCATION_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
+#include "absl/functional/function_ref.h"
+#include "absl/hash/hash.h"
+#include "absl/numeric/bits.h"
+#include "absl/types/span.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_tracing_extension.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+using AllocationTraceEvent = malloc_tracing_extension::AllocationTraceEvent;
+
+// A bounded multi-producer, single-consumer queue of AllocationTraceEvents.
+// Producers never block: they claim a slot with a CAS on head_, and drop the
+// event if the ring is full.  Each slot carries a sequence number, which tells
+// the consumer when the producer that claimed it has finished writing.
+class AllocationTraceRing {
+ public:
+  static constexpr size_t kCapacity = 1024;
+
+  AllocationTraceRing() {
+    for (size_t i = 0; i < kCapacity; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  AllocationTraceRing(const AllocationTraceRing&) = delete;
+  AllocationTraceRing& operator=(const AllocationTraceRing&) = delete;
+
+  // Returns false, and counts the event as dropped, if the ring is full.
+  bool Push(const AllocationTraceEvent& event);
+
+  // Pops the oldest event into *event.  Returns false if the ring is empty, or
+  // if the oldest event is still being written.  Callers must serialize.
+  bool Pop(AllocationTraceEvent* event);
+
+  // Returns the number of events dropped since the previous call.
+  uint64_t TakeDropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr size_t kMask = kCapacity - 1;
+  static_assert(absl::has_single_bit(kCapacity));
+
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    AllocationTraceEvent event;
+  };
+
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<uint64_t> head_{0};
+  std::atomic<uint64_t> dropped_{0};
+  alignas(ABSL_CACHELINE_SIZE) uint64_t tail_ = 0;
+  Slot slots_[kCapacity];
+};
+
+inline bool AllocationTraceRing::Push(const AllocationTraceEvent& event) {
+  uint64_t pos = head_.load(std::memory_order_relaxed);
+  while (true) {
+    Slot& slot = slots_[pos & kMask];
+    const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    const int64_t diff = static_cast<int64_t>(seq - pos);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        slot.event = event;
+        slot.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // The consumer has not yet freed this slot from the previous lap.
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+inline bool AllocationTraceRing::Pop(AllocationTraceEvent* event) {
+  Slot& slot = slots_[tail_ & kMask];
+  if (slot.seq.load(std::memory_order_acquire) != tail_ + 1) return false;
+  *event = slot.event;
+  slot.seq.store(tail_ + kCapacity, std::memory_order_release);
+  ++tail_;
+  return true;
+}
+
+enum class AllocationTraceState : int {
+  kOff = 0,
+  kSampled = 1,
+  kAll = 2,
+};
+
+// Records allocation events into one AllocationTraceRing per CPU.  The rings
+// are allocated by the caller the first time a trace starts, and are kept for
+// the lifetime of the process.
+class AllocationTracer {
+ public:
+  // Events recorded with kAll hash at most this many frames, to bound the
+  // cost of unwinding on every allocation.
+  static constexpr int kAllModeStackDepth = 4;
+
+  constexpr AllocationTracer() = default;
+
+  AllocationTracer(const AllocationTracer&) = delete;
+  AllocationTracer& operator=(const AllocationTracer&) = delete;
+
+  static constexpr size_t BytesRequired(int num_cpus) {
+    return num_cpus * sizeof(AllocationTraceRing);
+  }
+
+  bool initialized() const {
+    return rings_.load(std::memory_order_acquire) != nullptr;
+  }
+
+  // Constructs the rings in memory, which must be BytesRequired(num_cpus)
+  // bytes aligned to ABSL_CACHELINE_SIZE.  Must be called at most once, before
+  // Start().
+  void Init(int num_cpus, void* memory);
+
+  // Starts or stops recording.  Returns false if a trace is already active, or
+  // Init() has not been called.  Threads on the allocation fast path do not
+  // check state(): kAll takes effect for each of them only at its next
+  // Sampler::UpdateFastPathState(), on an allocation or free that takes the
+  // slow path anyway.
+  bool Start(AllocationTraceState state);
+  void Stop() {
+    state_.store(AllocationTraceState::kOff, std::memory_order_relaxed);
+  }
+
+  AllocationTraceState state() const {
+    return state_.load(std::memory_order_relaxed);
+  }
+  bool recording_all() const { return state() == AllocationTraceState::kAll; }
+  bool recording_sampled() const {
+    return state() == AllocationTraceState::kSampled;
+  }
+
+  // Records an event on behalf of cpu, which may be negative if unknown.
+  void Record(AllocationTraceEvent::Type type, const void* ptr, size_t size,
+              size_t alignment, uint32_t stack_hash, int cpu);
+
+  // Passes every buffered event to f, and returns the number of events dropped
+  // since the previous call.  f is called without drain_lock_ held, so it may
+  // allocate, and even call Drain itself.
+  uint64_t Drain(absl::FunctionRef<void(const AllocationTraceEvent&)> f);
+
+  static uint32_t HashStack(absl::Span<void* const> stack) {
+    return static_cast<uint32_t>(absl::HashOf(stack));
+  }
+
+ private:
+  std::atomic<AllocationTraceState> state_{AllocationTraceState::kOff};
+  std::atomic<AllocationTraceRing*> rings_{nullptr};
+  int num_cpus_ = 0;
+  absl::base_internal::SpinLock drain_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_ALLOCATION_TRACE_H_
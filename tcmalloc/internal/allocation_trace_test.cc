@@ -0,0 +1,179 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/allocation_trace.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+#include "tcmalloc/malloc_tracing_extension.h"
+#include "tcmalloc/testing/thread_manager.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+using Type = AllocationTraceEvent::Type;
+
+class AllocationTracerTest : public ::testing::Test {
+ protected:
+  static constexpr int kCpus = 4;
+
+  AllocationTracerTest() {
+    memory_ = aligned_alloc(ABSL_CACHELINE_SIZE,
+                            AllocationTracer::BytesRequired(kCpus));
+    tracer_.Init(kCpus, memory_);
+  }
+
+  ~AllocationTracerTest() override { free(memory_); }
+
+  std::vector<AllocationTraceEvent> Drain(uint64_t* dropped = nullptr) {
+    std::vector<AllocationTraceEvent> events;
+    uint64_t d = tracer_.Drain(
+        [&](const AllocationTraceEvent& e) { events.push_back(e); });
+    if (dropped != nullptr) *dropped = d;
+    return events;
+  }
+
+  void* memory_;
+  AllocationTracer tracer_;
+};
+
+TEST_F(AllocationTracerTest, StartStop) {
+  EXPECT_EQ(tracer_.state(), AllocationTraceState::kOff);
+  EXPECT_TRUE(tracer_.Start(AllocationTraceState::kSampled));
+  EXPECT_TRUE(tracer_.recording_sampled());
+  EXPECT_FALSE(tracer_.recording_all());
+  // Only one trace may be active.
+  EXPECT_FALSE(tracer_.Start(AllocationTraceState::kAll));
+  tracer_.Stop();
+  EXPECT_TRUE(tracer_.Start(AllocationTraceState::kAll));
+  EXPECT_TRUE(tracer_.recording_all());
+  tracer_.Stop();
+}
+
+TEST_F(AllocationTracerTest, RecordsEvents) {
+  int x;
+  tracer_.Record(Type::kAllocate, &x, 24, 64, 0x1234, 2);
+  tracer_.Record(Type::kFree, &x, 32, 0, 0x5678, kCpus + 1);
+
+  uint64_t dropped;
+  std::vector<AllocationTraceEvent> events = Drain(&dropped);
+  EXPECT_EQ(dropped, 0);
+  ASSERT_EQ(events.size(), 2);
+
+  // Rings are drained in CPU order.
+  EXPECT_EQ(events[0].type, Type::kFree);
+  EXPECT_EQ(events[0].cpu, 1);
+  EXPECT_EQ(events[0].size, 32);
+  EXPECT_EQ(events[0].alignment_log2, 0);
+  EXPECT_EQ(events[0].stack_hash, 0x5678);
+
+  EXPECT_EQ(events[1].type, Type::kAllocate);
+  EXPECT_EQ(events[1].address, reinterpret_cast<uintptr_t>(&x));
+  EXPECT_EQ(events[1].cpu, 2);
+  EXPECT_EQ(events[1].size, 24);
+  EXPECT_EQ(events[1].alignment_log2, 6);
+  EXPECT_EQ(events[1].stack_hash, 0x1234);
+
+  EXPECT_TRUE(Drain().empty());
+}
+
+TEST_F(AllocationTracerTest, DropsWhenFull) {
+  const size_t kExtra = 10;
+  for (size_t i = 0; i < AllocationTraceRing::kCapacity + kExtra; ++i) {
+    tracer_.Record(Type::kAllocate, reinterpret_cast<void*>(i), 8, 0, 0, 0);
+  }
+
+  uint64_t dropped;
+  std::vector<AllocationTraceEvent> events = Drain(&dropped);
+  EXPECT_EQ(dropped, kExtra);
+  ASSERT_EQ(events.size(), AllocationTraceRing::kCapacity);
+  // The oldest events are kept.
+  for (size_t i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(events[i].address, i);
+  }
+
+  // Draining makes room again, and resets the count of drops.
+  tracer_.Record(Type::kAllocate, nullptr, 8, 0, 0, 0);
+  EXPECT_EQ(Drain(&dropped).size(), 1);
+  EXPECT_EQ(dropped, 0);
+}
+
+TEST_F(AllocationTracerTest, CallbackMayDrain) {
+  for (size_t i = 0; i < 2 * AllocationTraceRing::kCapacity; ++i) {
+    tracer_.Record(Type::kAllocate, reinterpret_cast<void*>(i), 8, 0, 0,
+                   i % 2);
+  }
+
+  // The callback runs without the drain lock, so it may record events and
+  // drain them itself.
+  size_t outer = 0, inner = 0;
+  tracer_.Drain([&](const AllocationTraceEvent& e) {
+    ++outer;
+    if (e.address == 0) {
+      tracer_.Record(Type::kFree, nullptr, 8, 0, 0, 0);
+      tracer_.Drain([&](const AllocationTraceEvent&) { ++inner; });
+    }
+  });
+  EXPECT_GT(inner, 0);
+  EXPECT_EQ(outer + inner, 2 * AllocationTraceRing::kCapacity + 1);
+  EXPECT_TRUE(Drain().empty());
+}
+
+TEST_F(AllocationTracerTest, ConcurrentRecordAndDrain) {
+  constexpr int kThreads = 8;
+  std::vector<std::atomic<uint64_t>> recorded(kThreads);
+
+  ThreadManager threads;
+  threads.Start(kThreads, [&](int id) {
+    const uint64_t n = recorded[id].fetch_add(1, std::memory_order_relaxed);
+    tracer_.Record(Type::kAllocate,
+                   reinterpret_cast<void*>((uint64_t{1} << 32) * id + n), 8, 0,
+                   0, id % 2);
+  });
+
+  absl::flat_hash_set<uint64_t> seen;
+  uint64_t dropped = 0;
+  for (int i = 0; i < 1000; ++i) {
+    uint64_t d;
+    for (const AllocationTraceEvent& e : Drain(&d)) {
+      EXPECT_TRUE(seen.insert(e.address).second) << e.address;
+    }
+    dropped += d;
+  }
+  threads.Stop();
+
+  uint64_t d;
+  for (const AllocationTraceEvent& e : Drain(&d)) {
+    EXPECT_TRUE(seen.insert(e.address).second) << e.address;
+  }
+  dropped += d;
+
+  uint64_t total = 0;
+  for (const auto& r : recorded) {
+    total += r.load(std::memory_order_relaxed);
+  }
+  EXPECT_EQ(seen.size() + dropped, total);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -113,7 +113,13 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
-#if defined __x86_64__
+#if defined __x86_64__ && defined TCMALLOC_LA57
+// With 5-level paging (LA57), x86_64 processors translate the lower 57 bits,
+// and Linux hands out addresses above 47 bits to mmap() calls that ask for
+// them.
+inline constexpr int kAddressBits =
+    (sizeof(void*) < 8 ? (8 * sizeof(void*)) : 57);
+#elif defined __x86_64__
 // All current and planned x86_64 processors only look at the lower 48 bits
 // in virtual to physical address translation.  The top 16 are thus unused.
 // TODO(b/134686025): Under what operating systems can we increase it safely to
@@ -0,0 +1,126 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/frame_pointer_unwinder.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/debugging/stacktrace.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+#if defined(__x86_64__)
+namespace {
+
+struct ThreadStack {
+  enum State : uint8_t { kUnknown, kLookingUp, kKnown, kUnavailable };
+
+  uintptr_t lo;
+  uintptr_t hi;
+  State state;
+};
+
+ABSL_CONST_INIT thread_local ThreadStack thread_stack
+    ABSL_ATTRIBUTE_INITIAL_EXEC = {0, 0, ThreadStack::kUnknown};
+
+// Sets [*lo, *hi) to the calling thread's stack, which is looked up once per
+// thread.  Returns false if the bounds are not known, including while they are
+// being looked up: pthread_getattr_np allocates, and that allocation may be
+// sampled in turn.
+bool GetThreadStackBounds(uintptr_t* lo, uintptr_t* hi) {
+  ThreadStack& stack = thread_stack;
+  if (ABSL_PREDICT_FALSE(stack.state == ThreadStack::kUnknown)) {
+    stack.state = ThreadStack::kLookingUp;
+    const int saved_errno = errno;
+    bool found = false;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+      void* addr;
+      size_t size;
+      if (pthread_attr_getstack(&attr, &addr, &size) == 0 && size > 0) {
+        stack.lo = reinterpret_cast<uintptr_t>(addr);
+        stack.hi = stack.lo + size;
+        found = true;
+      }
+      pthread_attr_destroy(&attr);
+    }
+    errno = saved_errno;
+    stack.state = found ? ThreadStack::kKnown : ThreadStack::kUnavailable;
+  }
+  if (stack.state != ThreadStack::kKnown) return false;
+  *lo = stack.lo;
+  *hi = stack.hi;
+  return true;
+}
+
+}  // namespace
+#endif
+
+int GetStackTraceFromFramePointers(void** result, int max_depth,
+                                   int skip_count) {
+#if defined(__x86_64__)
+  // The largest step between consecutive frames we believe, as in absl.
+  constexpr uintptr_t kMaxFrameBytes = 100000;
+
+  // Each frame starts with the caller's saved frame pointer, followed by the
+  // return address into the caller.
+  void** fp = static_cast<void**>(__builtin_frame_address(0));
+  uintptr_t lo, hi;
+  const uintptr_t fp_u = reinterpret_cast<uintptr_t>(fp);
+  if (!GetThreadStackBounds(&lo, &hi) || fp_u < lo || fp_u >= hi) {
+    // We are on a stack we know nothing about, such as a signal stack, so
+    // leave it to the careful unwinder.  Skip this frame too.
+    return absl::GetStackTrace(result, max_depth, skip_count + 1);
+  }
+
+  int depth = 0;
+  while (depth < max_depth) {
+    // Both words of the frame must be on the stack.
+    const uintptr_t cur_u = reinterpret_cast<uintptr_t>(fp);
+    if (cur_u % sizeof(void*) != 0 || cur_u < lo ||
+        cur_u > hi - 2 * sizeof(void*)) {
+      break;
+    }
+    void* const ret = fp[1];
+    if (ret == nullptr) break;
+    if (skip_count > 0) {
+      --skip_count;
+    } else {
+      result[depth++] = ret;
+    }
+
+    void** const next = static_cast<void**>(fp[0]);
+    const uintptr_t next_u = reinterpret_cast<uintptr_t>(next);
+    // The stack grows down, so callers' frames are at higher addresses.
+    if (next_u <= cur_u || next_u - cur_u > kMaxFrameBytes) break;
+    fp = next;
+  }
+  return depth;
+#else
+  // Skip this frame too.
+  return absl::GetStackTrace(result, max_depth, skip_count + 1);
+#endif
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
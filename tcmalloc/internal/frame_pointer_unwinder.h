@@ -0,0 +1,45 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_FRAME_POINTER_UNWINDER_H_
+#define TCMALLOC_INTERNAL_FRAME_POINTER_UNWINDER_H_
+
+#include "absl/base/attributes.h"
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Fills result with the return addresses of up to max_depth frames, skipping
+// the innermost skip_count, and returns how many it stored.  result[0] is in
+// the caller, as with absl::GetStackTrace().
+//
+// On x86-64 this follows the chain of saved frame pointers and nothing else:
+// no unwinder hooks and no unwind tables.  Frames compiled without frame
+// pointers are missing from the result, and the walk stops at the first link
+// that is misaligned, leaves the thread's stack, or does not point a little
+// further up it.  The stack's bounds are looked up on the first call in each
+// thread; calls made while they are unknown, or from outside that stack (such
+// as on a signal stack), use absl::GetStackTrace() instead, as do other
+// architectures.
+ABSL_ATTRIBUTE_NOINLINE int GetStackTraceFromFramePointers(void** result,
+                                                           int max_depth,
+                                                           int skip_count);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_FRAME_POINTER_UNWINDER_H_
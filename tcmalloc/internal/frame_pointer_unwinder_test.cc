@@ -0,0 +1,91 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/frame_pointer_unwinder.h"
+
+#include <thread>  // NOLINT(build/c++11)
+
+#include "gtest/gtest.h"
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr int kRecursion = 5;
+constexpr int kMaxDepth = 32;
+
+struct Traces {
+  void* stack[kMaxDepth];
+  int depth;
+  void* skipped[kMaxDepth];
+  int skipped_depth;
+};
+
+ABSL_ATTRIBUTE_NOINLINE void Recurse(int n, Traces* t) {
+  if (n == 0) {
+    t->depth = GetStackTraceFromFramePointers(t->stack, kMaxDepth, 0);
+    t->skipped_depth =
+        GetStackTraceFromFramePointers(t->skipped, kMaxDepth, 1);
+  } else {
+    Recurse(n - 1, t);
+  }
+  ABSL_BLOCK_TAIL_CALL_OPTIMIZATION();
+}
+
+// This test is built with frame pointers, so the unwinder should see through
+// the whole recursion.
+TEST(FramePointerUnwinderTest, WalksRecursion) {
+  Traces t;
+  Recurse(kRecursion, &t);
+
+  ASSERT_GT(t.depth, kRecursion);
+  // Index 0 is the call site of the unwinder.  Each frame above it returns to
+  // the same place in the recursion.
+  EXPECT_NE(t.stack[0], t.stack[1]);
+  for (int i = 2; i <= kRecursion; ++i) {
+    EXPECT_EQ(t.stack[i], t.stack[1]) << i;
+  }
+
+  ASSERT_GE(t.skipped_depth, kRecursion);
+  for (int i = 1; i <= kRecursion; ++i) {
+    EXPECT_EQ(t.skipped[i - 1], t.stack[i]) << i;
+  }
+}
+
+// Each thread looks up the bounds of its own stack, so the walk from a new
+// thread must not be cut short by those of the main thread.
+TEST(FramePointerUnwinderTest, WalksRecursionOnThread) {
+  Traces main_traces;
+  Recurse(kRecursion, &main_traces);
+  Traces t;
+  std::thread thread([&t]() { Recurse(kRecursion, &t); });
+  thread.join();
+
+  ASSERT_GT(t.depth, kRecursion);
+  for (int i = 1; i <= kRecursion; ++i) {
+    EXPECT_EQ(t.stack[i], main_traces.stack[i]) << i;
+  }
+}
+
+TEST(FramePointerUnwinderTest, RespectsMaxDepth) {
+  void* stack[2];
+  EXPECT_LE(GetStackTraceFromFramePointers(stack, 2, 0), 2);
+  EXPECT_EQ(GetStackTraceFromFramePointers(stack, 0, 0), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
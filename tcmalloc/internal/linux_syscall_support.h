@@ -22,19 +22,29 @@ struct kernel_rseq {
   unsigned cpu_id;
   unsigned long long rseq_cs;
   unsigned flags;
-  unsigned padding[2];
-  // This is a prototype extension to the rseq() syscall.  Since a process may
-  // run on only a few cores at a time, we can use a dense set of "v(irtual)
-  // cpus."  This can reduce cache requirements, as we only need N caches for
-  // the cores we actually run on simultaneously, rather than a cache for every
-  // physical core.
+  unsigned node_id;
+  // The memory map concurrency ID (Linux 6.3+).  Since a process may run on
+  // only a few cores at a time, the kernel hands its running threads a dense
+  // set of "v(irtual) cpus," below the number of CPUs the process may run on
+  // and the number of its threads.  This can reduce cache requirements, as we
+  // only need N caches for the cores we actually run on simultaneously,
+  // rather than a cache for every physical core.
+  //
+  // IDs are below NumCPUs() <= 2^16, so we read just the low half, as we read
+  // cpu_id.
   union {
+    unsigned mm_cid;
     struct {
-      short numa_node_id;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      short mm_cid_high;
       short vcpu_id;
+#else
+      short vcpu_id;
+      short mm_cid_high;
+#endif
     };
-    int vcpu_flat;
   };
+  unsigned padding;
 } __attribute__((aligned(4 * sizeof(unsigned long long))));
 
 static_assert(sizeof(kernel_rseq) == (4 * sizeof(unsigned long long)),
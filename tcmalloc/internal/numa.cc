@@ -26,11 +26,16 @@
 #include <array>
 #include <cstring>
 #include <optional>
+#include <utility>
 
 #include "absl/base/attributes.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/functional/function_ref.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/strip.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
@@ -53,6 +58,59 @@ int OpenSysfsCpulist(size_t node) {
   return signal_safe_open(path, O_RDONLY | O_CLOEXEC);
 }
 
+int OpenSysfsMeminfo(size_t node) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/meminfo",
+           node);
+  return signal_safe_open(path, O_RDONLY | O_CLOEXEC);
+}
+
+std::optional<size_t> NumaNodesFreeBytes(
+    const uint64_t nodes, absl::FunctionRef<int(size_t)> open_node_meminfo) {
+  size_t free_bytes = 0;
+  for (size_t node = 0; node < 64; node++) {
+    if ((nodes & (uint64_t{1} << node)) == 0) continue;
+
+    const int fd = open_node_meminfo(node);
+    if (fd == -1) return std::nullopt;
+    // Lines read "Node <node> <field>: <value> kB", with MemFree among the
+    // first few, so there is no need to read the whole file.
+    char buf[512];
+    size_t bytes_read = 0;
+    signal_safe_read(fd, buf, sizeof(buf), &bytes_read);
+    signal_safe_close(fd);
+
+    absl::string_view meminfo(buf, bytes_read);
+    constexpr absl::string_view kMemFree = "MemFree:";
+    const size_t pos = meminfo.find(kMemFree);
+    if (pos == meminfo.npos) return std::nullopt;
+    meminfo.remove_prefix(pos + kMemFree.size());
+    meminfo = meminfo.substr(0, meminfo.find('\n'));
+    meminfo = absl::StripAsciiWhitespace(meminfo);
+    if (!absl::ConsumeSuffix(&meminfo, "kB")) return std::nullopt;
+    size_t free_kb;
+    if (!absl::SimpleAtoi(meminfo, &free_kb)) return std::nullopt;
+    free_bytes += free_kb * 1024;
+  }
+  return free_bytes;
+}
+
+void PartitionsByFreeBytes(absl::Span<const size_t> free_bytes,
+                           absl::Span<int> order) {
+  ASSERT(order.size() == free_bytes.size());
+  for (size_t partition = 0; partition < order.size(); partition++) {
+    order[partition] = partition;
+  }
+  // There are only a handful of partitions, so an insertion sort will do, and
+  // it is stable.
+  for (size_t i = 1; i < order.size(); i++) {
+    for (size_t j = i;
+         j > 0 && free_bytes[order[j]] < free_bytes[order[j - 1]]; j--) {
+      std::swap(order[j], order[j - 1]);
+    }
+  }
+}
+
 bool InitNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
                       uint64_t* const partition_to_nodes,
                       NumaBindMode* const bind_mode,
@@ -167,6 +225,34 @@ bool InitNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
   return numa_aware;
 }
 
+int BuildCpuToNumaNodeMap(uint8_t cpu_to_node[CPU_SETSIZE],
+                          absl::FunctionRef<int(size_t)> open_node_cpulist) {
+  int num_nodes = 1;
+  for (size_t node = 0;; node++) {
+    const int fd = open_node_cpulist(node);
+    if (fd == -1) {
+      CHECK_CONDITION(errno == ENOENT);
+      break;
+    }
+    CHECK_CONDITION(node <= UINT8_MAX);
+
+    const std::optional<cpu_set_t> node_cpus =
+        ParseCpulist([&](char* const buf, const size_t count) {
+          return signal_safe_read(fd, buf, count, /*bytes_read=*/nullptr);
+        });
+    CHECK_CONDITION(node_cpus.has_value());
+    signal_safe_close(fd);
+
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &*node_cpus)) {
+        cpu_to_node[cpu] = node;
+      }
+    }
+    num_nodes = node + 1;
+  }
+  return num_nodes;
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
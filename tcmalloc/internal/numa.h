@@ -17,12 +17,14 @@
 
 #include <sched.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <optional>
 
 #include "absl/functional/function_ref.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/config.h"
 #include "tcmalloc/internal/percpu.h"
 
@@ -158,6 +160,37 @@ bool InitNumaTopology(size_t cpu_to_scaled_partition[CPU_SETSIZE],
                       size_t num_partitions, size_t scale_by,
                       absl::FunctionRef<int(size_t)> open_node_cpulist);
 
+// Builds a mapping from cpuid to the NUMA node that cpu belongs to, using
+// `open_node_cpulist` as described for InitNumaTopology.  Unlike
+// InitNumaTopology this records the system's nodes whether or not NUMA
+// awareness is enabled.  CPUs not listed in any node map to node 0.
+//
+// Returns the number of nodes detected, which is at least 1.
+int BuildCpuToNumaNodeMap(uint8_t cpu_to_node[CPU_SETSIZE],
+                          absl::FunctionRef<int(size_t)> open_node_cpulist =
+                              OpenSysfsCpulist);
+
+// Opens a /sys/devices/system/node/nodeX/meminfo file for read only access &
+// returns the file descriptor.
+int OpenSysfsMeminfo(size_t node);
+
+// Returns the total free memory, in bytes, of the NUMA nodes set in the `nodes`
+// bitmap, or std::nullopt if the free memory of any of them is unknown.
+//
+// The `open_node_meminfo` function is typically OpenSysfsMeminfo but tests may
+// use a different implementation.
+std::optional<size_t> NumaNodesFreeBytes(
+    uint64_t nodes,
+    absl::FunctionRef<int(size_t)> open_node_meminfo = OpenSysfsMeminfo);
+
+// Fills `order` with the partitions 0 to free_bytes.size() - 1, those under
+// the most pressure (with the least free memory) first.  Partitions with equal
+// free memory keep their relative order.
+//
+// REQUIRES: order.size() == free_bytes.size()
+void PartitionsByFreeBytes(absl::Span<const size_t> free_bytes,
+                           absl::Span<int> order);
+
 // Returns the NUMA partition to which `node` belongs.
 inline size_t NodeToPartition(const size_t node, const size_t num_partitions) {
   return node % num_partitions;
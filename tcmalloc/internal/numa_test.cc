@@ -18,13 +18,16 @@
 #include <linux/memfd.h>
 #include <sched.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <syscall.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <limits>
 #include <new>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -231,6 +234,98 @@ TEST_F(NumaTopologyTest, LongCpuLists) {
   }
 }
 
+// Nodes are recorded even when NUMA awareness is disabled.
+TEST_F(NumaTopologyTest, CpuToNumaNodeMap) {
+  std::vector<SyntheticCpuList> nodes;
+  nodes.emplace_back("0-5");
+  nodes.emplace_back("");
+  nodes.emplace_back("6-11");
+
+  uint8_t cpu_to_node[CPU_SETSIZE] = {0};
+  const int num_nodes =
+      BuildCpuToNumaNodeMap(cpu_to_node, [&](const size_t node) {
+        if (node >= nodes.size()) {
+          errno = ENOENT;
+          return -1;
+        }
+        return nodes[node].fd();
+      });
+
+  EXPECT_EQ(num_nodes, 3);
+  for (int cpu = 0; cpu <= 5; cpu++) {
+    EXPECT_EQ(cpu_to_node[cpu], 0);
+  }
+  for (int cpu = 6; cpu <= 11; cpu++) {
+    EXPECT_EQ(cpu_to_node[cpu], 2);
+  }
+}
+
+// Free memory is summed over the requested nodes only.
+TEST_F(NumaTopologyTest, NodesFreeBytes) {
+  std::vector<SyntheticCpuList> meminfo;
+  meminfo.emplace_back(
+      "Node 0 MemTotal:       65536 kB\n"
+      "Node 0 MemFree:         1024 kB\n"
+      "Node 0 MemUsed:        64512 kB");
+  meminfo.emplace_back(
+      "Node 1 MemTotal:       65536 kB\n"
+      "Node 1 MemFree:        32768 kB\n"
+      "Node 1 MemUsed:        32768 kB");
+  meminfo.emplace_back("Node 2 MemTotal:       65536 kB");
+  auto open_node_meminfo = [&](const size_t node) {
+    if (node >= meminfo.size()) {
+      errno = ENOENT;
+      return -1;
+    }
+    CHECK_CONDITION(lseek(meminfo[node].fd(), 0, SEEK_SET) == 0);
+    return dup(meminfo[node].fd());
+  };
+
+  EXPECT_EQ(NumaNodesFreeBytes(0b01, open_node_meminfo), 1024 * 1024);
+  EXPECT_EQ(NumaNodesFreeBytes(0b10, open_node_meminfo), 32768 * 1024);
+  EXPECT_EQ(NumaNodesFreeBytes(0b11, open_node_meminfo), 33792 * 1024);
+  // Node 2 doesn't report its free memory, and node 3 doesn't exist.
+  EXPECT_EQ(NumaNodesFreeBytes(0b101, open_node_meminfo), std::nullopt);
+  EXPECT_EQ(NumaNodesFreeBytes(0b1001, open_node_meminfo), std::nullopt);
+}
+
+// Releases visit the partitions whose nodes have the least memory free first.
+TEST_F(NumaTopologyTest, PartitionsByFreeBytes) {
+  std::vector<SyntheticCpuList> meminfo;
+  for (const int free_kb : {4096, 1024, 65536, 1024}) {
+    meminfo.emplace_back(absl::StrCat("Node ", meminfo.size(),
+                                      " MemFree: ", free_kb, " kB"));
+  }
+  meminfo.emplace_back("Node 4 MemTotal:       65536 kB");
+  auto open_node_meminfo = [&](const size_t node) {
+    if (node >= meminfo.size()) {
+      errno = ENOENT;
+      return -1;
+    }
+    CHECK_CONDITION(lseek(meminfo[node].fd(), 0, SEEK_SET) == 0);
+    return dup(meminfo[node].fd());
+  };
+
+  // As PageAllocator does, rank partitions whose free memory is unknown as if
+  // they had plenty.  Partition 3's free memory is summed over its two nodes,
+  // and partition 4 doesn't report it.
+  constexpr uint64_t kPartitionNodes[] = {0b1, 0b10, 0b100, 0b1001, 0b10000};
+  std::vector<size_t> free_bytes;
+  for (const uint64_t nodes : kPartitionNodes) {
+    free_bytes.push_back(NumaNodesFreeBytes(nodes, open_node_meminfo)
+                             .value_or(std::numeric_limits<size_t>::max()));
+  }
+  std::vector<int> order(free_bytes.size());
+  PartitionsByFreeBytes(free_bytes, absl::MakeSpan(order));
+  EXPECT_THAT(order, testing::ElementsAre(1, 0, 3, 2, 4));
+
+  // Partitions under equal pressure keep their order.
+  const size_t equal[] = {2, 1, 2, 1};
+  order.resize(4);
+  PartitionsByFreeBytes(equal, absl::MakeSpan(order));
+  EXPECT_THAT(order, testing::ElementsAre(1, 3, 0, 2));
+}
+
 // Ensure we can initialize using the host system's real NUMA topology
 // information.
 TEST_F(NumaTopologyTest, Host) {
@@ -34,6 +34,8 @@ TCMalloc_Internal_GetHugePageFillerSkipSubreleaseLongInterval(
     absl::Duration* v);
 ABSL_ATTRIBUTE_WEAK bool
 TCMalloc_Internal_GetResizeCpuCacheSizeClassesEnabled();
+ABSL_ATTRIBUTE_WEAK bool
+TCMalloc_Internal_GetPredictiveCpuCacheCapacityEnabled();
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetReleasePartialAllocPagesEnabled();
 ABSL_ATTRIBUTE_WEAK bool
 TCMalloc_Internal_GetReleasePagesFromHugeRegionEnabled();
@@ -50,6 +52,8 @@ ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHeapSizeHardLimit(uint64_t v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHPAASubrelease(bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetResizeCpuCacheSizeClassesEnabled(
     bool v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetPredictiveCpuCacheCapacityEnabled(
+    bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetReleasePartialAllocPagesEnabled(
     bool v);
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetReleasePagesFromHugeRegionEnabled(
@@ -87,8 +91,22 @@ ABSL_ATTRIBUTE_WEAK double
 TCMalloc_Internal_GetPerCpuCachesDynamicSlabShrinkThreshold();
 ABSL_ATTRIBUTE_WEAK void
 TCMalloc_Internal_SetPerCpuCachesDynamicSlabShrinkThreshold(double v);
+ABSL_ATTRIBUTE_WEAK int32_t
+TCMalloc_Internal_GetShardedTransferCacheRemoteStealThreshold();
+ABSL_ATTRIBUTE_WEAK void
+TCMalloc_Internal_SetShardedTransferCacheRemoteStealThreshold(int32_t v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_GetStatsSnapshotStaleness(
+    absl::Duration* v);
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetStatsSnapshotStaleness(
+    absl::Duration v);
+ABSL_ATTRIBUTE_WEAK size_t TCMalloc_Internal_GetHugeDedicatedThreshold();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetHugeDedicatedThreshold(size_t v);
 ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetMadviseFree();
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetMadviseFree(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetFastUnwindSampledStacks();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetFastUnwindSampledStacks(bool v);
+ABSL_ATTRIBUTE_WEAK bool TCMalloc_Internal_GetReallocRemap();
+ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetReallocRemap(bool v);
 }
 
 #endif  // TCMALLOC_INTERNAL_PARAMETER_ACCESSORS_H_
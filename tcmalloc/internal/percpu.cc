@@ -21,11 +21,14 @@
 #include <syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cstring>
 
 #include "absl/base/attributes.h"
 #include "absl/base/call_once.h"  // IWYU pragma: keep
 #include "absl/base/internal/sysinfo.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/linux_syscall_support.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
@@ -54,9 +57,13 @@ extern "C" {
 //     { kCpuIdUnsupported, kCpuIdUninitialized }
 //   Initialized, available:
 //     [0, NumCpus())    (Always updated at context-switch)
+// vcpu_id starts out as kCpuIdUninitialized too, so that we can tell whether
+// the kernel fills in mm_cid when we register.
 ABSL_CONST_INIT thread_local volatile kernel_rseq __rseq_abi = {
-    0,      static_cast<unsigned>(kCpuIdUninitialized),   0, 0,
-    {0, 0}, {{kCpuIdUninitialized, kCpuIdUninitialized}},
+    0, static_cast<unsigned>(kCpuIdUninitialized),
+    0, 0,
+    0, {static_cast<unsigned>(kCpuIdUninitialized)},
+    0,
 };
 
 }  // extern "C"
@@ -68,6 +75,7 @@ enum PerCpuInitStatus {
 
 ABSL_CONST_INIT static PerCpuInitStatus init_status = kSlowMode;
 ABSL_CONST_INIT static absl::once_flag init_per_cpu_once;
+ABSL_CONST_INIT static bool using_flat_virtual_cpus = false;
 #if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
 ABSL_CONST_INIT static std::atomic<bool> using_upstream_fence{false};
 #endif  // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
@@ -88,8 +96,28 @@ static bool InitThreadPerCpu() {
   return false;
 }
 
-bool UsingFlatVirtualCpus() {
-  return false;
+// Decides whether to index per-CPU data by the kernel's dense concurrency IDs
+// rather than by physical CPU, once the first thread has registered.
+//
+// The dense IDs are below both the number of CPUs we may run on and the
+// number of our threads, so a container restricted to a few CPUs of a large
+// machine only touches a few caches.  But we cannot tell which physical CPU
+// runs a virtual CPU, so fencing one interrupts every CPU running one of our
+// threads.  Physical CPUs remain the default; PERCPU_VCPU_MODE=flat opts in
+// where the kernel provides the IDs.
+static bool ChooseFlatVirtualCpus() {
+  const char* mode = thread_safe_getenv("PERCPU_VCPU_MODE");
+  if (mode == nullptr || strcmp(mode, "flat") != 0) {
+    return false;
+  }
+  // Kernels without mm_cid leave our initial value alone.
+  const bool available = __rseq_abi.vcpu_id >= kCpuIdInitialized;
+  if (!available) {
+    Log(kLog, __FILE__, __LINE__,
+        "PERCPU_VCPU_MODE=flat, but the kernel does not provide virtual CPU "
+        "IDs; using physical CPUs");
+  }
+  return available;
 }
 
 static void InitPerCpu() {
@@ -99,6 +127,7 @@ static void InitPerCpu() {
   // init_status to initialize all subsequent threads.
   if (InitThreadPerCpu()) {
     init_status = kFastMode;
+    using_flat_virtual_cpus = ChooseFlatVirtualCpus();
 
 #if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
     constexpr int kMEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ = (1 << 8);
@@ -111,6 +140,11 @@ static void InitPerCpu() {
   }
 }
 
+bool UsingFlatVirtualCpus() {
+  absl::base_internal::LowLevelCallOnce(&init_per_cpu_once, InitPerCpu);
+  return using_flat_virtual_cpus;
+}
+
 // Tries to initialize RSEQ both at the process-wide (init_status) and
 // thread-level (cpu-id) level.  If process-wide initialization has already been
 // completed then only the thread-level will be completed.  A return of false
@@ -149,13 +183,13 @@ static bool SetAffinityOneCpu(int cpu) {
   return false;
 }
 
-// We're being asked to fence against the mask <target>, but a -1 mask
+// We're being asked to fence against the mask <target>, but a null mask
 // means every CPU.  Do we need <cpu>?
-static bool NeedCpu(const int cpu, const int target) {
-  return target == -1 || target == cpu;
+static bool NeedCpu(const int cpu, const cpu_set_t* target) {
+  return target == nullptr || CPU_ISSET(cpu, target);
 }
 
-static void SlowFence(int target) {
+static void SlowFence(const cpu_set_t* target) {
   // Necessary, so the point in time mentioned below has visibility
   // of our writes.
   std::atomic_thread_fence(std::memory_order_seq_cst);
@@ -263,15 +297,15 @@ static void UpstreamRseqFenceCpu(int cpu) {
 }
 #endif  // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
 
-// Interrupt every concurrently running sibling thread on "cpu", and guarantee
-// our writes up til now are visible to every other CPU. (cpu == -1 is
-// equivalent to all CPUs.)
-static void FenceInterruptCPU(int cpu) {
+// Interrupt every concurrently running sibling thread on the CPUs in "cpus",
+// and guarantee our writes up til now are visible to every other CPU. (A null
+// "cpus" is equivalent to all CPUs.)
+static void FenceInterruptCPUs(const cpu_set_t* cpus) {
   CHECK_CONDITION(IsFast());
 
   // TODO(b/149390298):  Provide an upstream extension for sys_membarrier to
   // interrupt ongoing restartable sequences.
-  SlowFence(cpu);
+  SlowFence(cpus);
 }
 
 void FenceCpu(int cpu, const size_t virtual_cpu_id_offset) {
@@ -288,8 +322,6 @@ void FenceCpu(int cpu, const size_t virtual_cpu_id_offset) {
   }
 
   if (virtual_cpu_id_offset == offsetof(kernel_rseq, vcpu_id)) {
-    ASSUME(false);
-
     // With virtual CPUs, we cannot identify the true physical core we need to
     // interrupt.
     FenceAllCpus();
@@ -303,7 +335,56 @@ void FenceCpu(int cpu, const size_t virtual_cpu_id_offset) {
   }
 #endif  // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
 
-  FenceInterruptCPU(cpu);
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  FenceInterruptCPUs(&cpus);
+}
+
+void FenceCpus(const cpu_set_t& cpus, const size_t virtual_cpu_id_offset) {
+  // See FenceCpu.
+  CompilerBarrier();
+
+  cpu_set_t targets = cpus;
+  if (ABSL_PREDICT_TRUE(IsFastNoInit())) {
+    const int cpu = GetCurrentVirtualCpu(virtual_cpu_id_offset);
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_CLR(cpu, &targets);
+    }
+  }
+  const int num_targets = CPU_COUNT(&targets);
+  if (num_targets == 0) {
+    return;
+  }
+
+  if (virtual_cpu_id_offset == offsetof(kernel_rseq, vcpu_id)) {
+    // With virtual CPUs, we cannot identify the true physical cores we need to
+    // interrupt.
+    FenceAllCpus();
+    return;
+  }
+
+#if TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
+  if (using_upstream_fence.load(std::memory_order_relaxed)) {
+    // The kernel fences either a single CPU, or every CPU running one of our
+    // threads, per call.  Once a large share of the CPUs need fencing, one
+    // call for all of them is cheaper than a call for each, and interrupts at
+    // most a few more.
+    if (num_targets > 1 && num_targets * 2 >= NumCPUs()) {
+      UpstreamRseqFenceCpu(-1);
+      return;
+    }
+    for (int cpu = 0, n = std::min(NumCPUs(), CPU_SETSIZE); cpu < n; ++cpu) {
+      if (CPU_ISSET(cpu, &targets)) {
+        UpstreamRseqFenceCpu(cpu);
+      }
+    }
+    return;
+  }
+#endif  // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
+
+  // Visits every CPU in one pass.
+  FenceInterruptCPUs(&targets);
 }
 
 void FenceAllCpus() {
@@ -313,7 +394,7 @@ void FenceAllCpus() {
     return;
   }
 #endif  // TCMALLOC_INTERNAL_PERCPU_USE_RSEQ
-  FenceInterruptCPU(-1);
+  FenceInterruptCPUs(nullptr);
 }
 
 }  // namespace percpu
@@ -128,7 +128,8 @@ size_t TcmallocSlab_Internal_PopBatch(size_t size_class, void** batch,
 // increase the visibility of functions embedded into the root-namespace (by
 // virtue of C linkage) in the supported case.
 
-// Return whether we are using flat virtual CPUs.
+// Return whether we are using flat virtual CPUs: the kernel's dense,
+// per-process concurrency IDs (rseq's mm_cid) in place of physical CPU IDs.
 bool UsingFlatVirtualCpus();
 
 inline int GetCurrentCpuUnsafe() {
@@ -192,8 +193,8 @@ inline int GetCurrentVirtualCpu(const size_t virtual_cpu_id_offset) {
 }
 
 inline int VirtualRseqCpuId() {
-  const size_t offset = UsingFlatVirtualCpus() ? offsetof(kernel_rseq, cpu_id)
-                                               : offsetof(kernel_rseq, vcpu_id);
+  const size_t offset = UsingFlatVirtualCpus() ? offsetof(kernel_rseq, vcpu_id)
+                                               : offsetof(kernel_rseq, cpu_id);
   return VirtualRseqCpuId(offset);
 }
 
@@ -294,6 +295,9 @@ inline int CompareAndSwapUnsafe(int target_cpu, std::atomic<intptr_t>* p,
 }
 
 void FenceCpu(int cpu, const size_t virtual_cpu_id_offset);
+// Like FenceCpu for each CPU in <cpus>, but visits each at most once, and
+// fences all of them with a single call where that is cheaper.
+void FenceCpus(const cpu_set_t& cpus, const size_t virtual_cpu_id_offset);
 void FenceAllCpus();
 
 }  // namespace percpu
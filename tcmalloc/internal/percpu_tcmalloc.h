@@ -34,6 +34,7 @@
 #include "absl/base/dynamic_annotations.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/functional/function_ref.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/mincore.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/sysinfo.h"
@@ -258,6 +259,34 @@ class TcmallocSlab {
   size_t ShrinkOtherCache(int cpu, size_t size_class, size_t len,
                           ShrinkHandler shrink_handler);
 
+  // A change to the capacity of a cpu/size_class slab, for
+  // ResizeOtherCaches().
+  struct OtherCacheResize {
+    int cpu;
+    size_t size_class;
+    // Whether to grow the capacity by up to <len>, as GrowOtherCache() does,
+    // or to shrink it by up to <len>, as ShrinkOtherCache() does.
+    bool grow;
+    size_t len;
+    // Set to the increment or decrement applied.
+    size_t result;
+    // Used by ResizeOtherCaches().
+    uint16_t begin;
+  };
+
+  // Applies each of <resizes>, with the results GrowOtherCache() and
+  // ShrinkOtherCache() would have.  Rather than fencing once or twice for each
+  // resize, it locks the headers of all of them and fences all the CPUs
+  // involved together (see FenceCpus()).  <max_capacity> returns the max
+  // capacity of a size class for the current shift, like the callback passed
+  // to GrowOtherCache().  A cpu/size_class may appear only once in <resizes>.
+  //
+  // May be called from another processor, not just the CPUs in <resizes>.
+  void ResizeOtherCaches(
+      absl::Span<OtherCacheResize> resizes,
+      absl::FunctionRef<size_t(size_t size_class, uint8_t shift)> max_capacity,
+      ShrinkHandler shrink_handler);
+
   // Remove all items (of all classes) from <cpu>'s slab; reset capacity for all
   // classes to zero.  Then, for each sizeclass, invoke
   // DrainHandler(size_class, <items from slab>, <previous slab capacity>);
@@ -266,6 +295,14 @@ class TcmallocSlab {
   // Push/Pop/Grow/Shrink concurrently (even on the same CPU) is safe.
   void Drain(int cpu, DrainHandler drain_handler);
 
+  // Drains <cpu>'s slab like Drain(), and while no Push can proceed on <cpu>,
+  // invokes <release>(start, length) for every page-aligned range of its slab
+  // that holds neither headers nor the prefetch targets preceding each slot
+  // array.  The released memory may read back as zero.  Returns the number of
+  // bytes passed to <release>.
+  size_t DrainAndRelease(int cpu, DrainHandler drain_handler,
+                         absl::FunctionRef<void(void*, size_t)> release);
+
   PerCPUMetadataState MetadataMemoryUsage() const;
 
   inline int GetCurrentVirtualCpuUnsafe() {
@@ -382,6 +419,10 @@ class TcmallocSlab {
   static void StopConcurrentMutations(Slabs* slabs, Shift shift, int cpu,
                                       size_t virtual_cpu_id_offset);
 
+  // Implementation of Drain() and DrainAndRelease(); <release> may be null.
+  size_t DrainImpl(int cpu, DrainHandler drain_handler,
+                   absl::FunctionRef<void(void*, size_t)>* release);
+
   // Implementation of InitCpu() allowing for reuse in ResizeSlabs().
   static void InitCpuImpl(Slabs* slabs, Shift shift, int cpu,
                           size_t virtual_cpu_id_offset,
@@ -1398,63 +1439,69 @@ template <size_t NumClasses>
 size_t TcmallocSlab<NumClasses>::GrowOtherCache(
     int cpu, size_t size_class, size_t len,
     absl::FunctionRef<size_t(uint8_t)> max_capacity) {
-  ASSERT(cpu >= 0);
-  ASSERT(cpu < NumCPUs());
-  const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
-  const size_t virtual_cpu_id_offset = virtual_cpu_id_offset_;
-  const size_t max_cap = max_capacity(ToUint8(shift));
-
-  // Phase 1: Collect begin as it will be overwritten by the lock.
-  std::atomic<int64_t>* hdrp = GetHeader(slabs, shift, cpu, size_class);
-  Header hdr = LoadHeader(hdrp);
-  CHECK_CONDITION(!hdr.IsLocked());
-  ASSERT(hdr.IsInitialized());
-  const uint16_t begin = hdr.begin;
-
-  // Phase 2: stop concurrent mutations for <cpu> for size class <size_class>.
-  do {
-    LockHeader(slabs, shift, cpu, size_class);
-    FenceCpu(cpu, virtual_cpu_id_offset);
-    hdr = LoadHeader(GetHeader(slabs, shift, cpu, size_class));
-    // If the header was overwritten in Grow/Shrink, then we need to try again.
-  } while (!hdr.IsLocked());
-
-  // Phase 3: Grow the capacity. Use a copy of begin and end_copy to
-  // restore the header, shrink it, and return the length by which the
-  // region was shrunk.
-  uint16_t to_grow = std::min<uint16_t>(len, max_cap - (hdr.end_copy - begin));
-
-  hdr.begin = begin;
-  hdr.end_copy += to_grow;
-  hdr.end = hdr.end_copy;
-  StoreHeader(hdrp, hdr);
-  return to_grow;
+  OtherCacheResize resize = {
+      .cpu = cpu, .size_class = size_class, .grow = true, .len = len};
+  ResizeOtherCaches(
+      absl::MakeSpan(&resize, 1),
+      [&](size_t, uint8_t shift) { return max_capacity(shift); },
+      [](size_t, void**, size_t) { ASSERT(false); });
+  return resize.result;
 }
 
 template <size_t NumClasses>
 size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
     int cpu, size_t size_class, size_t len, ShrinkHandler shrink_handler) {
-  ASSERT(cpu >= 0);
-  ASSERT(cpu < NumCPUs());
+  OtherCacheResize resize = {
+      .cpu = cpu, .size_class = size_class, .grow = false, .len = len};
+  ResizeOtherCaches(
+      absl::MakeSpan(&resize, 1), [](size_t, uint8_t) { return 0; },
+      shrink_handler);
+  return resize.result;
+}
+
+template <size_t NumClasses>
+void TcmallocSlab<NumClasses>::ResizeOtherCaches(
+    absl::Span<OtherCacheResize> resizes,
+    absl::FunctionRef<size_t(size_t size_class, uint8_t shift)> max_capacity,
+    ShrinkHandler shrink_handler) {
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
   const size_t virtual_cpu_id_offset = virtual_cpu_id_offset_;
 
-  // Phase 1: Collect begin as it will be overwritten by the lock.
-  std::atomic<int64_t>* hdrp = GetHeader(slabs, shift, cpu, size_class);
-  Header hdr = LoadHeader(hdrp);
-  CHECK_CONDITION(!hdr.IsLocked());
-  const uint16_t begin = hdr.begin;
+  // Phase 1: Collect begin as it will be overwritten by the lock, and lock
+  // each header.
+  cpu_set_t to_fence;
+  CPU_ZERO(&to_fence);
+  for (OtherCacheResize& resize : resizes) {
+    ASSERT(resize.cpu >= 0);
+    ASSERT(resize.cpu < NumCPUs());
+    Header hdr =
+        LoadHeader(GetHeader(slabs, shift, resize.cpu, resize.size_class));
+    CHECK_CONDITION(!hdr.IsLocked());
+    ASSERT(!resize.grow || hdr.IsInitialized());
+    resize.begin = hdr.begin;
+    resize.result = 0;
+    LockHeader(slabs, shift, resize.cpu, resize.size_class);
+    CPU_SET(resize.cpu, &to_fence);
+  }
 
-  // Phase 2: stop concurrent mutations for <cpu> for size class <size_class>.
-  do {
-    LockHeader(slabs, shift, cpu, size_class);
-    FenceCpu(cpu, virtual_cpu_id_offset);
-    hdr = LoadHeader(GetHeader(slabs, shift, cpu, size_class));
-    // If the header was overwritten in Grow/Shrink, then we need to try again.
-  } while (!hdr.IsLocked());
+  // Phase 2: stop concurrent mutations.  If a header was overwritten in
+  // Grow/Shrink before the fence, then we need to lock it and fence its CPU
+  // again.
+  while (CPU_COUNT(&to_fence) > 0) {
+    FenceCpus(to_fence, virtual_cpu_id_offset);
+    CPU_ZERO(&to_fence);
+    for (const OtherCacheResize& resize : resizes) {
+      const Header hdr =
+          LoadHeader(GetHeader(slabs, shift, resize.cpu, resize.size_class));
+      if (!hdr.IsLocked()) {
+        LockHeader(slabs, shift, resize.cpu, resize.size_class);
+        CPU_SET(resize.cpu, &to_fence);
+      }
+    }
+  }
 
-  // Phase 3: If we do not have len number of items to shrink, we try
-  // to pop items from the list first to create enough capacity that can be
+  // Phase 3: If a shrink does not have len number of unused items, we try to
+  // pop items from the list first to create enough capacity that can be
   // shrunk. If we pop items, we also execute callbacks.
   //
   // We can't write all 4 fields at once with a single write, because Pop does
@@ -1467,35 +1514,67 @@ size_t TcmallocSlab<NumClasses>::ShrinkOtherCache(
   // no Push/Pop will make progress.  Once we Fence below, we know no Push/Pop
   // is using the old current, and can safely update begin/end to be an empty
   // slab.
-
-  const uint16_t unused = hdr.end_copy - hdr.current;
-  if (unused < len) {
-    const uint16_t expected_pop = len - unused;
+  for (const OtherCacheResize& resize : resizes) {
+    if (resize.grow) continue;
+    std::atomic<int64_t>* hdrp =
+        GetHeader(slabs, shift, resize.cpu, resize.size_class);
+    Header hdr = LoadHeader(hdrp);
+    const uint16_t unused = hdr.end_copy - hdr.current;
+    if (unused >= resize.len) continue;
+    const uint16_t expected_pop = resize.len - unused;
     const uint16_t actual_pop =
-        std::min<uint16_t>(expected_pop, hdr.current - begin);
-    void** batch = reinterpret_cast<void**>(GetHeader(slabs, shift, cpu, 0) +
-                                            hdr.current - actual_pop);
+        std::min<uint16_t>(expected_pop, hdr.current - resize.begin);
+    void** batch = reinterpret_cast<void**>(
+        GetHeader(slabs, shift, resize.cpu, 0) + hdr.current - actual_pop);
     TSANAcquireBatch(batch, actual_pop);
-    shrink_handler(size_class, batch, actual_pop);
+    shrink_handler(resize.size_class, batch, actual_pop);
     hdr.current -= actual_pop;
     StoreHeader(hdrp, hdr);
-    FenceCpu(cpu, virtual_cpu_id_offset);
+    CPU_SET(resize.cpu, &to_fence);
+  }
+  if (CPU_COUNT(&to_fence) > 0) {
+    FenceCpus(to_fence, virtual_cpu_id_offset);
   }
 
-  // Phase 4: Shrink the capacity. Use a copy of begin and end_copy to
-  // restore the header, shrink it, and return the length by which the
-  // region was shrunk.
-  hdr.begin = begin;
-  const uint16_t to_shrink =
-      std::min<uint16_t>(len, hdr.end_copy - hdr.current);
-  hdr.end_copy -= to_shrink;
-  hdr.end = hdr.end_copy;
-  StoreHeader(hdrp, hdr);
-  return to_shrink;
+  // Phase 4: Grow or shrink the capacity. Use a copy of begin and end_copy to
+  // restore the header, resize it, and record the length by which the region
+  // was resized.
+  for (OtherCacheResize& resize : resizes) {
+    std::atomic<int64_t>* hdrp =
+        GetHeader(slabs, shift, resize.cpu, resize.size_class);
+    Header hdr = LoadHeader(hdrp);
+    hdr.begin = resize.begin;
+    if (resize.grow) {
+      const size_t max_cap = max_capacity(resize.size_class, ToUint8(shift));
+      resize.result = std::min<uint16_t>(
+          resize.len, max_cap - (hdr.end_copy - resize.begin));
+      hdr.end_copy += resize.result;
+    } else {
+      resize.result =
+          std::min<uint16_t>(resize.len, hdr.end_copy - hdr.current);
+      hdr.end_copy -= resize.result;
+    }
+    hdr.end = hdr.end_copy;
+    StoreHeader(hdrp, hdr);
+  }
 }
 
 template <size_t NumClasses>
 void TcmallocSlab<NumClasses>::Drain(int cpu, DrainHandler drain_handler) {
+  DrainImpl(cpu, drain_handler, nullptr);
+}
+
+template <size_t NumClasses>
+size_t TcmallocSlab<NumClasses>::DrainAndRelease(
+    int cpu, DrainHandler drain_handler,
+    absl::FunctionRef<void(void*, size_t)> release) {
+  return DrainImpl(cpu, drain_handler, &release);
+}
+
+template <size_t NumClasses>
+size_t TcmallocSlab<NumClasses>::DrainImpl(
+    int cpu, DrainHandler drain_handler,
+    absl::FunctionRef<void(void*, size_t)>* release) {
   CHECK_CONDITION(cpu >= 0);
   CHECK_CONDITION(cpu < NumCPUs());
   const auto [slabs, shift] = GetSlabsAndShift(std::memory_order_relaxed);
@@ -1547,6 +1626,33 @@ void TcmallocSlab<NumClasses>::Drain(int cpu, DrainHandler drain_handler) {
   // Phase 5: fence and reset the remaining fields to beginning of the region.
   // This allows concurrent mutations again.
   FenceCpu(cpu, virtual_cpu_id_offset);
+
+  // The headers are still locked and no Push/Pop is in flight, so nothing in
+  // the slot arrays will be read again and their pages can be released.  Only
+  // the headers and the prefetch targets must survive.
+  size_t released = 0;
+  if (release != nullptr) {
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(CpuMemoryStart(slabs, shift, cpu));
+    const uintptr_t page_size = static_cast<uintptr_t>(kPhysicalPageAlign);
+    auto release_range = [&](size_t from, size_t to) {
+      const uintptr_t first = (start + from + page_size - 1) & ~(page_size - 1);
+      const uintptr_t last = (start + to) & ~(page_size - 1);
+      if (first >= last) return;
+      (*release)(reinterpret_cast<void*>(first), last - first);
+      released += last - first;
+    };
+    size_t kept = sizeof(std::atomic<int64_t>) * NumClasses;
+    for (size_t size_class = 0; size_class < NumClasses; ++size_class) {
+      if (begin[size_class] == 0) continue;
+      const size_t prefetch_target = (begin[size_class] - 1) * sizeof(void*);
+      if (prefetch_target < kept) continue;
+      release_range(kept, prefetch_target);
+      kept = prefetch_target + sizeof(void*);
+    }
+    release_range(kept, size_t{1} << ToUint8(shift));
+  }
+
   for (size_t size_class = 0; size_class < NumClasses; ++size_class) {
     std::atomic<int64_t>* hdrp = GetHeader(slabs, shift, cpu, size_class);
     Header hdr;
@@ -1556,6 +1662,7 @@ void TcmallocSlab<NumClasses>::Drain(int cpu, DrainHandler drain_handler) {
     hdr.end_copy = begin[size_class];
     StoreHeader(hdrp, hdr);
   }
+  return released;
 }
 
 template <size_t NumClasses>
@@ -469,6 +469,64 @@ TEST_F(TcmallocSlabTest, Unit) {
   }
 }
 
+TEST_F(TcmallocSlabTest, ResizeOtherCaches) {
+  if (MallocExtension::PerCpuCachesActive()) {
+    // This test unregisters rseq temporarily, as to decrease flakiness.
+    GTEST_SKIP() << "per-CPU TCMalloc is incompatible with unregistering rseq";
+  }
+
+  if (!IsFast()) {
+    GTEST_SKIP() << "Need fast percpu. Skipping.";
+    return;
+  }
+
+  const int cpu = AllowedCpus()[0];
+  ScopedFakeCpuId fake_cpu_id(cpu);
+  slab_.InitCpu(cpu, [](size_t size_class) { return kCapacity; });
+
+  // Fill size class 1 to a capacity of 4, and leave size class 2 empty.
+  const auto max_capacity = [](uint8_t shift) { return kCapacity; };
+  ASSERT_EQ(slab_.Grow(cpu, 1, 4, max_capacity), 4);
+  for (size_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(slab_.Push(1, &objects_[i], ExpectNoOverflow, nullptr));
+  }
+
+  // Shrink size class 1, which has to pop objects to do so, and grow size
+  // classes 2 and 3, the latter beyond its max capacity, in one batch.
+  using Resize = TcmallocSlab::OtherCacheResize;
+  Resize resizes[] = {
+      {.cpu = cpu, .size_class = 1, .grow = false, .len = 3},
+      {.cpu = cpu, .size_class = 2, .grow = true, .len = kCapacity / 2},
+      {.cpu = cpu, .size_class = 3, .grow = true, .len = kCapacity + 1},
+  };
+  std::vector<void*> popped;
+  slab_.ResizeOtherCaches(
+      absl::MakeSpan(resizes),
+      [](size_t size_class, uint8_t shift) { return kCapacity; },
+      [&](size_t size_class, void** batch, size_t count) {
+        EXPECT_EQ(size_class, 1);
+        popped.insert(popped.end(), batch, batch + count);
+      });
+
+  EXPECT_EQ(resizes[0].result, 3);
+  EXPECT_EQ(resizes[1].result, kCapacity / 2);
+  EXPECT_EQ(resizes[2].result, kCapacity);
+  EXPECT_THAT(popped, UnorderedElementsAreArray(&object_ptrs_[1], 3));
+  EXPECT_EQ(slab_.Length(cpu, 1), 1);
+  EXPECT_EQ(slab_.Capacity(cpu, 1), 1);
+  EXPECT_EQ(slab_.Capacity(cpu, 2), kCapacity / 2);
+  EXPECT_EQ(slab_.Capacity(cpu, 3), kCapacity);
+
+  // The slabs still work after the batch.
+  EXPECT_EQ(slab_.Pop(1, ExpectNoUnderflow, nullptr), &objects_[0]);
+  EXPECT_TRUE(slab_.Push(2, &objects_[0], ExpectNoOverflow, nullptr));
+  EXPECT_EQ(slab_.Length(cpu, 2), 1);
+  EXPECT_EQ(slab_.Pop(2, ExpectNoUnderflow, nullptr), &objects_[0]);
+  for (size_t size_class = 1; size_class <= 3; ++size_class) {
+    slab_.Shrink(cpu, size_class, kCapacity);
+  }
+}
+
 TEST_F(TcmallocSlabTest, SimulatedMadviseFailure) {
   if (!IsFast()) {
     GTEST_SKIP() << "Need fast percpu. Skipping.";
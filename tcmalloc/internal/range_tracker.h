@@ -121,6 +121,13 @@ class RangeTracker {
   // was the returned value from a call to FindAndMark.
   // Unmarks it.
   void Unmark(size_t index, size_t n);
+
+  // REQUIRES: the range [index, index + n) is clear and immediately follows
+  // a range returned by FindAndMark.
+  // Marks it as part of that range; the number of live allocations is
+  // unchanged, so a later Unmark must cover both.
+  void Extend(size_t index, size_t n);
+
   // If there is at least one free range at or after <start>,
   // put it in *index, *length and return true; else return false.
   bool NextFreeRange(size_t start, size_t* index, size_t* length) const;
@@ -255,6 +262,28 @@ inline void RangeTracker<N>::Unmark(size_t index, size_t n) {
   }
 }
 
+template <size_t N>
+inline void RangeTracker<N>::Extend(size_t index, size_t n) {
+  ASSERT(n > 0);
+  ASSERT(index > 0 && bits_.GetBit(index - 1));
+  ASSERT(bits_.FindSet(index) >= index + n);
+
+  // We only shrink the free range starting at index; if it was not the
+  // longest, longest_free_ is unaffected.
+  const size_t old_len = bits_.FindSet(index) - index;
+  bits_.SetRange(index, n);
+  nused_ += n;
+  if (old_len < longest_free()) return;
+
+  size_t longest_len = 0;
+  size_t i = 0, len;
+  while (bits_.NextFreeRange(i, &i, &len)) {
+    if (len > longest_len) longest_len = len;
+    i += len;
+  }
+  longest_free_ = longest_len;
+}
+
 // If there is at least one free range at or after <start>,
 // put it in *index, *length and return true; else return false.
 template <size_t N>
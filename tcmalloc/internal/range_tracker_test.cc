@@ -289,6 +289,32 @@ TEST_F(RangeTrackerTest, Trivial) {
   EXPECT_THAT(FreeRanges(), ElementsAre(Pair(0, 300)));
 }
 
+TEST_F(RangeTrackerTest, Extend) {
+  ASSERT_EQ(0, range_.FindAndMark(100));
+  EXPECT_EQ(1, range_.allocs());
+  EXPECT_EQ(kBits - 100, range_.longest_free());
+  range_.Extend(100, 50);
+  EXPECT_EQ(1, range_.allocs());
+  EXPECT_EQ(150, range_.used());
+  EXPECT_EQ(kBits - 150, range_.longest_free());
+  EXPECT_THAT(FreeRanges(), ElementsAre(Pair(150, kBits - 150)));
+
+  // Extending from a range other than the longest leaves longest alone.
+  ASSERT_EQ(150, range_.FindAndMark(kBits - 160));
+  EXPECT_THAT(FreeRanges(), ElementsAre(Pair(kBits - 10, 10)));
+  range_.Unmark(0, 150);
+  ASSERT_EQ(kBits - 10, range_.FindAndMark(5));
+  EXPECT_EQ(150, range_.longest_free());
+  range_.Extend(kBits - 5, 3);
+  EXPECT_EQ(150, range_.longest_free());
+  EXPECT_THAT(FreeRanges(), ElementsAre(Pair(0, 150), Pair(kBits - 2, 2)));
+
+  // The extended range is freed as a single allocation.
+  range_.Unmark(kBits - 10, 8);
+  EXPECT_EQ(1, range_.allocs());
+  EXPECT_THAT(FreeRanges(), ElementsAre(Pair(0, 150), Pair(kBits - 10, 10)));
+}
+
 }  // namespace
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
@@ -0,0 +1,92 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_INTERNAL_SEQLOCK_H_
+#define TCMALLOC_INTERNAL_SEQLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+#include "tcmalloc/internal/config.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Holds a trivially copyable T that is written rarely and read often.  Readers
+// take no lock and never delay the writer: they copy the value out and retry
+// if a Store() overlapped the copy.
+//
+// The value is kept as an array of atomic words, so that a reader racing with
+// the writer sees torn data (which it then discards) rather than a data race.
+template <typename T>
+class SeqlockValue {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  constexpr SeqlockValue() = default;
+
+  SeqlockValue(const SeqlockValue&) = delete;
+  SeqlockValue& operator=(const SeqlockValue&) = delete;
+
+  // Callers must serialize calls to Store().
+  void Store(const T& value) {
+    uint64_t buf[kWords] = {};
+    memcpy(buf, &value, sizeof(T));
+
+    const uint64_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kWords; ++i) {
+      words_[i].store(buf[i], std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Returns the value from the most recent Store(), or a value-initialized T
+  // if there has been none.
+  T Load() const {
+    uint64_t buf[kWords];
+    while (true) {
+      const uint64_t seq = seq_.load(std::memory_order_acquire);
+      if (seq & 1) continue;
+      for (size_t i = 0; i < kWords; ++i) {
+        buf[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == seq) break;
+    }
+    T value;
+    memcpy(&value, buf, sizeof(T));
+    return value;
+  }
+
+ private:
+  static constexpr size_t kWords =
+      (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  // Odd while a Store() is in progress.
+  std::atomic<uint64_t> seq_{0};
+  std::atomic<uint64_t> words_[kWords] = {};
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_INTERNAL_SEQLOCK_H_
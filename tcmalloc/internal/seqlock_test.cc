@@ -0,0 +1,75 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/internal/seqlock.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/testing/thread_manager.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+struct Triple {
+  uint64_t a;
+  uint64_t b;
+  uint32_t c;
+};
+
+TEST(SeqlockValueTest, StoreLoad) {
+  SeqlockValue<Triple> v;
+  Triple t = v.Load();
+  EXPECT_EQ(t.a, 0);
+  EXPECT_EQ(t.b, 0);
+  EXPECT_EQ(t.c, 0);
+
+  v.Store({1, 2, 3});
+  t = v.Load();
+  EXPECT_EQ(t.a, 1);
+  EXPECT_EQ(t.b, 2);
+  EXPECT_EQ(t.c, 3);
+}
+
+TEST(SeqlockValueTest, ReadersNeverSeeTornValues) {
+  SeqlockValue<Triple> v;
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    for (uint64_t i = 1; !done.load(std::memory_order_relaxed); ++i) {
+      v.Store({i, ~i, static_cast<uint32_t>(i)});
+    }
+  });
+
+  ThreadManager readers;
+  readers.Start(4, [&](int) {
+    const Triple t = v.Load();
+    EXPECT_EQ(t.b, t.a == 0 ? 0 : ~t.a);
+    EXPECT_EQ(t.c, static_cast<uint32_t>(t.a));
+  });
+  absl::SleepFor(absl::Milliseconds(100));
+  readers.Stop();
+
+  done.store(true, std::memory_order_relaxed);
+  writer.join();
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -84,6 +84,9 @@ ABSL_ATTRIBUTE_WEAK void
 MallocExtension_Internal_GetSkipSubreleaseShortInterval(absl::Duration* ret);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetSkipSubreleaseLongInterval(
     absl::Duration* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetStatsSnapshotStaleness(
+    absl::Duration* ret);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_GetHugeDedicatedThreshold();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetProperties(
     std::map<std::string, tcmalloc::MallocExtension::Property>* ret);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetStats(std::string* ret);
@@ -95,6 +98,10 @@ ABSL_ATTRIBUTE_WEAK void
 MallocExtension_Internal_SetSkipSubreleaseShortInterval(absl::Duration value);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetSkipSubreleaseLongInterval(
     absl::Duration value);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetStatsSnapshotStaleness(
+    absl::Duration value);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetHugeDedicatedThreshold(
+    size_t value);
 ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu);
 ABSL_ATTRIBUTE_WEAK size_t
 MallocExtension_Internal_ReleaseMemoryToSystem(size_t bytes);
@@ -103,6 +110,12 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMemoryLimit(
 
 ABSL_ATTRIBUTE_WEAK size_t
 MallocExtension_Internal_GetAllocatedSize(const void* ptr);
+ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_AllocateBatch(
+    size_t size, void** batch, size_t count);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeallocateBatch(
+    size_t size, void* const* batch, size_t count);
+ABSL_ATTRIBUTE_WEAK void* MallocExtension_Internal_BeginScopedArena();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_EndScopedArena(void* region);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_MarkThreadBusy();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_MarkThreadIdle();
 
@@ -111,11 +124,16 @@ ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetProfileSamplingRate(
     int64_t);
 
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ProcessBackgroundActions();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ProcessReleaseQueue();
 
 ABSL_ATTRIBUTE_WEAK tcmalloc::MallocExtension::BytesPerSecond
 MallocExtension_Internal_GetBackgroundReleaseRate();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetBackgroundReleaseRate(
     tcmalloc::MallocExtension::BytesPerSecond);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetBackgroundActionPeriod(
+    tcmalloc::MallocExtension::BackgroundAction action, absl::Duration* ret);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetBackgroundActionPeriod(
+    tcmalloc::MallocExtension::BackgroundAction action, absl::Duration value);
 
 ABSL_ATTRIBUTE_WEAK int64_t MallocExtension_Internal_GetGuardedSamplingRate();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetGuardedSamplingRate(
@@ -20,6 +20,10 @@
 #ifndef TCMALLOC_INTERNAL_MALLOC_TRACING_EXTENSION_H_
 #define TCMALLOC_INTERNAL_MALLOC_TRACING_EXTENSION_H_
 
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "tcmalloc/malloc_tracing_extension.h"
 
@@ -29,6 +33,15 @@ ABSL_ATTRIBUTE_WEAK
 absl::StatusOr<tcmalloc::malloc_tracing_extension::AllocatedAddressRanges>
 MallocTracingExtension_Internal_GetAllocatedAddressRanges();
 
+ABSL_ATTRIBUTE_WEAK absl::Status
+MallocTracingExtension_Internal_StartAllocationTrace(
+    tcmalloc::malloc_tracing_extension::AllocationTraceMode mode);
+ABSL_ATTRIBUTE_WEAK void MallocTracingExtension_Internal_StopAllocationTrace();
+ABSL_ATTRIBUTE_WEAK absl::StatusOr<uint64_t>
+MallocTracingExtension_Internal_DrainAllocationTrace(
+    std::vector<tcmalloc::malloc_tracing_extension::AllocationTraceEvent>*
+        events);
+
 #endif
 
 #endif  // TCMALLOC_INTERNAL_MALLOC_TRACING_EXTENSION_H_
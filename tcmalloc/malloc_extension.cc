@@ -561,6 +561,56 @@ void MallocExtension::SetSkipSubreleaseLongInterval(absl::Duration value) {
 #endif
 }
 
+absl::Duration MallocExtension::GetStatsSnapshotStaleness() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_GetStatsSnapshotStaleness == nullptr) {
+    return absl::ZeroDuration();
+  }
+
+  absl::Duration value;
+  MallocExtension_Internal_GetStatsSnapshotStaleness(&value);
+  return value;
+#else
+  return absl::ZeroDuration();
+#endif
+}
+
+void MallocExtension::SetStatsSnapshotStaleness(absl::Duration value) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_SetStatsSnapshotStaleness == nullptr) {
+    return;
+  }
+
+  MallocExtension_Internal_SetStatsSnapshotStaleness(value);
+#else
+  (void)value;
+#endif
+}
+
+size_t MallocExtension::GetHugeDedicatedThreshold() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_GetHugeDedicatedThreshold == nullptr) {
+    return 0;
+  }
+
+  return MallocExtension_Internal_GetHugeDedicatedThreshold();
+#else
+  return 0;
+#endif
+}
+
+void MallocExtension::SetHugeDedicatedThreshold(size_t value) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_SetHugeDedicatedThreshold == nullptr) {
+    return;
+  }
+
+  MallocExtension_Internal_SetHugeDedicatedThreshold(value);
+#else
+  (void)value;
+#endif
+}
+
 absl::optional<size_t> MallocExtension::GetNumericProperty(
     absl::string_view property) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
@@ -674,6 +724,51 @@ MallocExtension::GetProperties() {
   return ret;
 }
 
+size_t MallocExtension::AllocateBatch(size_t size, absl::Span<void*> batch) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_AllocateBatch != nullptr) {
+    return MallocExtension_Internal_AllocateBatch(size, batch.data(),
+                                                  batch.size());
+  }
+#endif
+  size_t allocated = 0;
+  for (; allocated < batch.size(); ++allocated) {
+    void* p = malloc(size);
+    if (p == nullptr) break;
+    batch[allocated] = p;
+  }
+  return allocated;
+}
+
+void MallocExtension::DeallocateBatch(size_t size,
+                                      absl::Span<void* const> batch) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_DeallocateBatch != nullptr) {
+    MallocExtension_Internal_DeallocateBatch(size, batch.data(), batch.size());
+    return;
+  }
+#endif
+  for (void* p : batch) {
+    sdallocx(p, size, 0);
+  }
+}
+
+MallocExtension::ScopedArena::ScopedArena() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_BeginScopedArena != nullptr) {
+    region_ = MallocExtension_Internal_BeginScopedArena();
+  }
+#endif
+}
+
+MallocExtension::ScopedArena::~ScopedArena() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (region_ != nullptr) {
+    MallocExtension_Internal_EndScopedArena(region_);
+  }
+#endif
+}
+
 size_t MallocExtension::ReleaseCpuMemory(int cpu) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (MallocExtension_Internal_ReleaseCpuMemory != nullptr) {
@@ -691,6 +786,14 @@ void MallocExtension::ProcessBackgroundActions() {
 #endif
 }
 
+void MallocExtension::ProcessReleaseQueue() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ProcessReleaseQueue != nullptr) {
+    MallocExtension_Internal_ProcessReleaseQueue();
+  }
+#endif
+}
+
 bool MallocExtension::NeedsProcessBackgroundActions() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   return &MallocExtension_Internal_ProcessBackgroundActions != nullptr;
@@ -716,6 +819,30 @@ void MallocExtension::SetBackgroundReleaseRate(BytesPerSecond rate) {
 #endif
 }
 
+absl::Duration MallocExtension::GetBackgroundActionPeriod(
+    BackgroundAction action) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetBackgroundActionPeriod != nullptr) {
+    absl::Duration value;
+    MallocExtension_Internal_GetBackgroundActionPeriod(action, &value);
+    return value;
+  }
+#endif
+  (void)action;
+  return absl::InfiniteDuration();
+}
+
+void MallocExtension::SetBackgroundActionPeriod(BackgroundAction action,
+                                                absl::Duration period) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetBackgroundActionPeriod != nullptr) {
+    MallocExtension_Internal_SetBackgroundActionPeriod(action, period);
+  }
+#endif
+  (void)action;
+  (void)period;
+}
+
 }  // namespace tcmalloc
 
 // Default implementation just returns size. The expectation is that
@@ -357,6 +357,11 @@ class MallocExtension final {
   //
   //  "tcmalloc.per_cpu_caches_active"
   //      Whether tcmalloc is using per-CPU caches (1 or 0 respectively).
+  //
+  //  "tcmalloc.per_cpu_caches_populated"
+  //      The number of per-CPU caches that have ever held objects (0 without
+  //      per-CPU caches).  With virtual CPUs (PERCPU_VCPU_MODE=flat), this is
+  //      at most the number of CPUs we may run on.
   // -------------------------------------------------------------------
 
   // Gets the named property's value or a nullopt if the property is not valid.
@@ -509,6 +514,29 @@ class MallocExtension final {
   static absl::Duration GetSkipSubreleaseLongInterval();
   static void SetSkipSubreleaseLongInterval(absl::Duration value);
 
+  // Gets and sets how stale GetNumericProperty() may be for
+  // "generic.virtual_memory_used", "generic.physical_memory_used",
+  // "generic.current_allocated_bytes", "generic.bytes_in_use_by_app",
+  // "generic.peak_memory_usage", "generic.heap_size" and the
+  // "tcmalloc.pageheap_*" byte counts.  Within that bound these are served from
+  // a snapshot without taking any allocator lock, which suits frequent
+  // monitoring.  The snapshot is refreshed by ProcessBackgroundActions() and
+  // by any call that finds it too old.  Zero (the default) always computes
+  // exact values.
+  static absl::Duration GetStatsSnapshotStaleness();
+  static void SetStatsSnapshotStaleness(absl::Duration value);
+
+  // Gets and sets the size at and above which allocations get a mapping of
+  // their own, rounded up to a multiple of the hugepage size and
+  // hugepage-aligned.  The mapping is advised with MADV_HUGEPAGE, collapsed
+  // where the kernel supports MADV_COLLAPSE, and unmapped as a whole when the
+  // allocation is freed.  Its pages are never shared with other allocations or
+  // cached by TCMalloc.  Sampled and cold allocations are excluded.  Zero (the
+  // default) disables this; a nonzero value below the hugepage size is raised
+  // to the hugepage size.
+  static size_t GetHugeDedicatedThreshold();
+  static void SetHugeDedicatedThreshold(size_t value);
+
   // Returns the estimated number of bytes that will be allocated for a request
   // of "size" bytes.  This is an estimate: an allocation of "size" bytes may
   // reserve more bytes, but will never reserve fewer.
@@ -532,6 +560,50 @@ class MallocExtension final {
   // null.
   static absl::optional<size_t> GetAllocatedSize(const void* p);
 
+  // Allocates up to batch.size() objects of "size" bytes each, as if by
+  // repeated calls to malloc(size), and stores them in batch.  Returns the
+  // number of objects allocated; fewer than batch.size() are returned only if
+  // memory is exhausted, in which case the remaining entries of batch are left
+  // unmodified.
+  //
+  // Objects may be freed individually (free, sdallocx, ...) or together with
+  // DeallocateBatch.  When linked against TCMalloc, small objects are moved
+  // between the per-CPU cache and batch in bulk, which is cheaper than calling
+  // malloc() batch.size() times.
+  static size_t AllocateBatch(size_t size, absl::Span<void*> batch);
+
+  // Frees every non-null pointer in batch.  Each must have been returned by
+  // malloc(size) (or AllocateBatch(size, ...)) with the same "size" passed
+  // here, as for sdallocx.
+  static void DeallocateBatch(size_t size, absl::Span<void* const> batch);
+
+  // While a ScopedArena is alive, small allocations made by the thread that
+  // created it are bump-allocated from a private region instead of the
+  // per-CPU cache.  Freeing such an object is cheap and does not make its
+  // memory reusable; all of the region is returned when the ScopedArena is
+  // destroyed, whether or not its objects were freed.
+  //
+  // This suits request-scoped work that allocates many short-lived objects.
+  // Objects allocated in the scope must be neither used nor freed after it
+  // ends, and need not be freed at all.  They are not sampled for heap or
+  // allocation profiles.  Large, over-aligned, and cold objects are allocated
+  // as usual.
+  //
+  // ScopedArenas may be nested, and must be destroyed in reverse order of
+  // creation, on the thread that created them.  When not linked against
+  // TCMalloc, a ScopedArena has no effect.
+  class ScopedArena {
+   public:
+    ScopedArena();
+    ~ScopedArena();
+
+    ScopedArena(const ScopedArena&) = delete;
+    ScopedArena& operator=(const ScopedArena&) = delete;
+
+   private:
+    void* region_ = nullptr;
+  };
+
   // Returns
   // * kOwned if TCMalloc allocated the memory pointed to by p, or
   // * kNotOwned if allocated elsewhere or p is null.
@@ -616,6 +688,17 @@ class MallocExtension final {
   // When linked against TCMalloc, this method does not return.
   static void ProcessBackgroundActions();
 
+  // Issues, from the calling thread, the releases of memory to the OS that the
+  // allocator would otherwise make with its page heap lock held.  Once this
+  // is running, the allocator queues those releases for this thread instead,
+  // so that other threads do not wait on the lock while the kernel unmaps
+  // pages.  (Releases made by ReleaseMemoryToSystem, including those of
+  // ProcessBackgroundActions, are issued outside the lock by the thread that
+  // makes them, whether or not this is running.)
+  //
+  // When linked against TCMalloc, this method does not return.
+  static void ProcessReleaseQueue();
+
   // Return true if ProcessBackgroundActions should be called on this platform.
   // Not all platforms need/support background actions. As of 2021 this
   // includes Apple and Emscripten.
@@ -632,6 +715,36 @@ class MallocExtension final {
   // Specifies the release rate from the page heap.  ProcessBackgroundActions
   // must be called for this to be operative.
   static void SetBackgroundReleaseRate(BytesPerSecond rate);
+
+  // The periodic actions taken by ProcessBackgroundActions.
+  enum class BackgroundAction {
+    // Drains per-CPU caches that have been idle.
+    kCpuCacheReclaim,
+    // Moves capacity from per-CPU caches with few misses to those with many.
+    kCpuCacheShuffle,
+    // Moves capacity between size classes within per-CPU caches.
+    kSizeClassResize,
+    // Grows or shrinks the per-CPU slab, if dynamic slabs are enabled.
+    kSlabResize,
+    // Returns unused objects from the transfer caches.
+    kTransferCachePlunder,
+    // Moves capacity between transfer caches.
+    kTransferCacheResize,
+    // Releases free memory to the OS at GetBackgroundReleaseRate().
+    kRelease,
+    // Collapses hugepages that were broken up to release memory, and have
+    // since filled up again, back into hugepages.
+    kHugepageCollapse,
+  };
+
+  // Gets and sets the base period of a background action.  The background
+  // thread runs the action more often than this under memory pressure or a
+  // burst of cache misses, and less often while running it achieves nothing.
+  // An infinite period disables the action.  Periods that are not positive,
+  // and actions not listed above, are ignored.
+  static absl::Duration GetBackgroundActionPeriod(BackgroundAction action);
+  static void SetBackgroundActionPeriod(BackgroundAction action,
+                                        absl::Duration period);
 };
 
 }  // namespace tcmalloc
@@ -19,6 +19,9 @@
 
 #include "tcmalloc/malloc_tracing_extension.h"
 
+#include <cstdint>
+#include <vector>
+
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "tcmalloc/internal_malloc_tracing_extension.h"
@@ -36,5 +39,34 @@ absl::StatusOr<AllocatedAddressRanges> GetAllocatedAddressRanges() {
       "malloc_tracing_extension routines not exported by the current malloc.");
 }
 
+absl::Status StartAllocationTrace(AllocationTraceMode mode) {
+#if ABSL_HAVE_ATTRIBUTE_WEAK && !defined(__APPLE__) && !defined(__EMSCRIPTEN__)
+  if (&MallocTracingExtension_Internal_StartAllocationTrace != nullptr) {
+    return MallocTracingExtension_Internal_StartAllocationTrace(mode);
+  }
+#endif
+  return absl::UnimplementedError(
+      "malloc_tracing_extension routines not exported by the current malloc.");
+}
+
+void StopAllocationTrace() {
+#if ABSL_HAVE_ATTRIBUTE_WEAK && !defined(__APPLE__) && !defined(__EMSCRIPTEN__)
+  if (&MallocTracingExtension_Internal_StopAllocationTrace != nullptr) {
+    MallocTracingExtension_Internal_StopAllocationTrace();
+  }
+#endif
+}
+
+absl::StatusOr<uint64_t> DrainAllocationTrace(
+    std::vector<AllocationTraceEvent>* events) {
+#if ABSL_HAVE_ATTRIBUTE_WEAK && !defined(__APPLE__) && !defined(__EMSCRIPTEN__)
+  if (&MallocTracingExtension_Internal_DrainAllocationTrace != nullptr) {
+    return MallocTracingExtension_Internal_DrainAllocationTrace(events);
+  }
+#endif
+  return absl::UnimplementedError(
+      "malloc_tracing_extension routines not exported by the current malloc.");
+}
+
 }  // namespace malloc_tracing_extension
 }  // namespace tcmalloc
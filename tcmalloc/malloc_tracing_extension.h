@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 
 namespace tcmalloc {
@@ -48,6 +49,64 @@ struct AllocatedAddressRanges {
 // Returns the address ranges currently allocated by TCMalloc.
 absl::StatusOr<AllocatedAddressRanges> GetAllocatedAddressRanges();
 
+// An allocation or deallocation recorded by an allocation trace.  Traces are
+// meant to be written out as-is: a trace file is a sequence of these records,
+// in native byte order, which the allocation trace replay tool consumes.
+struct AllocationTraceEvent {
+  enum class Type : uint8_t { kAllocate = 0, kFree = 1 };
+
+  // Cycle counter reading when the event was recorded.  Only used to order
+  // events recorded on different CPUs.
+  uint64_t timestamp;
+  uint64_t address;
+  // The requested size for allocations, and the allocated size for frees.
+  uint64_t size;
+  // Hash of the stack that allocated or freed the object.  Events recorded in
+  // kAll mode hash only the innermost few frames.
+  uint32_t stack_hash;
+  uint16_t cpu;
+  Type type;
+  // log2 of the requested alignment, or 0 if none was requested.
+  uint8_t alignment_log2;
+};
+static_assert(sizeof(AllocationTraceEvent) == 32);
+
+enum class AllocationTraceMode {
+  // Record only allocations selected by the heap profiling sampler, and their
+  // frees.  This has no measurable cost on the allocation fast path.
+  kSampled,
+  // Record every allocation and free, on a best-effort basis.  This moves all
+  // allocations off the fast path for as long as the trace is active.  Each
+  // thread switches over on its own, at its next allocation or free that
+  // takes the slow path anyway: a sampled allocation, an allocation larger
+  // than the largest size class, or the free of a sampled or large object.
+  // Until then, that thread's allocations and frees are not recorded, so a
+  // trace may miss events from its first moments, including frees of objects
+  // whose allocation it recorded on another thread.
+  //
+  // A thread that only frees small objects, such as a consumer freeing what
+  // a producer allocated, may never switch over during the trace.  None of
+  // its frees are recorded then, and their objects appear to stay live to
+  // the end of the trace.  Consumers of kAll traces should tolerate frees of
+  // unknown objects and should not read allocations that are never freed as
+  // leaks.
+  kAll,
+};
+
+// Starts recording allocation events into per-CPU buffers.  Only one trace
+// may be active at a time.  Events that do not fit in a full buffer are
+// dropped, so the buffers must be drained regularly.
+absl::Status StartAllocationTrace(AllocationTraceMode mode);
+
+// Stops recording.  Events still buffered can be drained afterwards.
+void StopAllocationTrace();
+
+// Appends buffered events to *events and returns the number of events dropped
+// since the previous call.  Events are in order for each CPU, but not across
+// CPUs; sort by timestamp for a global order.
+absl::StatusOr<uint64_t> DrainAllocationTrace(
+    std::vector<AllocationTraceEvent>* events);
+
 }  // namespace malloc_tracing_extension
 }  // namespace tcmalloc
 
@@ -17,6 +17,8 @@
 
 #include <map>
 #include <new>
+#include <utility>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "absl/synchronization/mutex.h"
@@ -30,6 +32,16 @@ namespace tcmalloc_internal {
 
 class FakeStaticForwarder {
  public:
+  FakeStaticForwarder() = default;
+  FakeStaticForwarder(const FakeStaticForwarder&) = delete;
+  FakeStaticForwarder& operator=(const FakeStaticForwarder&) = delete;
+
+  ~FakeStaticForwarder() {
+    for (const auto& [ptr, alignment] : allocations_) {
+      ::operator delete(ptr, alignment);
+    }
+  }
+
   static constexpr size_t class_to_size(int size_class) { return kClassSize; }
   static constexpr Length class_to_pages(int size_class) { return Length(1); }
 
@@ -88,6 +100,18 @@ class FakeStaticForwarder {
     }
   }
 
+  int NumShards() const { return num_shards_; }
+  void set_num_shards(int num_shards) { num_shards_ = num_shards; }
+
+  int CurrentShard() const { return current_shard_; }
+  void set_current_shard(int shard) { current_shard_ = shard; }
+
+  void* Alloc(size_t size, std::align_val_t alignment) {
+    void* ptr = ::operator new(size, alignment);
+    allocations_.emplace_back(ptr, alignment);
+    return ptr;
+  }
+
  private:
   struct SpanInfo {
     Span* span;
@@ -96,6 +120,10 @@ class FakeStaticForwarder {
 
   absl::Mutex mu_;
   std::map<PageId, SpanInfo> map_ ABSL_GUARDED_BY(mu_);
+
+  int num_shards_ = 1;
+  int current_shard_ = 0;
+  std::vector<std::pair<void*, std::align_val_t>> allocations_;
 };
 
 class RawMockStaticForwarder : public FakeStaticForwarder {
@@ -24,6 +24,11 @@ ABSL_CONST_INIT bool FakeShardedTransferCacheManager::enable_generic_cache_(
 ABSL_CONST_INIT bool
     FakeShardedTransferCacheManager::enable_cache_for_large_classes_only_(
         false);
+ABSL_CONST_INIT bool
+    FakeShardedTransferCacheManager::enable_numa_aware_sharding_(false);
+ABSL_CONST_INIT int FakeShardedTransferCacheManager::remote_steal_threshold_(
+    1);
 ABSL_CONST_INIT int FakeCpuLayout::num_shards_(0);
+ABSL_CONST_INIT int FakeCpuLayout::shards_per_node_(0);
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
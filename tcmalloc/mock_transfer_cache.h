@@ -125,10 +125,20 @@ class FakeShardedTransferCacheManager
   static void SetCacheForLargeClassesOnly(bool value) {
     enable_cache_for_large_classes_only_ = value;
   }
+  static bool UseNumaAwareSharding() { return enable_numa_aware_sharding_; }
+  static void SetNumaAwareSharding(bool value) {
+    enable_numa_aware_sharding_ = value;
+  }
+  static int RemoteStealThreshold() { return remote_steal_threshold_; }
+  static void SetRemoteStealThreshold(int value) {
+    remote_steal_threshold_ = value;
+  }
 
  private:
   static bool enable_generic_cache_;
   static bool enable_cache_for_large_classes_only_;
+  static bool enable_numa_aware_sharding_;
+  static int remote_steal_threshold_;
 };
 
 // Wires up a largely functional TransferCache + TransferCacheManager +
@@ -286,7 +296,7 @@ class TwoSizeClassManager : public FakeTransferCacheManager {
 
 class FakeCpuLayout {
  public:
-  static constexpr int kNumCpus = 4;
+  static constexpr int kNumCpus = 8;
   static constexpr int kCpusPerShard = 2;
 
   FakeCpuLayout() : current_cpu_(0) {}
@@ -314,9 +324,26 @@ class FakeCpuLayout {
     return num_shards_;
   }
 
+  // Places shards_per_node consecutive shards on each NUMA node.  Zero places
+  // every shard on node 0.
+  static void SetShardsPerNode(int shards_per_node) {
+    ASSERT(shards_per_node >= 0);
+    shards_per_node_ = shards_per_node;
+  }
+
+  static int BuildNodeMap(uint8_t numa_node_index[CPU_SETSIZE]) {
+    if (shards_per_node_ == 0) return 1;
+    const int cpus_per_node = shards_per_node_ * kCpusPerShard;
+    for (int cpu = 0; cpu < num_shards_ * kCpusPerShard; ++cpu) {
+      numa_node_index[cpu] = cpu / cpus_per_node;
+    }
+    return (num_shards_ + shards_per_node_ - 1) / shards_per_node_;
+  }
+
  private:
   int current_cpu_;
   static int num_shards_;
+  static int shards_per_node_;
 };
 
 // Defines transfer cache manager for testing legacy transfer cache.
@@ -411,16 +438,21 @@ class FakeShardedTransferCacheEnvironment {
       ShardedTransferCacheManagerBase<Manager, FakeCpuLayout,
                                       MinimalFakeCentralFreeList>;
 
+  // A non-zero shards_per_node enables NUMA-aware sharding, with that many
+  // shards on each node.
   explicit FakeShardedTransferCacheEnvironment(int num_shards,
-                                               bool use_generic_cache)
+                                               bool use_generic_cache,
+                                               int shards_per_node = 0)
       : sharded_manager_(&owner_, &cpu_layout_) {
     if (use_generic_cache) {
       owner_.SetGenericCache(true);
     } else {
       owner_.SetCacheForLargeClassesOnly(true);
     }
+    owner_.SetNumaAwareSharding(shards_per_node > 0);
 
     cpu_layout_.Init(num_shards);
+    cpu_layout_.SetShardsPerNode(shards_per_node);
     sharded_manager_.Init();
   }
 
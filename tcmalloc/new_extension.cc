@@ -64,3 +64,17 @@ ABSL_ATTRIBUTE_WEAK void* operator new[](
   return ::operator new[](size, alignment, std::nothrow);
 }
 #endif  // __cpp_aligned_new
+
+ABSL_ATTRIBUTE_WEAK void tcmalloc::operator_new_batch(
+    size_t size, absl::Span<void*> batch) noexcept(false) {
+  for (void*& p : batch) {
+    p = ::operator new(size);
+  }
+}
+
+ABSL_ATTRIBUTE_WEAK void tcmalloc::operator_delete_batch(
+    size_t size, absl::Span<void* const> batch) noexcept {
+  for (void* p : batch) {
+    ::operator delete(p);
+  }
+}
@@ -19,6 +19,7 @@
 #include <cstdint>
 #include <new>
 
+#include "absl/types/span.h"
 #include "tcmalloc/malloc_extension.h"
 
 void* operator new(size_t size, tcmalloc::hot_cold_t hot_cold) noexcept(false);
@@ -42,4 +43,18 @@ void* operator new[](size_t size, std::align_val_t alignment,
                      tcmalloc::hot_cold_t hot_cold) noexcept;
 #endif  // __cpp_aligned_new
 
+namespace tcmalloc {
+
+// Fills batch with batch.size() objects of "size" bytes each, as if by
+// repeated calls to ::operator new(size).  Like operator new, this does not
+// return on failure.  The objects may be released individually with
+// ::operator delete or together with operator_delete_batch.
+void operator_new_batch(size_t size, absl::Span<void*> batch) noexcept(false);
+
+// Releases every object in batch.  Each must have been returned by
+// ::operator new(size) or operator_new_batch(size, ...) with the same size.
+void operator_delete_batch(size_t size, absl::Span<void* const> batch) noexcept;
+
+}  // namespace tcmalloc
+
 #endif  // TCMALLOC_NEW_EXTENSION_H_
@@ -28,6 +28,7 @@
 #include "absl/base/optimization.h"
 #include "absl/numeric/bits.h"
 #include "absl/random/random.h"
+#include "absl/types/span.h"
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/testing/testutil.h"
@@ -483,5 +484,30 @@ TEST(HotColdNew, OperatorNewArrayAlignedNothrow) {
 }
 #endif  // __cpp_aligned_new
 
+TEST(BatchNew, OperatorNewBatch) {
+  absl::BitGen rng;
+  for (size_t size : {1, 16, 1000, 1 << 20}) {
+    for (size_t count : {1, 64, 129, 500}) {
+      std::vector<void*> batch(count, nullptr);
+      operator_new_batch(size, absl::MakeSpan(batch));
+      for (void* p : batch) {
+        ASSERT_NE(p, nullptr);
+        benchmark::DoNotOptimize(memset(p, 0xBF, size));
+      }
+
+      std::sort(batch.begin(), batch.end());
+      EXPECT_EQ(std::adjacent_find(batch.begin(), batch.end()), batch.end());
+
+      if (absl::Bernoulli(rng, 0.2)) {
+        for (void* p : batch) {
+          sized_delete(p, size);
+        }
+      } else {
+        operator_delete_batch(size, batch);
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace tcmalloc
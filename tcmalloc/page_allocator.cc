@@ -14,15 +14,24 @@
 
 #include "tcmalloc/page_allocator.h"
 
+#include <stdint.h>
+
+#include <atomic>
 #include <limits>
 #include <new>
+#include <optional>
 
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/experiment_config.h"
 #include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/numa.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
@@ -93,6 +102,9 @@ bool want_hpaa() {
 }
 
 PageAllocator::PageAllocator() {
+  for (auto& free_bytes : numa_free_bytes_) {
+    free_bytes.store(kUnknownFreeBytes, std::memory_order_relaxed);
+  }
   const bool kUseHPAA = want_hpaa();
   has_cold_impl_ = ColdFeatureActive();
   if (kUseHPAA) {
@@ -234,8 +246,10 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
         return true;
       }
     }
-    for (int partition = 0; partition < active_numa_partitions(); partition++) {
-      ret += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+    int order[kNumaPartitions];
+    PartitionsByPressure(order);
+    for (size_t i = 0; i < active_numa_partitions(); i++) {
+      ret += static_cast<HugePageAwareAllocator*>(normal_impl_[order[i]])
                  ->ReleaseAtLeastNPagesBreakingHugepages(pages - ret);
       if (ret >= pages) {
         return true;
@@ -249,10 +263,123 @@ bool PageAllocator::ShrinkHardBy(Length pages, LimitKind limit_kind) {
   return (pages <= ret);
 }
 
+size_t PageAllocator::CollapseHugepages() {
+  if (alg_ != HPAA) return 0;
+
+  size_t collapsed = 0;
+  for (size_t partition = 0; partition < active_numa_partitions();
+       partition++) {
+    collapsed += static_cast<HugePageAwareAllocator*>(normal_impl_[partition])
+                     ->CollapseHugepages();
+  }
+  collapsed +=
+      static_cast<HugePageAwareAllocator*>(sampled_impl_)->CollapseHugepages();
+  if (has_cold_impl_) {
+    collapsed +=
+        static_cast<HugePageAwareAllocator*>(cold_impl_)->CollapseHugepages();
+  }
+  return collapsed;
+}
+
 size_t PageAllocator::active_numa_partitions() const {
   return tc_globals.numa_topology().active_partitions();
 }
 
+void PageAllocator::UpdateNumaPressure() {
+  if (!tc_globals.numa_topology().numa_aware()) return;
+
+  const int64_t now = absl::base_internal::CycleClock::Now();
+  const int64_t interval =
+      absl::ToDoubleSeconds(kNumaPressureInterval) *
+      absl::base_internal::CycleClock::Frequency();
+  int64_t last = last_numa_update_.load(std::memory_order_relaxed);
+  if (now - last < interval ||
+      !last_numa_update_.compare_exchange_strong(last, now,
+                                                 std::memory_order_relaxed)) {
+    return;
+  }
+
+  for (size_t partition = 0; partition < active_numa_partitions();
+       partition++) {
+    const std::optional<size_t> free_bytes = NumaNodesFreeBytes(
+        tc_globals.numa_topology().GetPartitionNodes(partition));
+    numa_free_bytes_[partition].store(free_bytes.value_or(kUnknownFreeBytes),
+                                      std::memory_order_relaxed);
+  }
+}
+
+void PageAllocator::PartitionsByPressure(int order[kNumaPartitions]) const {
+  const size_t n = active_numa_partitions();
+  size_t free_bytes[kNumaPartitions];
+  for (size_t partition = 0; partition < n; partition++) {
+    free_bytes[partition] =
+        numa_free_bytes_[partition].load(std::memory_order_relaxed);
+  }
+  // Partitions with unknown free memory go last.
+  PartitionsByFreeBytes(absl::MakeConstSpan(free_bytes, n),
+                        absl::MakeSpan(order, n));
+}
+
+void PageAllocator::PrintNumaPartitions(Printer* out) {
+  if (!tc_globals.numa_topology().numa_aware()) return;
+
+  static const double MiB = 1048576.0;
+  BackingStats stats[kNumaPartitions];
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    for (size_t partition = 0; partition < active_numa_partitions();
+         partition++) {
+      stats[partition] = normal_impl_[partition]->stats();
+    }
+  }
+
+  out->printf("------------------------------------------------\n");
+  for (size_t partition = 0; partition < active_numa_partitions();
+       partition++) {
+    const BackingStats& s = stats[partition];
+    out->printf(
+        "NUMA partition %zu: %10.1f MiB backed, %10.1f MiB free, %10.1f MiB "
+        "unmapped",
+        partition, (s.system_bytes - s.unmapped_bytes) / MiB,
+        s.free_bytes / MiB, s.unmapped_bytes / MiB);
+    const size_t node_free_bytes =
+        numa_free_bytes_[partition].load(std::memory_order_relaxed);
+    if (node_free_bytes == kUnknownFreeBytes) {
+      out->printf("\n");
+    } else {
+      out->printf("; %.1f MiB free on its nodes\n", node_free_bytes / MiB);
+    }
+  }
+}
+
+void PageAllocator::PrintNumaPartitionsInPbtxt(PbtxtRegion* region) {
+  if (!tc_globals.numa_topology().numa_aware()) return;
+
+  BackingStats stats[kNumaPartitions];
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    for (size_t partition = 0; partition < active_numa_partitions();
+         partition++) {
+      stats[partition] = normal_impl_[partition]->stats();
+    }
+  }
+
+  for (size_t partition = 0; partition < active_numa_partitions();
+       partition++) {
+    const BackingStats& s = stats[partition];
+    PbtxtRegion np = region->CreateSubRegion("numa_partition");
+    np.PrintI64("partition", partition);
+    np.PrintI64("backed_bytes", s.system_bytes - s.unmapped_bytes);
+    np.PrintI64("free_bytes", s.free_bytes);
+    np.PrintI64("unmapped_bytes", s.unmapped_bytes);
+    const size_t node_free_bytes =
+        numa_free_bytes_[partition].load(std::memory_order_relaxed);
+    if (node_free_bytes != kUnknownFreeBytes) {
+      np.PrintI64("node_free_bytes", node_free_bytes);
+    }
+  }
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
@@ -19,17 +19,23 @@
 #include <stddef.h>
 
 #include <array>
+#include <atomic>
 #include <limits>
 #include <utility>
 
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/huge_dedicated_allocator.h"
 #include "tcmalloc/huge_page_aware_allocator.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/page_allocator_interface.h"
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/pages.h"
+#include "tcmalloc/release_queue.h"
+#include "tcmalloc/size_class_regions.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stats.h"
 
@@ -47,9 +53,22 @@ class PageAllocator {
   //
   // Any address in the returned Span is guaranteed to satisfy
   // GetMemoryTag(addr) == "tag".
+  //
+  // Spans of at least Parameters::huge_dedicated_threshold() bytes get a
+  // mapping of their own (see HugeDedicatedAllocator).
+  //
+  // The pages of the returned Span are not subject to a pending release from
+  // release_queue().
   Span* New(Length n, SpanAllocInfo span_alloc_info, MemoryTag tag)
       ABSL_LOCKS_EXCLUDED(pageheap_lock);
 
+  // As New, for a span of small objects of the given size class.  With
+  // TCMALLOC_SIZE_CLASS_REGIONS, the span comes from the size class's region if
+  // there is room.
+  Span* NewForSizeClass(size_t size_class, Length n,
+                        SpanAllocInfo span_alloc_info, MemoryTag tag)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   // As New, but the returned span is aligned to a <align>-page boundary.
   // <align> must be a power of two.
   Span* NewAligned(Length n, Length align, SpanAllocInfo span_alloc_info,
@@ -58,9 +77,24 @@ class PageAllocator {
   // Delete the span "[p, p+n-1]".
   // REQUIRES: span was returned by earlier call to New() with the same value of
   //           "tag" and has not yet been deleted.
+  //
+  // A span with a mapping of its own is unmapped by UnmapDeleted().
   void Delete(Span* span, size_t objects_per_span, MemoryTag tag)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Unmaps the mappings of the huge-dedicated spans Delete() has deleted.
+  // Called once pageheap_lock is dropped after a Delete() that may have freed
+  // such a span.
+  void UnmapDeleted() ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    huge_dedicated_.UnmapDeleted();
+  }
+
+  // Grow "span" in place to "n" pages, if the pages following it are free.
+  // REQUIRES: span was returned by earlier call to New() with the same value of
+  //           "tag" and has not yet been deleted.
+  bool TryGrow(Span* span, Length n, MemoryTag tag)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   BackingStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   void GetSmallSpanStats(SmallSpanStats* result)
@@ -75,9 +109,22 @@ class PageAllocator {
   // may also be larger than num_pages since page_heap might decide to
   // release one large range instead of fragmenting it into two
   // smaller released and unreleased ranges.
+  //
+  // Each NUMA partition caches memory according to its own demand; memory is
+  // released first from the partitions whose nodes have the least memory
+  // free, as of the last UpdateNumaPressure().
   Length ReleaseAtLeastNPages(Length num_pages)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Reads how much memory is free on the nodes of each NUMA partition, unless
+  // it was read less than kNumaPressureInterval ago or we are not NUMA aware.
+  void UpdateNumaPressure() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  static constexpr absl::Duration kNumaPressureInterval = absl::Seconds(1);
+
+  // Collapses hugepages that were subreleased, and have since been filled
+  // again, back into hugepages.  Returns the number collapsed.
+  size_t CollapseHugepages() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
   // Prints stats about the page heap to *out.
   void Print(Printer* out, MemoryTag tag) ABSL_LOCKS_EXCLUDED(pageheap_lock);
   void PrintInPbtxt(PbtxtRegion* region, MemoryTag tag)
@@ -122,6 +169,10 @@ class PageAllocator {
     return PeakStats{peak_backed_bytes_, peak_sampled_application_bytes_};
   }
 
+  // Releases to the OS that the HugePageAwareAllocators have put off until
+  // pageheap_lock is dropped.
+  ReleaseQueue& release_queue() { return release_queue_; }
+
  private:
   bool ShrinkHardBy(Length page, LimitKind limit_kind)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
@@ -131,6 +182,23 @@ class PageAllocator {
 
   size_t active_numa_partitions() const;
 
+  // Fills order[0, active_numa_partitions()) with the active NUMA partitions,
+  // those whose nodes have the least memory free first.
+  void PartitionsByPressure(int order[kNumaPartitions]) const;
+
+  // Prints the backed, free and unmapped memory of each NUMA partition.
+  void PrintNumaPartitions(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  void PrintNumaPartitionsInPbtxt(PbtxtRegion* region)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Returns span, once no release of its pages is pending.
+  Span* Fenced(Span* span) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    if (span != nullptr) {
+      release_queue_.Fence(span->first_page(), span->num_pages());
+    }
+    return span;
+  }
+
   static constexpr size_t kNumHeaps = kNumaPartitions + 2;
 
   union Choices {
@@ -145,6 +213,17 @@ class PageAllocator {
   PageAllocatorInterface* cold_impl_;
   Algorithm alg_;
   bool has_cold_impl_;
+#ifdef TCMALLOC_SIZE_CLASS_REGIONS
+  SizeClassRegions size_class_regions_;
+#endif
+  HugeDedicatedAllocator huge_dedicated_;
+  ReleaseQueue release_queue_;
+
+  // Memory free on the nodes of each NUMA partition, as of the last
+  // UpdateNumaPressure(), or kUnknownFreeBytes.
+  static constexpr size_t kUnknownFreeBytes = std::numeric_limits<size_t>::max();
+  std::atomic<size_t> numa_free_bytes_[kNumaPartitions];
+  std::atomic<int64_t> last_numa_update_{0};
 
   // Max size of backed spans we will attempt to maintain.
   // Crash if we can't maintain below limits_[kHard], which is guaranteed to be
@@ -188,20 +267,63 @@ inline PageAllocatorInterface* PageAllocator::impl(MemoryTag tag) const {
 
 inline Span* PageAllocator::New(Length n, SpanAllocInfo span_alloc_info,
                                 MemoryTag tag) {
-  return impl(tag)->New(n, span_alloc_info);
+  if (ABSL_PREDICT_FALSE(
+          HugeDedicatedAllocator::ShouldUse(n, Length(1), tag))) {
+    if (Span* span = huge_dedicated_.New(n, tag)) return span;
+  }
+  return Fenced(impl(tag)->New(n, span_alloc_info));
+}
+
+inline Span* PageAllocator::NewForSizeClass(size_t size_class, Length n,
+                                            SpanAllocInfo span_alloc_info,
+                                            MemoryTag tag) {
+#ifdef TCMALLOC_SIZE_CLASS_REGIONS
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (Span* span = size_class_regions_.New(size_class, n, tag)) {
+      return span;
+    }
+  }
+#endif
+  return New(n, span_alloc_info, tag);
 }
 
 inline Span* PageAllocator::NewAligned(Length n, Length align,
                                        SpanAllocInfo span_alloc_info,
                                        MemoryTag tag) {
-  return impl(tag)->NewAligned(n, align, span_alloc_info);
+  if (ABSL_PREDICT_FALSE(HugeDedicatedAllocator::ShouldUse(n, align, tag))) {
+    if (Span* span = huge_dedicated_.New(n, tag)) return span;
+  }
+  return Fenced(impl(tag)->NewAligned(n, align, span_alloc_info));
 }
 
 inline void PageAllocator::Delete(Span* span, size_t objects_per_span,
                                   MemoryTag tag) {
+#ifdef TCMALLOC_SIZE_CLASS_REGIONS
+  if (SizeClassRegions::Contains(span)) {
+    size_class_regions_.Delete(span);
+    return;
+  }
+#endif
+  if (ABSL_PREDICT_FALSE(huge_dedicated_.Contains(span))) {
+    huge_dedicated_.Delete(span);
+    return;
+  }
   impl(tag)->Delete(span, objects_per_span);
 }
 
+inline bool PageAllocator::TryGrow(Span* span, Length n, MemoryTag tag) {
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (ABSL_PREDICT_FALSE(huge_dedicated_.Contains(span))) {
+      return huge_dedicated_.TryGrow(span, n);
+    }
+  }
+  if (!impl(tag)->TryGrow(span, n)) return false;
+  Fenced(span);
+  return true;
+}
+
 inline BackingStats PageAllocator::stats() const {
   BackingStats ret = normal_impl_[0]->stats();
   for (int partition = 1; partition < active_numa_partitions(); partition++) {
@@ -211,6 +333,10 @@ inline BackingStats PageAllocator::stats() const {
   if (has_cold_impl_) {
     ret += cold_impl_->stats();
   }
+#ifdef TCMALLOC_SIZE_CLASS_REGIONS
+  ret += size_class_regions_.stats();
+#endif
+  ret += huge_dedicated_.stats();
   return ret;
 }
 
@@ -248,13 +374,21 @@ inline void PageAllocator::GetLargeSpanStats(LargeSpanStats* result) {
 
 inline Length PageAllocator::ReleaseAtLeastNPages(Length num_pages) {
   Length released;
+#ifdef TCMALLOC_SIZE_CLASS_REGIONS
+  // Free spans in size class regions are whole, so releasing them breaks up
+  // nothing.
+  released = size_class_regions_.ReleaseAtLeastNPages(num_pages);
+#endif
   // TODO(ckennelly): Refine this policy.  Cold data should be the most
   // resilient to not being on huge pages.
   if (has_cold_impl_) {
-    released = cold_impl_->ReleaseAtLeastNPages(num_pages);
+    released += cold_impl_->ReleaseAtLeastNPages(
+        num_pages > released ? num_pages - released : Length(0));
   }
-  for (int partition = 0; partition < active_numa_partitions(); partition++) {
-    released += normal_impl_[partition]->ReleaseAtLeastNPages(
+  int order[kNumaPartitions];
+  PartitionsByPressure(order);
+  for (size_t i = 0; i < active_numa_partitions(); i++) {
+    released += normal_impl_[order[i]]->ReleaseAtLeastNPages(
         num_pages > released ? num_pages - released : Length(0));
   }
 
@@ -275,6 +409,11 @@ inline void PageAllocator::Print(Printer* out, MemoryTag tag) {
   impl(tag)->Print(out);
   if (tag != MemoryTag::kNormal) {
     out->printf(">>>>>>> End %s page allocator <<<<<<<\n", label);
+  } else {
+    // These serve every normal partition, so they are reported once.
+    huge_dedicated_.Print(out);
+    release_queue_.Print(out);
+    PrintNumaPartitions(out);
   }
 }
 
@@ -283,9 +422,24 @@ inline void PageAllocator::PrintInPbtxt(PbtxtRegion* region, MemoryTag tag) {
     return;
   }
 
-  PbtxtRegion pa = region->CreateSubRegion("page_allocator");
-  pa.PrintRaw("tag", MemoryTagToLabel(tag));
-  impl(tag)->PrintInPbtxt(&pa);
+  {
+    PbtxtRegion pa = region->CreateSubRegion("page_allocator");
+    pa.PrintRaw("tag", MemoryTagToLabel(tag));
+    impl(tag)->PrintInPbtxt(&pa);
+  }
+  if (tag == MemoryTag::kNormal) {
+    // These serve every normal partition, so they are reported once, on
+    // their own.
+    {
+      PbtxtRegion hd = region->CreateSubRegion("huge_dedicated_allocator");
+      huge_dedicated_.PrintInPbtxt(&hd);
+    }
+    {
+      PbtxtRegion rq = region->CreateSubRegion("release_queue");
+      release_queue_.PrintInPbtxt(&rq);
+    }
+    PrintNumaPartitionsInPbtxt(region);
+  }
 }
 
 inline void PageAllocator::set_limit(size_t limit, LimitKind limit_kind) {
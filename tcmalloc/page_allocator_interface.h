@@ -56,6 +56,16 @@ class PageAllocatorInterface {
   virtual void Delete(Span* span, size_t num_objects)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
+  // Try to grow "span" in place to "n" pages by claiming the free pages
+  // immediately after it.  Returns false, leaving span untouched, if they are
+  // not available; implementations that cannot grow spans always do so.
+  // REQUIRES: span was returned by earlier call to New(), has not yet been
+  //           deleted, and n > span->num_pages().
+  virtual bool TryGrow(Span* span, Length n)
+      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    return false;
+  }
+
   virtual BackingStats stats() const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
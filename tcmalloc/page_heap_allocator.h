@@ -18,7 +18,9 @@
 #include <stddef.h>
 
 #include "absl/base/attributes.h"
+#include "absl/base/const_init.h"
 #include "absl/base/dynamic_annotations.h"
+#include "absl/base/internal/spinlock.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/arena.h"
@@ -40,8 +42,10 @@ struct AllocatorStats {
   size_t total;
 };
 
-// Simple allocator for objects of a specified type.  External locking
-// is required before accessing one of these objects.
+// Simple allocator for objects of a specified type.  Each allocator has its
+// own lock, so allocating, say, a Span does not contend with allocating a
+// ThreadCache, nor with the page heap.  The lock is ordered after
+// pageheap_lock and before the Arena's.
 template <class T>
 class PageHeapAllocator {
  public:
@@ -51,14 +55,14 @@ class PageHeapAllocator {
   // We use an explicit Init function because these variables are statically
   // allocated and their constructors might not have run by the time some
   // other static variable tries to allocate memory.
-  void Init(Arena* arena) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  void Init(Arena* arena) ABSL_LOCKS_EXCLUDED(lock_) {
     arena_ = arena;
     // Reserve some space at the beginning to avoid fragmentation.
     Delete(New());
   }
 
-  ABSL_ATTRIBUTE_RETURNS_NONNULL T* New()
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  ABSL_ATTRIBUTE_RETURNS_NONNULL T* New() ABSL_LOCKS_EXCLUDED(lock_) {
+    absl::base_internal::SpinLockHolder h(&lock_);
     // Consult free list
     T* result = free_list_;
     stats_.in_use++;
@@ -76,8 +80,8 @@ class PageHeapAllocator {
     return result;
   }
 
-  void Delete(T* p) ABSL_ATTRIBUTE_NONNULL()
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  void Delete(T* p) ABSL_ATTRIBUTE_NONNULL() ABSL_LOCKS_EXCLUDED(lock_) {
+    absl::base_internal::SpinLockHolder h(&lock_);
     *(reinterpret_cast<void**>(p)) = free_list_;
 #ifdef ABSL_HAVE_ADDRESS_SANITIZER
     // Poison the object on the freelist.  We do not dereference it after this
@@ -88,18 +92,23 @@ class PageHeapAllocator {
     stats_.in_use--;
   }
 
-  AllocatorStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  AllocatorStats stats() const ABSL_LOCKS_EXCLUDED(lock_) {
+    absl::base_internal::SpinLockHolder h(&lock_);
     return stats_;
   }
 
  private:
+  mutable absl::base_internal::SpinLock lock_ ABSL_ACQUIRED_AFTER(
+      pageheap_lock){absl::kConstInit,
+                     absl::base_internal::SCHEDULE_KERNEL_ONLY};
+
   // Arena from which to allocate memory
   Arena* arena_;
 
   // Free list of already carved objects
-  T* free_list_ ABSL_GUARDED_BY(pageheap_lock);
+  T* free_list_ ABSL_GUARDED_BY(lock_);
 
-  AllocatorStats stats_ ABSL_GUARDED_BY(pageheap_lock);
+  AllocatorStats stats_ ABSL_GUARDED_BY(lock_);
 };
 
 }  // namespace tcmalloc_internal
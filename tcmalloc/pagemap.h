@@ -29,10 +29,12 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <atomic>
 #include <optional>
 #include <vector>
 
 #include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/logging.h"
@@ -203,8 +205,15 @@ class PageMap2 {
 };
 
 // Three-level radix tree
-// Currently only used for TCMALLOC_SMALL_BUT_SLOW
-template <int BITS, PagemapAllocator Allocator>
+// Used for TCMALLOC_SMALL_BUT_SLOW, and for TCMALLOC_LA57, where a flat root
+// covering 57-bit addresses would be gigabytes.
+//
+// If CACHE_BITS is nonzero, sizeclass() and get_existing() first look in a
+// direct-mapped cache of 1 << CACHE_BITS recently used leaves, indexed by the
+// low bits of the leaf number.  A hit skips the root and mid-level loads,
+// leaving one dependent load before the leaf itself.  Each leaf records its
+// own number, so an entry that another leaf has replaced is just a miss.
+template <int BITS, PagemapAllocator Allocator, int CACHE_BITS = 0>
 class PageMap3 {
  private:
   // For x86 we currently have 48 usable bits, for POWER we have 46. With
@@ -237,6 +246,8 @@ class PageMap3 {
     CompactSizeClass sizeclass[kLeafLength];
     Span* span[kLeafLength];
     void* hugepage[kLeafHugepages];
+    // The page number of the first page covered, shifted down by kLeafBits.
+    uintptr_t leaf_number;
   };
 
   struct Node {
@@ -244,13 +255,44 @@ class PageMap3 {
     Leaf* leafs[kMidLength];
   };
 
+  static_assert(CACHE_BITS >= 0 && CACHE_BITS <= kLeafBits + kMidBits);
+  static constexpr int kCacheLength = 1 << CACHE_BITS;
+
   Node* root_[kRootLength];  // Top-level node
+  // Leaf cache; unused if CACHE_BITS is zero.  Entries are only ever null or
+  // point at a live leaf, since leaves are never freed.
+  mutable std::atomic<Leaf*> leaf_cache_[kCacheLength];
   size_t bytes_used_;
 
+  // Returns the leaf covering k, which must have been Ensure()d.
+  ABSL_ATTRIBUTE_ALWAYS_INLINE const Leaf* FindLeaf(uintptr_t k) const
+      ABSL_NO_THREAD_SAFETY_ANALYSIS {
+    const uintptr_t leaf_number = k >> kLeafBits;
+    std::atomic<Leaf*>* entry = nullptr;
+    if constexpr (CACHE_BITS > 0) {
+      entry = &leaf_cache_[leaf_number & (kCacheLength - 1)];
+      const Leaf* leaf = entry->load(std::memory_order_relaxed);
+      if (ABSL_PREDICT_TRUE(leaf != nullptr &&
+                            leaf->leaf_number == leaf_number)) {
+        return leaf;
+      }
+    }
+    const uintptr_t i1 = k >> (kLeafBits + kMidBits);
+    const uintptr_t i2 = (k >> kLeafBits) & (kMidLength - 1);
+    ASSERT((k >> BITS) == 0);
+    ASSERT(root_[i1] != nullptr);
+    Leaf* leaf = root_[i1]->leafs[i2];
+    ASSERT(leaf != nullptr);
+    if constexpr (CACHE_BITS > 0) {
+      entry->store(leaf, std::memory_order_relaxed);
+    }
+    return leaf;
+  }
+
  public:
   typedef uintptr_t Number;
 
-  constexpr PageMap3() : root_{}, bytes_used_(0) {}
+  constexpr PageMap3() : root_{}, leaf_cache_{}, bytes_used_(0) {}
 
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
   void* get(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
@@ -286,26 +328,14 @@ class PageMap3 {
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
   // Requires that the span is known to already exist.
   Span* get_existing(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
-    const Number i1 = k >> (kLeafBits + kMidBits);
-    const Number i2 = (k >> kLeafBits) & (kMidLength - 1);
-    const Number i3 = k & (kLeafLength - 1);
-    ASSERT((k >> BITS) == 0);
-    ASSERT(root_[i1] != nullptr);
-    ASSERT(root_[i1]->leafs[i2] != nullptr);
-    return root_[i1]->leafs[i2]->span[i3];
+    return FindLeaf(k)->span[k & (kLeafLength - 1)];
   }
 
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
   // REQUIRES: Must be a valid page number previously Ensure()d.
   CompactSizeClass ABSL_ATTRIBUTE_ALWAYS_INLINE
   sizeclass(Number k) const ABSL_NO_THREAD_SAFETY_ANALYSIS {
-    const Number i1 = k >> (kLeafBits + kMidBits);
-    const Number i2 = (k >> kLeafBits) & (kMidLength - 1);
-    const Number i3 = k & (kLeafLength - 1);
-    ASSERT((k >> BITS) == 0);
-    ASSERT(root_[i1] != nullptr);
-    ASSERT(root_[i1]->leafs[i2] != nullptr);
-    return root_[i1]->leafs[i2]->sizeclass[i3];
+    return FindLeaf(k)->sizeclass[k & (kLeafLength - 1)];
   }
 
   void set(Number k, Span* s) {
@@ -377,6 +407,7 @@ class PageMap3 {
         if (leaf == nullptr) return false;
         bytes_used_ += sizeof(Leaf);
         memset(leaf, 0, sizeof(*leaf));
+        leaf->leaf_number = key >> kLeafBits;
         root_[i1]->leafs[i2] = leaf;
       }
 
@@ -392,6 +423,15 @@ class PageMap3 {
   const void* RootAddress() { return root_; }
 };
 
+// The free path looks up the size class of every object it is not told the
+// size of.  With the deeper pagemap of TCMALLOC_LA57, cache enough leaves to
+// cover 16 GiB of address space with 8 KiB pages.
+#ifdef TCMALLOC_LA57
+inline constexpr int kPageMapLeafCacheBits = 6;
+#else
+inline constexpr int kPageMapLeafCacheBits = 0;
+#endif
+
 class PageMap {
  public:
   constexpr PageMap() : map_{} {}
@@ -495,7 +535,8 @@ class PageMap {
 
  private:
 #ifdef TCMALLOC_USE_PAGEMAP3
-  PageMap3<kAddressBits - kPageShift, MetaDataAlloc> map_;
+  PageMap3<kAddressBits - kPageShift, MetaDataAlloc, kPageMapLeafCacheBits>
+      map_;
 #else
   PageMap2<kAddressBits - kPageShift, MetaDataAlloc> map_;
 #endif
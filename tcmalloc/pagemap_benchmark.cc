@@ -0,0 +1,105 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "benchmark/benchmark.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pagemap.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Maps never free their nodes, so remember them for FreeNodes().
+std::vector<void*>* Nodes() {
+  static std::vector<void*>* nodes = new std::vector<void*>();
+  return nodes;
+}
+
+void* Alloc(size_t bytes) {
+  void* ptr = ::operator new(bytes);
+  Nodes()->push_back(ptr);
+  return ptr;
+}
+
+void FreeNodes() {
+  for (void* ptr : *Nodes()) {
+    ::operator delete(ptr);
+  }
+  Nodes()->clear();
+}
+
+using FlatRootMap = PageMap2<48 - kPageShift, Alloc>;
+// The maps TCMALLOC_LA57 uses, without and with the leaf cache.
+using ThreeLevelMap = PageMap3<57 - kPageShift, Alloc>;
+using CachedThreeLevelMap = PageMap3<57 - kPageShift, Alloc, 6>;
+
+// Measures the latency of the size class lookup at the start of every free
+// that is not given a size.  range(0) random pages from a 64 GiB region are
+// looked up in a random order, each lookup depending on the one before.
+template <typename Map>
+void BM_sizeclass_lookup(benchmark::State& state) {
+  const size_t num_pages = state.range(0);
+  auto map = std::make_unique<Map>();
+
+  constexpr uintptr_t kRegionStart = uintptr_t{1} << (43 - kPageShift);
+  constexpr uintptr_t kRegionPages = uintptr_t{1} << (36 - kPageShift);
+  CHECK_CONDITION(map->Ensure(kRegionStart, kRegionPages));
+
+  absl::BitGen rng;
+  std::vector<uintptr_t> pages;
+  while (pages.size() < num_pages) {
+    const uintptr_t page =
+        kRegionStart + absl::Uniform<uintptr_t>(rng, 0, kRegionPages);
+    if (map->sizeclass(page) != 0) continue;
+    // Every lookup returns 1, which the next index depends on.
+    map->set_with_sizeclass(page, nullptr, 1);
+    pages.push_back(page);
+  }
+  std::shuffle(pages.begin(), pages.end(), rng);
+
+  const size_t mask = num_pages - 1;
+  size_t i = 0;
+  for (auto s : state) {
+    i = (i + map->sizeclass(pages[i])) & mask;
+  }
+  benchmark::DoNotOptimize(i);
+
+  map.reset();
+  FreeNodes();
+}
+
+BENCHMARK_TEMPLATE(BM_sizeclass_lookup, FlatRootMap)
+    ->RangeMultiplier(4)
+    ->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_sizeclass_lookup, ThreeLevelMap)
+    ->RangeMultiplier(4)
+    ->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_sizeclass_lookup, CachedThreeLevelMap)
+    ->RangeMultiplier(4)
+    ->Range(16, 1 << 16);
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -21,6 +21,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <memory>
 #include <new>
 #include <string>
 #include <vector>
@@ -135,6 +136,80 @@ TEST_P(PageMapTest, RandomAccess) {
 
 INSTANTIATE_TEST_SUITE_P(Limits, PageMapTest, ::testing::Values(100, 1 << 20));
 
+class PageMap3Test : public ::testing::Test {
+ public:
+  static void* alloc(size_t n) {
+    void* ptr = ::operator new(n);
+    ptrs()->push_back(ptr);
+    return ptr;
+  }
+
+  ~PageMap3Test() override {
+    for (void* ptr : *ptrs()) {
+      ::operator delete(ptr);
+    }
+    ptrs()->clear();
+  }
+
+ private:
+  static std::vector<void*>* ptrs() {
+    static std::vector<void*>* ret = new std::vector<void*>();
+    return ret;
+  }
+};
+
+// Sized like the map for 57-bit addresses and 8 KiB pages, with a leaf cache
+// small enough that the test leaves evict one another.
+using CachedMap = PageMap3<44, PageMap3Test::alloc, 2>;
+
+TEST_F(PageMap3Test, CachedLookups) {
+  auto map = std::make_unique<CachedMap>();
+
+  // Pages in 16 different leaves, spread across the top-level nodes too.
+  std::vector<uintptr_t> pages;
+  for (uintptr_t i = 0; i < 16; ++i) {
+    const uintptr_t page = (i * 0x9e3779b9ul) & ((uintptr_t{1} << 44) - 1);
+    ASSERT_TRUE(map->Ensure(page, 1));
+    map->set_with_sizeclass(page, span(page), sc(page));
+    pages.push_back(page);
+  }
+
+  // Lookups must be right whichever leaf currently holds the cache entry.
+  absl::BitGen rng;
+  for (int round = 0; round < 1000; ++round) {
+    const uintptr_t page = pages[absl::Uniform<size_t>(rng, 0, pages.size())];
+    ASSERT_EQ(map->sizeclass(page), sc(page)) << page;
+    ASSERT_EQ(map->get_existing(page), span(page)) << page;
+    ASSERT_EQ(map->get(page), span(page)) << page;
+  }
+
+  // Updates are seen through cached leaves.
+  for (uintptr_t page : pages) {
+    ASSERT_EQ(map->sizeclass(page), sc(page));
+    map->clear_sizeclass(page);
+    ASSERT_EQ(map->sizeclass(page), 0);
+  }
+}
+
+TEST_F(PageMap3Test, CachedAndUncachedAgree) {
+  auto cached = std::make_unique<CachedMap>();
+  auto uncached = std::make_unique<PageMap3<44, PageMap3Test::alloc>>();
+
+  const uintptr_t base = uintptr_t{1} << 40;
+  const uintptr_t n = uintptr_t{1} << 17;  // Several leaves.
+  ASSERT_TRUE(cached->Ensure(base, n));
+  ASSERT_TRUE(uncached->Ensure(base, n));
+  for (uintptr_t i = 0; i < n; i += 7) {
+    cached->set_with_sizeclass(base + i, span(i), sc(i));
+    uncached->set_with_sizeclass(base + i, span(i), sc(i));
+  }
+  for (uintptr_t i = 0; i < n; ++i) {
+    ASSERT_EQ(cached->sizeclass(base + i), uncached->sizeclass(base + i));
+    ASSERT_EQ(cached->get_existing(base + i),
+              uncached->get_existing(base + i));
+  }
+}
+
 // Surround pagemap with unused memory. This isolates it so that it does not
 // share pages with any other structures. This avoids the risk that adjacent
 // objects might cause it to be mapped in. The padding is of sufficient size
@@ -13,6 +13,7 @@
 // limitations under the License.
 #include "tcmalloc/parameters.h"
 
+#include <algorithm>
 #include <atomic>
 #include <limits>
 
@@ -123,6 +124,8 @@ ABSL_CONST_INIT std::atomic<int64_t> Parameters::guarded_sampling_rate_(
     50 * kDefaultProfileSamplingRate);
 ABSL_CONST_INIT std::atomic<bool>
     Parameters::resize_cpu_cache_size_classes_enabled_(true);
+ABSL_CONST_INIT std::atomic<bool>
+    Parameters::predictive_cpu_cache_capacity_enabled_(false);
 // TODO(b/263387812): remove when experimentation is complete
 ABSL_CONST_INIT std::atomic<bool> Parameters::improved_guarded_sampling_(true);
 ABSL_CONST_INIT std::atomic<bool> Parameters::release_partial_alloc_pages_(
@@ -143,16 +146,35 @@ ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_enabled_(
 ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_dynamic_slab_(
     true);
 ABSL_CONST_INIT std::atomic<bool> Parameters::madvise_free_(false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::fast_unwind_sampled_stacks_(
+    false);
+ABSL_CONST_INIT std::atomic<bool> Parameters::realloc_remap_(false);
 ABSL_CONST_INIT std::atomic<tcmalloc::hot_cold_t>
     Parameters::min_hot_access_hint_(static_cast<tcmalloc::hot_cold_t>(128));
 ABSL_CONST_INIT std::atomic<double>
     Parameters::per_cpu_caches_dynamic_slab_grow_threshold_(0.9);
 ABSL_CONST_INIT std::atomic<double>
     Parameters::per_cpu_caches_dynamic_slab_shrink_threshold_(0.4);
+ABSL_CONST_INIT std::atomic<int32_t>
+    Parameters::sharded_transfer_cache_remote_steal_threshold_(8);
+ABSL_CONST_INIT std::atomic<int64_t> Parameters::stats_snapshot_staleness_ns_(
+    0);
+ABSL_CONST_INIT std::atomic<size_t> Parameters::huge_dedicated_threshold_(0);
 
 ABSL_CONST_INIT std::atomic<int64_t> Parameters::profile_sampling_rate_(
     kDefaultProfileSamplingRate);
 
+absl::Duration Parameters::background_action_period(
+    MallocExtension::BackgroundAction action) {
+  return tc_globals.background_scheduler().base_period(action);
+}
+
+void Parameters::set_background_action_period(
+    MallocExtension::BackgroundAction action, absl::Duration value) {
+  // The scheduler rejects unknown actions and periods that are not positive.
+  (void)tc_globals.background_scheduler().set_base_period(action, value);
+}
+
 absl::Duration Parameters::filler_skip_subrelease_interval() {
   return absl::Nanoseconds(
       skip_subrelease_interval_ns().load(std::memory_order_relaxed));
@@ -230,6 +252,7 @@ static bool want_disable_dynamic_slabs() {
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
 
+using tcmalloc::tcmalloc_internal::kHugePageSize;
 using tcmalloc::tcmalloc_internal::kLog;
 using tcmalloc::tcmalloc_internal::Log;
 using tcmalloc::tcmalloc_internal::Parameters;
@@ -299,6 +322,22 @@ void MallocExtension_Internal_SetSkipSubreleaseLongInterval(
   Parameters::set_filler_skip_subrelease_long_interval(value);
 }
 
+void MallocExtension_Internal_GetStatsSnapshotStaleness(absl::Duration* ret) {
+  *ret = Parameters::stats_snapshot_staleness();
+}
+
+void MallocExtension_Internal_SetStatsSnapshotStaleness(absl::Duration value) {
+  Parameters::set_stats_snapshot_staleness(value);
+}
+
+size_t MallocExtension_Internal_GetHugeDedicatedThreshold() {
+  return Parameters::huge_dedicated_threshold();
+}
+
+void MallocExtension_Internal_SetHugeDedicatedThreshold(size_t value) {
+  Parameters::set_huge_dedicated_threshold(value);
+}
+
 tcmalloc::MallocExtension::BytesPerSecond
 MallocExtension_Internal_GetBackgroundReleaseRate() {
   return Parameters::background_release_rate();
@@ -309,6 +348,16 @@ void MallocExtension_Internal_SetBackgroundReleaseRate(
   Parameters::set_background_release_rate(rate);
 }
 
+void MallocExtension_Internal_GetBackgroundActionPeriod(
+    tcmalloc::MallocExtension::BackgroundAction action, absl::Duration* ret) {
+  *ret = Parameters::background_action_period(action);
+}
+
+void MallocExtension_Internal_SetBackgroundActionPeriod(
+    tcmalloc::MallocExtension::BackgroundAction action, absl::Duration value) {
+  Parameters::set_background_action_period(action, value);
+}
+
 void TCMalloc_Internal_SetBackgroundReleaseRate(size_t value) {
   tcmalloc::tcmalloc_internal::malloc_release_rate().store(
       static_cast<tcmalloc::MallocExtension::BytesPerSecond>(value),
@@ -329,6 +378,10 @@ bool TCMalloc_Internal_GetResizeCpuCacheSizeClassesEnabled() {
   return Parameters::resize_cpu_cache_size_classes();
 }
 
+bool TCMalloc_Internal_GetPredictiveCpuCacheCapacityEnabled() {
+  return Parameters::predictive_cpu_cache_capacity();
+}
+
 bool TCMalloc_Internal_GetReleasePartialAllocPagesEnabled() {
   return Parameters::release_partial_alloc_pages();
 }
@@ -386,6 +439,11 @@ void TCMalloc_Internal_SetResizeCpuCacheSizeClassesEnabled(bool v) {
       v, std::memory_order_relaxed);
 }
 
+void TCMalloc_Internal_SetPredictiveCpuCacheCapacityEnabled(bool v) {
+  Parameters::predictive_cpu_cache_capacity_enabled_.store(
+      v, std::memory_order_relaxed);
+}
+
 void TCMalloc_Internal_SetReleasePartialAllocPagesEnabled(bool v) {
   Parameters::release_partial_alloc_pages_.store(v, std::memory_order_relaxed);
 }
@@ -482,12 +540,56 @@ void TCMalloc_Internal_SetPerCpuCachesDynamicSlabShrinkThreshold(double v) {
       v, std::memory_order_relaxed);
 }
 
+int32_t TCMalloc_Internal_GetShardedTransferCacheRemoteStealThreshold() {
+  return Parameters::sharded_transfer_cache_remote_steal_threshold();
+}
+
+void TCMalloc_Internal_SetShardedTransferCacheRemoteStealThreshold(int32_t v) {
+  Parameters::sharded_transfer_cache_remote_steal_threshold_.store(
+      v, std::memory_order_relaxed);
+}
+
+void TCMalloc_Internal_GetStatsSnapshotStaleness(absl::Duration* v) {
+  *v = Parameters::stats_snapshot_staleness();
+}
+
+void TCMalloc_Internal_SetStatsSnapshotStaleness(absl::Duration v) {
+  Parameters::stats_snapshot_staleness_ns_.store(
+      std::max<int64_t>(absl::ToInt64Nanoseconds(v), 0),
+      std::memory_order_relaxed);
+}
+
+size_t TCMalloc_Internal_GetHugeDedicatedThreshold() {
+  return Parameters::huge_dedicated_threshold();
+}
+
+void TCMalloc_Internal_SetHugeDedicatedThreshold(size_t v) {
+  // HugeDedicatedAllocator::Contains() relies on its spans being at least a
+  // hugepage long.
+  Parameters::huge_dedicated_threshold_.store(
+      v == 0 ? 0 : std::max(v, kHugePageSize), std::memory_order_relaxed);
+}
+
 bool TCMalloc_Internal_GetMadviseFree() { return Parameters::madvise_free(); }
 
 void TCMalloc_Internal_SetMadviseFree(bool v) {
   Parameters::madvise_free_.store(v, std::memory_order_relaxed);
 }
 
+bool TCMalloc_Internal_GetFastUnwindSampledStacks() {
+  return Parameters::fast_unwind_sampled_stacks();
+}
+
+void TCMalloc_Internal_SetFastUnwindSampledStacks(bool v) {
+  Parameters::fast_unwind_sampled_stacks_.store(v, std::memory_order_relaxed);
+}
+
+bool TCMalloc_Internal_GetReallocRemap() { return Parameters::realloc_remap(); }
+
+void TCMalloc_Internal_SetReallocRemap(bool v) {
+  Parameters::realloc_remap_.store(v, std::memory_order_relaxed);
+}
+
 uint8_t TCMalloc_Internal_GetMinHotAccessHint() {
   return static_cast<uint8_t>(Parameters::min_hot_access_hint());
 }
@@ -40,6 +40,11 @@ class Parameters {
     TCMalloc_Internal_SetBackgroundReleaseRate(static_cast<size_t>(value));
   }
 
+  static absl::Duration background_action_period(
+      MallocExtension::BackgroundAction action);
+  static void set_background_action_period(
+      MallocExtension::BackgroundAction action, absl::Duration value);
+
   static uint64_t heap_size_hard_limit();
   static void set_heap_size_hard_limit(uint64_t value);
 
@@ -82,6 +87,28 @@ class Parameters {
     TCMalloc_Internal_SetMadviseFree(value);
   }
 
+  // Whether sampled allocations capture their stacks by walking frame
+  // pointers rather than with absl::GetStackTrace().
+  static bool fast_unwind_sampled_stacks() {
+    return fast_unwind_sampled_stacks_.load(std::memory_order_relaxed);
+  }
+
+  static void set_fast_unwind_sampled_stacks(bool value) {
+    TCMalloc_Internal_SetFastUnwindSampledStacks(value);
+  }
+
+  // Whether realloc moves the pages of very large allocations with mremap
+  // rather than copying them.  Off by default: the moved-from pages stay
+  // counted as backed until they are released, and the moved pages lose the
+  // NUMA and hugepage policy of the range they are moved into.
+  static bool realloc_remap() {
+    return realloc_remap_.load(std::memory_order_relaxed);
+  }
+
+  static void set_realloc_remap(bool value) {
+    TCMalloc_Internal_SetReallocRemap(value);
+  }
+
   static tcmalloc::hot_cold_t min_hot_access_hint() {
     return min_hot_access_hint_.load(std::memory_order_relaxed);
   }
@@ -107,6 +134,13 @@ class Parameters {
         std::memory_order_relaxed);
   }
 
+  // Whether per-CPU cache capacity is shuffled by forecast demand rather
+  // than by the misses of the last interval (see CpuCache).
+  static bool predictive_cpu_cache_capacity() {
+    return predictive_cpu_cache_capacity_enabled_.load(
+        std::memory_order_relaxed);
+  }
+
   static bool release_partial_alloc_pages() {
     return release_partial_alloc_pages_.load(std::memory_order_relaxed);
   }
@@ -181,6 +215,38 @@ class Parameters {
     TCMalloc_Internal_SetPerCpuCachesDynamicSlabShrinkThreshold(value);
   }
 
+  // Number of consecutive misses in a NUMA-aware sharded transfer cache shard,
+  // not satisfied by other shards on the same node, after which the shard
+  // starts stealing objects from shards on other nodes.
+  static int32_t sharded_transfer_cache_remote_steal_threshold() {
+    return sharded_transfer_cache_remote_steal_threshold_.load(
+        std::memory_order_relaxed);
+  }
+  static void set_sharded_transfer_cache_remote_steal_threshold(int32_t value) {
+    TCMalloc_Internal_SetShardedTransferCacheRemoteStealThreshold(value);
+  }
+
+  // How old a stats snapshot GetNumericProperty() may return for the commonly
+  // polled properties, which it then answers without taking pageheap_lock.
+  // Zero disables the snapshot.
+  static absl::Duration stats_snapshot_staleness() {
+    return absl::Nanoseconds(
+        stats_snapshot_staleness_ns_.load(std::memory_order_relaxed));
+  }
+  static void set_stats_snapshot_staleness(absl::Duration value) {
+    TCMalloc_Internal_SetStatsSnapshotStaleness(value);
+  }
+
+  // Normal-tagged page allocations of at least this many bytes get their own
+  // hugepage-aligned mapping (see HugeDedicatedAllocator).  Zero disables this;
+  // other values are raised to at least kHugePageSize.
+  static size_t huge_dedicated_threshold() {
+    return huge_dedicated_threshold_.load(std::memory_order_relaxed);
+  }
+  static void set_huge_dedicated_threshold(size_t value) {
+    TCMalloc_Internal_SetHugeDedicatedThreshold(value);
+  }
+
   static bool separate_allocs_for_few_and_many_objects_spans();
   static size_t chunks_per_alloc();
 
@@ -191,6 +257,7 @@ class Parameters {
   friend void ::TCMalloc_Internal_SetImprovedGuardedSampling(bool v);
   friend void ::TCMalloc_Internal_SetHPAASubrelease(bool v);
   friend void ::TCMalloc_Internal_SetResizeCpuCacheSizeClassesEnabled(bool v);
+  friend void ::TCMalloc_Internal_SetPredictiveCpuCacheCapacityEnabled(bool v);
   friend void ::TCMalloc_Internal_SetReleasePartialAllocPagesEnabled(bool v);
   friend void ::TCMalloc_Internal_SetReleasePagesFromHugeRegionEnabled(bool v);
   friend void ::TCMalloc_Internal_SetMaxPerCpuCacheSize(int32_t v);
@@ -211,15 +278,23 @@ class Parameters {
   friend void ::TCMalloc_Internal_SetPerCpuCachesDynamicSlabShrinkThreshold(
       double v);
 
+  friend void ::TCMalloc_Internal_SetShardedTransferCacheRemoteStealThreshold(
+      int32_t v);
+  friend void ::TCMalloc_Internal_SetStatsSnapshotStaleness(absl::Duration v);
+  friend void ::TCMalloc_Internal_SetHugeDedicatedThreshold(size_t v);
+
   friend void TCMalloc_Internal_SetLifetimeAllocatorOptions(
       absl::string_view s);
   friend void ::TCMalloc_Internal_SetMadviseFree(bool v);
+  friend void ::TCMalloc_Internal_SetFastUnwindSampledStacks(bool v);
+  friend void ::TCMalloc_Internal_SetReallocRemap(bool v);
   friend void ::TCMalloc_Internal_SetMinHotAccessHint(uint8_t v);
 
   static std::atomic<int64_t> guarded_sampling_rate_;
   // TODO(b/263387812): remove when experimentation is complete
   static std::atomic<bool> improved_guarded_sampling_;
   static std::atomic<bool> resize_cpu_cache_size_classes_enabled_;
+  static std::atomic<bool> predictive_cpu_cache_capacity_enabled_;
   static std::atomic<int32_t> max_per_cpu_cache_size_;
   static std::atomic<int64_t> max_total_thread_cache_bytes_;
   static std::atomic<double> peak_sampling_heap_growth_fraction_;
@@ -229,9 +304,14 @@ class Parameters {
   static std::atomic<int64_t> profile_sampling_rate_;
   static std::atomic<bool> per_cpu_caches_dynamic_slab_;
   static std::atomic<bool> madvise_free_;
+  static std::atomic<bool> fast_unwind_sampled_stacks_;
+  static std::atomic<bool> realloc_remap_;
   static std::atomic<tcmalloc::hot_cold_t> min_hot_access_hint_;
   static std::atomic<double> per_cpu_caches_dynamic_slab_grow_threshold_;
   static std::atomic<double> per_cpu_caches_dynamic_slab_shrink_threshold_;
+  static std::atomic<int32_t> sharded_transfer_cache_remote_steal_threshold_;
+  static std::atomic<int64_t> stats_snapshot_staleness_ns_;
+  static std::atomic<size_t> huge_dedicated_threshold_;
 };
 
 }  // namespace tcmalloc_internal
@@ -0,0 +1,198 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/release_queue.h"
+
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/system-alloc.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+bool ReleaseQueue::Enqueue(void* start, size_t length) {
+  if (defer_depth_.load(std::memory_order_relaxed) == 0 &&
+      !worker_active_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  ASSERT(length > 0);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(start);
+  if (!Push(begin, begin + length)) return false;
+
+  // Pairs with WaitForEnqueue(): either the worker sees the new epoch before
+  // it sleeps, or we see that it is waiting and wake it.
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  if (waiting_.exchange(false, std::memory_order_seq_cst)) {
+    syscall(SYS_futex, &epoch_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+  return true;
+}
+
+bool ReleaseQueue::Push(uintptr_t begin, uintptr_t end) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  // Releases tend to come in address order, so most ranges that can be
+  // coalesced adjoin the last one.
+  if (num_queued_ > 0) {
+    Range& last = queued_[num_queued_ - 1];
+    if (last.end == begin) {
+      last.end = end;
+      ++enqueued_;
+      ++coalesced_;
+      return true;
+    }
+    if (end == last.start) {
+      last.start = begin;
+      ++enqueued_;
+      ++coalesced_;
+      return true;
+    }
+  }
+  if (num_queued_ == kCapacity) {
+    ++overflows_;
+    return false;
+  }
+  ++enqueued_;
+  queued_[num_queued_++] = {begin, end};
+  pending_.store(num_queued_ + num_in_flight_, std::memory_order_release);
+  return true;
+}
+
+void ReleaseQueue::WaitForEnqueue(uint32_t epoch) {
+  static_assert(sizeof(epoch_) == sizeof(int), "futexes are 32 bits");
+  waiting_.store(true, std::memory_order_seq_cst);
+  if (epoch_.load(std::memory_order_seq_cst) == epoch) {
+    // Returns at once if an Enqueue() has bumped the epoch since; a signal or
+    // a stale wake-up only costs the caller another Drain().
+    syscall(SYS_futex, &epoch_, FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr,
+            0);
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+}
+
+size_t ReleaseQueue::Drain() {
+  absl::base_internal::SpinLockHolder d(&drain_lock_);
+  AddressRange ranges[kCapacity];
+  size_t num_ranges = 0;
+  size_t bytes = 0;
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    if (num_queued_ == 0) return 0;
+    ASSERT(num_in_flight_ == 0);
+
+    std::sort(queued_, queued_ + num_queued_,
+              [](const Range& a, const Range& b) { return a.start < b.start; });
+    for (size_t i = 0; i < num_queued_; ++i) {
+      const Range& r = queued_[i];
+      if (num_in_flight_ > 0 && in_flight_[num_in_flight_ - 1].end == r.start) {
+        in_flight_[num_in_flight_ - 1].end = r.end;
+        ++coalesced_;
+      } else {
+        in_flight_[num_in_flight_++] = r;
+      }
+    }
+    num_queued_ = 0;
+    pending_.store(num_in_flight_, std::memory_order_release);
+
+    for (size_t i = 0; i < num_in_flight_; ++i) {
+      const Range& r = in_flight_[i];
+      ranges[num_ranges++] = {reinterpret_cast<void*>(r.start),
+                              r.end - r.start};
+      bytes += r.end - r.start;
+    }
+  }
+
+  const size_t batched = SystemReleaseBatch(ranges, num_ranges);
+
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    num_in_flight_ = 0;
+    pending_.store(num_queued_, std::memory_order_release);
+  }
+  ++drains_;
+  ranges_released_ += num_ranges;
+  ranges_batched_ += batched;
+  bytes_released_ += bytes;
+  return bytes;
+}
+
+bool ReleaseQueue::Overlaps(uintptr_t start, uintptr_t end) const {
+  auto overlaps = [&](const Range* ranges, size_t n) {
+    return std::any_of(ranges, ranges + n, [&](const Range& r) {
+      return r.start < end && start < r.end;
+    });
+  };
+  return overlaps(queued_, num_queued_) ||
+         overlaps(in_flight_, num_in_flight_);
+}
+
+void ReleaseQueue::FenceSlow(PageId p, Length n) {
+  const uintptr_t start = p.start_uintptr();
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    if (!Overlaps(start, start + n.in_bytes())) return;
+    ++fence_waits_;
+  }
+  // Once the pages are handed out nothing releases them again, so the range
+  // cannot be queued anew after this.
+  Drain();
+}
+
+void ReleaseQueue::Print(Printer* out) {
+  static const double MiB = 1048576.0;
+  absl::base_internal::SpinLockHolder d(&drain_lock_);
+  absl::base_internal::SpinLockHolder h(&lock_);
+  out->printf("------------------------------------------------\n");
+  out->printf(
+      "ReleaseQueue: %zu ranges pending; %lld queued (%lld coalesced), "
+      "%lld released synchronously because the queue was full\n",
+      num_queued_, enqueued_, coalesced_, overflows_);
+  out->printf(
+      "ReleaseQueue: %lld drains released %lld ranges (%.1f MiB), "
+      "%lld of them in process_madvise batches\n",
+      drains_, ranges_released_, bytes_released_ / MiB, ranges_batched_);
+  out->printf(
+      "ReleaseQueue: %lld allocations waited for a pending release\n",
+      fence_waits_);
+}
+
+void ReleaseQueue::PrintInPbtxt(PbtxtRegion* region) {
+  absl::base_internal::SpinLockHolder d(&drain_lock_);
+  absl::base_internal::SpinLockHolder h(&lock_);
+  region->PrintI64("pending_ranges", num_queued_);
+  region->PrintI64("enqueued_ranges", enqueued_);
+  region->PrintI64("coalesced_ranges", coalesced_);
+  region->PrintI64("overflows", overflows_);
+  region->PrintI64("drains", drains_);
+  region->PrintI64("released_ranges", ranges_released_);
+  region->PrintI64("batched_ranges", ranges_batched_);
+  region->PrintI64("released_bytes", bytes_released_);
+  region->PrintI64("fence_waits", fence_waits_);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,176 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_RELEASE_QUEUE_H_
+#define TCMALLOC_RELEASE_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/const_init.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Ranges the HugePageAwareAllocator has given up on, waiting to be released
+// to the OS once pageheap_lock is no longer held.  The allocator decides what
+// to release (and accounts for it as unmapped) under the lock, but the
+// madvise calls, which take the kernel's mmap lock and can be slow, are made
+// by Drain() afterwards: by the thread that asked for the release (see
+// DeferScope), or by a thread running MallocExtension::ProcessReleaseQueue().
+// Drain coalesces adjacent ranges and issues them in batches (see
+// SystemReleaseBatch).
+//
+// Since released pages are immediately free for reuse, a range may be handed
+// out again before its release is issued.  PageAllocator calls Fence() on
+// every span it returns, which drains the queue if the span overlaps a range
+// that is queued or being released, so that no release can wipe out memory
+// that is in use.
+class ReleaseQueue {
+ public:
+  constexpr ReleaseQueue() = default;
+
+  ReleaseQueue(const ReleaseQueue&) = delete;
+  ReleaseQueue& operator=(const ReleaseQueue&) = delete;
+
+  // Defers the releases made while it holds pageheap_lock, for its owner to
+  // Drain() once it has dropped the lock.
+  class DeferScope {
+   public:
+    explicit DeferScope(ReleaseQueue& queue)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock)
+        : queue_(queue) {
+      queue_.defer_depth_.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~DeferScope() ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+      ASSERT(queue_.defer_depth_.load(std::memory_order_relaxed) > 0);
+      queue_.defer_depth_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    DeferScope(const DeferScope&) = delete;
+    DeferScope& operator=(const DeferScope&) = delete;
+
+   private:
+    ReleaseQueue& queue_;
+  };
+
+  // Queues [start, start + length) to be released by Drain(), if releases are
+  // being deferred.  Returns false, queuing nothing, if they are not or if the
+  // queue is full; the caller must then release the range itself.
+  bool Enqueue(void* start, size_t length)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Releases every queued range to the OS, and waits for any concurrent
+  // Drain() to finish.  Returns the number of bytes released.
+  size_t Drain() ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  // Ensures that no release of [p, p + n) is still to come, so that the pages
+  // can be handed out.
+  void Fence(PageId p, Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    if (ABSL_PREDICT_TRUE(pending_.load(std::memory_order_acquire) == 0)) {
+      return;
+    }
+    FenceSlow(p, n);
+  }
+
+  // Defers every release from now on, for a thread running
+  // MallocExtension::ProcessReleaseQueue() to Drain().
+  void AddWorker() { worker_active_.store(true, std::memory_order_relaxed); }
+
+  // Returns the number of Enqueue() calls so far, for WaitForEnqueue().
+  uint32_t enqueue_epoch() const {
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  // Blocks the worker until a range is queued after enqueue_epoch() returned
+  // epoch.  It may return early, so the worker must Drain() and check again.
+  void WaitForEnqueue(uint32_t epoch);
+
+  void Print(Printer* out) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  void PrintInPbtxt(PbtxtRegion* region) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+ private:
+  // Large enough for a round of releases from the filler and cache to fit
+  // after coalescing; an overflow only costs a synchronous release.
+  static constexpr size_t kCapacity = 256;
+
+  struct Range {
+    uintptr_t start;
+    uintptr_t end;
+  };
+
+  // Adds [begin, end) to queued_, returning false if there is no room.
+  bool Push(uintptr_t begin, uintptr_t end) ABSL_LOCKS_EXCLUDED(lock_);
+
+  void FenceSlow(PageId p, Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+
+  bool Overlaps(uintptr_t start, uintptr_t end) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Held for the whole of a Drain(), so that a fence that finds its range in
+  // flight can wait for the release to be issued.  Acquired before lock_.
+  absl::base_internal::SpinLock drain_lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+  absl::base_internal::SpinLock lock_{
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY};
+
+  Range queued_[kCapacity] ABSL_GUARDED_BY(lock_) = {};
+  size_t num_queued_ ABSL_GUARDED_BY(lock_) = 0;
+  // Ranges taken by the Drain() in progress, sorted and coalesced.
+  Range in_flight_[kCapacity] ABSL_GUARDED_BY(lock_) = {};
+  size_t num_in_flight_ ABSL_GUARDED_BY(lock_) = 0;
+  // num_queued_ + num_in_flight_, for Fence() to check without lock_.
+  std::atomic<size_t> pending_{0};
+
+  // Changed with pageheap_lock held, but HugePageFiller::Put releases with
+  // the lock dropped.
+  std::atomic<int> defer_depth_{0};
+  std::atomic<bool> worker_active_{false};
+  // Bumped by every accepted Enqueue(), and the futex WaitForEnqueue() sleeps
+  // on.  waiting_ is set while the worker may be asleep, so that Enqueue()
+  // only makes the wake-up syscall once per sleep.
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<bool> waiting_{false};
+
+  // Ranges accepted by Enqueue(), those of them that extended the range
+  // queued before, and those turned away because the queue was full.
+  int64_t enqueued_ ABSL_GUARDED_BY(lock_) = 0;
+  int64_t coalesced_ ABSL_GUARDED_BY(lock_) = 0;
+  int64_t overflows_ ABSL_GUARDED_BY(lock_) = 0;
+  // Fences that had to drain the queue.
+  int64_t fence_waits_ ABSL_GUARDED_BY(lock_) = 0;
+
+  int64_t drains_ ABSL_GUARDED_BY(drain_lock_) = 0;
+  // Ranges issued after coalescing, and how many of them went out in a
+  // process_madvise batch rather than one madvise each.
+  int64_t ranges_released_ ABSL_GUARDED_BY(drain_lock_) = 0;
+  int64_t ranges_batched_ ABSL_GUARDED_BY(drain_lock_) = 0;
+  int64_t bytes_released_ ABSL_GUARDED_BY(drain_lock_) = 0;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_RELEASE_QUEUE_H_
@@ -0,0 +1,129 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/release_queue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "gtest/gtest.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+constexpr size_t kNumPages = 4;
+
+class ReleaseQueueTest : public ::testing::Test {
+ protected:
+  ReleaseQueueTest() : queue_(std::make_unique<ReleaseQueue>()) {
+    // Leave room to align to a TCMalloc page.
+    mapping_ = mmap(nullptr, (kNumPages + 1) * kPageSize,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK_CONDITION(mapping_ != MAP_FAILED);
+    const uintptr_t aligned =
+        (reinterpret_cast<uintptr_t>(mapping_) + kPageSize - 1) &
+        ~(kPageSize - 1);
+    base_ = reinterpret_cast<char*>(aligned);
+    memset(base_, 1, kNumPages * kPageSize);
+  }
+
+  ~ReleaseQueueTest() override {
+    munmap(mapping_, (kNumPages + 1) * kPageSize);
+  }
+
+  char* page(size_t i) { return base_ + i * kPageSize; }
+
+  // Returns true if page i still holds what the test wrote there.
+  bool Backed(size_t i) { return page(i)[0] == 1; }
+
+  bool Enqueue(size_t i, size_t n) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    ReleaseQueue::DeferScope defer(*queue_);
+    return queue_->Enqueue(page(i), n * kPageSize);
+  }
+
+  std::unique_ptr<ReleaseQueue> queue_;
+
+ private:
+  void* mapping_;
+  char* base_;
+};
+
+TEST_F(ReleaseQueueTest, OnlyWhileDeferring) {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  EXPECT_FALSE(queue_->Enqueue(page(0), kPageSize));
+}
+
+TEST_F(ReleaseQueueTest, ReleasedOnDrain) {
+  ASSERT_TRUE(Enqueue(1, 1));
+  ASSERT_TRUE(Enqueue(0, 1));
+  ASSERT_TRUE(Enqueue(3, 1));
+  for (size_t i = 0; i < kNumPages; ++i) {
+    EXPECT_TRUE(Backed(i)) << i;
+  }
+
+  EXPECT_EQ(queue_->Drain(), 3 * kPageSize);
+  EXPECT_FALSE(Backed(0));
+  EXPECT_FALSE(Backed(1));
+  EXPECT_TRUE(Backed(2));
+  EXPECT_FALSE(Backed(3));
+  EXPECT_EQ(queue_->Drain(), 0);
+}
+
+TEST_F(ReleaseQueueTest, FenceDrainsOverlap) {
+  ASSERT_TRUE(Enqueue(0, 2));
+
+  queue_->Fence(PageIdContaining(page(2)), Length(2));
+  EXPECT_TRUE(Backed(0));
+
+  queue_->Fence(PageIdContaining(page(1)), Length(2));
+  EXPECT_FALSE(Backed(0));
+  EXPECT_FALSE(Backed(1));
+  EXPECT_EQ(queue_->Drain(), 0);
+}
+
+TEST_F(ReleaseQueueTest, EnqueueWakesWorker) {
+  queue_->AddWorker();
+  // An epoch that is already stale does not block.
+  const uint32_t epoch = queue_->enqueue_epoch();
+  ASSERT_TRUE(Enqueue(0, 1));
+  queue_->WaitForEnqueue(epoch);
+  EXPECT_EQ(queue_->Drain(), kPageSize);
+
+  // The join hangs unless Enqueue() wakes the waiting thread.
+  const uint32_t next = queue_->enqueue_epoch();
+  EXPECT_NE(next, epoch);
+  std::thread worker([&] { queue_->WaitForEnqueue(next); });
+  absl::SleepFor(absl::Milliseconds(10));
+  ASSERT_TRUE(Enqueue(2, 1));
+  worker.join();
+  EXPECT_EQ(queue_->Drain(), kPageSize);
+  EXPECT_FALSE(Backed(2));
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -29,7 +29,7 @@ namespace tcmalloc_internal {
 // New() and Delete() for SampledAllocation.
 // 1) SampledAllocation is used internally by TCMalloc and can not use normal
 // heap allocation. We rely on PageHeapAllocator that allocates from TCMalloc's
-// arena and requires the pageheap_lock here.
+// arena, which does its own locking.
 // 2) PageHeapAllocator only allocates/deallocates memory, so we need to
 // manually invoke the constructor/destructor to initialize/clear some fields.
 class SampledAllocationAllocator {
@@ -40,28 +40,17 @@ class SampledAllocationAllocator {
     allocator_.Init(arena);
   }
 
-  SampledAllocation* New(StackTrace stack_trace)
-      ABSL_LOCKS_EXCLUDED(pageheap_lock) {
-    SampledAllocation* s;
-    {
-      absl::base_internal::SpinLockHolder h(&pageheap_lock);
-      s = allocator_.New();
-    }
+  SampledAllocation* New(StackTrace stack_trace) {
+    SampledAllocation* s = allocator_.New();
     return new (s) SampledAllocation(std::move(stack_trace));
   }
 
-  void Delete(SampledAllocation* s) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    allocator_.Delete(s);
-  }
+  void Delete(SampledAllocation* s) { allocator_.Delete(s); }
 
-  AllocatorStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    return allocator_.stats();
-  }
+  AllocatorStats stats() const { return allocator_.stats(); }
 
  private:
-  PageHeapAllocator<SampledAllocation> allocator_
-      ABSL_GUARDED_BY(pageheap_lock);
+  PageHeapAllocator<SampledAllocation> allocator_;
 };
 
 }  // namespace tcmalloc_internal
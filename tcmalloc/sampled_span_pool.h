@@ -0,0 +1,181 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SAMPLED_SPAN_POOL_H_
+#define TCMALLOC_SAMPLED_SPAN_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/numeric/bits.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Each sampled small object is moved to a span of its own, which has to come
+// from the page allocator under pageheap_lock and go back to it when the
+// object is freed.  At low sampling periods that makes pageheap_lock hot.
+//
+// SampledSpanPool keeps freed sampled spans, still registered in the pagemap,
+// so that later samples of the same length can reuse them without locking.
+// Each length has a bounded multi-producer, multi-consumer queue: producers
+// and consumers claim slots with a CAS on tail_ and head_ respectively, and
+// each slot carries a sequence number that says whose turn it is.
+class SampledSpanPool {
+ public:
+  // Spans long enough for any size class.
+  static constexpr Length kMaxPages = BytesToLengthCeil(kMaxSize);
+  static constexpr size_t kCapacityPerLength = 16;
+  // Bound on the bytes held across all lengths.
+  static constexpr size_t kMaxBytes = 1 << 20;
+  // Freed spans are only pooled at sampling rates of at most this many bytes.
+  // At the default rate samples are rare enough that pageheap_lock does not
+  // matter, and pooled spans would just be stranded.
+  static constexpr int64_t kMaxSamplingRate = 512 << 10;
+
+  constexpr SampledSpanPool() = default;
+
+  SampledSpanPool(const SampledSpanPool&) = delete;
+  SampledSpanPool& operator=(const SampledSpanPool&) = delete;
+
+  // Returns a pooled span of n pages, or nullptr if there is none.
+  Span* Pop(Length n) {
+    if (n > kMaxPages) return nullptr;
+    Span* span = queues_[n.raw_num() - 1].Pop();
+    if (span != nullptr) {
+      bytes_.fetch_sub(n.in_bytes(), std::memory_order_relaxed);
+    }
+    return span;
+  }
+
+  // Adds span to the pool.  Returns false if the pool has no room for it, in
+  // which case the caller keeps ownership.
+  bool Push(Span* span) {
+    const Length n = span->num_pages();
+    if (n > kMaxPages) return false;
+    const size_t bytes = n.in_bytes();
+    if (bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes >
+            kMaxBytes ||
+        !queues_[n.raw_num() - 1].Push(span)) {
+      bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Removes every span from the pool and passes it to f.
+  template <typename F>
+  void Drain(F f) {
+    for (size_t i = 0; i < kMaxPages.raw_num(); ++i) {
+      while (Span* span = queues_[i].Pop()) {
+        bytes_.fetch_sub(span->bytes_in_span(), std::memory_order_relaxed);
+        f(span);
+      }
+    }
+  }
+
+  // Bytes of pooled spans.  The count is briefly high while a Push() that
+  // will fail backs out.
+  size_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+ private:
+  class Queue {
+   public:
+    constexpr Queue() : slots_{} {}
+
+    bool Push(Span* span) {
+      uint64_t pos = tail_.load(std::memory_order_relaxed);
+      while (true) {
+        Slot& slot = slots_[pos & kMask];
+        const int64_t diff = static_cast<int64_t>(LoadSeq(pos) - pos);
+        if (diff == 0) {
+          if (tail_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            slot.span.store(span, std::memory_order_relaxed);
+            StoreSeq(pos, pos + 1);
+            return true;
+          }
+        } else if (diff < 0) {
+          // Full.
+          return false;
+        } else {
+          pos = tail_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    Span* Pop() {
+      uint64_t pos = head_.load(std::memory_order_relaxed);
+      while (true) {
+        Slot& slot = slots_[pos & kMask];
+        const int64_t diff = static_cast<int64_t>(LoadSeq(pos) - (pos + 1));
+        if (diff == 0) {
+          if (head_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            Span* span = slot.span.load(std::memory_order_relaxed);
+            StoreSeq(pos, pos + kCapacityPerLength);
+            return span;
+          }
+        } else if (diff < 0) {
+          // Empty.
+          return nullptr;
+        } else {
+          pos = head_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+   private:
+    static constexpr uint64_t kMask = kCapacityPerLength - 1;
+    static_assert(absl::has_single_bit(kCapacityPerLength));
+
+    struct Slot {
+      // The slot's sequence number, less its index.  A position may be pushed
+      // to when its slot's sequence number equals it, and popped from when the
+      // sequence number is one more.  Storing the difference lets the slots
+      // be zero-initialized.
+      std::atomic<uint64_t> seq;
+      std::atomic<Span*> span;
+    };
+
+    uint64_t LoadSeq(uint64_t pos) const {
+      return slots_[pos & kMask].seq.load(std::memory_order_acquire) +
+             (pos & kMask);
+    }
+    void StoreSeq(uint64_t pos, uint64_t seq) {
+      slots_[pos & kMask].seq.store(seq - (pos & kMask),
+                                    std::memory_order_release);
+    }
+
+    std::atomic<uint64_t> head_{0};
+    std::atomic<uint64_t> tail_{0};
+    Slot slots_[kCapacityPerLength];
+  };
+
+  std::atomic<size_t> bytes_{0};
+  Queue queues_[kMaxPages.raw_num()];
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SAMPLED_SPAN_POOL_H_
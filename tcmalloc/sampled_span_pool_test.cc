@@ -0,0 +1,165 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/sampled_span_pool.h"
+
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/testing/thread_manager.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+class SampledSpanPoolTest : public ::testing::Test {
+ protected:
+  // Returns a span of n pages.  The pool never touches the pages themselves,
+  // so they need not be backed.
+  Span* MakeSpan(Length n) {
+    spans_.push_back(std::make_unique<Span>());
+    Span* span = spans_.back().get();
+    span->Init(PageId(next_page_), n);
+    next_page_ += n.raw_num();
+    return span;
+  }
+
+  std::vector<Span*> DrainAll() {
+    std::vector<Span*> drained;
+    pool_.Drain([&](Span* span) { drained.push_back(span); });
+    return drained;
+  }
+
+  SampledSpanPool pool_;
+
+ private:
+  std::vector<std::unique_ptr<Span>> spans_;
+  uintptr_t next_page_ = 1;
+};
+
+TEST_F(SampledSpanPoolTest, PushPop) {
+  EXPECT_EQ(pool_.Pop(Length(1)), nullptr);
+
+  Span* one = MakeSpan(Length(1));
+  Span* two = MakeSpan(Length(2));
+  EXPECT_TRUE(pool_.Push(one));
+  EXPECT_TRUE(pool_.Push(two));
+  EXPECT_EQ(pool_.bytes(), Length(3).in_bytes());
+
+  // Spans are only handed back for the length they have.
+  EXPECT_EQ(pool_.Pop(Length(3)), nullptr);
+  EXPECT_EQ(pool_.Pop(Length(2)), two);
+  EXPECT_EQ(pool_.Pop(Length(2)), nullptr);
+  EXPECT_EQ(pool_.Pop(Length(1)), one);
+  EXPECT_EQ(pool_.bytes(), 0);
+}
+
+TEST_F(SampledSpanPoolTest, RejectsLongSpans) {
+  Span* span = MakeSpan(SampledSpanPool::kMaxPages + Length(1));
+  EXPECT_FALSE(pool_.Push(span));
+  EXPECT_EQ(pool_.Pop(SampledSpanPool::kMaxPages + Length(1)), nullptr);
+  EXPECT_EQ(pool_.bytes(), 0);
+}
+
+TEST_F(SampledSpanPoolTest, Bounded) {
+  // Each length holds at most kCapacityPerLength spans.
+  for (size_t i = 0; i < SampledSpanPool::kCapacityPerLength; ++i) {
+    EXPECT_TRUE(pool_.Push(MakeSpan(Length(1))));
+  }
+  EXPECT_FALSE(pool_.Push(MakeSpan(Length(1))));
+
+  // The pool as a whole holds at most kMaxBytes.
+  size_t pushed = SampledSpanPool::kCapacityPerLength;
+  for (Length n = Length(2); n <= SampledSpanPool::kMaxPages; ++n) {
+    for (size_t i = 0; i < SampledSpanPool::kCapacityPerLength; ++i) {
+      if (pool_.Push(MakeSpan(n))) ++pushed;
+    }
+  }
+  EXPECT_LE(pool_.bytes(), SampledSpanPool::kMaxBytes);
+
+  EXPECT_EQ(DrainAll().size(), pushed);
+  EXPECT_EQ(pool_.bytes(), 0);
+}
+
+TEST_F(SampledSpanPoolTest, Drain) {
+  absl::flat_hash_set<Span*> pushed;
+  for (size_t i = 0; i < 4; ++i) {
+    for (Length n = Length(1); n <= Length(3); ++n) {
+      Span* span = MakeSpan(n);
+      ASSERT_TRUE(pool_.Push(span));
+      pushed.insert(span);
+    }
+  }
+
+  std::vector<Span*> drained = DrainAll();
+  EXPECT_EQ(absl::flat_hash_set<Span*>(drained.begin(), drained.end()),
+            pushed);
+  EXPECT_EQ(pool_.bytes(), 0);
+  EXPECT_EQ(pool_.Pop(Length(1)), nullptr);
+}
+
+TEST_F(SampledSpanPoolTest, ConcurrentPushPop) {
+  constexpr int kThreads = 8;
+  constexpr size_t kSpansPerThread = 4;
+  std::vector<std::vector<Span*>> owned(kThreads);
+  for (auto& spans : owned) {
+    for (size_t i = 0; i < kSpansPerThread; ++i) {
+      spans.push_back(MakeSpan(Length(1 + i % 2)));
+    }
+  }
+
+  // Each thread moves spans between the pool and its own list.  A span handed
+  // to two threads at once would show up twice at the end.
+  std::atomic<size_t> popped{0};
+  ThreadManager threads;
+  threads.Start(kThreads, [&](int id) {
+    std::vector<Span*>& spans = owned[id];
+    if (!spans.empty() && pool_.Push(spans.back())) {
+      spans.pop_back();
+    }
+    if (Span* span = pool_.Pop(Length(1 + id % 2))) {
+      EXPECT_EQ(span->num_pages(), Length(1 + id % 2));
+      spans.push_back(span);
+      popped.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+  absl::SleepFor(absl::Milliseconds(100));
+  threads.Stop();
+
+  absl::flat_hash_set<Span*> seen;
+  for (const auto& spans : owned) {
+    for (Span* span : spans) {
+      EXPECT_TRUE(seen.insert(span).second);
+    }
+  }
+  for (Span* span : DrainAll()) {
+    EXPECT_TRUE(seen.insert(span).second);
+  }
+  EXPECT_EQ(seen.size(), kThreads * kSpansPerThread);
+  EXPECT_GT(popped.load(std::memory_order_relaxed), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
@@ -117,6 +117,11 @@ class Sampler {
   bool IsOnFastPath() const;
   void UpdateFastPathState();
 
+  // Keeps this thread's allocations off the fast path, even when
+  // tc_globals.IsOnFastPath(), e.g., to divert them to a scoped arena.  Takes
+  // effect at the next UpdateFastPathState().
+  void set_fast_path_disabled(bool disabled) { fast_path_disabled_ = disabled; }
+
   // Generate a geometric with mean profile_sampling_rate.
   //
   // Remembers the value of sample_rate for use in reweighing the sample
@@ -140,7 +145,8 @@ class Sampler {
         allocs_until_guarded_sample_(0),
         rnd_(0),
         initialized_(false),
-        was_on_fast_path_(false) {}
+        was_on_fast_path_(false),
+        fast_path_disabled_(false) {}
 
  private:
   // Bytes until we sample next.
@@ -169,6 +175,7 @@ class Sampler {
   uint64_t rnd_;  // Cheap random number generator
   bool initialized_;
   bool was_on_fast_path_;
+  bool fast_path_disabled_;
 
  private:
   friend class SamplerTest;
@@ -176,6 +183,8 @@ class Sampler {
   void Init(uint64_t seed);
   size_t RecordAllocationSlow(size_t k);
   ssize_t GetGeometricVariable(ssize_t mean);
+  // Returns whether this thread's allocations may take the fast path now.
+  bool ShouldBeOnFastPath() const;
 };
 
 inline size_t Sampler::RecordAllocation(size_t k) {
@@ -293,8 +302,12 @@ inline uint64_t Sampler::NextRandom(uint64_t rnd) {
 
 inline bool Sampler::IsOnFastPath() const { return was_on_fast_path_; }
 
+inline bool Sampler::ShouldBeOnFastPath() const {
+  return tc_globals.IsOnFastPath() && !fast_path_disabled_;
+}
+
 inline void Sampler::UpdateFastPathState() {
-  const bool is_on_fast_path = tc_globals.IsOnFastPath();
+  const bool is_on_fast_path = ShouldBeOnFastPath();
   if (ABSL_PREDICT_TRUE(was_on_fast_path_ == is_on_fast_path)) {
     return;
   }
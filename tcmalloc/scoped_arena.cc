@@ -0,0 +1,93 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/scoped_arena.h"
+
+#include <new>
+
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_allocator.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+ABSL_CONST_INIT thread_local ScopedArenaRegion* ScopedArenaRegion::current_
+    ABSL_ATTRIBUTE_INITIAL_EXEC = nullptr;
+
+Span* ScopedArenaRegion::NewChunk() {
+  Span* span = tc_globals.page_allocator().New(
+      kChunkPages, {1, AccessDensityPrediction::kSparse}, MemoryTag::kSampled);
+  if (span == nullptr) return nullptr;
+  // Objects live anywhere in the chunk, not only on its first page, so every
+  // page has to resolve to the span.
+  tc_globals.pagemap().RegisterSizeClass(span, 0);
+  span->set_location(Span::IN_SCOPED_ARENA);
+  return span;
+}
+
+void ScopedArenaRegion::SetChunk(uintptr_t begin, uintptr_t end) {
+  cursor_ = (begin + kHeaderSize + kAlignment - 1) & ~(kAlignment - 1);
+  limit_ = end;
+}
+
+bool ScopedArenaRegion::Refill() {
+  Span* span = NewChunk();
+  if (span == nullptr) return false;
+  chunks_.prepend(span);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(span->start_address());
+  SetChunk(begin, begin + span->bytes_in_span());
+  return true;
+}
+
+ScopedArenaRegion* ScopedArenaRegion::Begin() {
+  Span* home = NewChunk();
+  if (home == nullptr) return nullptr;
+  void* start = home->start_address();
+  auto* region = new (start) ScopedArenaRegion(home, current_);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(start);
+  region->SetChunk(begin + sizeof(ScopedArenaRegion),
+                   begin + home->bytes_in_span());
+  current_ = region;
+  return region;
+}
+
+void ScopedArenaRegion::End(ScopedArenaRegion* region) {
+  CHECK_CONDITION(region == current_ &&
+                  "ScopedArena ended out of order or on another thread");
+  current_ = region->parent_;
+
+  Span* home = region->home_;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  while (!region->chunks_.empty()) {
+    Span* span = region->chunks_.first();
+    region->chunks_.remove(span);
+    span->set_location(Span::IN_USE);
+    tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1,
+                                       MemoryTag::kSampled);
+  }
+  // *region is in home, so it must not be touched past this point.
+  home->set_location(Span::IN_USE);
+  tc_globals.page_allocator().Delete(home, /*objects_per_span=*/1,
+                                     MemoryTag::kSampled);
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,129 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SCOPED_ARENA_H_
+#define TCMALLOC_SCOPED_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// ScopedArenaRegion backs a MallocExtension::ScopedArena.  While a region is
+// active on a thread, that thread's small allocations are bump-allocated from
+// chunks of pages obtained from the page allocator, and when the region ends
+// all of its chunks are returned at once.
+//
+// Chunks use the sampled memory tag.  Sized delete already leaves the fast path
+// for sampled memory, so it never mistakes an arena object for one of a size
+// class, and every free of an arena object ends up looking up its span in the
+// PageMap.  Chunk spans are marked Span::IN_SCOPED_ARENA, which makes such a
+// free a no-op.  Each object is preceded by a header holding its usable size,
+// for GetSize().
+//
+// The region's own state lives at the start of its first chunk, so that
+// beginning one allocates no metadata.
+class ScopedArenaRegion {
+ public:
+  // Objects are aligned to, and their usable size is a multiple of, this.
+  // Requests for a larger alignment use the regular allocator.
+  static constexpr size_t kAlignment = 16;
+  // Larger requests use the regular allocator, so that at most a small
+  // fraction of each chunk is wasted when an object does not fit in it.
+  static constexpr size_t kMaxObjectSize = 16 << 10;
+  // Chunks are well below a hugepage, so that they come from HugePageFiller.
+  static constexpr size_t kChunkBytes = 256 << 10;
+
+  // Starts a region on the calling thread, nested in its current region, if
+  // any.  Returns nullptr if no memory could be obtained for it.
+  static ScopedArenaRegion* Begin();
+
+  // Returns all memory of region, which must be the calling thread's current
+  // region, and reinstates the region it was nested in.
+  static void End(ScopedArenaRegion* region);
+
+  // Returns the calling thread's current region, or nullptr.
+  static ScopedArenaRegion* Current() { return current_; }
+
+  // Returns an object of at least size bytes, or nullptr if size exceeds
+  // kMaxObjectSize or memory is exhausted.
+  void* Allocate(size_t size);
+
+  // Returns the usable size of ptr, which must have been returned by
+  // Allocate().
+  static size_t UsableSize(const void* ptr) {
+    return *reinterpret_cast<const size_t*>(static_cast<const char*>(ptr) -
+                                            kHeaderSize);
+  }
+
+  // Returns true if span is a chunk of some region.
+  static bool IsChunk(const Span& span) {
+    return span.location() == Span::IN_SCOPED_ARENA;
+  }
+
+ private:
+  static constexpr size_t kHeaderSize = sizeof(size_t);
+  static_assert(kHeaderSize <= kAlignment);
+  static constexpr Length kChunkPages = BytesToLengthCeil(kChunkBytes);
+
+  explicit ScopedArenaRegion(Span* home, ScopedArenaRegion* parent)
+      : home_(home), parent_(parent) {}
+
+  // Allocates a chunk and makes it the one objects are carved from.
+  static Span* NewChunk();
+  ABSL_ATTRIBUTE_NOINLINE bool Refill();
+  void SetChunk(uintptr_t begin, uintptr_t end);
+
+  ABSL_CONST_INIT static thread_local ScopedArenaRegion* current_
+      ABSL_ATTRIBUTE_INITIAL_EXEC;
+
+  // Where the next object starts, and the end of the current chunk.
+  uintptr_t cursor_ = 0;
+  uintptr_t limit_ = 0;
+  // The chunk holding this object; it is returned last.
+  Span* const home_;
+  // Every other chunk.
+  SpanList chunks_;
+  ScopedArenaRegion* const parent_;
+};
+
+inline void* ScopedArenaRegion::Allocate(size_t size) {
+  if (ABSL_PREDICT_FALSE(size > kMaxObjectSize)) return nullptr;
+  // The header of the next object goes in the padding of this one.
+  const size_t footprint =
+      (size + kHeaderSize + kAlignment - 1) & ~(kAlignment - 1);
+  if (ABSL_PREDICT_FALSE(footprint > limit_ - cursor_)) {
+    if (!Refill()) return nullptr;
+  }
+  char* result = reinterpret_cast<char*>(cursor_);
+  cursor_ += footprint;
+  *reinterpret_cast<size_t*>(result - kHeaderSize) = footprint - kHeaderSize;
+  return result;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SCOPED_ARENA_H_
@@ -0,0 +1,207 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_generator.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+#include "tcmalloc/span.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// Bytes of metadata per span, as assumed by the overhead column of the
+// compiled-in tables.
+constexpr size_t kSpanMetadataBytes = 48;
+
+// Sizes above this need 128-byte alignment (see SizeMap::IsValidSizeClass).
+constexpr size_t kMaxSmallSize = 1024;
+
+size_t ClassAlignment(size_t size) {
+  if (size <= SizeMap::kMultiPageSize) return static_cast<size_t>(kAlignment);
+  if (size <= kMaxSmallSize) return SizeMap::kMultiPageAlignment;
+  return 128;
+}
+
+// End-of-span waste and span metadata, as a fraction of the bytes used for
+// objects.
+double SpanOverhead(size_t size, size_t pages) {
+  const size_t span_bytes = Length(pages).in_bytes();
+  const size_t tail = span_bytes % size;
+  return static_cast<double>(tail + kSpanMetadataBytes) / (span_bytes - tail);
+}
+
+// Bytes of end-of-span waste and span metadata per object.
+double OverheadPerObject(size_t size, size_t pages) {
+  return SpanOverhead(size, pages) * size;
+}
+
+}  // namespace
+
+size_t PagesForSizeClass(size_t size,
+                         const SizeClassGeneratorOptions& options) {
+  ASSERT(size > 0);
+  if (size <= SizeMap::kMultiPageSize) return 1;
+
+  const size_t min_pages = BytesToLengthCeil(size).raw_num();
+  size_t best_pages = min_pages;
+  double best_overhead = std::numeric_limits<double>::infinity();
+  for (size_t pages = min_pages; pages < 256; ++pages) {
+    if (size >= kBitmapMinObjectSize &&
+        Length(pages).in_bytes() / size > 64) {
+      break;
+    }
+    const double overhead = SpanOverhead(size, pages);
+    if (overhead <= options.max_span_overhead) return pages;
+    if (overhead < best_overhead) {
+      best_overhead = overhead;
+      best_pages = pages;
+    }
+  }
+  return best_pages;
+}
+
+size_t BatchSizeForSizeClass(size_t size) {
+  ASSERT(size > 0);
+  return std::clamp<size_t>((64 << 10) / size, 2, 32);
+}
+
+std::vector<SizeClassInfo> GenerateSizeClasses(
+    absl::Span<const SizeRequests> requests,
+    const SizeClassGeneratorOptions& options) {
+  // Every size SizeMap accepts for a class is a candidate.
+  std::vector<size_t> sizes;
+  for (size_t size = static_cast<size_t>(kAlignment); size <= kMaxSize;
+       size += static_cast<size_t>(kAlignment)) {
+    if (size % ClassAlignment(size) == 0) sizes.push_back(size);
+  }
+  ASSERT(sizes.back() == kMaxSize);
+  const size_t n = sizes.size();
+
+  // Requests (and their bytes) that round up to at most sizes[j], at j + 1.
+  std::vector<double> count_prefix(n + 1), bytes_prefix(n + 1);
+  for (const SizeRequests& request : requests) {
+    if (request.size > kMaxSize || request.count <= 0) continue;
+    const size_t j =
+        std::lower_bound(sizes.begin(), sizes.end(), request.size) -
+        sizes.begin();
+    count_prefix[j + 1] += request.count;
+    bytes_prefix[j + 1] += request.count * request.size;
+  }
+  for (size_t j = 0; j < n; ++j) {
+    count_prefix[j + 1] += count_prefix[j];
+    bytes_prefix[j + 1] += bytes_prefix[j];
+  }
+
+  std::vector<size_t> pages(n);
+  std::vector<double> overhead(n);
+  // The class below sizes[j] can be no smaller than sizes[lowest[j]].
+  std::vector<size_t> lowest(n);
+  for (size_t j = 0, i = 0; j < n; ++j) {
+    pages[j] = PagesForSizeClass(sizes[j], options);
+    overhead[j] = OverheadPerObject(sizes[j], pages[j]);
+    while (i + 1 < j && sizes[i] * options.max_growth < sizes[j]) ++i;
+    lowest[j] = i;
+  }
+
+  // Waste of a class of sizes[j] that serves the requests above sizes[i].
+  auto cost = [&](size_t i, size_t j) {
+    const double count = count_prefix[j + 1] - count_prefix[i + 1];
+    const double bytes = bytes_prefix[j + 1] - bytes_prefix[i + 1];
+    return count * (sizes[j] + overhead[j]) - bytes;
+  };
+
+  // waste[k][j] is the least waste of k + 1 classes, the largest of which is
+  // sizes[j], for the requests up to sizes[j].  The smallest class is always
+  // sizes[0], which serves the tiniest requests.
+  constexpr double kInfinity = std::numeric_limits<double>::infinity();
+  const size_t max_classes = std::min(options.max_classes - 1, n);
+  std::vector<std::vector<double>> waste(max_classes,
+                                         std::vector<double>(n, kInfinity));
+  std::vector<std::vector<size_t>> below(max_classes, std::vector<size_t>(n));
+  waste[0][0] = count_prefix[1] * (sizes[0] + overhead[0]) - bytes_prefix[1];
+  size_t best_k = waste[0][n - 1] < kInfinity ? 0 : max_classes;
+  for (size_t k = 1; k < max_classes; ++k) {
+    for (size_t j = k; j < n; ++j) {
+      for (size_t i = std::max(lowest[j], k - 1); i < j; ++i) {
+        if (waste[k - 1][i] == kInfinity) continue;
+        const double w = waste[k - 1][i] + cost(i, j);
+        if (w < waste[k][j]) {
+          waste[k][j] = w;
+          below[k][j] = i;
+        }
+      }
+    }
+    if (waste[k][n - 1] < kInfinity &&
+        (best_k == max_classes || waste[k][n - 1] < waste[best_k][n - 1])) {
+      best_k = k;
+    }
+  }
+  if (best_k == max_classes) return {};
+
+  std::vector<SizeClassInfo> size_classes(best_k + 2);
+  size_classes[0] = {0, 0, 0};
+  for (size_t k = best_k + 1, j = n - 1; k > 0; --k) {
+    size_classes[k] = {sizes[j], pages[j], BatchSizeForSizeClass(sizes[j])};
+    j = below[k - 1][j];
+  }
+  return size_classes;
+}
+
+double SizeClassWaste(absl::Span<const SizeClassInfo> size_classes,
+                      absl::Span<const SizeRequests> requests) {
+  double waste = 0;
+  for (const SizeRequests& request : requests) {
+    if (request.size > kMaxSize || request.count <= 0) continue;
+    for (size_t c = 1; c < size_classes.size(); ++c) {
+      const SizeClassInfo& info = size_classes[c];
+      if (info.size < request.size) continue;
+      waste += request.count * (info.size - request.size +
+                                OverheadPerObject(info.size, info.pages));
+      break;
+    }
+  }
+  return waste;
+}
+
+std::string FormatSizeClasses(absl::Span<const SizeClassInfo> size_classes) {
+  std::string out = "# <bytes> <pages> <batch size>  <fixed>\n";
+  for (size_t c = 1; c < size_classes.size(); ++c) {
+    const SizeClassInfo& info = size_classes[c];
+    if (info.size == 0) break;
+    absl::StrAppendFormat(&out, "%9u %7u %12u  # %.2f%%\n", info.size,
+                          info.pages, info.num_to_move,
+                          100 * SpanOverhead(info.size, info.pages));
+  }
+  return out;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
@@ -0,0 +1,87 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Generates size class tables fitted to a workload's distribution of requested
+// sizes.  The tables can be loaded at startup through
+// TCMALLOC_SIZE_CLASSES_FILE (see ParseSizeClasses).
+
+#ifndef TCMALLOC_SIZE_CLASS_GENERATOR_H_
+#define TCMALLOC_SIZE_CLASS_GENERATOR_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/size_class_info.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// How many objects of a requested size a workload holds (or allocates).
+struct SizeRequests {
+  size_t size;
+  double count;
+};
+
+struct SizeClassGeneratorOptions {
+  // Most size classes to generate, counting the empty class 0.
+  size_t max_classes = kNumBaseClasses;
+
+  // Each class may be at most this much larger than the one below it, unless
+  // they are adjacent multiples of the class alignment.  This bounds the waste
+  // for sizes the workload did not show.
+  double max_growth = 1.25;
+
+  // Pick the smallest span whose end-of-span waste and span metadata are at
+  // most this fraction of the memory used for objects.
+  double max_span_overhead = 0.02;
+};
+
+// Returns the number of pages for spans of size-byte objects, as
+// GenerateSizeClasses chooses them.
+size_t PagesForSizeClass(size_t size, const SizeClassGeneratorOptions& options);
+
+// Returns the number of objects moved between caches at a time for size-byte
+// objects.  This follows the compiled-in tables: 64 KiB, capped at 32 objects.
+size_t BatchSizeForSizeClass(size_t size);
+
+// Returns the size classes, starting with the empty class 0, that minimize the
+// memory wasted on requests: rounding each one up to its class's size, plus
+// each class's share of end-of-span waste and span metadata.  Requests larger
+// than kMaxSize are ignored.  The last class is always kMaxSize.  Returns an
+// empty table if options.max_classes is too small to satisfy
+// options.max_growth.
+std::vector<SizeClassInfo> GenerateSizeClasses(
+    absl::Span<const SizeRequests> requests,
+    const SizeClassGeneratorOptions& options = {});
+
+// Returns the bytes wasted by serving requests from size_classes, counted as
+// in GenerateSizeClasses.
+double SizeClassWaste(absl::Span<const SizeClassInfo> size_classes,
+                      absl::Span<const SizeRequests> requests);
+
+// Returns size_classes in the format read by ParseSizeClasses, with each
+// class's end-of-span and metadata overhead as a comment.
+std::string FormatSizeClasses(absl::Span<const SizeClassInfo> size_classes);
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SIZE_CLASS_GENERATOR_H_
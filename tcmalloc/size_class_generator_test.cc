@@ -0,0 +1,106 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_generator.h"
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/size_class_info.h"
+#include "tcmalloc/sizemap.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+std::vector<size_t> Sizes(absl::Span<const SizeClassInfo> size_classes) {
+  std::vector<size_t> sizes;
+  for (const SizeClassInfo& info : size_classes) {
+    sizes.push_back(info.size);
+  }
+  return sizes;
+}
+
+bool IsValid(absl::Span<const SizeClassInfo> size_classes) {
+  auto m = std::make_unique<SizeMap>();
+  return m->Init(size_classes);
+}
+
+TEST(SizeClassGeneratorTest, NoRequests) {
+  const std::vector<SizeClassInfo> size_classes = GenerateSizeClasses({});
+  ASSERT_GE(size_classes.size(), 2);
+  EXPECT_LE(size_classes.size(), kNumBaseClasses);
+  EXPECT_EQ(size_classes[1].size, static_cast<size_t>(kAlignment));
+  EXPECT_EQ(size_classes.back().size, kMaxSize);
+  EXPECT_TRUE(IsValid(size_classes));
+
+  // Only the growth limit adds classes.
+  SizeClassGeneratorOptions options;
+  options.max_growth = 2;
+  EXPECT_LT(GenerateSizeClasses({}, options).size(), size_classes.size());
+}
+
+TEST(SizeClassGeneratorTest, SkewedRequests) {
+  const SizeRequests requests[] = {
+      {96, 1000},
+      {960, 100},
+      {3072, 10},
+  };
+  const std::vector<SizeClassInfo> size_classes =
+      GenerateSizeClasses(requests);
+  ASSERT_TRUE(IsValid(size_classes));
+  EXPECT_THAT(Sizes(size_classes),
+              testing::IsSupersetOf({size_t{96}, size_t{960}, size_t{3072}}));
+  EXPECT_LT(SizeClassWaste(size_classes, requests),
+            SizeClassWaste(kSizeClasses, requests));
+
+  for (const SizeClassInfo& info : absl::MakeSpan(size_classes).subspan(1)) {
+    SizeClassGeneratorOptions options;
+    EXPECT_EQ(info.pages, PagesForSizeClass(info.size, options));
+    EXPECT_EQ(info.num_to_move, BatchSizeForSizeClass(info.size));
+  }
+}
+
+TEST(SizeClassGeneratorTest, TooFewClasses) {
+  SizeClassGeneratorOptions options;
+  options.max_classes = 4;
+  EXPECT_TRUE(GenerateSizeClasses({}, options).empty());
+}
+
+TEST(SizeClassGeneratorTest, RoundTrip) {
+  const SizeRequests requests[] = {{24, 10}, {200, 5}, {5000, 1}};
+  const std::vector<SizeClassInfo> size_classes =
+      GenerateSizeClasses(requests);
+  const std::string text = FormatSizeClasses(size_classes);
+
+  std::vector<SizeClassInfo> parsed(kNumBaseClasses);
+  const size_t count = ParseSizeClasses(text, absl::MakeSpan(parsed));
+  ASSERT_EQ(count, size_classes.size());
+  for (size_t c = 0; c < count; ++c) {
+    EXPECT_EQ(parsed[c].size, size_classes[c].size);
+    EXPECT_EQ(parsed[c].pages, size_classes[c].pages);
+    EXPECT_EQ(parsed[c].num_to_move, size_classes[c].num_to_move);
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
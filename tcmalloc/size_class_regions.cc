@@ -0,0 +1,133 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_regions.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/stats.h"
+#include "tcmalloc/system-alloc.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+Span* SizeClassRegions::New(size_t size_class, Length n, MemoryTag tag) {
+  ASSERT(size_class > 0 && size_class < kNumClasses);
+  Region& region = regions_[size_class];
+
+  Span* span;
+  if (!region.normal.empty()) {
+    span = region.normal.first();
+    region.normal.remove(span);
+    normal_pages_ -= span->num_pages();
+  } else if (!region.returned.empty()) {
+    span = region.returned.first();
+    region.returned.remove(span);
+    returned_pages_ -= span->num_pages();
+    SystemBack(span->start_address(), span->bytes_in_span());
+  } else {
+    if (region.unavailable) return nullptr;
+    const uintptr_t start = RegionStart(size_class, tag);
+    if ((region.used + n).in_bytes() > kSizeClassRegionSize) return nullptr;
+
+    if (region.used + n > region.mapped) {
+      // Map in multiples of kMinSystemAlloc, as SystemAlloc() would.
+      const size_t chunk =
+          std::max(BytesToLengthFloor(kMinSystemAlloc).raw_num(), size_t{1});
+      const size_t needed = (region.used + n - region.mapped).raw_num();
+      const Length pages =
+          std::min(Length((needed + chunk - 1) / chunk * chunk),
+                   BytesToLengthFloor(kSizeClassRegionSize) - region.mapped);
+      void* next = reinterpret_cast<void*>(start + region.mapped.in_bytes());
+      bool taken;
+      if (SystemAllocAt(next, pages.in_bytes(), tag, &taken) == nullptr) {
+        // Only give up on the region if its range is in use.  A failure to
+        // map (e.g., out of memory) may not happen again.
+        region.unavailable = taken;
+        return nullptr;
+      }
+      region.mapped += pages;
+      mapped_pages_ += pages;
+      unused_pages_ += pages;
+    }
+
+    const PageId p = PageIdContaining(reinterpret_cast<void*>(start)) +
+                     region.used;
+    if (!tc_globals.pagemap().Ensure(p, n)) return nullptr;
+    span = Span::New(p, n);
+    tc_globals.pagemap().Set(p, span);
+    region.used += n;
+    unused_pages_ -= n;
+  }
+
+  ASSERT(span->num_pages() == n);
+  ASSERT(SizeClassFromAddress(span->start_address()) == size_class);
+  ASSERT(GetMemoryTag(span->start_address()) == tag);
+  span->set_location(Span::IN_USE);
+  return span;
+}
+
+void SizeClassRegions::Delete(Span* span) {
+  ASSERT(Contains(span));
+  ASSERT(tc_globals.pagemap().sizeclass(span->first_page()) == 0);
+  span->set_location(Span::ON_NORMAL_FREELIST);
+  regions_[SizeClassFromAddress(span->start_address())].normal.prepend(span);
+  normal_pages_ += span->num_pages();
+}
+
+Length SizeClassRegions::ReleaseAtLeastNPages(Length num_pages) {
+  Length released;
+  // Round robin through the regions, so that repeated small releases do not
+  // all come from the lowest size classes.
+  for (size_t i = 0; i < kNumClasses && released < num_pages;
+       i++, release_index_ = (release_index_ + 1) % kNumClasses) {
+    Region& region = regions_[release_index_];
+    while (released < num_pages && !region.normal.empty()) {
+      Span* span = region.normal.last();
+      if (!SystemRelease(span->start_address(), span->bytes_in_span())) {
+        break;
+      }
+      region.normal.remove(span);
+      normal_pages_ -= span->num_pages();
+      span->set_location(Span::ON_RETURNED_FREELIST);
+      region.returned.prepend(span);
+      returned_pages_ += span->num_pages();
+      released += span->num_pages();
+    }
+  }
+  return released;
+}
+
+BackingStats SizeClassRegions::stats() const {
+  BackingStats stats;
+  stats.system_bytes = mapped_pages_.in_bytes();
+  stats.free_bytes = normal_pages_.in_bytes();
+  stats.unmapped_bytes = (returned_pages_ + unused_pages_).in_bytes();
+  return stats;
+}
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
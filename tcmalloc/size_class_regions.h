@@ -0,0 +1,102 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SIZE_CLASS_REGIONS_H_
+#define TCMALLOC_SIZE_CLASS_REGIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/stats.h"
+
+GOOGLE_MALLOC_SECTION_BEGIN
+namespace tcmalloc {
+namespace tcmalloc_internal {
+
+// Hands out spans for small objects from the per-size-class address regions
+// described at kSizeClassRegionFlag, so that SizeClassFromAddress() works for
+// every object in them.
+//
+// Each region is mapped from its start as it fills, and never shrinks.  All of
+// a size class's spans have the same length, so freed spans are kept whole on
+// a per-class list, and released to the OS only when asked to.  A span stays
+// in the pagemap for as long as it is in the region.
+class SizeClassRegions {
+ public:
+  constexpr SizeClassRegions() = default;
+
+  SizeClassRegions(const SizeClassRegions&) = delete;
+  SizeClassRegions& operator=(const SizeClassRegions&) = delete;
+
+  // Returns the first address of size_class's region.
+  static uintptr_t RegionStart(size_t size_class, MemoryTag tag) {
+    ASSERT(size_class > 0 && size_class < kNumClasses);
+    return (static_cast<uintptr_t>(tag) << kTagShift) | kSizeClassRegionFlag |
+           (size_class << kSizeClassRegionShift);
+  }
+
+  // Returns true if span was allocated by New().
+  static bool Contains(const Span* span) {
+    return SizeClassFromAddress(span->start_address()) != 0;
+  }
+
+  // Returns a span of n pages from size_class's region, or nullptr if the
+  // region cannot hold another one.  The span is in the pagemap, but its size
+  // class is not registered.
+  Span* New(size_t size_class, Length n, MemoryTag tag)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns span to its region.
+  // REQUIRES: Contains(span), and its size class has been unregistered.
+  void Delete(Span* span) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Releases free spans to the OS until at least num_pages have been released
+  // or there are none left.  Returns the number of pages released.
+  Length ReleaseAtLeastNPages(Length num_pages)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Mapped pages not yet handed out count as unmapped, since they have never
+  // been touched.
+  BackingStats stats() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+ private:
+  struct Region {
+    // Pages from the region's start that have been handed out, and mapped.
+    Length used;
+    Length mapped;
+    // Set when the region's address range turned out to be taken.
+    bool unavailable = false;
+    SpanList normal;
+    SpanList returned;
+  };
+
+  Region regions_[kNumClasses];
+  Length mapped_pages_;
+  Length unused_pages_;
+  Length normal_pages_;
+  Length returned_pages_;
+  // Index of the region ReleaseAtLeastNPages() starts from.
+  size_t release_index_ = 0;
+};
+
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
+GOOGLE_MALLOC_SECTION_END
+
+#endif  // TCMALLOC_SIZE_CLASS_REGIONS_H_
@@ -0,0 +1,239 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/size_class_regions.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/stats.h"
+
+namespace tcmalloc {
+namespace tcmalloc_internal {
+namespace {
+
+// The live allocator never takes spans of small objects with this tag, so its
+// regions are free for the tests to map.  Every test uses its own size
+// classes, since regions stay mapped once a test has mapped them.
+constexpr MemoryTag kTag = MemoryTag::kSampled;
+
+class SizeClassRegionsTest : public ::testing::Test {
+ protected:
+  SizeClassRegionsTest() {
+    // If this test is not linked against TCMalloc, the global arena used for
+    // metadata will not be initialized.
+    tc_globals.InitIfNecessary();
+  }
+
+  void SetUp() override {
+    if (!kSizeClassRegions) {
+      GTEST_SKIP() << "size class regions are not enabled";
+    }
+  }
+
+  Span* New(size_t size_class, Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    return regions_->New(size_class, n, kTag);
+  }
+
+  void Delete(Span* span) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    regions_->Delete(span);
+  }
+
+  Length Release(Length n) ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    return regions_->ReleaseAtLeastNPages(n);
+  }
+
+  BackingStats Stats() ABSL_LOCKS_EXCLUDED(pageheap_lock) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    return regions_->stats();
+  }
+
+  std::unique_ptr<SizeClassRegions> regions_ =
+      std::make_unique<SizeClassRegions>();
+};
+
+TEST_F(SizeClassRegionsTest, RegionBoundaries) {
+  for (size_t size_class : {size_t{1}, kNumClasses / 2, kNumClasses - 1}) {
+    const uintptr_t start = SizeClassRegions::RegionStart(size_class, kTag);
+    const uintptr_t last = start + kSizeClassRegionSize - 1;
+    EXPECT_EQ(start % kSizeClassRegionSize, 0);
+    EXPECT_EQ(SizeClassFromAddress(reinterpret_cast<void*>(start)), size_class);
+    EXPECT_EQ(SizeClassFromAddress(reinterpret_cast<void*>(last)), size_class);
+    EXPECT_EQ(SizeClassFromAddress(reinterpret_cast<void*>(start - 1)),
+              size_class - 1);
+    EXPECT_EQ(GetMemoryTag(reinterpret_cast<void*>(start)), kTag);
+    EXPECT_EQ(GetMemoryTag(reinterpret_cast<void*>(last)), kTag);
+  }
+}
+
+TEST_F(SizeClassRegionsTest, AddressesOutsideRegions) {
+  EXPECT_EQ(SizeClassFromAddress(nullptr), 0);
+
+  // Large allocations come from the lower half of the tag's range.
+  void* large = ::operator new(kMaxSize + 1);
+  EXPECT_EQ(SizeClassFromAddress(large), 0);
+  ::operator delete(large);
+
+  // Just below the first region is the lower half of the tag's range.
+  const uintptr_t first = SizeClassRegions::RegionStart(1, kTag);
+  EXPECT_EQ(SizeClassFromAddress(reinterpret_cast<void*>(first - 1)), 0);
+  EXPECT_EQ(SizeClassFromAddress(
+                reinterpret_cast<void*>(first & ~kSizeClassRegionFlag)),
+            0);
+}
+
+TEST_F(SizeClassRegionsTest, ReusesFreedSpans) {
+  constexpr size_t kSizeClass = 1;
+  const uintptr_t start = SizeClassRegions::RegionStart(kSizeClass, kTag);
+
+  Span* a = New(kSizeClass, Length(1));
+  ASSERT_NE(a, nullptr);
+  EXPECT_EQ(a->start_address(), reinterpret_cast<void*>(start));
+  EXPECT_TRUE(SizeClassRegions::Contains(a));
+  Span* b = New(kSizeClass, Length(1));
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(b->first_page(), a->first_page() + Length(1));
+  memset(a->start_address(), 1, a->bytes_in_span());
+  memset(b->start_address(), 1, b->bytes_in_span());
+
+  BackingStats stats = Stats();
+  EXPECT_GE(stats.system_bytes, Length(2).in_bytes());
+  EXPECT_EQ(stats.free_bytes, 0);
+
+  Delete(a);
+  stats = Stats();
+  EXPECT_EQ(stats.free_bytes, Length(1).in_bytes());
+
+  EXPECT_EQ(New(kSizeClass, Length(1)), a);
+  EXPECT_EQ(Stats().free_bytes, 0);
+}
+
+TEST_F(SizeClassRegionsTest, ReleasesRoundRobin) {
+  constexpr size_t kFirst = 2, kSecond = 3;
+  Span* first[2] = {New(kFirst, Length(1)), New(kFirst, Length(1))};
+  Span* second = New(kSecond, Length(1));
+  ASSERT_NE(first[0], nullptr);
+  ASSERT_NE(first[1], nullptr);
+  ASSERT_NE(second, nullptr);
+  Delete(first[0]);
+  Delete(first[1]);
+  Delete(second);
+
+  // Each release starts past the region the last one ended in, so the second
+  // page comes from kSecond even though kFirst still has a free span.
+  EXPECT_EQ(Release(Length(1)), Length(1));
+  EXPECT_EQ(second->location(), Span::ON_NORMAL_FREELIST);
+  EXPECT_EQ(Release(Length(1)), Length(1));
+  EXPECT_EQ(second->location(), Span::ON_RETURNED_FREELIST);
+  EXPECT_NE(first[0]->location(), first[1]->location());
+
+  EXPECT_EQ(Release(Length(2)), Length(1));
+  EXPECT_EQ(first[0]->location(), Span::ON_RETURNED_FREELIST);
+  EXPECT_EQ(first[1]->location(), Span::ON_RETURNED_FREELIST);
+
+  const BackingStats stats = Stats();
+  EXPECT_EQ(stats.free_bytes, 0);
+  EXPECT_EQ(stats.unmapped_bytes, stats.system_bytes);
+
+  // A released span is backed again when it is handed out.
+  Span* span = New(kSecond, Length(1));
+  EXPECT_EQ(span, second);
+  memset(span->start_address(), 1, span->bytes_in_span());
+}
+
+TEST_F(SizeClassRegionsTest, FullRegion) {
+  constexpr size_t kSizeClass = 4;
+  const Length region_pages = BytesToLengthFloor(kSizeClassRegionSize);
+  EXPECT_EQ(New(kSizeClass, region_pages + Length(1)), nullptr);
+  EXPECT_EQ(Stats().system_bytes, 0);
+
+  // The region is still usable for spans that fit.
+  Span* span = New(kSizeClass, Length(1));
+  ASSERT_NE(span, nullptr);
+  EXPECT_EQ(SizeClassFromAddress(span->start_address()), kSizeClass);
+}
+
+TEST_F(SizeClassRegionsTest, RegionAlreadyMapped) {
+  constexpr size_t kSizeClass = 5;
+  void* start =
+      reinterpret_cast<void*>(SizeClassRegions::RegionStart(kSizeClass, kTag));
+  const size_t bytes = Length(1).in_bytes();
+  void* taken = mmap(start, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(taken, MAP_FAILED);
+  if (taken != start) {
+    munmap(taken, bytes);
+    GTEST_SKIP() << "could not map the start of the region";
+  }
+
+  EXPECT_EQ(New(kSizeClass, Length(1)), nullptr);
+  EXPECT_EQ(Stats().system_bytes, 0);
+
+  // The region is not tried again, even once its range is free.
+  ASSERT_EQ(munmap(taken, bytes), 0);
+  EXPECT_EQ(New(kSizeClass, Length(1)), nullptr);
+
+  // Other regions are unaffected.
+  EXPECT_NE(New(kSizeClass + 1, Length(1)), nullptr);
+}
+
+TEST_F(SizeClassRegionsTest, MapFailureIsRetried) {
+  constexpr size_t kSizeClass = 7;
+  rlimit old_limit;
+  ASSERT_EQ(getrlimit(RLIMIT_AS, &old_limit), 0);
+
+  // Cap the address space at its current size, so that mapping the region
+  // fails with ENOMEM.
+  FILE* statm = fopen("/proc/self/statm", "r");
+  ASSERT_NE(statm, nullptr);
+  unsigned long pages;
+  ASSERT_EQ(fscanf(statm, "%lu", &pages), 1);
+  fclose(statm);
+  rlimit limit = old_limit;
+  limit.rlim_cur = pages * getpagesize();
+  if (limit.rlim_cur > old_limit.rlim_cur ||
+      setrlimit(RLIMIT_AS, &limit) != 0) {
+    GTEST_SKIP() << "could not limit the address space";
+  }
+  Span* span = New(kSizeClass, Length(1));
+  ASSERT_EQ(setrlimit(RLIMIT_AS, &old_limit), 0);
+  EXPECT_EQ(span, nullptr);
+  EXPECT_EQ(Stats().system_bytes, 0);
+
+  // Unlike a taken range, the region is tried again.
+  span = New(kSizeClass, Length(1));
+  ASSERT_NE(span, nullptr);
+  EXPECT_EQ(SizeClassFromAddress(span->start_address()), kSizeClass);
+}
+
+}  // namespace
+}  // namespace tcmalloc_internal
+}  // namespace tcmalloc
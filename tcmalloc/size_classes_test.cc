@@ -480,6 +480,90 @@ TEST(SizeMapTest, ValidateConditionsForSeparateAllocsInHugePageFiller) {
   }
 }
 
+TEST(SizeMapTest, AllocPrefetch) {
+  SizeMap m;
+  m.Init(kSizeClasses);
+  const size_t small = m.SizeClass(CppPolicy(), 8);
+  const size_t large = m.SizeClass(CppPolicy(), 1024);
+  ASSERT_LT(m.class_to_size(small), ABSL_CACHELINE_SIZE);
+  ASSERT_GT(m.class_to_size(large), ABSL_CACHELINE_SIZE);
+
+  m.set_alloc_prefetch(small, AllocPrefetch::kOn);
+  m.set_alloc_prefetch(large, AllocPrefetch::kOn);
+  EXPECT_EQ(m.prefetch_lines(small), 1);
+  EXPECT_EQ(m.prefetch_lines(large), SizeMap::kMaxPrefetchLines);
+
+  // Feedback only affects adaptive size classes.
+  for (int i = 0; i < SizeMap::kPrefetchWindow; ++i) {
+    m.RecordSampledTouch(large, false);
+  }
+  EXPECT_EQ(m.prefetch_lines(large), SizeMap::kMaxPrefetchLines);
+
+  m.set_alloc_prefetch(large, AllocPrefetch::kOff);
+  EXPECT_EQ(m.prefetch_lines(large), 0);
+}
+
+TEST(SizeMapTest, AdaptiveAllocPrefetch) {
+  SizeMap m;
+  m.Init(kSizeClasses);
+  const size_t size_class = m.SizeClass(CppPolicy(), 1024);
+  m.set_alloc_prefetch(size_class, AllocPrefetch::kAdaptive);
+  EXPECT_EQ(m.prefetch_lines(size_class), 0);
+
+  // Few misses keep prefetching off.
+  for (int i = 0; i < SizeMap::kPrefetchWindow; ++i) {
+    m.RecordSampledTouch(size_class, i == 0);
+  }
+  EXPECT_EQ(m.prefetch_lines(size_class), 0);
+
+  // Frequent misses turn it on at the end of the window.
+  for (int i = 0; i < SizeMap::kPrefetchWindow; ++i) {
+    EXPECT_EQ(m.prefetch_lines(size_class), 0);
+    m.RecordSampledTouch(size_class, i % SizeMap::kPrefetchMissRatio == 0);
+  }
+  EXPECT_EQ(m.prefetch_lines(size_class), SizeMap::kMaxPrefetchLines);
+
+  // It stays on for a while, regardless of what is observed meanwhile, then
+  // switches off to measure again.
+  for (int i = 0;
+       i < SizeMap::kPrefetchRecheckWindows * SizeMap::kPrefetchWindow; ++i) {
+    EXPECT_EQ(m.prefetch_lines(size_class), SizeMap::kMaxPrefetchLines);
+    m.RecordSampledTouch(size_class, false);
+  }
+  EXPECT_EQ(m.prefetch_lines(size_class), 0);
+}
+
+TEST(SizeMapTest, ParseSizeClasses) {
+  SizeClassInfo parsed[4];
+  ASSERT_EQ(ParseSizeClasses("# <bytes> <pages> <batch size>\n"
+                             "  8 1 32  # comment\n"
+                             "\n"
+                             "16\t1\t32\r\n"
+                             "32, 1, 32",
+                             absl::MakeSpan(parsed)),
+            4);
+  EXPECT_EQ(parsed[0].size, 0);
+  EXPECT_EQ(parsed[0].pages, 0);
+  EXPECT_EQ(parsed[0].num_to_move, 0);
+  EXPECT_EQ(parsed[1].size, 8);
+  EXPECT_EQ(parsed[2].size, 16);
+  EXPECT_EQ(parsed[3].size, 32);
+  EXPECT_EQ(parsed[3].pages, 1);
+  EXPECT_EQ(parsed[3].num_to_move, 32);
+
+  // Too many classes.
+  EXPECT_EQ(ParseSizeClasses("8 1 32\n16 1 32\n32 1 32\n64 1 32\n",
+                             absl::MakeSpan(parsed)),
+            0);
+  // Malformed lines.
+  EXPECT_EQ(ParseSizeClasses("8 1\n", absl::MakeSpan(parsed)), 0);
+  EXPECT_EQ(ParseSizeClasses("8 1 32 4\n", absl::MakeSpan(parsed)), 0);
+  EXPECT_EQ(ParseSizeClasses("8 1 -32\n", absl::MakeSpan(parsed)), 0);
+  EXPECT_EQ(ParseSizeClasses("99999999999999999999999 1 32\n",
+                             absl::MakeSpan(parsed)),
+            0);
+}
+
 TEST(SizeMapTest, Preinit) {
   ABSL_CONST_INIT static SizeMap m;
 
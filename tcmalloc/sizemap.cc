@@ -15,8 +15,11 @@
 #include "tcmalloc/sizemap.h"
 
 #include <algorithm>
+#include <limits>
 #include <new>
 
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/optimization.h"
@@ -28,6 +31,45 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+size_t ParseSizeClasses(absl::string_view text,
+                        absl::Span<SizeClassInfo> size_classes) {
+  if (size_classes.empty()) return 0;
+  size_classes[0] = {0, 0, 0};
+  size_t count = 1;
+
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+    absl::string_view line = text.substr(0, end);
+    text.remove_prefix(end == absl::string_view::npos ? text.size() : end + 1);
+    line = line.substr(0, line.find('#'));
+
+    // Each line holds either nothing or exactly three unsigned numbers.
+    size_t fields[3];
+    int num_fields = 0;
+    while (true) {
+      while (!line.empty() && (line.front() == ' ' || line.front() == '\t' ||
+                               line.front() == '\r' || line.front() == ',')) {
+        line.remove_prefix(1);
+      }
+      if (line.empty()) break;
+      if (line.front() < '0' || line.front() > '9' || num_fields == 3) {
+        return 0;
+      }
+      size_t value = 0;
+      while (!line.empty() && line.front() >= '0' && line.front() <= '9') {
+        if (value > (std::numeric_limits<size_t>::max() - 9) / 10) return 0;
+        value = value * 10 + (line.front() - '0');
+        line.remove_prefix(1);
+      }
+      fields[num_fields++] = value;
+    }
+    if (num_fields == 0) continue;
+    if (num_fields != 3 || count == size_classes.size()) return 0;
+    size_classes[count++] = {fields[0], fields[1], fields[2]};
+  }
+  return count;
+}
+
 bool SizeMap::IsValidSizeClass(size_t size, size_t pages,
                                size_t num_objects_to_move) {
   if (size == 0) {
@@ -197,6 +239,14 @@ bool SizeMap::Init(absl::Span<const SizeClassInfo> size_classes) {
     }
   }
 
+  const AllocPrefetch prefetch =
+      IsExperimentActive(Experiment::TCMALLOC_ALLOC_PREFETCH)
+          ? AllocPrefetch::kAdaptive
+          : AllocPrefetch::kOff;
+  for (size_t c = 1; c < kNumClasses; c++) {
+    set_alloc_prefetch(c, prefetch);
+  }
+
   if (!kHasExpandedClasses) {
     return true;
   }
@@ -267,6 +317,53 @@ bool SizeMap::Init(absl::Span<const SizeClassInfo> size_classes) {
   return true;
 }
 
+void SizeMap::set_alloc_prefetch(size_t size_class, AllocPrefetch mode) {
+  ASSERT(size_class < kNumClasses);
+  prefetch_mode_[size_class].store(mode, std::memory_order_relaxed);
+  prefetch_feedback_[size_class].store(0, std::memory_order_relaxed);
+  prefetch_lines_[size_class].store(
+      mode == AllocPrefetch::kOn ? MaxPrefetchLines(size_class) : 0,
+      std::memory_order_relaxed);
+}
+
+void SizeMap::RecordSampledTouch(size_t size_class, bool missed) {
+  ASSERT(size_class < kNumClasses);
+  if (alloc_prefetch(size_class) != AllocPrefetch::kAdaptive) return;
+
+  std::atomic<uint32_t>& feedback = prefetch_feedback_[size_class];
+  uint32_t old = feedback.load(std::memory_order_relaxed);
+  uint32_t next;
+  do {
+    uint32_t samples = (old & 0xff) + 1;
+    uint32_t misses = ((old >> 8) & 0xff) + (missed ? 1 : 0);
+    uint32_t windows = old >> 16;
+    if (samples == kPrefetchWindow) {
+      samples = 0;
+      misses = 0;
+      ++windows;
+    }
+    next = (windows << 16) | (misses << 8) | samples;
+  } while (!feedback.compare_exchange_weak(old, next,
+                                           std::memory_order_relaxed));
+  if ((next & 0xff) != 0) return;
+
+  // This sample completed a window; decide what the next one does.  Races
+  // with concurrent samples only cost a little accuracy.
+  if (prefetch_lines(size_class) != 0) {
+    // Misses were measured with the prefetch in flight, so they do not tell
+    // whether it is still needed.  Periodically stop and measure again.
+    if ((next >> 16) < kPrefetchRecheckWindows) return;
+    prefetch_lines_[size_class].store(0, std::memory_order_relaxed);
+  } else {
+    const uint32_t window_misses = ((old >> 8) & 0xff) + (missed ? 1 : 0);
+    if (window_misses * kPrefetchMissRatio >= kPrefetchWindow) {
+      prefetch_lines_[size_class].store(MaxPrefetchLines(size_class),
+                                        std::memory_order_relaxed);
+    }
+  }
+  feedback.store(0, std::memory_order_relaxed);
+}
+
 }  // namespace tcmalloc_internal
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
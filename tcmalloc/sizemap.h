@@ -19,6 +19,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <type_traits>
 
@@ -27,6 +28,7 @@
 #include "absl/base/macros.h"
 #include "absl/base/optimization.h"
 #include "absl/numeric/bits.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/config.h"
@@ -45,9 +47,42 @@ extern const absl::Span<const SizeClassInfo> kSizeClasses;
 extern const absl::Span<const SizeClassInfo> kExperimentalPow2SizeClasses;
 extern const absl::Span<const SizeClassInfo> kLegacySizeClasses;
 
+// Parses a size class table with one class per line, written as
+// "<bytes> <pages> <batch size>", into size_classes[1], size_classes[2], ....
+// Blank lines and anything after a '#' are ignored.  size_classes[0] is set to
+// the empty class.  Returns the number of entries written, or 0 if text is
+// malformed or has too many classes to fit.  The table itself is not checked;
+// SizeMap::Init does that.
+size_t ParseSizeClasses(absl::string_view text,
+                        absl::Span<SizeClassInfo> size_classes);
+
+// Whether CpuCache::Allocate prefetches a size class's objects for write
+// before handing them out.
+enum class AllocPrefetch : uint8_t {
+  kOff,
+  // Prefetch while sampled allocations show that the objects are usually not
+  // in cache when they are allocated.
+  kAdaptive,
+  kOn,
+};
+
 // Size-class information + mapping
 class SizeMap {
  public:
+  // The most leading cache lines of an object that are prefetched on
+  // allocation.
+  static constexpr size_t kMaxPrefetchLines = 2;
+
+  // Sampled allocations are judged in windows of this many.  Prefetching is
+  // turned on for an adaptive size class when at least 1/kPrefetchMissRatio of
+  // a window missed.
+  static constexpr uint32_t kPrefetchWindow = 16;
+  static constexpr uint32_t kPrefetchMissRatio = 4;
+  // While prefetching, sampled allocations say nothing about whether the
+  // prefetch is still needed, so it is switched back off for one window after
+  // this many windows to measure again.
+  static constexpr uint32_t kPrefetchRecheckWindows = 8;
+
   // All size classes <= 512 in all configs always have 1 page spans.
   static constexpr size_t kMultiPageSize = 512;
   // Min alignment for all size classes > kMultiPageSize in all configs.
@@ -165,6 +200,24 @@ class SizeMap {
   // Mapping from size class to max size storable in that class
   uint32_t class_to_size_[kNumClasses] = {0};
 
+  // Number of leading cache lines CpuCache::Allocate prefetches for write, or
+  // 0 if it does not prefetch objects of the size class.  CpuCache keeps a bit
+  // of whether this is nonzero, so changes must be followed by
+  // CpuCache::UpdatePrefetch().
+  std::atomic<uint8_t> prefetch_lines_[kNumClasses] = {};
+
+  std::atomic<AllocPrefetch> prefetch_mode_[kNumClasses] = {};
+
+  // Feedback for kAdaptive size classes, packed as
+  // (windows << 16) | (misses << 8) | samples so that it updates atomically.
+  std::atomic<uint32_t> prefetch_feedback_[kNumClasses] = {};
+
+  size_t MaxPrefetchLines(size_t size_class) const {
+    return std::min(kMaxPrefetchLines,
+                    (class_to_size(size_class) + ABSL_CACHELINE_SIZE - 1) /
+                        ABSL_CACHELINE_SIZE);
+  }
+
  protected:
   // Set the give size classes to be used by TCMalloc.
   bool SetSizeClasses(absl::Span<const SizeClassInfo> size_classes);
@@ -275,6 +328,25 @@ class SizeMap {
     return {cold_sizes_, cold_sizes_count_};
   }
 
+  // Number of leading cache lines of a newly allocated object to prefetch for
+  // write, or 0 for none.
+  ABSL_ATTRIBUTE_ALWAYS_INLINE inline size_t prefetch_lines(
+      size_t size_class) const {
+    ASSERT(size_class < kNumClasses);
+    return prefetch_lines_[size_class].load(std::memory_order_relaxed);
+  }
+
+  AllocPrefetch alloc_prefetch(size_t size_class) const {
+    ASSERT(size_class < kNumClasses);
+    return prefetch_mode_[size_class].load(std::memory_order_relaxed);
+  }
+  void set_alloc_prefetch(size_t size_class, AllocPrefetch mode);
+
+  // Reports whether the first cache line of a sampled allocation from
+  // size_class missed in cache when it was handed out.  Adaptive size classes
+  // turn prefetching on or off based on these reports.
+  void RecordSampledTouch(size_t size_class, bool missed);
+
   static bool IsValidSizeClass(size_t size, size_t num_pages,
                                size_t num_objects_to_move);
 };
@@ -17,9 +17,12 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <atomic>
 
+#include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/numeric/bits.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/logging.h"
@@ -33,6 +36,90 @@ GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
+namespace {
+
+// The loops that build and convert freelist batches are simple enough for the
+// compiler to vectorize.  RunVectorized inlines them into clones compiled for
+// wider instruction sets, and picks one based on the running CPU.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TCMALLOC_SPAN_X86_DISPATCH 1
+#endif
+
+enum class SimdLevel : int { kUnknown, kNone, kAvx2, kAvx512 };
+
+ABSL_CONST_INIT std::atomic<SimdLevel> simd_level{SimdLevel::kUnknown};
+
+SimdLevel DetectSimdLevel() {
+#ifdef TCMALLOC_SPAN_X86_DISPATCH
+  // We may run before constructors, when libgcc's copy of the CPU model is not
+  // yet populated.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl")) {
+    return SimdLevel::kAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::kAvx2;
+  }
+#endif  // TCMALLOC_SPAN_X86_DISPATCH
+  return SimdLevel::kNone;
+}
+
+inline SimdLevel GetSimdLevel() {
+  SimdLevel level = simd_level.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(level == SimdLevel::kUnknown)) {
+    // Racing initializers compute the same answer.
+    level = DetectSimdLevel();
+    simd_level.store(level, std::memory_order_relaxed);
+  }
+  return level;
+}
+
+#ifdef TCMALLOC_SPAN_X86_DISPATCH
+#ifdef __clang__
+#define TCMALLOC_SPAN_VECTORIZE(isa) __attribute__((target(isa), flatten))
+#else
+// At -O2, GCC's default cost model does not vectorize loops that need an
+// epilogue, which is all of ours.
+#define TCMALLOC_SPAN_VECTORIZE(isa)                               \
+  __attribute__((target(isa), optimize("vect-cost-model=dynamic"), \
+                 flatten))
+#endif
+
+template <typename F>
+TCMALLOC_SPAN_VECTORIZE("avx512f,avx512bw,avx512vl")
+void RunAvx512(const F& f) {
+  f();
+}
+
+template <typename F>
+TCMALLOC_SPAN_VECTORIZE("avx2")
+void RunAvx2(const F& f) {
+  f();
+}
+
+#undef TCMALLOC_SPAN_VECTORIZE
+#endif  // TCMALLOC_SPAN_X86_DISPATCH
+
+template <typename F>
+void RunVectorized(const F& f) {
+#ifdef TCMALLOC_SPAN_X86_DISPATCH
+  switch (GetSimdLevel()) {
+    case SimdLevel::kAvx512:
+      RunAvx512(f);
+      return;
+    case SimdLevel::kAvx2:
+      RunAvx2(f);
+      return;
+    default:
+      break;
+  }
+#endif  // TCMALLOC_SPAN_X86_DISPATCH
+  f();
+}
+
+}  // namespace
+
 void Span::Sample(SampledAllocation* sampled_allocation) {
   CHECK_CONDITION(!sampled_ && sampled_allocation);
   sampled_ = 1;
@@ -180,22 +267,98 @@ Span::ObjIdx* Span::BitmapIdxToPtr(ObjIdx idx, size_t size) const {
   return ptr;
 }
 
+void Span::IdxRunToPtrs(const ObjIdx* run, size_t n, uintptr_t start,
+                        int shift, void** out) {
+  RunVectorized([&] {
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = reinterpret_cast<void*>(
+          start + (static_cast<uintptr_t>(run[n - 1 - i]) << shift));
+    }
+  });
+}
+
+void Span::BatchPtrToIdx(absl::Span<void* const> batch, Span* const* spans,
+                         size_t size, ObjIdx* idx) {
+  void* const* ptrs = batch.data();
+  const size_t n = batch.size();
+  if (size < kBitmapMinObjectSize) {
+    if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
+      // Single page spans: as in PtrToIdx, the offset comes from the low bits
+      // of the pointer, without loading the span.
+      RunVectorized([&] {
+        for (size_t i = 0; i < n; ++i) {
+          idx[i] = static_cast<ObjIdx>(
+              (reinterpret_cast<uintptr_t>(ptrs[i]) & (kPageSize - 1)) >>
+              kAlignmentShift);
+        }
+      });
+    } else {
+      RunVectorized([&] {
+        for (size_t i = 0; i < n; ++i) {
+          idx[i] = static_cast<ObjIdx>(
+              (reinterpret_cast<uintptr_t>(ptrs[i]) -
+               spans[i]->first_page_.start_uintptr()) >>
+              SizeMap::kMultiPageAlignmentShift);
+        }
+      });
+    }
+  } else {
+    // The reciprocal only depends on the size, so there is no need to load
+    // reciprocal_ from each span.
+    const uint16_t reciprocal = CalcReciprocal(size);
+    if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
+      RunVectorized([&] {
+        for (size_t i = 0; i < n; ++i) {
+          idx[i] = OffsetToIdx<Align::SMALL>(
+              static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptrs[i]) -
+                                    spans[i]->first_page_.start_uintptr()),
+              size, reciprocal);
+        }
+      });
+    } else {
+      RunVectorized([&] {
+        for (size_t i = 0; i < n; ++i) {
+          idx[i] = OffsetToIdx<Align::LARGE>(
+              static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptrs[i]) -
+                                    spans[i]->first_page_.start_uintptr()),
+              size, reciprocal);
+        }
+      });
+    }
+  }
+#ifndef NDEBUG
+  for (size_t i = 0; i < n; ++i) {
+    ASSERT(idx[i] == spans[i]->PtrToFreelistIdx(ptrs[i], size));
+  }
+#endif  // NDEBUG
+}
+
 size_t Span::BitmapFreelistPopBatch(void** __restrict batch, size_t N,
                                     size_t size) {
 #ifndef NDEBUG
   size_t before = bitmap_.CountBits(0, 64);
 #endif  // NDEBUG
 
+  // Scan the bitmap first, then materialize the pointers in one pass, which
+  // keeps the multiply out of the bit scanning loop.
+  ObjIdx indices[64];
   size_t count = 0;
   // Want to fill the batch either with N objects, or the number of objects
   // remaining in the span.
   while (!bitmap_.IsZero() && count < N) {
     size_t offset = bitmap_.FindSet(0);
     ASSERT(offset < 64);
-    batch[count] = BitmapIdxToPtr(offset, size);
+    indices[count] = offset;
     bitmap_.ClearLowestBit();
     count++;
   }
+  const uintptr_t start = first_page_.start_uintptr();
+  RunVectorized([&] {
+    for (size_t i = 0; i < count; ++i) {
+      batch[i] = reinterpret_cast<void*>(
+          start + static_cast<uintptr_t>(indices[i]) * size);
+    }
+  });
 
 #ifndef NDEBUG
   size_t after = bitmap_.CountBits(0, 64);
@@ -265,12 +428,13 @@ int Span::BuildFreelist(size_t size, size_t count, void** batch, int N) {
   }
 
   // First, push as much as we can into the batch.
-  char* ptr = static_cast<char*>(start_address());
+  const uintptr_t start = first_page_.start_uintptr();
   int result = N <= count ? N : count;
-  for (int i = 0; i < result; ++i) {
-    batch[i] = ptr;
-    ptr += size;
-  }
+  RunVectorized([&] {
+    for (int i = 0; i < result; ++i) {
+      batch[i] = reinterpret_cast<void*>(start + i * size);
+    }
+  });
   allocated_.store(result, std::memory_order_relaxed);
 
   ObjIdx idxStep = size / static_cast<size_t>(kAlignment);
@@ -303,25 +467,32 @@ int Span::BuildFreelist(size_t size, size_t count, void** batch, int N) {
   // Note: we take freelist objects from the beginning and stacked objects
   // from the end. This has a nice property of not paging in whole span at once
   // and not draining whole cache.
-  ObjIdx* host = nullptr;  // cached first object on freelist
   const size_t max_embed = size / sizeof(ObjIdx) - 1;
-  int embed_count = 0;
+  size_t embed_count = 0;
   while (idx < idxEnd) {
     // Check the no idx can be confused with kListEnd.
     ASSERT(idx != kListEnd);
-    if (host && embed_count != max_embed) {
-      // Push onto first object on the freelist.
-      embed_count++;
-      idxEnd -= idxStep;
-      host[embed_count] = idxEnd;
+    // Push a new object onto the freelist...
+    ObjIdx* host = IdxToPtr(idx, size);
+    host[0] = freelist_;
+    freelist_ = idx;
+    idx += idxStep;
+
+    // ...and fill it with a run of indices taken from the end of the span.
+    const size_t remaining = (idxEnd - idx) / idxStep;
+    embed_count = remaining < max_embed ? remaining : max_embed;
+    const ObjIdx run_end = idxEnd;
+    auto fill = [&] {
+      for (size_t i = 1; i <= embed_count; ++i) {
+        host[i] = static_cast<ObjIdx>(run_end - i * idxStep);
+      }
+    };
+    if (embed_count >= kMinVectorizedRun) {
+      RunVectorized(fill);
     } else {
-      // The first object is full, push new object onto freelist.
-      host = IdxToPtr(idx, size);
-      host[0] = freelist_;
-      freelist_ = idx;
-      embed_count = 0;
-      idx += idxStep;
+      fill();
     }
+    idxEnd -= embed_count * idxStep;
   }
   embed_count_ = embed_count;
   return result;
@@ -24,6 +24,7 @@
 #include "absl/base/attributes.h"
 #include "absl/base/thread_annotations.h"
 #include "absl/numeric/bits.h"
+#include "absl/types/span.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
@@ -83,22 +84,26 @@ struct SpanAllocInfo {
 //  - ON_RETURNED_FREELIST: the span has no allocated objects, owned by PageHeap
 //    and is on returned PageHeap list.
 //    location_ == ON_RETURNED_FREELIST.
+//  - SCOPED_ARENA: the span is a chunk of a ScopedArenaRegion, which
+//    bump-allocates objects from it and frees them all at once.
+//    location_ == IN_SCOPED_ARENA.
 class Span;
 typedef TList<Span> SpanList;
 
 class Span : public SpanList::Elem {
  public:
   // Allocator/deallocator for spans. Note that these functions are defined
-  // in static_vars.h, which is weird: see there for why.
-  static Span* New(PageId p, Length len)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
-  static void Delete(Span* span) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // in static_vars.h, which is weird: see there for why.  Span metadata has
+  // its own lock, so these may be called with or without pageheap_lock held.
+  static Span* New(PageId p, Length len);
+  static void Delete(Span* span);
 
   // locations used to track what list a span resides on.
   enum Location {
     IN_USE,                // not on PageHeap lists
     ON_NORMAL_FREELIST,    // on normal PageHeap list
     ON_RETURNED_FREELIST,  // on returned PageHeap list
+    IN_SCOPED_ARENA,       // in use, as a chunk of a ScopedArenaRegion
   };
   Location location() const;
   void set_location(Location loc);
@@ -195,6 +200,9 @@ class Span : public SpanList::Elem {
   // size > SizeMap::kMultiPageSize.
   enum class Align { SMALL, LARGE };
 
+  // See the comment on freelist organization in cc file.
+  typedef uint16_t ObjIdx;
+
   // Indicate whether the Span is empty. Size is used to determine whether
   // the span is using a compressed linked list of objects, or a bitmap
   // to hold available objects.
@@ -205,6 +213,12 @@ class Span : public SpanList::Elem {
   //
   // If the freelist becomes full, we do not push the object onto the freelist.
   bool FreelistPush(void* ptr, size_t size) {
+    return FreelistPush(ptr, PtrToFreelistIdx(ptr, size), size);
+  }
+
+  // As above, for a caller that has already converted ptr to its index with
+  // BatchPtrToIdx.
+  bool FreelistPush(void* ptr, ObjIdx idx, size_t size) {
     const auto allocated = allocated_.load(std::memory_order_relaxed);
     ASSERT(allocated > 0);
     if (ABSL_PREDICT_FALSE(allocated == 1)) {
@@ -214,19 +228,22 @@ class Span : public SpanList::Elem {
     // Bitmaps are used to record object availability when there are fewer than
     // 64 objects in a span.
     if (ABSL_PREDICT_FALSE(size >= kBitmapMinObjectSize)) {
-      if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
-        return BitmapFreelistPush<Align::SMALL>(ptr, size);
-      } else {
-        return BitmapFreelistPush<Align::LARGE>(ptr, size);
-      }
+      return BitmapFreelistPush(ptr, idx, size);
     }
     if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
-      return FreelistPushSized<Align::SMALL>(ptr, size);
+      return FreelistPushSized<Align::SMALL>(ptr, idx, size);
     } else {
-      return FreelistPushSized<Align::LARGE>(ptr, size);
+      return FreelistPushSized<Align::LARGE>(ptr, idx, size);
     }
   }
 
+  // Converts each batch[i], which must be an object of the given size in
+  // spans[i], to its freelist index in idx[i].  This touches neither the
+  // freelists nor the objects, so it can run outside of the lock that guards
+  // the spans.  Vectorized where the CPU supports it.
+  static void BatchPtrToIdx(absl::Span<void* const> batch, Span* const* spans,
+                            size_t size, ObjIdx* idx);
+
   // Pops up to N objects from the freelist and returns them in the batch array.
   // Returns number of objects actually popped.
   size_t FreelistPopBatch(void** batch, size_t N, size_t size);
@@ -245,10 +262,12 @@ class Span : public SpanList::Elem {
   static constexpr size_t kCacheSize = 4;
 
  private:
-  // See the comment on freelist organization in cc file.
-  typedef uint16_t ObjIdx;
   static constexpr ObjIdx kListEnd = -1;
 
+  // Freelist runs shorter than this are converted to pointers inline, as the
+  // vectorized conversion does not pay for its call below that.
+  static constexpr size_t kMinVectorizedRun = 8;
+
   // Use uint16_t or uint8_t for 16 bit and 8 bit fields instead of bitfields.
   // LLVM will generate widen load/store and bit masking operations to access
   // bitfields and this hurts performance. Although compiler flag
@@ -312,6 +331,15 @@ class Span : public SpanList::Elem {
   ObjIdx BitmapPtrToIdx(void* ptr, size_t size) const;
   ObjIdx* BitmapIdxToPtr(ObjIdx idx, size_t size) const;
 
+  // Returns the freelist index of ptr, which may be managed by either the
+  // bitmap or the linked list.
+  ObjIdx PtrToFreelistIdx(void* ptr, size_t size) const;
+
+  // Stores start + (run[n - 1 - i] << shift) into out[i] for i in [0, n), that
+  // is, the objects of a freelist run in the order they are popped.
+  static void IdxRunToPtrs(const ObjIdx* run, size_t n, uintptr_t start,
+                           int shift, void** out);
+
   // Helper function for converting a pointer to an index.
   template <Align align>
   static ObjIdx OffsetToIdx(uintptr_t offset, size_t size, uint16_t reciprocal);
@@ -335,12 +363,11 @@ class Span : public SpanList::Elem {
   size_t FreelistPopBatchSized(void** __restrict batch, size_t N, size_t size);
 
   template <Align align>
-  bool FreelistPushSized(void* ptr, size_t size);
+  bool FreelistPushSized(void* ptr, ObjIdx idx, size_t size);
 
   // For spans containing 64 or fewer objects, indicate that the object at the
   // index has been returned. Always returns true.
-  template <Align align>
-  bool BitmapFreelistPush(void* ptr, size_t size);
+  bool BitmapFreelistPush(void* ptr, ObjIdx idx, size_t size);
 
   // A bitmap is used to indicate object availability for spans containing
   // 64 or fewer objects.
@@ -429,9 +456,17 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
     if (result + embed_count > N) {
       iter = N - result;
     }
-    for (size_t i = 0; i < iter; i++) {
-      // Pop from the first object on freelist.
-      batch[result + i] = IdxToPtrSized<align>(host[embed_count - i], size);
+    if (iter >= kMinVectorizedRun) {
+      IdxRunToPtrs(&host[embed_count - iter + 1], iter,
+                   first_page_.start_uintptr(),
+                   align == Align::SMALL ? kAlignmentShift
+                                         : SizeMap::kMultiPageAlignmentShift,
+                   &batch[result]);
+    } else {
+      for (size_t i = 0; i < iter; i++) {
+        // Pop from the first object on freelist.
+        batch[result + i] = IdxToPtrSized<align>(host[embed_count - i], size);
+      }
     }
     embed_count -= iter;
     result += iter;
@@ -459,8 +494,8 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
 }
 
 template <Span::Align align>
-bool Span::FreelistPushSized(void* ptr, size_t size) {
-  ObjIdx idx = PtrToIdxSized<align>(ptr, size);
+bool Span::FreelistPushSized(void* ptr, ObjIdx idx, size_t size) {
+  ASSERT(idx == PtrToIdxSized<align>(ptr, size));
   if (cache_size_ != kCacheSize) {
     // Have empty space in the cache, push there.
     cache_[cache_size_] = idx;
@@ -518,13 +553,11 @@ Span::ObjIdx Span::BitmapPtrToIdx(void* ptr, size_t size) const {
   return idx;
 }
 
-template <Span::Align align>
-bool Span::BitmapFreelistPush(void* ptr, size_t size) {
+inline bool Span::BitmapFreelistPush(void* ptr, ObjIdx idx, size_t size) {
 #ifndef NDEBUG
   size_t before = bitmap_.CountBits(0, 64);
 #endif
-  // TODO(djgove) Conversions to offsets can be computed outside of lock.
-  ObjIdx idx = BitmapPtrToIdx<align>(ptr, size);
+  ASSERT(BitmapIdxToPtr(idx, size) == ptr);
   // Check that the object is not already returned.
   ASSERT(bitmap_.GetBit(idx) == 0);
   // Set the bit indicating where the object was returned.
@@ -537,6 +570,21 @@ bool Span::BitmapFreelistPush(void* ptr, size_t size) {
   return true;
 }
 
+inline Span::ObjIdx Span::PtrToFreelistIdx(void* ptr, size_t size) const {
+  if (ABSL_PREDICT_FALSE(size >= kBitmapMinObjectSize)) {
+    if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
+      return BitmapPtrToIdx<Align::SMALL>(ptr, size);
+    } else {
+      return BitmapPtrToIdx<Align::LARGE>(ptr, size);
+    }
+  }
+  if (ABSL_PREDICT_TRUE(size <= SizeMap::kMultiPageSize)) {
+    return PtrToIdxSized<Align::SMALL>(ptr, size);
+  } else {
+    return PtrToIdxSized<Align::LARGE>(ptr, size);
+  }
+}
+
 inline Span::Location Span::location() const {
   return static_cast<Location>(location_);
 }
@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -147,6 +148,80 @@ BENCHMARK(BM_single_span_fulldrain)
     ->Arg(40)
     ->Arg(kNumClasses - 1);
 
+// BM_refill builds the freelist of a fresh span and drains it in batches,
+// as CentralFreeList does when refilling a size class after its spans have
+// been emptied.  Run over every size class to report per-class throughput.
+void BM_refill(benchmark::State& state) {
+  const int size_class = state.range(0);
+
+  size_t size = tc_globals.sizemap().class_to_size(size_class);
+  if (size == 0) {
+    state.SkipWithError("Empty size class.");
+    return;
+  }
+  size_t batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+  auto npages = Length(tc_globals.sizemap().class_to_pages(size_class));
+  size_t objects_per_span = npages.in_bytes() / size;
+
+  void* mem;
+  int res = posix_memalign(&mem, kPageSize, npages.in_bytes());
+  CHECK_CONDITION(res == 0);
+  Span span;
+  span.Init(PageIdContaining(mem), npages);
+
+  std::vector<void*> objects(objects_per_span + kMaxObjectsToMove);
+
+  int64_t processed = 0;
+  while (state.KeepRunningBatch(objects_per_span)) {
+    size_t popped =
+        span.BuildFreelist(size, objects_per_span, objects.data(), batch_size);
+    while (popped < objects_per_span) {
+      popped += span.FreelistPopBatch(&objects[popped], batch_size, size);
+    }
+    benchmark::DoNotOptimize(objects.data());
+    processed += popped;
+  }
+
+  state.SetItemsProcessed(processed);
+  state.SetBytesProcessed(processed * size);
+  free(mem);
+}
+
+BENCHMARK(BM_refill)->DenseRange(1, kNumClasses - 1);
+
+// BM_batch_ptr_to_idx converts a batch of objects to freelist indices, as
+// CentralFreeList::InsertRange does before taking its lock.
+void BM_batch_ptr_to_idx(benchmark::State& state) {
+  const int size_class = state.range(0);
+
+  size_t size = tc_globals.sizemap().class_to_size(size_class);
+  if (size == 0) {
+    state.SkipWithError("Empty size class.");
+    return;
+  }
+  size_t batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+  RawSpan raw_span;
+  raw_span.Init(size_class);
+  Span& span = raw_span.span();
+
+  void* batch[kMaxObjectsToMove];
+  Span* spans[kMaxObjectsToMove];
+  Span::ObjIdx idx[kMaxObjectsToMove];
+  size_t n = span.FreelistPopBatch(batch, batch_size, size);
+  std::fill(spans, spans + n, &span);
+
+  int64_t processed = 0;
+  while (state.KeepRunningBatch(n)) {
+    Span::BatchPtrToIdx({batch, n}, spans, size, idx);
+    benchmark::DoNotOptimize(idx);
+    processed += n;
+  }
+
+  state.SetItemsProcessed(processed);
+}
+
+BENCHMARK(BM_batch_ptr_to_idx)->DenseRange(1, kNumClasses - 1);
+
 void BM_NewDelete(benchmark::State& state) {
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
   for (auto s : state) {
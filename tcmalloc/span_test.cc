@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
@@ -191,6 +192,50 @@ TEST_P(SpanTest, FreelistRandomized) {
   }
 }
 
+TEST_P(SpanTest, BatchPtrToIdx) {
+  Span& span_ = raw_span_.span();
+
+  // Drain the span.
+  std::vector<void*> objects(objects_per_span_);
+  size_t popped = 0;
+  while (popped < objects_per_span_) {
+    size_t n =
+        span_.FreelistPopBatch(&objects[popped], objects_per_span_, size_);
+    ASSERT_GT(n, 0);
+    popped += n;
+  }
+  ASSERT_TRUE(span_.FreelistEmpty(size_));
+
+  // Push all objects but one back, converting them to indices in batches as
+  // CentralFreeList::InsertRange does.
+  std::vector<Span*> spans(objects_per_span_, &span_);
+  Span::ObjIdx idx[kMaxObjectsToMove];
+  const size_t to_push = objects_per_span_ - 1;
+  for (size_t start = 0; start < to_push; start += batch_size_) {
+    const size_t n = std::min(batch_size_, to_push - start);
+    Span::BatchPtrToIdx({&objects[start], n}, &spans[start], size_, idx);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_TRUE(span_.FreelistPush(objects[start + i], idx[i], size_));
+    }
+  }
+
+  // The same objects come back out.
+  absl::flat_hash_set<void*> expected(objects.begin(),
+                                      objects.begin() + to_push);
+  absl::flat_hash_set<void*> got;
+  void* batch[kMaxObjectsToMove];
+  for (;;) {
+    size_t n = span_.FreelistPopBatch(batch, batch_size_, size_);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_TRUE(got.insert(batch[i]).second);
+    }
+    if (n < batch_size_) {
+      break;
+    }
+  }
+  EXPECT_EQ(got, expected);
+}
+
 INSTANTIATE_TEST_SUITE_P(All, SpanTest, testing::Range(size_t(1), kNumClasses));
 
 }  // namespace
@@ -19,7 +19,6 @@
 
 #include <limits>
 
-#include "absl/base/internal/spinlock.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/mincore.h"
@@ -40,10 +39,7 @@ StackTraceTable::~StackTraceTable() {
   while (cur != nullptr) {
     LinkedSample* next = cur->next;
     cur->~LinkedSample();
-    {
-      absl::base_internal::SpinLockHolder h(&pageheap_lock);
-      tc_globals.linked_sample_allocator().Delete(cur);
-    }
+    tc_globals.linked_sample_allocator().Delete(cur);
     cur = next;
   }
   all_ = nullptr;
@@ -62,11 +58,7 @@ void StackTraceTable::AddTrace(double sample_weight, const StackTrace& t) {
   // when iterating over `tc_globals.sampled_allocation_recorder()` and
   // allocating, see more details in "HeapProfilingTest.AllocateWhileIterating"
   // under google3/tcmalloc/heap_profiling_test.cc.
-  LinkedSample* s;
-  {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    s = tc_globals.linked_sample_allocator().New();
-  }
+  LinkedSample* s = tc_globals.linked_sample_allocator().New();
   s = new (s) LinkedSample;
 
   // Report total bytes that are a multiple of the object size.
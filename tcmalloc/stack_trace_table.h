@@ -32,9 +32,9 @@ namespace tcmalloc_internal {
 
 class StackTraceTable final : public ProfileBase {
  public:
-  StackTraceTable(ProfileType type) ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  StackTraceTable(ProfileType type);
 
-  ~StackTraceTable() override ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  ~StackTraceTable() override;
 
   // base::Profile methods.
   void Iterate(
@@ -49,8 +49,7 @@ class StackTraceTable final : public ProfileBase {
   // sample. `sample_weight` is a floating point value used to calculate the
   // the expected number of objects allocated (might be fractional considering
   // fragmentation) corresponding to a given sample.
-  void AddTrace(double sample_weight, const StackTrace& t)
-      ABSL_LOCKS_EXCLUDED(pageheap_lock);
+  void AddTrace(double sample_weight, const StackTrace& t);
 
   // Exposed for PageHeapAllocator
   struct LinkedSample {
@@ -14,6 +14,7 @@
 
 #include "tcmalloc/static_vars.h"
 
+#include <fcntl.h>
 #include <stddef.h>
 
 #include <atomic>
@@ -23,11 +24,15 @@
 #include "absl/base/const_init.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/deallocation_profiler.h"
+#include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/mincore.h"
 #include "tcmalloc/internal/numa.h"
+#include "tcmalloc/internal/util.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/sampler.h"
@@ -68,6 +73,9 @@ ABSL_CONST_INIT deallocationz::DeallocationProfilerList
 ABSL_CONST_INIT std::atomic<AllocHandle> Static::sampled_alloc_handle_generator{
     0};
 ABSL_CONST_INIT PeakHeapTracker Static::peak_heap_tracker_;
+ABSL_CONST_INIT BackgroundScheduler Static::background_scheduler_;
+ABSL_CONST_INIT AllocationTracer Static::allocation_tracer_;
+ABSL_CONST_INIT SampledSpanPool Static::sampled_span_pool_;
 ABSL_CONST_INIT PageHeapAllocator<StackTraceTable::LinkedSample>
     Static::linked_sample_allocator_;
 ABSL_CONST_INIT std::atomic<bool> Static::inited_{false};
@@ -103,6 +111,7 @@ size_t Static::metadata_bytes() {
       sizeof(sampled_internal_fragmentation_) + sizeof(total_sampled_count_) +
       sizeof(allocation_samples) + sizeof(deallocation_samples) +
       sizeof(sampled_alloc_handle_generator) + sizeof(peak_heap_tracker_) +
+      sizeof(allocation_tracer_) + sizeof(sampled_span_pool_) +
       sizeof(guardedpage_allocator_) + sizeof(stacktrace_filter_) +
       sizeof(numa_topology_) + sizeof(cache_topology_);
   // LINT.ThenChange(:static_vars)
@@ -120,15 +129,56 @@ size_t Static::pagemap_residence() {
 
 int ABSL_ATTRIBUTE_WEAK default_want_legacy_size_classes();
 
+// Returns the size classes in the file named by TCMALLOC_SIZE_CLASSES_FILE, or
+// an empty span if it is unset or cannot be read or parsed.  This runs before
+// malloc works, so the file is read into static buffers.
+static absl::Span<const SizeClassInfo> SizeClassesFromFile() {
+  const char* path = thread_safe_getenv("TCMALLOC_SIZE_CLASSES_FILE");
+  if (path == nullptr || path[0] == '\0') return {};
+
+  ABSL_CONST_INIT static char buffer[16 << 10];
+  ABSL_CONST_INIT static SizeClassInfo size_classes[kNumBaseClasses];
+
+  int fd = signal_safe_open(path, O_RDONLY);
+  if (fd < 0) {
+    Log(kLog, __FILE__, __LINE__, "Could not open size classes file", path);
+    return {};
+  }
+  size_t length = 0;
+  ssize_t result;
+  while (length < sizeof(buffer) &&
+         (result = signal_safe_read(fd, buffer + length,
+                                    sizeof(buffer) - length, nullptr)) > 0) {
+    length += result;
+  }
+  signal_safe_close(fd);
+  if (length == sizeof(buffer)) {
+    Log(kLog, __FILE__, __LINE__, "Size classes file is too large", path);
+    return {};
+  }
+
+  const size_t count = ParseSizeClasses(absl::string_view(buffer, length),
+                                        absl::MakeSpan(size_classes));
+  if (count == 0) {
+    Log(kLog, __FILE__, __LINE__, "Could not parse size classes file", path);
+    return {};
+  }
+  return absl::MakeConstSpan(size_classes, count);
+}
+
 ABSL_ATTRIBUTE_COLD ABSL_ATTRIBUTE_NOINLINE void Static::SlowInitIfNecessary() {
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
 
   // double-checked locking
   if (!inited_.load(std::memory_order_acquire)) {
     absl::Span<const SizeClassInfo> size_classes;
+    const absl::Span<const SizeClassInfo> size_classes_from_file =
+        SizeClassesFromFile();
 
     if (IsExperimentActive(Experiment::TEST_ONLY_TCMALLOC_POW2_SIZECLASS)) {
       size_classes = kExperimentalPow2SizeClasses;
+    } else if (!size_classes_from_file.empty()) {
+      size_classes = size_classes_from_file;
     } else if (default_want_legacy_size_classes != nullptr &&
                default_want_legacy_size_classes() > 0) {
       // TODO(b/242710633): remove this opt out.
@@ -137,7 +187,14 @@ ABSL_ATTRIBUTE_COLD ABSL_ATTRIBUTE_NOINLINE void Static::SlowInitIfNecessary() {
       size_classes = kSizeClasses;
     }
 
-    CHECK_CONDITION(sizemap_.Init(size_classes));
+    if (!sizemap_.Init(size_classes)) {
+      // Only a table loaded at runtime can be invalid.  Init() leaves the
+      // SizeMap untouched when it rejects a table, so fall back to the default.
+      CHECK_CONDITION(size_classes.data() == size_classes_from_file.data());
+      Log(kLog, __FILE__, __LINE__,
+          "Invalid size classes file, using the default size classes");
+      CHECK_CONDITION(sizemap_.Init(kSizeClasses));
+    }
     numa_topology_.Init();
     cache_topology_.Init();
     sampledallocation_allocator_.Init(&arena_);
@@ -28,10 +28,12 @@
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/allocation_sample.h"
 #include "tcmalloc/arena.h"
+#include "tcmalloc/background_scheduler.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/deallocation_profiler.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/internal/allocation_trace.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/explicitly_constructed.h"
 #include "tcmalloc/internal/logging.h"
@@ -44,6 +46,7 @@
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/peak_heap_tracker.h"
 #include "tcmalloc/sampled_allocation_allocator.h"
+#include "tcmalloc/sampled_span_pool.h"
 #include "tcmalloc/sizemap.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stack_trace_table.h"
@@ -90,13 +93,22 @@ class Static final {
 
   static PeakHeapTracker& peak_heap_tracker() { return peak_heap_tracker_; }
 
+  static BackgroundScheduler& background_scheduler() {
+    return background_scheduler_;
+  }
+
+  static AllocationTracer& allocation_tracer() { return allocation_tracer_; }
+
+  static SampledSpanPool& sampled_span_pool() { return sampled_span_pool_; }
+
   static NumaTopology<kNumaPartitions, kNumBaseClasses>& numa_topology() {
     return numa_topology_;
   }
 
   //////////////////////////////////////////////////////////////////////
   // In addition to the explicit initialization comment, the variables below
-  // must be protected by pageheap_lock.
+  // must be protected by pageheap_lock.  The exceptions are the arena and the
+  // PageHeapAllocators, which do their own locking.
 
   static Arena& arena() { return arena_; }
 
@@ -175,10 +187,12 @@ class Static final {
         // the fast-path, since we will fall back to the slow path until this
         // variable is initialized.
         static_cast<int>(CpuCacheActive()) &
-        static_cast<int>(subtle::percpu::IsFastNoInit());
+        static_cast<int>(subtle::percpu::IsFastNoInit()) &
 #else
-        !CpuCacheActive();
+        static_cast<int>(!CpuCacheActive()) &
 #endif
+        // A trace of every allocation needs them to reach slow_alloc.
+        static_cast<int>(!allocation_tracer_.recording_all());
   }
 
   static CacheTopology& cache_topology() { return cache_topology_; }
@@ -218,6 +232,9 @@ class Static final {
   ABSL_CONST_INIT static std::atomic<bool> inited_;
   ABSL_CONST_INIT static std::atomic<bool> cpu_cache_active_;
   ABSL_CONST_INIT static PeakHeapTracker peak_heap_tracker_;
+  ABSL_CONST_INIT static BackgroundScheduler background_scheduler_;
+  ABSL_CONST_INIT static AllocationTracer allocation_tracer_;
+  ABSL_CONST_INIT static SampledSpanPool sampled_span_pool_;
   ABSL_CONST_INIT static NumaTopology<kNumaPartitions, kNumBaseClasses>
       numa_topology_;
 
@@ -21,6 +21,7 @@
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -63,6 +64,21 @@
 #define PR_SET_VMA_ANON_NAME 0
 #endif
 
+// MADV_COLLAPSE was added in Linux 6.1, and older headers do not define it.
+#if defined(__linux__) && !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+
+// pidfd_open and process_madvise were added in Linux 5.3 and 5.10, and older
+// headers do not define their syscall numbers, which are the same on every
+// architecture.
+#if defined(__linux__) && !defined(SYS_pidfd_open)
+#define SYS_pidfd_open 434
+#endif
+#if defined(__linux__) && !defined(SYS_process_madvise)
+#define SYS_process_madvise 440
+#endif
+
 // Solaris has a bug where it doesn't declare madvise() for C++.
 //    http://www.opensolaris.org/jive/thread.jspa?threadID=21035&tstart=0
 #if defined(__sun) && defined(__SVR4)
@@ -388,6 +404,14 @@ void BindMemory(void* const base, const size_t size, const size_t partition) {
 
 ABSL_CONST_INIT std::atomic<int> system_release_errors(0);
 
+#ifdef __linux__
+// A pidfd for this process, for process_madvise, and the pid it was opened
+// for: a child inherits the parent's pidfd across fork.
+ABSL_CONST_INIT int self_pidfd ABSL_GUARDED_BY(spinlock) = -1;
+ABSL_CONST_INIT pid_t self_pidfd_pid ABSL_GUARDED_BY(spinlock) = 0;
+ABSL_CONST_INIT std::atomic<bool> batch_release_unsupported(false);
+#endif
+
 }  // namespace
 
 AddressRange SystemAlloc(size_t bytes, size_t alignment, const MemoryTag tag) {
@@ -412,6 +436,34 @@ AddressRange SystemAlloc(size_t bytes, size_t alignment, const MemoryTag tag) {
   return {result, actual_bytes};
 }
 
+void* SystemAllocAt(void* addr, size_t bytes, const MemoryTag tag,
+                    bool* taken) {
+  ASSERT(GetMemoryTag(addr) == tag);
+  ASSERT(reinterpret_cast<uintptr_t>(addr) % GetPageSize() == 0);
+  ErrnoRestorer errno_restorer;
+
+  *taken = false;
+  void* result = mmap(addr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (result == MAP_FAILED) return nullptr;
+  if (result != addr) {
+    munmap(result, bytes);
+    *taken = true;
+    return nullptr;
+  }
+  switch (tag) {
+    case MemoryTag::kNormalP0:
+      BindMemory(result, bytes, 0);
+      break;
+    case MemoryTag::kNormalP1:
+      BindMemory(result, bytes, 1);
+      break;
+    default:
+      break;
+  }
+  return result;
+}
+
 static bool ReleasePages(void* start, size_t length) {
   ErrnoRestorer errno_restorer;
 
@@ -506,6 +558,197 @@ bool SystemRelease(void* start, size_t length) {
   return result;
 }
 
+#ifdef __linux__
+// Returns a pidfd for this process, or -1 if releases cannot be batched.
+static int SelfPidfd() {
+  if (batch_release_unsupported.load(std::memory_order_relaxed)) return -1;
+
+  absl::base_internal::SpinLockHolder lock_holder(&spinlock);
+  InitSystemAllocatorIfNecessary();
+  // A custom AddressRegionFactory may back its regions with something other
+  // than anonymous memory, which needs the MADV_REMOVE that process_madvise
+  // does not take.
+  if (region_factory != reinterpret_cast<AddressRegionFactory*>(&mmap_space)) {
+    return -1;
+  }
+  const pid_t pid = getpid();
+  if (self_pidfd < 0 || self_pidfd_pid != pid) {
+    if (self_pidfd >= 0) close(self_pidfd);
+    self_pidfd = syscall(SYS_pidfd_open, pid, 0);
+    self_pidfd_pid = pid;
+    if (self_pidfd < 0) {
+      batch_release_unsupported.store(true, std::memory_order_relaxed);
+      return -1;
+    }
+  }
+  return self_pidfd;
+}
+
+// Releases a prefix of ranges with process_madvise, returning its length.
+static size_t ProcessMadviseRelease(const AddressRange* ranges, size_t n) {
+  const int pidfd = SelfPidfd();
+  if (pidfd < 0) return 0;
+
+  // Well below IOV_MAX, and small enough for the stack.
+  constexpr size_t kMaxBatch = 64;
+  size_t done = 0;
+  while (done < n) {
+    iovec iov[kMaxBatch];
+    const size_t count = std::min(n - done, kMaxBatch);
+    for (size_t i = 0; i < count; ++i) {
+      iov[i].iov_base = ranges[done + i].ptr;
+      iov[i].iov_len = ranges[done + i].bytes;
+    }
+    // SystemRelease ends with MADV_DONTNEED for anonymous memory, whether or
+    // not it tried MADV_FREE first.
+    ssize_t ret;
+    do {
+      ret = syscall(SYS_process_madvise, pidfd, iov, count, MADV_DONTNEED, 0);
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+    if (ret == -1) {
+      if (errno == EBADF) {
+        // The application closed our pidfd out from under us, so its number
+        // may name something else by now.  Forget it without closing it.
+        absl::base_internal::SpinLockHolder lock_holder(&spinlock);
+        if (self_pidfd == pidfd) self_pidfd = -1;
+      } else {
+        // Kernels before 6.13 only take nondestructive advice for
+        // process_madvise, even for the calling process.
+        batch_release_unsupported.store(true, std::memory_order_relaxed);
+      }
+      return done;
+    }
+    // A short count means the kernel stopped partway; leave the range it
+    // stopped in, and the rest, to the caller.
+    size_t advised = ret;
+    size_t i = 0;
+    while (i < count && advised >= iov[i].iov_len) {
+      advised -= iov[i].iov_len;
+      ++i;
+    }
+    done += i;
+    if (i < count) break;
+  }
+  return done;
+}
+#endif
+
+size_t SystemReleaseBatch(const AddressRange* ranges, size_t n) {
+  ErrnoRestorer errno_restorer;
+  size_t batched = 0;
+#if defined(__linux__) && defined(MADV_DONTNEED)
+  batched = ProcessMadviseRelease(ranges, n);
+#endif
+  for (size_t i = batched; i < n; ++i) {
+    // Failures are counted in system_release_errors.
+    (void)SystemRelease(ranges[i].ptr, ranges[i].bytes);
+  }
+  return batched;
+}
+
+bool SystemRemap(void* from, void* to, size_t length) {
+  ErrnoRestorer errno_restorer;
+
+#ifdef MREMAP_DONTUNMAP
+  ASSERT(length > 0);
+  ASSERT((reinterpret_cast<uintptr_t>(from) & (GetPageSize() - 1)) == 0);
+  ASSERT((reinterpret_cast<uintptr_t>(to) & (GetPageSize() - 1)) == 0);
+  ASSERT((length & (GetPageSize() - 1)) == 0);
+  {
+    // A custom AddressRegionFactory may back its regions with something
+    // other than private anonymous memory, which mremap cannot move.
+    absl::base_internal::SpinLockHolder lock_holder(&spinlock);
+    if (region_factory !=
+        reinterpret_cast<AddressRegionFactory*>(&mmap_space)) {
+      return false;
+    }
+  }
+
+  // MREMAP_DONTUNMAP leaves [from, from + length) mapped (and empty), so the
+  // source stays usable by its owner.  Older kernels reject the flag.
+  void* result = mremap(from, length, length,
+                        MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, to);
+  return result != MAP_FAILED;
+#else
+  return false;
+#endif
+}
+
+void* SystemAllocHugepages(size_t bytes, const MemoryTag tag) {
+  ASSERT(bytes > 0);
+  ASSERT(bytes % kHugePageSize == 0);
+
+  void* result;
+  {
+    absl::base_internal::SpinLockHolder lock_holder(&spinlock);
+    InitSystemAllocatorIfNecessary();
+    if (region_factory !=
+        reinterpret_cast<AddressRegionFactory*>(&mmap_space)) {
+      return nullptr;
+    }
+    // MmapAligned keeps its placement hints unsynchronized, and relies on
+    // spinlock as MmapRegionFactory::Create does.
+    result = MmapAligned(bytes, kHugePageSize, tag);
+  }
+  if (result == nullptr) return nullptr;
+  CheckAddressBits<kAddressBits>(reinterpret_cast<uintptr_t>(result) + bytes -
+                                 1);
+  ASSERT(GetMemoryTag(result) == tag);
+
+  ErrnoRestorer errno_restorer;
+  if (mprotect(result, bytes, PROT_READ | PROT_WRITE) != 0) {
+    Log(kLogWithStack, __FILE__, __LINE__,
+        "mprotect() hugepages failed (ptr, size, error)", result, bytes,
+        strerror(errno));
+    SystemFreeHugepages(result, bytes);
+    return nullptr;
+  }
+#ifdef MADV_HUGEPAGE
+  // This is only a hint: the mapping is still usable if THP is disabled.
+  (void)madvise(result, bytes, MADV_HUGEPAGE);
+#endif
+  return result;
+}
+
+void SystemFreeHugepages(void* start, size_t bytes) {
+  ErrnoRestorer errno_restorer;
+  const int err = munmap(start, bytes);
+  if (err != 0) {
+    Log(kLogWithStack, __FILE__, __LINE__, "munmap() failed (error)",
+        strerror(errno));
+  }
+  ASSERT(err == 0);
+}
+
+bool SystemCollapse(void* start, size_t length) {
+#ifdef __linux__
+  ASSERT(reinterpret_cast<uintptr_t>(start) % kHugePageSize == 0);
+  ASSERT(length % kHugePageSize == 0);
+  // Once the kernel has rejected the advice as unknown, don't keep asking.
+  ABSL_CONST_INIT static std::atomic<bool> unsupported(false);
+  if (unsupported.load(std::memory_order_relaxed)) return false;
+
+  ErrnoRestorer errno_restorer;
+  int ret;
+  do {
+    ret = madvise(start, length, MADV_COLLAPSE);
+  } while (ret == -1 && errno == EINTR);
+  if (ret == 0) return true;
+  // EINVAL also covers ranges the kernel will not collapse.  The kernel checks
+  // the advice before the range, and accepts an empty range, so an empty
+  // request tells the two apart.
+  if (errno == EINVAL && madvise(start, 0, MADV_COLLAPSE) == -1 &&
+      errno == EINVAL) {
+    unsupported.store(true, std::memory_order_relaxed);
+  }
+  return false;
+#else
+  (void)start;
+  (void)length;
+  return false;
+#endif
+}
+
 AddressRegionFactory* GetRegionFactory() {
   absl::base_internal::SpinLockHolder lock_holder(&spinlock);
   InitSystemAllocatorIfNecessary();
@@ -562,6 +805,10 @@ static uintptr_t RandomMmapHint(size_t size, size_t alignment,
 
   rnd = Sampler::NextRandom(rnd);
   uintptr_t addr = rnd & kAddrMask & ~(alignment - 1) & ~kTagMask;
+  if (kSizeClassRegions) {
+    // Keep out of the half of the tag's range reserved for size class regions.
+    addr &= ~kSizeClassRegionFlag;
+  }
   addr |= static_cast<uintptr_t>(tag) << kTagShift;
   ASSERT(GetMemoryTag(reinterpret_cast<const void*>(addr)) == tag);
   return addr;
@@ -596,7 +843,9 @@ void* MmapAligned(size_t size, size_t alignment, const MemoryTag tag) {
 
   if (!next_addr || next_addr & (alignment - 1) ||
       GetMemoryTag(reinterpret_cast<void*>(next_addr)) != tag ||
-      GetMemoryTag(reinterpret_cast<void*>(next_addr + size - 1)) != tag) {
+      GetMemoryTag(reinterpret_cast<void*>(next_addr + size - 1)) != tag ||
+      (kSizeClassRegions &&
+       ((next_addr + size - 1) & kSizeClassRegionFlag) != 0)) {
     next_addr = RandomMmapHint(size, alignment, tag);
   }
   void* hint;
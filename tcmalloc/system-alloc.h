@@ -48,6 +48,14 @@ struct AddressRange {
 // Returns nullptr when out of memory.
 AddressRange SystemAlloc(size_t bytes, size_t alignment, MemoryTag tag);
 
+// Maps "bytes" of zeroed memory at exactly "addr", bypassing the region
+// factory.  Returns nullptr on failure.  *taken is set to whether the failure
+// was because the kernel placed the mapping elsewhere (e.g., because the range
+// is already in use), rather than a failed mmap (e.g., out of memory).
+// REQUIRES: GetMemoryTag(addr) == "tag", and addr and bytes are multiples of
+//           the system page size.
+void* SystemAllocAt(void* addr, size_t bytes, MemoryTag tag, bool* taken);
+
 // Returns the number of times we failed to give pages back to the OS after a
 // call to SystemRelease.
 int SystemReleaseErrors();
@@ -65,6 +73,44 @@ int SystemReleaseErrors();
 // Returns true on success.
 ABSL_MUST_USE_RESULT bool SystemRelease(void* start, size_t length);
 
+// Releases each of ranges[0, n) as SystemRelease would, with as few system
+// calls as the kernel allows: a single process_madvise for a batch of ranges
+// where it accepts MADV_DONTNEED for the calling process (Linux 6.13 and
+// later), otherwise one madvise per range.  Returns the number of ranges that
+// were released in batches.
+// REQUIRES: each range is aligned to the system page size.
+size_t SystemReleaseBatch(const AddressRange* ranges, size_t n);
+
+// Moves the pages backing [from, from + length) to [to, to + length) without
+// copying, leaving the source range mapped but unbacked.  The moved pages keep
+// the mapping attributes of the source (NUMA policy, MADV_HUGEPAGE), and both
+// ranges may be split into more VMAs.  Returns false if the pages could not be
+// moved (e.g., the kernel does not support it), in which case neither range is
+// modified and the caller should copy instead.
+// REQUIRES: both ranges were obtained from SystemAlloc, do not overlap, and
+//           are aligned to the system page size, as is length.
+ABSL_MUST_USE_RESULT bool SystemRemap(void* from, void* to, size_t length);
+
+// Maps "bytes" of zeroed memory, aligned to kHugePageSize, and advises the
+// kernel to back it with hugepages (MADV_HUGEPAGE).  Unlike SystemAlloc, the
+// mapping is not carved from a region, so it can be returned with a single
+// SystemFreeHugepages.  Returns nullptr when out of memory, or when a custom
+// AddressRegionFactory is installed, since that factory is expected to supply
+// all of our memory.
+//
+// The returned pointer is guaranteed to satisfy GetMemoryTag(ptr) == "tag".
+// REQUIRES: "bytes" is a non-zero multiple of kHugePageSize.
+void* SystemAllocHugepages(size_t bytes, MemoryTag tag);
+
+// Unmaps memory returned by SystemAllocHugepages.
+void SystemFreeHugepages(void* start, size_t bytes);
+
+// Asks the kernel to back [start, start + length) with hugepages right away
+// (MADV_COLLAPSE), faulting in any pages not yet backed.  Returns false if it
+// could not, including on kernels without MADV_COLLAPSE (before Linux 6.1).
+// REQUIRES: [start, start + length) is aligned to kHugePageSize boundaries.
+ABSL_MUST_USE_RESULT bool SystemCollapse(void* start, size_t length);
+
 // This call is the inverse of SystemRelease: the pages in this range
 // are in use and should be faulted in.  (In principle this is a
 // best-effort hint, but in practice we will unconditionally fault the
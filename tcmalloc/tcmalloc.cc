@@ -97,6 +97,7 @@
 #include "tcmalloc/global_stats.h"
 #include "tcmalloc/guarded_allocations.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/internal/allocation_trace.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
@@ -104,6 +105,7 @@
 #include "tcmalloc/internal/page_size.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/internal/sampled_allocation.h"
+#include "tcmalloc/internal/sysinfo.h"
 #include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/malloc_tracing_extension.h"
@@ -114,7 +116,10 @@
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/pages.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/release_queue.h"
+#include "tcmalloc/sampled_span_pool.h"
 #include "tcmalloc/sampler.h"
+#include "tcmalloc/scoped_arena.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stack_trace_table.h"
 #include "tcmalloc/static_vars.h"
@@ -315,35 +320,50 @@ extern "C" size_t MallocExtension_Internal_ReleaseMemoryToSystem(
   ABSL_CONST_INIT static size_t extra_bytes_released;
 
   absl::base_internal::SpinLockHolder rh(&release_lock);
+  ReleaseQueue& release_queue = tc_globals.page_allocator().release_queue();
+  tc_globals.page_allocator().UpdateNumaPressure();
 
-  absl::base_internal::SpinLockHolder h(&pageheap_lock);
-  if (num_bytes <= extra_bytes_released) {
-    // We released too much on a prior call, so don't release any
-    // more this time.
-    extra_bytes_released = extra_bytes_released - num_bytes;
-    num_bytes = 0;
-  } else {
-    num_bytes = num_bytes - extra_bytes_released;
-  }
+  size_t bytes_released;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    // The HugePageAwareAllocators queue the ranges they release, to be issued
+    // once pageheap_lock is dropped.
+    ReleaseQueue::DeferScope defer(release_queue);
+    // Return pooled sampled spans first, so that their pages can be released.
+    tc_globals.sampled_span_pool().Drain([](Span* span) {
+      tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1,
+                                         MemoryTag::kSampled);
+    });
+    if (num_bytes <= extra_bytes_released) {
+      // We released too much on a prior call, so don't release any
+      // more this time.
+      extra_bytes_released = extra_bytes_released - num_bytes;
+      num_bytes = 0;
+    } else {
+      num_bytes = num_bytes - extra_bytes_released;
+    }
 
-  Length num_pages;
-  if (num_bytes > 0) {
-    // A sub-page size request may round down to zero.  Assume the caller wants
-    // some memory released.
-    num_pages = BytesToLengthCeil(num_bytes);
-    ASSERT(num_pages > Length(0));
-  } else {
-    num_pages = Length(0);
-  }
-  size_t bytes_released =
-      tc_globals.page_allocator().ReleaseAtLeastNPages(num_pages).in_bytes();
-  if (bytes_released > num_bytes) {
-    extra_bytes_released = bytes_released - num_bytes;
-    return num_bytes;
+    Length num_pages;
+    if (num_bytes > 0) {
+      // A sub-page size request may round down to zero.  Assume the caller
+      // wants some memory released.
+      num_pages = BytesToLengthCeil(num_bytes);
+      ASSERT(num_pages > Length(0));
+    } else {
+      num_pages = Length(0);
+    }
+    bytes_released =
+        tc_globals.page_allocator().ReleaseAtLeastNPages(num_pages).in_bytes();
+    if (bytes_released > num_bytes) {
+      extra_bytes_released = bytes_released - num_bytes;
+      bytes_released = num_bytes;
+    } else {
+      // The PageHeap wasn't able to release num_bytes.  Don't try to
+      // compensate with a big release next time.
+      extra_bytes_released = 0;
+    }
   }
-  // The PageHeap wasn't able to release num_bytes.  Don't try to compensate
-  // with a big release next time.
-  extra_bytes_released = 0;
+  release_queue.Drain();
   return bytes_released;
 }
 
@@ -434,6 +454,10 @@ extern "C" void MallocExtension_Internal_GetProperties(
       stats.sharded_transfer_bytes;
   (*result)["tcmalloc.per_cpu_caches_active"].value =
       tc_globals.CpuCacheActive();
+  (*result)["tcmalloc.per_cpu_caches_populated"].value =
+      tc_globals.CpuCacheActive()
+          ? tc_globals.cpu_cache().GetPopulatedCpuStats().populated_caches
+          : 0;
   // Thread Cache Free List
   (*result)["tcmalloc.current_total_thread_cache_bytes"].value =
       stats.thread_bytes;
@@ -518,6 +542,9 @@ static void FreeSmallSlow(void* ptr, size_t size_class);
 
 inline size_t GetLargeSize(const void* ptr, const PageId p) {
   const Span* span = tc_globals.pagemap().GetExistingDescriptor(p);
+  if (ScopedArenaRegion::IsChunk(*span)) {
+    return ScopedArenaRegion::UsableSize(ptr);
+  }
   if (span->sampled()) {
     if (tc_globals.guardedpage_allocator().PointerIsMine(ptr)) {
       return tc_globals.guardedpage_allocator().GetRequestedSize(ptr);
@@ -528,10 +555,21 @@ inline size_t GetLargeSize(const void* ptr, const PageId p) {
   }
 }
 
+// Returns the size class of the object at ptr, which is on page p, or 0 if it
+// is not a small object.  Objects in size class regions need no pagemap
+// lookup.
+inline ABSL_ATTRIBUTE_ALWAYS_INLINE size_t GetSizeClassOf(const void* ptr,
+                                                          PageId p) {
+  if (size_t size_class = SizeClassFromAddress(ptr)) {
+    return size_class;
+  }
+  return tc_globals.pagemap().sizeclass(p);
+}
+
 inline size_t GetSize(const void* ptr) {
   if (ptr == nullptr) return 0;
   const PageId p = PageIdContaining(ptr);
-  size_t size_class = tc_globals.pagemap().sizeclass(p);
+  size_t size_class = GetSizeClassOf(ptr, p);
   if (size_class != 0) {
     return tc_globals.sizemap().class_to_size(size_class);
   } else {
@@ -546,6 +584,11 @@ inline size_t GetSize(const void* ptr) {
 static void InvokeHooksAndFreeSmall(void* ptr, size_t size_class) {
   // Refresh the fast path state.
   GetThreadSampler()->UpdateFastPathState();
+  if (ABSL_PREDICT_FALSE(tc_globals.allocation_tracer().recording_all())) {
+    RecordAllocationTraceEvent(
+        tc_globals, AllocationTraceEvent::Type::kFree, ptr,
+        tc_globals.sizemap().class_to_size(size_class), 0, nullptr);
+  }
   FreeSmallSlow(ptr, size_class);
 }
 
@@ -676,22 +719,41 @@ static void InvokeHooksAndFreePages(void* ptr) {
 
   Span* span = tc_globals.pagemap().GetExistingDescriptor(p);
   CHECK_CONDITION(span != nullptr && "Possible double free detected");
+  // Objects in a scoped arena are freed together when it ends.
+  if (ScopedArenaRegion::IsChunk(*span)) return;
+  if (ABSL_PREDICT_FALSE(tc_globals.allocation_tracer().recording_all())) {
+    RecordAllocationTraceEvent(tc_globals, AllocationTraceEvent::Type::kFree,
+                               ptr, GetLargeSize(ptr, p), 0, nullptr);
+  }
   // Prefetch now to avoid a stall accessing *span while under the lock.
   span->Prefetch();
 
   MaybeUnsampleAllocation(tc_globals, ptr, span);
 
+  if (IsSampledMemory(ptr)) {
+    if (tc_globals.guardedpage_allocator().PointerIsMine(ptr)) {
+      // Deallocate() makes a system call, and Span::Delete() has its own lock,
+      // so neither is done under pageheap_lock.
+      tc_globals.guardedpage_allocator().Deallocate(ptr);
+      Span::Delete(span);
+      return;
+    }
+    // At high sampling rates, keep the span for the next sample rather than
+    // taking pageheap_lock to free it.  Spans in the pool stay registered in
+    // the pagemap, as the next sample needs them to be.
+    if (!IsColdMemory(ptr) &&
+        Parameters::profile_sampling_rate() <=
+            SampledSpanPool::kMaxSamplingRate &&
+        tc_globals.sampled_span_pool().Push(span)) {
+      return;
+    }
+  }
+
   {
     absl::base_internal::SpinLockHolder h(&pageheap_lock);
     ASSERT(span->first_page() == p);
     if (IsSampledMemory(ptr)) {
-      if (tc_globals.guardedpage_allocator().PointerIsMine(ptr)) {
-        // Release lock while calling Deallocate() since it does a system call.
-        pageheap_lock.Unlock();
-        tc_globals.guardedpage_allocator().Deallocate(ptr);
-        pageheap_lock.Lock();
-        Span::Delete(span);
-      } else if (IsColdMemory(ptr)) {
+      if (IsColdMemory(ptr)) {
         ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
         tc_globals.page_allocator().Delete(span, /*objects_per_span=*/1,
                                            MemoryTag::kCold);
@@ -710,6 +772,9 @@ static void InvokeHooksAndFreePages(void* ptr) {
                                          MemoryTag::kNormal);
     }
   }
+  // A huge-dedicated span's mapping outlives it until now, so that the
+  // munmap is not made under pageheap_lock.
+  tc_globals.page_allocator().UnmapDeleted();
 }
 
 #ifndef NDEBUG
@@ -752,7 +817,7 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size_class(
 
   const PageId p = PageIdContaining(ptr);
   if (!have_size_class) {
-    size_class = tc_globals.pagemap().sizeclass(p);
+    size_class = GetSizeClassOf(ptr, p);
   }
   if (have_size_class || ABSL_PREDICT_TRUE(size_class != 0)) {
     ASSERT(size_class == GetSizeClass(ptr));
@@ -844,6 +909,11 @@ bool CorrectSize(void* ptr, size_t size, AlignPolicy align) {
   // have an incorrect one.
   if (size == 0) return true;
   if (ptr == nullptr) return true;
+  if (IsSampledMemory(ptr) &&
+      ScopedArenaRegion::IsChunk(*tc_globals.pagemap().GetExistingDescriptor(
+          PageIdContaining(ptr)))) {
+    return size <= ScopedArenaRegion::UsableSize(ptr);
+  }
   uint32_t size_class = 0;
   // Round-up passed in size to how much tcmalloc allocates for that size.
   if (tc_globals.guardedpage_allocator().PointerIsMine(ptr)) {
@@ -943,6 +1013,7 @@ inline struct mallinfo2 do_mallinfo2() {
 }  // namespace tcmalloc
 GOOGLE_MALLOC_SECTION_END
 
+using tcmalloc::tcmalloc_internal::AllocationTraceEvent;
 using tcmalloc::tcmalloc_internal::AllocSmall;
 using tcmalloc::tcmalloc_internal::CppPolicy;
 #ifdef TCMALLOC_HAVE_STRUCT_MALLINFO
@@ -956,8 +1027,12 @@ using tcmalloc::tcmalloc_internal::do_malloc_stats;
 using tcmalloc::tcmalloc_internal::do_malloc_trim;
 using tcmalloc::tcmalloc_internal::do_mallopt;
 using tcmalloc::tcmalloc_internal::GetThreadSampler;
+using tcmalloc::tcmalloc_internal::IsColdHint;
 using tcmalloc::tcmalloc_internal::MallocPolicy;
 using tcmalloc::tcmalloc_internal::Parameters;
+using tcmalloc::tcmalloc_internal::RecordAllocationTraceEvent;
+using tcmalloc::tcmalloc_internal::Sampler;
+using tcmalloc::tcmalloc_internal::ScopedArenaRegion;
 using tcmalloc::tcmalloc_internal::tc_globals;
 using tcmalloc::tcmalloc_internal::UsePerCpuCache;
 
@@ -978,6 +1053,15 @@ static Pointer ABSL_ATTRIBUTE_SECTION(google_malloc)
   tc_globals.InitIfNecessary();
   GetThreadSampler()->UpdateFastPathState();
 
+  if (ScopedArenaRegion* region = ScopedArenaRegion::Current();
+      ABSL_PREDICT_FALSE(region != nullptr) &&
+      policy.align() <= ScopedArenaRegion::kAlignment &&
+      !IsColdHint(policy.access())) {
+    if (void* p = region->Allocate(size); ABSL_PREDICT_TRUE(p != nullptr)) {
+      return Policy::as_pointer(p, ScopedArenaRegion::UsableSize(p));
+    }
+  }
+
   // Always use size returning: we likely need the capacity for invoking a hook.
   //  auto sized_policy = policy.SizeReturning();
   uint32_t size_class;
@@ -991,6 +1075,11 @@ static Pointer ABSL_ATTRIBUTE_SECTION(google_malloc)
   if (ABSL_PREDICT_FALSE(res.p == nullptr)) return policy.handle_oom(size);
 
   if (Policy::invoke_hooks()) {
+    if (ABSL_PREDICT_FALSE(tc_globals.allocation_tracer().recording_all())) {
+      RecordAllocationTraceEvent(tc_globals,
+                                 AllocationTraceEvent::Type::kAllocate, res.p,
+                                 size, policy.align(), nullptr);
+    }
   }
   return Policy::as_pointer(res.p, res.n);
 }
@@ -1068,6 +1157,28 @@ extern "C" size_t MallocExtension_Internal_GetAllocatedSize(const void* ptr) {
   return GetSize(ptr);
 }
 
+extern "C" void* MallocExtension_Internal_BeginScopedArena() {
+  tc_globals.InitIfNecessary();
+  ScopedArenaRegion* region = ScopedArenaRegion::Begin();
+  if (region != nullptr) {
+    // Send this thread's allocations through slow_alloc, which serves them
+    // from the region.
+    Sampler* sampler = GetThreadSampler();
+    sampler->set_fast_path_disabled(true);
+    sampler->UpdateFastPathState();
+  }
+  return region;
+}
+
+extern "C" void MallocExtension_Internal_EndScopedArena(void* region) {
+  ScopedArenaRegion::End(static_cast<ScopedArenaRegion*>(region));
+  if (ScopedArenaRegion::Current() == nullptr) {
+    Sampler* sampler = GetThreadSampler();
+    sampler->set_fast_path_disabled(false);
+    sampler->UpdateFastPathState();
+  }
+}
+
 extern "C" void MallocExtension_Internal_MarkThreadBusy() {
   tc_globals.InitIfNecessary();
 
@@ -1086,12 +1197,8 @@ MallocTracingExtension_Internal_GetAllocatedAddressRanges() {
   constexpr float kAllocatedSpansSizeReserveFactor = 1.2;
   constexpr int kMaxAttempts = 10;
   for (int i = 0; i < kMaxAttempts; i++) {
-    int estimated_span_count;
-    {
-      absl::base_internal::SpinLockHolder l(
-          &tcmalloc::tcmalloc_internal::pageheap_lock);
-      estimated_span_count = tc_globals.span_allocator().stats().total;
-    }
+    const int estimated_span_count =
+        tc_globals.span_allocator().stats().total;
     // We need to avoid allocation events during GetAllocatedSpans, as that may
     // cause a deadlock on pageheap_lock. To this end, we ensure that the result
     // vector already has a capacity greater than the current total span count.
@@ -1109,18 +1216,69 @@ MallocTracingExtension_Internal_GetAllocatedAddressRanges() {
       "output vector.");
 }
 
+absl::Status MallocTracingExtension_Internal_StartAllocationTrace(
+    tcmalloc::malloc_tracing_extension::AllocationTraceMode mode) {
+  using tcmalloc::malloc_tracing_extension::AllocationTraceMode;
+  using tcmalloc::tcmalloc_internal::AllocationTracer;
+  using tcmalloc::tcmalloc_internal::AllocationTraceState;
+
+  tc_globals.InitIfNecessary();
+  AllocationTracer& tracer = tc_globals.allocation_tracer();
+  if (!tracer.initialized()) {
+    absl::base_internal::SpinLockHolder l(
+        &tcmalloc::tcmalloc_internal::pageheap_lock);
+    if (!tracer.initialized()) {
+      const int num_cpus = tcmalloc::tcmalloc_internal::NumCPUs();
+      tracer.Init(num_cpus,
+                  tc_globals.arena().Alloc(
+                      AllocationTracer::BytesRequired(num_cpus),
+                      std::align_val_t{ABSL_CACHELINE_SIZE}));
+    }
+  }
+  if (!tracer.Start(mode == AllocationTraceMode::kAll
+                        ? AllocationTraceState::kAll
+                        : AllocationTraceState::kSampled)) {
+    return absl::FailedPreconditionError(
+        "An allocation trace is already active.");
+  }
+  return absl::OkStatus();
+}
+
+void MallocTracingExtension_Internal_StopAllocationTrace() {
+  tc_globals.allocation_tracer().Stop();
+}
+
+absl::StatusOr<uint64_t> MallocTracingExtension_Internal_DrainAllocationTrace(
+    std::vector<tcmalloc::malloc_tracing_extension::AllocationTraceEvent>*
+        events) {
+  return tc_globals.allocation_tracer().Drain(
+      [events](const tcmalloc::malloc_tracing_extension::AllocationTraceEvent&
+                   event) { events->push_back(event); });
+}
+
 //-------------------------------------------------------------------
 // Exported routines
 //-------------------------------------------------------------------
 
 using tcmalloc::tcmalloc_internal::AlignAsPolicy;
+using tcmalloc::tcmalloc_internal::BytesToLengthCeil;
 using tcmalloc::tcmalloc_internal::CorrectAlignment;
+using tcmalloc::tcmalloc_internal::CorrectSize;
 using tcmalloc::tcmalloc_internal::DefaultAlignPolicy;
 using tcmalloc::tcmalloc_internal::do_free;
 using tcmalloc::tcmalloc_internal::do_free_with_size;
+using tcmalloc::tcmalloc_internal::GetMemoryTag;
 using tcmalloc::tcmalloc_internal::GetPageSize;
+using tcmalloc::tcmalloc_internal::IsSampledMemory;
+using tcmalloc::tcmalloc_internal::kHugePageSize;
+using tcmalloc::tcmalloc_internal::kMaxSize;
+using tcmalloc::tcmalloc_internal::Length;
 using tcmalloc::tcmalloc_internal::MallocAlignPolicy;
 using tcmalloc::tcmalloc_internal::MultiplyOverflow;
+using tcmalloc::tcmalloc_internal::PageId;
+using tcmalloc::tcmalloc_internal::PageIdContaining;
+using tcmalloc::tcmalloc_internal::Span;
+using tcmalloc::tcmalloc_internal::SystemRemap;
 
 // depends on TCMALLOC_HAVE_STRUCT_MALLINFO, so needs to come after that.
 #include "tcmalloc/libc_override.h"
@@ -1176,6 +1334,108 @@ extern "C" ABSL_CACHELINE_ALIGNED ABSL_ATTRIBUTE_SECTION(google_malloc)
                           size);
 }
 
+// Batch allocation moves a run of same-sized objects between the caller and
+// the per-CPU cache with a single PopBatch / PushBatch instead of one
+// restartable sequence per object.  Anything that would take the slow path of
+// fast_alloc or do_free for an individual object (sampling, hooks, no per-CPU
+// cache, large or cold objects) is handled one object at a time, so profiles
+// look the same as for a loop over malloc / free.
+template <typename Policy>
+static size_t ABSL_ATTRIBUTE_SECTION(google_malloc)
+    alloc_batch(Policy policy, size_t size, void** batch, size_t count) {
+  using tcmalloc::tcmalloc_internal::kMaxObjectsToMove;
+
+  size_t allocated = 0;
+  uint32_t size_class;
+  if (ABSL_PREDICT_TRUE(
+          tc_globals.sizemap().GetSizeClass(policy, size, &size_class)) &&
+      UsePerCpuCache(tc_globals) && GetThreadSampler()->IsOnFastPath()) {
+    while (allocated < count) {
+      const size_t n = std::min(kMaxObjectsToMove, count - allocated);
+      // Allocating n objects one at a time charges the sampler n * (size + 1)
+      // bytes; TryRecordAllocationFast() adds the final byte itself.  If a
+      // sampling point falls inside this chunk, finish object by object.
+      if (!GetThreadSampler()->TryRecordAllocationFast(n * (size + 1) - 1)) {
+        break;
+      }
+      const size_t got = tc_globals.cpu_cache().AllocateBatch(
+          size_class, batch + allocated, n);
+      allocated += got;
+      if (ABSL_PREDICT_FALSE(got != n)) break;
+    }
+  }
+
+  for (; allocated < count; ++allocated) {
+    void* ptr = fast_alloc(policy, size);
+    if (ABSL_PREDICT_FALSE(ptr == nullptr)) break;
+    batch[allocated] = ptr;
+  }
+  return allocated;
+}
+
+template <typename AlignPolicy>
+static void ABSL_ATTRIBUTE_SECTION(google_malloc)
+    free_batch(size_t size, void* const* batch, size_t count,
+               AlignPolicy align) {
+  using tcmalloc::tcmalloc_internal::IsSampledMemory;
+  using tcmalloc::tcmalloc_internal::kMaxObjectsToMove;
+  using tcmalloc::tcmalloc_internal::kNumaPartitions;
+
+  uint32_t size_class;
+  if (ABSL_PREDICT_FALSE(!UsePerCpuCache(tc_globals) ||
+                         !GetThreadSampler()->IsOnFastPath() ||
+                         !tc_globals.sizemap().GetSizeClass(
+                             CppPolicy().AlignAs(align.align()), size,
+                             &size_class))) {
+    for (size_t i = 0; i < count; ++i) {
+      do_free_with_size(batch[i], size, align);
+    }
+    return;
+  }
+
+  void* objects[kMaxObjectsToMove];
+  size_t n = 0;
+  for (size_t i = 0; i < count; ++i) {
+    void* ptr = batch[i];
+    // Null and sampled (including cold) pointers carry the sampled tag.
+    bool same_class = !IsSampledMemory(ptr);
+    if (kNumaPartitions != 1 && same_class) {
+      uint32_t ptr_size_class;
+      same_class = tc_globals.sizemap().GetSizeClass(
+                       CppPolicy().AlignAs(align.align()).InSameNumaPartitionAs(
+                           ptr),
+                       size, &ptr_size_class) &&
+                   ptr_size_class == size_class;
+    }
+    if (ABSL_PREDICT_FALSE(!same_class)) {
+      do_free_with_size(ptr, size, align);
+      continue;
+    }
+
+    ASSERT(CorrectSize(ptr, size, align));
+    objects[n++] = ptr;
+    if (n == kMaxObjectsToMove) {
+      tc_globals.cpu_cache().DeallocateBatch(size_class, objects, n);
+      n = 0;
+    }
+  }
+  if (n != 0) {
+    tc_globals.cpu_cache().DeallocateBatch(size_class, objects, n);
+  }
+}
+
+extern "C" size_t MallocExtension_Internal_AllocateBatch(size_t size,
+                                                         void** batch,
+                                                         size_t count) {
+  return alloc_batch(MallocPolicy(), size, batch, count);
+}
+
+extern "C" void MallocExtension_Internal_DeallocateBatch(size_t size,
+                                                         void* const* batch,
+                                                         size_t count) {
+  free_batch(size, batch, count, MallocAlignPolicy());
+}
+
 extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalMemalign(
     size_t align, size_t size) noexcept {
   ASSERT(absl::has_single_bit(align));
@@ -1207,6 +1467,66 @@ extern "C" ABSL_CACHELINE_ALIGNED void* TCMallocInternalCalloc(
   return result;
 }
 
+// Page-level reallocations copying at least this many bytes move the old
+// pages into the new allocation with SystemRemap instead of memcpy.
+static constexpr size_t kMinRemapBytes = 16 * kHugePageSize;
+
+// Tries to grow the page-level allocation at ptr in place so that it can hold
+// size bytes, claiming the free pages that follow it.  The growth is charged
+// to the sampler as if it were a new allocation, so we only attempt this when
+// doing so will not pick a sample.
+static bool TryGrowPagesInPlace(void* ptr, size_t size) {
+  if (size <= kMaxSize || IsSampledMemory(ptr)) return false;
+  const PageId p = PageIdContaining(ptr);
+  if (tc_globals.pagemap().sizeclass(p) != 0) return false;
+  Span* span = tc_globals.pagemap().GetExistingDescriptor(p);
+  ASSERT(!span->sampled());
+  ASSERT(span->start_address() == ptr);
+
+  const Length n = BytesToLengthCeil(size);
+  ASSERT(n > span->num_pages());
+  const size_t growth = (n - span->num_pages()).in_bytes();
+  Sampler* sampler = GetThreadSampler();
+  if (!sampler->IsOnFastPath() || sampler->WillRecordAllocation(growth)) {
+    return false;
+  }
+  if (!tc_globals.page_allocator().TryGrow(span, n, GetMemoryTag(ptr))) {
+    return false;
+  }
+  const bool recorded = sampler->TryRecordAllocationFast(growth);
+  ASSERT(recorded);
+  (void)recorded;
+  return true;
+}
+
+// Moves the first size bytes of the page-level allocation at from into to by
+// remapping whole pages, which avoids touching (and faulting in) both copies
+// for very large reallocations.  Returns false if the caller has to copy.
+//
+// This is gated by Parameters::realloc_remap(), as it has costs the page heap
+// does not see: the source pages are freed still counted as backed although
+// the kernel no longer backs them, the moved pages keep the VMA policy (NUMA
+// binding, THP advice) of the source rather than the destination, and each
+// remap splits the VMAs of both ranges.
+static bool TryRemapPages(void* from, void* to, size_t size) {
+  if (!Parameters::realloc_remap() || size < kMinRemapBytes) return false;
+  if (IsSampledMemory(from) || IsSampledMemory(to) ||
+      GetMemoryTag(from) != GetMemoryTag(to)) {
+    return false;
+  }
+  const size_t page_mask = GetPageSize() - 1;
+  if (((reinterpret_cast<uintptr_t>(from) | reinterpret_cast<uintptr_t>(to)) &
+       page_mask) != 0) {
+    return false;
+  }
+
+  const size_t remapped = size & ~page_mask;
+  if (!SystemRemap(from, to, remapped)) return false;
+  memcpy(static_cast<char*>(to) + remapped,
+         static_cast<const char*>(from) + remapped, size - remapped);
+  return true;
+}
+
 static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
                                                             size_t new_size) {
   tc_globals.InitIfNecessary();
@@ -1244,7 +1564,13 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
   if ((new_size > old_size) || (new_size < upper_bound_to_shrink) ||
       will_sample ||
       tc_globals.guardedpage_allocator().PointerIsMine(old_ptr)) {
-    // Need to reallocate.
+    // Need to reallocate, unless a large allocation can simply grow.
+    if (new_size > old_size &&
+        (TryGrowPagesInPlace(old_ptr, alloc_size) ||
+         (alloc_size != new_size &&
+          TryGrowPagesInPlace(old_ptr, new_size)))) {
+      return old_ptr;
+    }
     void* new_ptr = nullptr;
 
     // Note: we shouldn't use larger size if the allocation will be sampled
@@ -1268,7 +1594,10 @@ static inline ABSL_ATTRIBUTE_ALWAYS_INLINE void* do_realloc(void* old_ptr,
     if (new_ptr == nullptr) {
       return nullptr;
     }
-    memcpy(new_ptr, old_ptr, ((old_size < new_size) ? old_size : new_size));
+    const size_t copy_size = (old_size < new_size) ? old_size : new_size;
+    if (!TryRemapPages(old_ptr, new_ptr, copy_size)) {
+      memcpy(new_ptr, old_ptr, copy_size);
+    }
     // We could use a variant of do_free() that leverages the fact
     // that we already know the sizeclass of old_ptr.  The benefit
     // would be small, so don't bother.
@@ -1652,3 +1981,14 @@ ABSL_CACHELINE_ALIGNED void* operator new[](
                       size);
   }
 }
+
+void tcmalloc::operator_new_batch(size_t size,
+                                  absl::Span<void*> batch) noexcept(false) {
+  // CppPolicy does not return on failure, so every slot is filled.
+  alloc_batch(CppPolicy(), size, batch.data(), batch.size());
+}
+
+void tcmalloc::operator_delete_batch(size_t size,
+                                     absl::Span<void* const> batch) noexcept {
+  free_batch(size, batch.data(), batch.size(), DefaultAlignPolicy());
+}
@@ -0,0 +1,331 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Replays an allocation trace recorded with
+// malloc_tracing_extension::StartAllocationTrace against either the linked-in
+// malloc or a standalone HugePageAwareAllocator, and reports operation
+// latencies and memory footprint, so that fragmentation and latency can be
+// compared across settings (experiments, parameters, allocator options).
+//
+// A trace file is the concatenation of the AllocationTraceEvents returned by
+// DrainAllocationTrace().  Events are replayed in timestamp order, one at a
+// time, on a single thread.  Frees of objects allocated before the trace
+// started are ignored.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_format.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/huge_page_aware_allocator.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/malloc_tracing_extension.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/span.h"
+
+ABSL_FLAG(std::string, trace, "", "Allocation trace to replay.");
+ABSL_FLAG(std::string, target, "malloc",
+          "What to replay the trace against: \"malloc\" for the linked-in "
+          "malloc, or \"hpaa\" for a standalone HugePageAwareAllocator, which "
+          "only sees allocations too large for a size class.");
+ABSL_FLAG(bool, hpaa_use_huge_region_more_often, false,
+          "For --target=hpaa, use HugeRegions for all large allocations.");
+ABSL_FLAG(bool, hpaa_separate_allocs, true,
+          "For --target=hpaa, keep sparsely- and densely-accessed spans on "
+          "separate hugepages.");
+ABSL_FLAG(int64_t, footprint_interval, 4096,
+          "Number of events between samples of the memory footprint.");
+ABSL_FLAG(bool, print_stats, false,
+          "Print the target's full statistics after replaying.");
+
+namespace tcmalloc {
+namespace {
+
+using malloc_tracing_extension::AllocationTraceEvent;
+
+// An allocator the trace is replayed against.
+class Target {
+ public:
+  virtual ~Target() = default;
+
+  // Returns a handle for the new object, or nullptr if the event does not
+  // apply to this target.
+  virtual void* Allocate(const AllocationTraceEvent& event) = 0;
+  virtual void Free(void* handle, const AllocationTraceEvent& allocation) = 0;
+
+  // Bytes of memory the target holds, whether in use or not.
+  virtual size_t Footprint() = 0;
+  virtual void PrintStats() = 0;
+};
+
+class MallocTarget final : public Target {
+ public:
+  void* Allocate(const AllocationTraceEvent& event) override {
+    if (event.alignment_log2 != 0) {
+      return ::operator new(
+          event.size, std::align_val_t{size_t{1} << event.alignment_log2});
+    }
+    return ::operator new(event.size);
+  }
+
+  void Free(void* handle, const AllocationTraceEvent& allocation) override {
+    if (allocation.alignment_log2 != 0) {
+      ::operator delete(
+          handle, allocation.size,
+          std::align_val_t{size_t{1} << allocation.alignment_log2});
+      return;
+    }
+    ::operator delete(handle, allocation.size);
+  }
+
+  size_t Footprint() override {
+    return MallocExtension::GetNumericProperty("generic.physical_memory_used")
+        .value_or(0);
+  }
+
+  void PrintStats() override {
+    absl::PrintF("%s", MallocExtension::GetStats());
+  }
+};
+
+class HugePageAwareAllocatorTarget final : public Target {
+ public:
+  HugePageAwareAllocatorTarget() {
+    tcmalloc_internal::huge_page_allocator_internal::
+        HugePageAwareAllocatorOptions options;
+    options.tag = tcmalloc_internal::MemoryTag::kNormal;
+    options.use_huge_region_more_often =
+        absl::GetFlag(FLAGS_hpaa_use_huge_region_more_often)
+            ? tcmalloc_internal::HugeRegionUsageOption::kUseForAllLargeAllocs
+            : tcmalloc_internal::HugeRegionUsageOption::kDefault;
+    options.allocs_for_sparse_and_dense_spans =
+        absl::GetFlag(FLAGS_hpaa_separate_allocs)
+            ? tcmalloc_internal::HugePageFillerAllocsOption::kSeparateAllocs
+            : tcmalloc_internal::HugePageFillerAllocsOption::kUnifiedAllocs;
+    // HugePageAwareAllocator can't be destroyed cleanly, so construct it in
+    // place and leak it.
+    allocator_ =
+        new (storage_) tcmalloc_internal::HugePageAwareAllocator(options);
+  }
+
+  void* Allocate(const AllocationTraceEvent& event) override {
+    using tcmalloc_internal::Length;
+
+    // Smaller objects come from spans shared through the central free lists,
+    // which this target does not model.
+    if (event.size <= tcmalloc_internal::kMaxSize) return nullptr;
+    const Length n = tcmalloc_internal::BytesToLengthCeil(event.size);
+    const Length align = tcmalloc_internal::BytesToLengthCeil(
+        size_t{1} << event.alignment_log2);
+    const tcmalloc_internal::SpanAllocInfo info = {
+        1, tcmalloc_internal::AccessDensityPrediction::kSparse};
+    tcmalloc_internal::Span* span = align > Length(1)
+                                        ? allocator_->NewAligned(n, align, info)
+                                        : allocator_->New(n, info);
+    CHECK_CONDITION(span != nullptr);
+    return span;
+  }
+
+  void Free(void* handle, const AllocationTraceEvent&) override {
+    absl::base_internal::SpinLockHolder h(&tcmalloc_internal::pageheap_lock);
+    allocator_->Delete(static_cast<tcmalloc_internal::Span*>(handle),
+                       /*objects_per_span=*/1);
+  }
+
+  size_t Footprint() override {
+    absl::base_internal::SpinLockHolder h(&tcmalloc_internal::pageheap_lock);
+    const tcmalloc_internal::BackingStats stats = allocator_->stats();
+    return stats.system_bytes - stats.unmapped_bytes;
+  }
+
+  void PrintStats() override {
+    std::string buffer(1 << 20, '\0');
+    tcmalloc_internal::Printer printer(&buffer[0], buffer.size());
+    allocator_->Print(&printer, /*everything=*/true);
+    buffer.resize(strlen(buffer.c_str()));
+    absl::PrintF("%s", buffer);
+  }
+
+ private:
+  alignas(tcmalloc_internal::HugePageAwareAllocator) char storage_[sizeof(
+      tcmalloc_internal::HugePageAwareAllocator)];
+  tcmalloc_internal::HugePageAwareAllocator* allocator_;
+};
+
+std::vector<AllocationTraceEvent> ReadTrace(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  CHECK_CONDITION(in.good() && "Could not open trace");
+  std::string bytes((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+  CHECK_CONDITION(bytes.size() % sizeof(AllocationTraceEvent) == 0 &&
+                  "Truncated trace");
+  std::vector<AllocationTraceEvent> events(bytes.size() /
+                                           sizeof(AllocationTraceEvent));
+  memcpy(events.data(), bytes.data(), bytes.size());
+  // Events are only ordered within each CPU's buffer.
+  std::stable_sort(events.begin(), events.end(),
+                   [](const AllocationTraceEvent& a,
+                      const AllocationTraceEvent& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+  return events;
+}
+
+// Records operation latencies in cycles.
+class LatencyStats {
+ public:
+  explicit LatencyStats(size_t capacity) { cycles_.reserve(capacity); }
+
+  void Add(int64_t cycles) { cycles_.push_back(cycles); }
+
+  void Print(const char* name) {
+    if (cycles_.empty()) {
+      absl::PrintF("%-8s no operations\n", name);
+      return;
+    }
+    std::sort(cycles_.begin(), cycles_.end());
+    const double ns_per_cycle =
+        1e9 / absl::base_internal::CycleClock::Frequency();
+    auto percentile = [&](double p) {
+      return cycles_[static_cast<size_t>(p * (cycles_.size() - 1))] *
+             ns_per_cycle;
+    };
+    absl::PrintF("%-8s %10u ops  p50 %8.1f ns  p99 %8.1f ns  p99.9 %8.1f ns  "
+                 "max %10.1f ns\n",
+                 name, cycles_.size(), percentile(0.5), percentile(0.99),
+                 percentile(0.999), percentile(1.0));
+  }
+
+ private:
+  std::vector<int64_t> cycles_;
+};
+
+int Replay() {
+  const std::string path = absl::GetFlag(FLAGS_trace);
+  CHECK_CONDITION(!path.empty() && "--trace is required");
+  const std::vector<AllocationTraceEvent> events = ReadTrace(path);
+
+  std::unique_ptr<Target> target;
+  const std::string target_name = absl::GetFlag(FLAGS_target);
+  if (target_name == "malloc") {
+    target = std::make_unique<MallocTarget>();
+  } else if (target_name == "hpaa") {
+    target = std::make_unique<HugePageAwareAllocatorTarget>();
+  } else {
+    absl::FPrintF(stderr, "Unknown --target=%s\n", target_name);
+    return 1;
+  }
+
+  struct Live {
+    void* handle;
+    AllocationTraceEvent allocation;
+  };
+  absl::flat_hash_map<uint64_t, Live> live;
+  live.reserve(events.size());
+  LatencyStats alloc_latency(events.size());
+  LatencyStats free_latency(events.size());
+
+  const int64_t footprint_interval =
+      std::max<int64_t>(absl::GetFlag(FLAGS_footprint_interval), 1);
+  size_t live_bytes = 0, peak_live_bytes = 0;
+  size_t peak_footprint = 0;
+  size_t skipped = 0, unmatched_frees = 0;
+  for (size_t i = 0; i < events.size(); ++i) {
+    const AllocationTraceEvent& event = events[i];
+    if (event.type == AllocationTraceEvent::Type::kAllocate) {
+      // A missed free (dropped from the trace) leaves a stale entry behind.
+      if (auto it = live.find(event.address); it != live.end()) {
+        live_bytes -= it->second.allocation.size;
+        target->Free(it->second.handle, it->second.allocation);
+        live.erase(it);
+      }
+      const int64_t start = absl::base_internal::CycleClock::Now();
+      void* handle = target->Allocate(event);
+      const int64_t end = absl::base_internal::CycleClock::Now();
+      if (handle == nullptr) {
+        ++skipped;
+      } else {
+        alloc_latency.Add(end - start);
+        live[event.address] = {handle, event};
+        live_bytes += event.size;
+        peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+      }
+    } else {
+      auto it = live.find(event.address);
+      if (it == live.end()) {
+        ++unmatched_frees;
+      } else {
+        const int64_t start = absl::base_internal::CycleClock::Now();
+        target->Free(it->second.handle, it->second.allocation);
+        const int64_t end = absl::base_internal::CycleClock::Now();
+        free_latency.Add(end - start);
+        live_bytes -= it->second.allocation.size;
+        live.erase(it);
+      }
+    }
+
+    if (i % footprint_interval == 0) {
+      peak_footprint = std::max(peak_footprint, target->Footprint());
+    }
+  }
+  const size_t final_footprint = target->Footprint();
+  peak_footprint = std::max(peak_footprint, final_footprint);
+
+  absl::PrintF("Replayed %u events against %s (%u skipped, %u unmatched "
+               "frees)\n",
+               events.size(), target_name, skipped, unmatched_frees);
+  alloc_latency.Print("alloc");
+  free_latency.Print("free");
+  absl::PrintF("Live bytes:      peak %12u  final %12u\n", peak_live_bytes,
+               live_bytes);
+  absl::PrintF("Footprint bytes: peak %12u  final %12u\n", peak_footprint,
+               final_footprint);
+  if (peak_live_bytes > 0) {
+    absl::PrintF("Peak footprint / peak live: %.3f\n",
+                 static_cast<double>(peak_footprint) / peak_live_bytes);
+  }
+  if (absl::GetFlag(FLAGS_print_stats)) {
+    target->PrintStats();
+  }
+
+  for (auto& [address, object] : live) {
+    target->Free(object.handle, object.allocation);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  return tcmalloc::Replay();
+}
@@ -0,0 +1,231 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Generates a size class table fitted to the requested sizes in a heap profile
+// or an allocation trace, and compares its waste with the compiled-in table.
+// The table is written in the format TCMalloc loads from
+// TCMALLOC_SIZE_CLASSES_FILE at startup.
+//
+// --profile takes an uncompressed pprof heap profile, as produced by
+// ProfileBuilder from MallocExtension::SnapshotCurrent (gunzip it first if
+// needed).  Requests are weighted by their estimated object count.
+//
+// --trace takes a trace file as read by allocation_trace_replay.  The trace is
+// replayed to find the point of peak live bytes, and requests are weighted by
+// the number of objects live at that point.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_format.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/profile.pb.h"
+#include "tcmalloc/malloc_tracing_extension.h"
+#include "tcmalloc/size_class_generator.h"
+#include "tcmalloc/sizemap.h"
+
+ABSL_FLAG(std::string, profile, "", "Heap profile to fit the table to.");
+ABSL_FLAG(std::string, trace, "", "Allocation trace to fit the table to.");
+ABSL_FLAG(std::string, output, "",
+          "File to write the table to.  Defaults to stdout.");
+ABSL_FLAG(int64_t, max_classes,
+          tcmalloc::tcmalloc_internal::kNumBaseClasses,
+          "Most size classes to generate, counting the empty class 0.");
+ABSL_FLAG(double, max_growth, 1.25,
+          "Most a class may exceed the one below it by, as a ratio.");
+ABSL_FLAG(double, max_span_overhead, 0.02,
+          "End-of-span waste and metadata to aim for, as a fraction of the "
+          "memory used for objects.");
+
+namespace tcmalloc {
+namespace {
+
+using malloc_tracing_extension::AllocationTraceEvent;
+using tcmalloc_internal::SizeRequests;
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  CHECK_CONDITION(in.good() && "Could not open input");
+  return std::string((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+}
+
+std::vector<SizeRequests> ToRequests(
+    const absl::btree_map<size_t, double>& counts) {
+  std::vector<SizeRequests> requests;
+  requests.reserve(counts.size());
+  for (const auto& [size, count] : counts) {
+    requests.push_back({size, count});
+  }
+  return requests;
+}
+
+std::vector<SizeRequests> RequestsFromProfile(const std::string& path) {
+  perftools::profiles::Profile profile;
+  CHECK_CONDITION(profile.ParseFromString(ReadFile(path)) &&
+                  "Could not parse profile");
+
+  auto string_id = [&](const char* s) -> int64_t {
+    for (int i = 0; i < profile.string_table_size(); ++i) {
+      if (profile.string_table(i) == s) return i;
+    }
+    return -1;
+  };
+  const int64_t objects_id = string_id("objects");
+  const int64_t request_id = string_id("request");
+  const int64_t bytes_id = string_id("bytes");
+  int objects_index = -1;
+  for (int i = 0; i < profile.sample_type_size(); ++i) {
+    if (profile.sample_type(i).type() == objects_id) objects_index = i;
+  }
+  CHECK_CONDITION(objects_index >= 0 && "Profile has no object counts");
+
+  absl::btree_map<size_t, double> counts;
+  for (const perftools::profiles::Sample& sample : profile.sample()) {
+    size_t requested = 0, allocated = 0;
+    for (const perftools::profiles::Label& label : sample.label()) {
+      if (label.key() == request_id) requested = label.num();
+      if (label.key() == bytes_id) allocated = label.num();
+    }
+    // Older profiles only have the allocated size.
+    const size_t size = requested != 0 ? requested : allocated;
+    if (size == 0) continue;
+    counts[size] += sample.value(objects_index);
+  }
+  return ToRequests(counts);
+}
+
+std::vector<SizeRequests> RequestsFromTrace(const std::string& path) {
+  const std::string bytes = ReadFile(path);
+  CHECK_CONDITION(bytes.size() % sizeof(AllocationTraceEvent) == 0 &&
+                  "Truncated trace");
+  std::vector<AllocationTraceEvent> events(bytes.size() /
+                                           sizeof(AllocationTraceEvent));
+  memcpy(events.data(), bytes.data(), bytes.size());
+  std::stable_sort(events.begin(), events.end(),
+                   [](const AllocationTraceEvent& a,
+                      const AllocationTraceEvent& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+
+  // Replays events [0, end), and returns the index just past the event that
+  // reached peak live bytes.  Fills *counts with the objects then live.
+  absl::flat_hash_map<uint64_t, size_t> live;
+  auto replay = [&](size_t end, absl::btree_map<size_t, double>* counts) {
+    live.clear();
+    size_t live_bytes = 0, peak_live_bytes = 0, peak = 0;
+    for (size_t i = 0; i < end; ++i) {
+      const AllocationTraceEvent& event = events[i];
+      if (event.type == AllocationTraceEvent::Type::kAllocate) {
+        size_t& size = live[event.address];
+        live_bytes += event.size - size;
+        size = event.size;
+        if (live_bytes > peak_live_bytes) {
+          peak_live_bytes = live_bytes;
+          peak = i + 1;
+        }
+      } else if (auto it = live.find(event.address); it != live.end()) {
+        live_bytes -= it->second;
+        live.erase(it);
+      }
+    }
+    if (counts != nullptr) {
+      for (const auto& [address, size] : live) {
+        (*counts)[size] += 1;
+      }
+    }
+    return peak;
+  };
+
+  absl::btree_map<size_t, double> counts;
+  replay(replay(events.size(), nullptr), &counts);
+  return ToRequests(counts);
+}
+
+int Generate() {
+  const std::string profile_path = absl::GetFlag(FLAGS_profile);
+  const std::string trace_path = absl::GetFlag(FLAGS_trace);
+  if (profile_path.empty() == trace_path.empty()) {
+    absl::FPrintF(stderr, "Exactly one of --profile and --trace is needed\n");
+    return 1;
+  }
+  const std::vector<SizeRequests> requests =
+      profile_path.empty() ? RequestsFromTrace(trace_path)
+                           : RequestsFromProfile(profile_path);
+
+  tcmalloc_internal::SizeClassGeneratorOptions options;
+  options.max_classes = std::clamp<int64_t>(
+      absl::GetFlag(FLAGS_max_classes), 2, tcmalloc_internal::kNumBaseClasses);
+  options.max_growth = absl::GetFlag(FLAGS_max_growth);
+  options.max_span_overhead = absl::GetFlag(FLAGS_max_span_overhead);
+  const std::vector<tcmalloc_internal::SizeClassInfo> size_classes =
+      tcmalloc_internal::GenerateSizeClasses(requests, options);
+  if (size_classes.empty()) {
+    absl::FPrintF(stderr,
+                  "--max_classes=%d is too few for --max_growth=%f\n",
+                  options.max_classes, options.max_growth);
+    return 1;
+  }
+
+  double requested_bytes = 0;
+  for (const SizeRequests& request : requests) {
+    if (request.size <= tcmalloc_internal::kMaxSize) {
+      requested_bytes += request.count * request.size;
+    }
+  }
+  const double default_waste = tcmalloc_internal::SizeClassWaste(
+      tcmalloc_internal::kSizeClasses, requests);
+  const double generated_waste =
+      tcmalloc_internal::SizeClassWaste(size_classes, requests);
+  absl::FPrintF(stderr,
+                "Requested bytes in size classes: %.0f\n"
+                "Waste with the default table (%u classes):   %.0f (%.2f%%)\n"
+                "Waste with the generated table (%u classes): %.0f (%.2f%%)\n",
+                requested_bytes, tcmalloc_internal::kSizeClasses.size() - 1,
+                default_waste, 100 * default_waste / requested_bytes,
+                size_classes.size() - 1, generated_waste,
+                100 * generated_waste / requested_bytes);
+
+  const std::string table = tcmalloc_internal::FormatSizeClasses(size_classes);
+  const std::string output = absl::GetFlag(FLAGS_output);
+  if (output.empty()) {
+    absl::PrintF("%s", table);
+  } else {
+    std::ofstream out(output);
+    out << table;
+    CHECK_CONDITION(out.good() && "Could not write output");
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  return tcmalloc::Generate();
+}
@@ -111,6 +111,8 @@ TEST_F(GetStatsTest, Pbtxt) {
   EXPECT_THAT(buf, HasSubstr("tcmalloc_release_partial_alloc_pages: true"));
   EXPECT_THAT(buf, HasSubstr("tcmalloc_release_pages_from_huge_region: true"));
   EXPECT_THAT(buf, HasSubstr("tcmalloc_resize_cpu_cache_size_classes: true"));
+  EXPECT_THAT(buf,
+              HasSubstr("tcmalloc_predictive_cpu_cache_capacity: false"));
   EXPECT_THAT(buf, ContainsRegex("(tcmalloc_filler_chunks_per_alloc: 8|(16))"));
 
   sized_delete(alloc, kSize);
@@ -168,6 +170,9 @@ TEST_F(GetStatsTest, Parameters) {
     EXPECT_THAT(
         buf,
         HasSubstr(R"(PARAMETER tcmalloc_resize_cpu_cache_size_classes 1)"));
+    EXPECT_THAT(
+        buf,
+        HasSubstr(R"(PARAMETER tcmalloc_predictive_cpu_cache_capacity 0)"));
     EXPECT_THAT(buf,
                 HasSubstr(R"(PARAMETER tcmalloc_improved_guarded_sampling 1)"));
     if (using_hpaa(buf)) {
@@ -0,0 +1,95 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "tcmalloc/internal/config.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/testing/testutil.h"
+
+namespace tcmalloc {
+namespace {
+
+using tcmalloc_internal::kHugePageSize;
+using ::testing::HasSubstr;
+
+constexpr size_t kThreshold = 64 << 20;
+
+class HugeDedicatedTest : public ::testing::Test {
+ protected:
+  HugeDedicatedTest()
+      : old_threshold_(MallocExtension::GetHugeDedicatedThreshold()) {
+    MallocExtension::SetHugeDedicatedThreshold(kThreshold);
+  }
+
+  ~HugeDedicatedTest() override {
+    MallocExtension::SetHugeDedicatedThreshold(old_threshold_);
+  }
+
+ private:
+  const size_t old_threshold_;
+};
+
+TEST_F(HugeDedicatedTest, AlignedAndReported) {
+  const size_t kSize = kThreshold + 12345;
+  void* ptr = ::operator new(kSize);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kHugePageSize, 0);
+  // Rounding up to hugepages does not show up in the allocation's size.
+  EXPECT_LT(*MallocExtension::GetAllocatedSize(ptr), kSize + kHugePageSize);
+  memset(ptr, 1, kSize);
+
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("HugeDedicated: 1 live allocations"));
+  const std::string pbtxt = GetStatsInPbTxt();
+  EXPECT_THAT(pbtxt, HasSubstr("huge_dedicated_allocator {"));
+  EXPECT_THAT(pbtxt, HasSubstr("live_allocations: 1"));
+
+  ::operator delete(ptr);
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("HugeDedicated: 0 live allocations"));
+}
+
+TEST_F(HugeDedicatedTest, BelowThreshold) {
+  void* ptr = ::operator new(kThreshold - (1 << 20));
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("HugeDedicated: 0 live allocations"));
+  ::operator delete(ptr);
+}
+
+TEST_F(HugeDedicatedTest, ThresholdIsAtLeastAHugepage) {
+  MallocExtension::SetHugeDedicatedThreshold(1);
+  EXPECT_EQ(MallocExtension::GetHugeDedicatedThreshold(), kHugePageSize);
+
+  void* small = ::operator new(kHugePageSize / 2);
+  void* large = ::operator new(kHugePageSize);
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("HugeDedicated: 1 live allocations"));
+  ::operator delete(small);
+  ::operator delete(large);
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("HugeDedicated: 0 live allocations"));
+
+  MallocExtension::SetHugeDedicatedThreshold(0);
+  EXPECT_EQ(MallocExtension::GetHugeDedicatedThreshold(), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc
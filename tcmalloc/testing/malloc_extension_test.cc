@@ -18,18 +18,27 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <map>
+#include <new>
 #include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/pages.h"
+#include "tcmalloc/scoped_arena.h"
 #include "tcmalloc/static_vars.h"
 
 namespace tcmalloc {
@@ -87,6 +96,30 @@ TEST(MallocExtension, SkipSubreleaseIntervals) {
             absl::ZeroDuration());
 }
 
+TEST(MallocExtension, StatsSnapshotStaleness) {
+  constexpr size_t kSize = 64 << 20;
+
+  MallocExtension::SetStatsSnapshotStaleness(absl::Hours(1));
+  EXPECT_EQ(MallocExtension::GetStatsSnapshotStaleness(), absl::Hours(1));
+
+  // The snapshot is taken by the first read, if need be, and later reads are
+  // served from it even though the heap has grown.
+  const size_t before =
+      *MallocExtension::GetNumericProperty("generic.current_allocated_bytes");
+  void* p = ::operator new(kSize);
+  EXPECT_EQ(
+      *MallocExtension::GetNumericProperty("generic.current_allocated_bytes"),
+      before);
+
+  // Without the snapshot, reads are exact.
+  MallocExtension::SetStatsSnapshotStaleness(absl::ZeroDuration());
+  EXPECT_EQ(MallocExtension::GetStatsSnapshotStaleness(), absl::ZeroDuration());
+  EXPECT_GE(
+      *MallocExtension::GetNumericProperty("generic.current_allocated_bytes"),
+      before + kSize);
+  ::operator delete(p);
+}
+
 TEST(MallocExtension, Properties) {
   // Verify that every property under GetProperties also works with
   // GetNumericProperty.
@@ -126,6 +159,7 @@ TEST(MallocExtension, Properties) {
       "tcmalloc.pageheap_free_bytes",
       "tcmalloc.pageheap_unmapped_bytes",
       "tcmalloc.per_cpu_caches_active",
+      "tcmalloc.per_cpu_caches_populated",
       "tcmalloc.required_bytes",
       "tcmalloc.sampled_internal_fragmentation",
       "tcmalloc.sharded_transfer_cache_free",
@@ -148,6 +182,108 @@ TEST(MallocExtension, Properties) {
   }
 }
 
+TEST(MallocExtension, AllocateBatch) {
+  // Cover batches that fit in a single transfer, span several, and sizes that
+  // are both small and beyond kMaxSize.
+  for (size_t size : {0, 8, 100, 4096, 300000}) {
+    for (size_t count : {1, 31, 128, 1000}) {
+      std::vector<void*> batch(count, nullptr);
+      ASSERT_EQ(MallocExtension::AllocateBatch(size, absl::MakeSpan(batch)),
+                count);
+
+      absl::flat_hash_set<void*> seen;
+      for (void* p : batch) {
+        ASSERT_NE(p, nullptr);
+        EXPECT_TRUE(seen.insert(p).second) << p;
+        EXPECT_THAT(MallocExtension::GetAllocatedSize(p),
+                    testing::Optional(testing::Ge(size)));
+        memset(p, 0xBF, size);
+      }
+
+      // Free half individually to check that the two paths interoperate.
+      for (size_t i = 0; i < count; i += 2) {
+        free(batch[i]);
+        batch[i] = nullptr;
+      }
+      MallocExtension::DeallocateBatch(size, batch);
+    }
+  }
+}
+
+TEST(MallocExtension, ScopedArena) {
+  std::vector<std::pair<void*, size_t>> objects;
+  {
+    MallocExtension::ScopedArena arena;
+    // Enough to span several chunks, with a large object mixed in.
+    for (size_t size : {size_t{0}, size_t{1}, size_t{24}, size_t{1000},
+                        size_t{100000}}) {
+      for (int i = 0; i < 1000; ++i) {
+        void* p = ::operator new(size);
+        EXPECT_THAT(MallocExtension::GetAllocatedSize(p),
+                    testing::Optional(testing::Ge(size)));
+        memset(p, 0xBF, size);
+        objects.emplace_back(p, size);
+      }
+    }
+
+    {
+      MallocExtension::ScopedArena nested;
+      void* p = malloc(100);
+      ASSERT_NE(p, nullptr);
+      p = realloc(p, 200);
+      ASSERT_NE(p, nullptr);
+      EXPECT_THAT(MallocExtension::GetAllocatedSize(p),
+                  testing::Optional(testing::Ge(200)));
+      free(p);
+    }
+
+    // Free every other object; the rest go with the arena, except for the
+    // large ones, which came from the regular allocator.
+    for (size_t i = 0; i < objects.size(); i += 2) {
+      ::operator delete(objects[i].first, objects[i].second);
+    }
+    for (size_t i = 1; i < objects.size(); i += 2) {
+      if (objects[i].second > 16 << 10) {
+        ::operator delete(objects[i].first, objects[i].second);
+      }
+    }
+  }
+
+  // Allocation is unaffected once the arena is gone.
+  void* p = malloc(100);
+  ASSERT_NE(p, nullptr);
+  EXPECT_THAT(MallocExtension::GetAllocatedSize(p),
+              testing::Optional(testing::Ge(100)));
+  free(p);
+}
+
+// Sampled large allocations take the sampler's slow path inside the scope;
+// that must not put the thread back on the fast path, past the arena.
+TEST(MallocExtension, ScopedArenaServesEveryAllocation) {
+  const int64_t old_rate = MallocExtension::GetProfileSamplingRate();
+  MallocExtension::SetProfileSamplingRate(1024);
+
+  {
+    MallocExtension::ScopedArena arena;
+    std::vector<void*> large;
+    for (int i = 0; i < 1000; ++i) {
+      large.push_back(::operator new(100000));
+      for (size_t size : {size_t{8}, size_t{64}, size_t{1000}}) {
+        void* p = ::operator new(size);
+        const Span* span =
+            tc_globals.pagemap().GetExistingDescriptor(PageIdContaining(p));
+        ASSERT_NE(span, nullptr);
+        ASSERT_TRUE(ScopedArenaRegion::IsChunk(*span)) << i << " " << size;
+      }
+    }
+    for (void* p : large) {
+      ::operator delete(p, 100000);
+    }
+  }
+
+  MallocExtension::SetProfileSamplingRate(old_rate);
+}
+
 // Test that when we resize the slab repeatedly, the metadata metric is
 // positive.
 TEST(MallocExtension, DynamicSlabMallocMetadata) {
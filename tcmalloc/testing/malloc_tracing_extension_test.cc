@@ -22,6 +22,7 @@
 #include <stddef.h>
 
 #include <cstdint>
+#include <new>
 #include <optional>
 #include <string>
 #include <type_traits>
@@ -49,6 +50,21 @@ TEST(MallocTracingExtension, GetAllocatedAddressRanges) {
   ASSERT_FALSE(allocated.ok());
   EXPECT_EQ(allocated.status().code(), absl::StatusCode::kUnimplemented);
 }
+
+TEST(MallocTracingExtension, AllocationTrace) {
+  using tcmalloc::malloc_tracing_extension::AllocationTraceMode;
+
+  EXPECT_EQ(tcmalloc::malloc_tracing_extension::StartAllocationTrace(
+                AllocationTraceMode::kAll)
+                .code(),
+            absl::StatusCode::kUnimplemented);
+  std::vector<tcmalloc::malloc_tracing_extension::AllocationTraceEvent> events;
+  EXPECT_EQ(
+      tcmalloc::malloc_tracing_extension::DrainAllocationTrace(&events)
+          .status()
+          .code(),
+      absl::StatusCode::kUnimplemented);
+}
 #else
 
 using ::tcmalloc::malloc_tracing_extension::AllocatedAddressRanges;
@@ -112,6 +128,54 @@ TEST(MallocTracingExtension, GetAllocatedAddressRanges) {
     }
   }
 }
+
+TEST(MallocTracingExtension, AllocationTrace) {
+  using tcmalloc::malloc_tracing_extension::AllocationTraceEvent;
+  using tcmalloc::malloc_tracing_extension::AllocationTraceMode;
+  using tcmalloc::malloc_tracing_extension::DrainAllocationTrace;
+  using tcmalloc::malloc_tracing_extension::StartAllocationTrace;
+  using tcmalloc::malloc_tracing_extension::StopAllocationTrace;
+
+  std::vector<AllocationTraceEvent> events;
+  events.reserve(1 << 16);
+  ASSERT_TRUE(DrainAllocationTrace(&events).ok());
+  events.clear();
+
+  ASSERT_TRUE(StartAllocationTrace(AllocationTraceMode::kAll).ok());
+  EXPECT_EQ(StartAllocationTrace(AllocationTraceMode::kSampled).code(),
+            absl::StatusCode::kFailedPrecondition);
+
+  // A large allocation takes the slow path, so this thread notices the trace
+  // right away.
+  ::operator delete(::operator new(1 << 20));
+
+  constexpr size_t kSize = 1234;
+  constexpr size_t kAlignment = 64;
+  void* small = ::operator new(kSize);
+  void* aligned = ::operator new(kSize, std::align_val_t{kAlignment});
+  ::operator delete(small, kSize);
+  ::operator delete(aligned, kSize, std::align_val_t{kAlignment});
+  StopAllocationTrace();
+
+  absl::StatusOr<uint64_t> dropped = DrainAllocationTrace(&events);
+  ASSERT_TRUE(dropped.ok());
+  EXPECT_EQ(*dropped, 0);
+
+  auto has_event = [&](AllocationTraceEvent::Type type, void* ptr,
+                       uint8_t alignment_log2) {
+    for (const AllocationTraceEvent& e : events) {
+      if (e.type == type && e.address == reinterpret_cast<uintptr_t>(ptr) &&
+          e.size >= kSize && e.alignment_log2 == alignment_log2) {
+        return true;
+      }
+    }
+    return false;
+  };
+  EXPECT_TRUE(has_event(AllocationTraceEvent::Type::kAllocate, small, 0));
+  EXPECT_TRUE(has_event(AllocationTraceEvent::Type::kAllocate, aligned, 6));
+  EXPECT_TRUE(has_event(AllocationTraceEvent::Type::kFree, small, 0));
+  EXPECT_TRUE(has_event(AllocationTraceEvent::Type::kFree, aligned, 0));
+}
 #endif
 
 }  // namespace
@@ -19,9 +19,13 @@
 #include <stdlib.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <utility>
 
 #include "gtest/gtest.h"
+#include "tcmalloc/internal/parameter_accessors.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/testing/testutil.h"
 
 namespace tcmalloc {
 namespace {
@@ -96,5 +100,58 @@ TEST(ReallocTest, AlignedAllocRealloc) {
   }
 }
 
+size_t CurrentAllocatedBytes() {
+  return *MallocExtension::GetNumericProperty(
+      "generic.current_allocated_bytes");
+}
+
+// Reallocates a freshly filled allocation of src_size bytes to dst_size bytes,
+// and checks that the contents and the allocated bytes follow.  Returns
+// whether the allocation grew in place.
+bool CheckLargeRealloc(size_t src_size, size_t dst_size) {
+  // Sampled allocations are always copied.
+  ScopedNeverSample never_sample;
+  const size_t before = CurrentAllocatedBytes();
+
+  unsigned char* src = static_cast<unsigned char*>(malloc(src_size));
+  Fill(src, src_size);
+  unsigned char* dst = static_cast<unsigned char*>(realloc(src, dst_size));
+  EXPECT_NE(dst, nullptr);
+  ExpectValid(dst, src_size);
+  Fill(dst, dst_size);
+  ExpectValid(dst, dst_size);
+  const size_t allocated = *MallocExtension::GetAllocatedSize(dst);
+  EXPECT_GE(allocated, dst_size);
+  EXPECT_EQ(CurrentAllocatedBytes(), before + allocated);
+
+  free(dst);
+  EXPECT_EQ(CurrentAllocatedBytes(), before);
+  return dst == src;
+}
+
+TEST(ReallocTest, LargeGrowsInPlace) {
+  // 5 MiB leaves 1 MiB of its last hugepage donated, which the allocation can
+  // grow into.
+  constexpr size_t kSrcSize = 5 << 20;
+  EXPECT_TRUE(CheckLargeRealloc(kSrcSize, kSrcSize + (512 << 10)));
+  // Not so once it needs more than the slack.
+  EXPECT_FALSE(CheckLargeRealloc(kSrcSize, 2 * kSrcSize));
+}
+
+TEST(ReallocTest, LargeRemap) {
+  if (&TCMalloc_Internal_SetReallocRemap == nullptr) {
+    GTEST_SKIP() << "Not linked against TCMalloc";
+  }
+  const bool previous = TCMalloc_Internal_GetReallocRemap();
+  constexpr size_t kSrcSize = 40 << 20;
+  for (bool remap : {false, true}) {
+    SCOPED_TRACE(remap);
+    TCMalloc_Internal_SetReallocRemap(remap);
+    // Include a partial page, which is copied rather than moved.
+    CheckLargeRealloc(kSrcSize + 100, 2 * kSrcSize);
+  }
+  TCMalloc_Internal_SetReallocRemap(previous);
+}
+
 }  // namespace
 }  // namespace tcmalloc
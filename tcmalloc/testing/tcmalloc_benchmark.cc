@@ -13,7 +13,10 @@
 // limitations under the License.
 
 #include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <algorithm>
 #include <memory>
 #include <new>
 #include <string>
@@ -21,12 +24,15 @@
 #include <vector>
 
 #include "absl/base/attributes.h"
+#include "absl/base/macros.h"
+#include "absl/base/optimization.h"
 #include "absl/random/random.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
 #include "benchmark/benchmark.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/declarations.h"
+#include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/malloc_extension.h"
 
 extern "C" ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetStats(
@@ -106,6 +112,41 @@ static void BM_new_delete_slow_path(benchmark::State& state) {
 }
 BENCHMARK(BM_new_delete_slow_path)->Arg(8)->Arg(8192);
 
+// Measures small allocations at high profile sampling rates.  range(0) is the
+// sampling rate in bytes, and range(1) selects whether sampled stacks are
+// captured by walking frame pointers.
+static void BM_sampled_new_delete(benchmark::State& state) {
+  int64_t old_rate = 0;
+  bool old_fast_unwind = false;
+  if (state.thread_index() == 0) {
+    old_rate = MallocExtension::GetProfileSamplingRate();
+    MallocExtension::SetProfileSamplingRate(state.range(0));
+    if (&TCMalloc_Internal_SetFastUnwindSampledStacks != nullptr) {
+      old_fast_unwind = TCMalloc_Internal_GetFastUnwindSampledStacks();
+      TCMalloc_Internal_SetFastUnwindSampledStacks(state.range(1) != 0);
+    }
+  }
+
+  const size_t kSize = 64;
+  for (auto s : state) {
+    void* p = ::operator new(kSize);
+    benchmark::DoNotOptimize(p);
+    ::operator delete(p, kSize);
+  }
+
+  if (state.thread_index() == 0) {
+    MallocExtension::SetProfileSamplingRate(old_rate);
+    if (&TCMalloc_Internal_SetFastUnwindSampledStacks != nullptr) {
+      TCMalloc_Internal_SetFastUnwindSampledStacks(old_fast_unwind);
+    }
+  }
+}
+BENCHMARK(BM_sampled_new_delete)
+    ->RangeMultiplier(2)
+    ->Ranges({{4 << 10, 512 << 10}, {0, 1}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
 static void* malloc_pages(size_t pages) {
 #if defined(TCMALLOC_256K_PAGES)
   static const size_t kPageSize = 256 * 1024;
@@ -181,6 +222,30 @@ static void BM_random_malloc_pages(benchmark::State& state) {
 
 BENCHMARK(BM_random_malloc_pages);
 
+// Grows an allocation from range(0) to range(1) bytes in steps of range(2)
+// bytes, as a growing buffer (e.g., a vector without reserve()) would.
+static void BM_realloc_grow(benchmark::State& state) {
+  const size_t start = state.range(0);
+  const size_t end = state.range(1);
+  const size_t step = state.range(2);
+
+  for (auto s : state) {
+    void* ptr = malloc(start);
+    for (size_t size = start + step; size <= end; size += step) {
+      ptr = realloc(ptr, size);
+      benchmark::DoNotOptimize(ptr);
+    }
+    free(ptr);
+  }
+  state.SetBytesProcessed(state.iterations() * (end - start));
+}
+
+BENCHMARK(BM_realloc_grow)
+    ->Args({256 << 10, 1 << 20, 64 << 10})
+    ->Args({1 << 20, 16 << 20, 1 << 20})
+    ->Args({16 << 20, 256 << 20, 16 << 20})
+    ->Args({64 << 20, 512 << 20, 64 << 20});
+
 static void BM_random_new_delete(benchmark::State& state) {
   const int kMaxOnHeap = 5000;
   const int kMaxRequestSize = 5000;
@@ -214,6 +279,78 @@ static void BM_random_new_delete(benchmark::State& state) {
 }
 BENCHMARK(BM_random_new_delete);
 
+// Measures threads whose working set moves between size classes in phases,
+// which makes the caches move capacity from the size classes a thread stopped
+// using to the ones it uses now.  Compare the default build with the
+// deprecated_perthread variant, which uses the per-thread caches that TCMalloc
+// also falls back to when rseq is unavailable.
+static void BM_shifting_size_class_mix(benchmark::State& state) {
+  constexpr int kPhaseLength = 1 << 16;
+  constexpr int kLiveObjects = 256;
+  constexpr size_t kSizes[] = {16, 48, 256, 1024, 4096};
+
+  void* v[kLiveObjects] = {};
+  int phase = state.thread_index();
+  int i = 0;
+  for (auto s : state) {
+    const size_t size = kSizes[phase % ABSL_ARRAYSIZE(kSizes)];
+    const int index = i % kLiveObjects;
+    ::operator delete(v[index]);
+    v[index] = ::operator new(size);
+    if (++i == kPhaseLength) {
+      i = 0;
+      ++phase;
+    }
+  }
+  for (void* p : v) {
+    ::operator delete(p);
+  }
+}
+BENCHMARK(BM_shifting_size_class_mix)->ThreadRange(1, 8);
+
+// Measures allocating an object and initializing its first cache lines, as
+// constructors do.  Objects are recycled in random order from a large pool, so
+// that they have usually left the cache by the time they are reused.  Compare
+// runs with and without BORG_EXPERIMENTS=TCMALLOC_ALLOC_PREFETCH.
+static void BM_new_first_touch(benchmark::State& state) {
+  const size_t size = state.range(0);
+  const int num_live = state.range(1);
+  const size_t touched = std::min<size_t>(size, 2 * ABSL_CACHELINE_SIZE);
+
+  absl::BitGen rand;
+  const int kRandomTableSize = 98765;
+  std::vector<int> random_index(kRandomTableSize);
+  for (int i = 0; i < kRandomTableSize; i++) {
+    random_index[i] = absl::Uniform<int32_t>(rand, 0, num_live);
+  }
+  std::vector<void*> live(num_live);
+  for (void*& ptr : live) {
+    ptr = ::operator new(size);
+    memset(ptr, 0, touched);
+  }
+
+  int r = 0;
+  for (auto s : state) {
+    void*& ptr = live[random_index[r]];
+    ::operator delete(ptr, size);
+    ptr = ::operator new(size);
+    memset(ptr, 0, touched);
+    benchmark::DoNotOptimize(ptr);
+    if (++r == kRandomTableSize) {
+      r = 0;
+    }
+  }
+  for (void* ptr : live) {
+    ::operator delete(ptr, size);
+  }
+}
+BENCHMARK(BM_new_first_touch)
+    ->Args({64, 1 << 10})
+    ->Args({64, 1 << 18})
+    ->Args({256, 1 << 10})
+    ->Args({256, 1 << 18})
+    ->Args({1024, 1 << 18});
+
 static void BM_get_stats(benchmark::State& state) {
   std::vector<std::unique_ptr<char[]>> allocations;
   const int num_allocations = state.range(0);
@@ -321,6 +458,42 @@ BENCHMARK(BM_get_stats_pageheap_lock)
     ->UseRealTime()
     ->Unit(benchmark::kMillisecond);
 
+// Measures the cost of allocations that go to the page heap while another
+// thread polls GetNumericProperty(), as a monitoring agent would.  range(0)
+// selects the poller: 0 for none, 1 for exact properties, which take
+// pageheap_lock, and 2 for properties served from the stats snapshot.
+static void BM_alloc_while_polling_properties(benchmark::State& state) {
+  const int mode = state.range(0);
+  const absl::Duration old_staleness =
+      MallocExtension::GetStatsSnapshotStaleness();
+  MallocExtension::SetStatsSnapshotStaleness(
+      mode == 2 ? absl::Seconds(1) : absl::ZeroDuration());
+
+  absl::Notification done;
+  std::thread poll_thread;
+  if (mode != 0) {
+    poll_thread = std::thread([&] {
+      while (!done.HasBeenNotified()) {
+        benchmark::DoNotOptimize(
+            MallocExtension::GetNumericProperty("generic.physical_memory_used"));
+      }
+    });
+  }
+
+  // Large enough to bypass the per-CPU caches and central freelists.
+  const size_t kSize = 2 * tcmalloc_internal::kMaxSize;
+  for (auto s : state) {
+    void* p = ::operator new(kSize);
+    benchmark::DoNotOptimize(p);
+    ::operator delete(p, kSize);
+  }
+
+  done.Notify();
+  if (poll_thread.joinable()) poll_thread.join();
+  MallocExtension::SetStatsSnapshotStaleness(old_staleness);
+}
+BENCHMARK(BM_alloc_while_polling_properties)->Arg(0)->Arg(1)->Arg(2);
+
 static void BM_get_stats_pbtxt_internal(benchmark::State& state) {
   if (&MallocExtension_Internal_GetStatsInPbtxt == nullptr) {
     // Sanitizer builds don't provide this function.
@@ -0,0 +1,144 @@
+// Copyright 2023 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/base/internal/sysinfo.h"
+#include "absl/types/optional.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+using tcmalloc_internal::subtle::percpu::UsingFlatVirtualCpus;
+using tcmalloc_internal::subtle::percpu::VirtualRseqCpuId;
+
+// Virtual CPUs make every fence interrupt all of our CPUs, so they are used
+// only when asked for.
+TEST(VirtualCpuTest, PhysicalCpusByDefault) {
+  if (getenv("PERCPU_VCPU_MODE") != nullptr) {
+    GTEST_SKIP() << "PERCPU_VCPU_MODE is set";
+  }
+  EXPECT_FALSE(UsingFlatVirtualCpus());
+}
+
+// Restricts the test thread, and so the threads it goes on to spawn, to a
+// single CPU, like a container given one CPU of a large machine, and runs
+// several allocating threads there.  With virtual CPUs, the cache IDs stay
+// below the number of live threads whichever physical CPU we were given.
+TEST(VirtualCpuTest, RestrictedAffinityPopulatesFewCaches) {
+  if (!MallocExtension::PerCpuCachesActive()) {
+    GTEST_SKIP() << "per-CPU caches are not active";
+  }
+  if (!UsingFlatVirtualCpus()) {
+    GTEST_SKIP() << "virtual CPUs are not in use";
+  }
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  ASSERT_GT(CPU_COUNT(&allowed), 0);
+
+  // Pick the highest-numbered CPU we may run on, so that its physical ID is
+  // as far as possible from the dense IDs.  The bounds below only tell the two
+  // apart when that ID is above kThreads.
+  int target = -1;
+  for (int cpu = 0, n = absl::base_internal::NumCPUs(); cpu < n; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      target = cpu;
+    }
+  }
+  ASSERT_GE(target, 0);
+
+  cpu_set_t restricted;
+  CPU_ZERO(&restricted);
+  CPU_SET(target, &restricted);
+  // sched_setaffinity(0, ...) restricts only the calling thread; the threads
+  // below inherit its mask.
+  ASSERT_EQ(sched_setaffinity(0, sizeof(restricted), &restricted), 0);
+
+  constexpr int kThreads = 8;
+  constexpr int kIterations = 100000;
+  std::atomic<int> max_id{-1};
+  std::vector<std::thread> threads;
+  threads.reserve(kThreads);
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&max_id, i]() {
+      std::vector<void*> ptrs;
+      for (int j = 0; j < kIterations; ++j) {
+        ptrs.push_back(::operator new(16 << (j % 8)));
+        if (ptrs.size() > static_cast<size_t>(16 + i)) {
+          for (void* ptr : ptrs) {
+            ::operator delete(ptr);
+          }
+          ptrs.clear();
+        }
+        int id = VirtualRseqCpuId();
+        int seen = max_id.load(std::memory_order_relaxed);
+        while (id > seen &&
+               !max_id.compare_exchange_weak(seen, id,
+                                             std::memory_order_relaxed)) {
+        }
+      }
+      for (void* ptr : ptrs) {
+        ::operator delete(ptr);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  ASSERT_EQ(sched_setaffinity(0, sizeof(allowed), &allowed), 0);
+
+  // The kernel hands out IDs below the number of threads that were alive,
+  // kThreads workers plus this one, however high the physical CPU we ran on.
+  constexpr int kLiveThreads = kThreads + 1;
+  EXPECT_GE(max_id.load(), 0);
+  EXPECT_LT(max_id.load(), kLiveThreads);
+  if (target >= kLiveThreads) {
+    EXPECT_LT(max_id.load(), target);
+  }
+
+  absl::optional<size_t> populated =
+      MallocExtension::GetNumericProperty("tcmalloc.per_cpu_caches_populated");
+  ASSERT_TRUE(populated.has_value());
+  EXPECT_GT(*populated, 0);
+  EXPECT_LE(*populated, static_cast<size_t>(kLiveThreads));
+
+  const std::string stats = MallocExtension::GetStats();
+  EXPECT_NE(stats.find("Populated per-CPU caches (virtual CPUs: yes)"),
+            std::string::npos);
+  const size_t pos = stats.find("caches populated, all below ID ");
+  ASSERT_NE(pos, std::string::npos);
+  unsigned int id_limit = 0;
+  ASSERT_EQ(sscanf(stats.c_str() + pos, "caches populated, all below ID %u",
+                   &id_limit),
+            1);
+  EXPECT_LE(id_limit, static_cast<unsigned int>(kLiveThreads));
+}
+
+}  // namespace
+}  // namespace tcmalloc
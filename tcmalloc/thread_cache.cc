@@ -77,17 +77,51 @@ void* ThreadCache::FetchFromCentralCache(size_t size_class, size_t byte_size) {
   ASSERT(list->empty());
   const int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
 
-  const int num_to_move = std::min<int>(list->max_length(), batch_size);
-  void* batch[kMaxObjectsToMove];
-  int fetch_count =
-      tc_globals.transfer_cache().RemoveRange(size_class, batch, num_to_move);
-  if (fetch_count == 0) {
-    return nullptr;
+  int num_to_move = std::min<int>(list->max_length(), batch_size);
+  // A list that has already missed since the last Scavenge() is in demand, so
+  // refill it with several batches, as far as its max_length and this thread's
+  // cache budget allow.
+  if (list->misses() > 0 &&
+      list->max_length() > static_cast<size_t>(batch_size)) {
+    const size_t budget =
+        size_ < max_size_ ? (max_size_ - size_) / byte_size : 0;
+    num_to_move = std::max<int>(
+        num_to_move,
+        std::min<size_t>({list->max_length(),
+                          static_cast<size_t>(kMaxBatchesPerFetch * batch_size),
+                          budget}));
   }
+  list->record_miss();
 
-  if (--fetch_count > 0) {
-    size_ += byte_size * fetch_count;
-    list->PushBatch(fetch_count, batch + 1);
+  void* batch[kMaxObjectsToMove];
+  void* result = nullptr;
+  int fetched = 0;
+  while (fetched < num_to_move) {
+    const int want = std::min(num_to_move - fetched, batch_size);
+    const int fetch_count =
+        tc_globals.transfer_cache().RemoveRange(size_class, batch, want);
+    if (fetch_count == 0) {
+      break;
+    }
+    fetched += fetch_count;
+
+    void** to_push = batch;
+    int push_count = fetch_count;
+    if (result == nullptr) {
+      result = batch[0];
+      ++to_push;
+      --push_count;
+    }
+    if (push_count > 0) {
+      size_ += byte_size * push_count;
+      list->PushBatch(push_count, to_push);
+    }
+    if (fetch_count < want) {
+      break;
+    }
+  }
+  if (result == nullptr) {
+    return nullptr;
   }
 
   // Increase max length slowly up to batch_size.  After that,
@@ -108,11 +142,12 @@ void* ThreadCache::FetchFromCentralCache(size_t size_class, size_t byte_size) {
     ASSERT(new_length % batch_size == 0);
     list->set_max_length(new_length);
   }
-  return batch[0];
+  return result;
 }
 
 void ThreadCache::ListTooLong(FreeList* list, size_t size_class) {
   const int batch_size = tc_globals.sizemap().num_objects_to_move(size_class);
+  list->record_miss();
   ReleaseToCentralCache(list, size_class, batch_size);
 
   // If the list is too long, we need to transfer some number of
@@ -170,26 +205,49 @@ void ThreadCache::Scavenge() {
   // that situation by dropping L/2 nodes from the free list.  This
   // may not release much memory, but if so we will call scavenge again
   // pretty soon and the low-water marks will be high on that call.
+  //
+  // Like the per-CPU caches' size class resizing, this also moves capacity
+  // between size classes: a list that has missed since the last Scavenge is
+  // in demand, so its max_length is left alone, while a list that has held
+  // unused objects without missing for kMaxIdleScavenges calls is drained
+  // entirely, and its max_length halved, so that this thread's share of the
+  // cache goes to the lists that use it.
   for (int size_class = 0; size_class < kNumClasses; size_class++) {
     FreeList* list = &list_[size_class];
     const int lowmark = list->lowwatermark();
+    const bool missed = list->misses() > 0;
+    list->clear_misses();
     if (lowmark > 0) {
-      const int drop = (lowmark > 1) ? lowmark / 2 : 1;
+      list->set_idle_scavenges(missed ? 0 : list->idle_scavenges() + 1);
+      const bool idle = list->idle_scavenges() >= kMaxIdleScavenges;
+      // An idle list is drained entirely, including objects freed to it
+      // since the last Scavenge(), not just down to its low-water mark.
+      int drop;
+      if (idle) {
+        drop = list->length();
+      } else {
+        drop = (lowmark > 1) ? lowmark / 2 : 1;
+      }
       ReleaseToCentralCache(list, size_class, drop);
 
-      // Shrink the max length if it isn't used.  Only shrink down to
-      // batch_size -- if the thread was active enough to get the max_length
-      // above batch_size, it will likely be that active again.  If
-      // max_length shinks below batch_size, the thread will have to
-      // go through the slow-start behavior again.  The slow-start is useful
-      // mainly for threads that stay relatively idle for their entire
+      // Shrink the max length if it isn't used.  Unless the list is idle,
+      // only shrink down to batch_size -- if the thread was active enough to
+      // get the max_length above batch_size, it will likely be that active
+      // again.  If max_length shinks below batch_size, the thread will have
+      // to go through the slow-start behavior again.  The slow-start is
+      // useful mainly for threads that stay relatively idle for their entire
       // lifetime.
       const int batch_size =
           tc_globals.sizemap().num_objects_to_move(size_class);
-      if (list->max_length() > batch_size) {
+      if (idle) {
+        list->set_max_length(std::max<int>(list->max_length() / 2, 1));
+      } else if (!missed &&
+                 list->max_length() > static_cast<size_t>(batch_size)) {
         list->set_max_length(
             std::max<int>(list->max_length() - batch_size, batch_size));
       }
+    } else {
+      list->set_idle_scavenges(0);
     }
     list->clear_lowwatermark();
   }
@@ -34,6 +34,7 @@
 GOOGLE_MALLOC_SECTION_BEGIN
 namespace tcmalloc {
 namespace tcmalloc_internal {
+class ThreadCachePeer;
 
 //-------------------------------------------------------------------
 // Data kept per thread
@@ -107,6 +108,8 @@ class ThreadCache {
   }
 
  private:
+  friend class ::tcmalloc::tcmalloc_internal::ThreadCachePeer;
+
   // We inherit rather than include the list as a data structure to reduce
   // compiler padding.  Without inheritance, the compiler pads the list
   // structure and then adds it as a member, even though we could fit everything
@@ -119,17 +122,20 @@ class ThreadCache {
     // length_ > max_length_.  After the kMaxOverages'th time, max_length_
     // shrinks and length_overages_ is reset to zero.
     uint32_t length_overages_;
-
-    // This extra unused field pads FreeList size to 32 bytes on 64
-    // bit machines, helping compiler generate faster code for
-    // indexing array of lists.
-    void* ABSL_ATTRIBUTE_UNUSED extra_;
+    // The number of times the list went to the central free-list, because it
+    // was empty or too long, since the last Scavenge().
+    uint32_t misses_;
+    // The number of consecutive Scavenge() calls that found unused objects in
+    // the list and no misses.
+    uint32_t idle_scavenges_;
 
    public:
     void Init() {
       lowater_ = 0;
       max_length_ = 1;
       length_overages_ = 0;
+      misses_ = 0;
+      idle_scavenges_ = 0;
     }
 
     // Return the maximum length of the list.
@@ -144,6 +150,13 @@ class ThreadCache {
 
     void set_length_overages(size_t new_count) { length_overages_ = new_count; }
 
+    // Miss and idleness tracking, for Scavenge().
+    size_t misses() const { return misses_; }
+    void record_miss() { ++misses_; }
+    void clear_misses() { misses_ = 0; }
+    size_t idle_scavenges() const { return idle_scavenges_; }
+    void set_idle_scavenges(size_t n) { idle_scavenges_ = n; }
+
     // Low-water mark management
     int lowwatermark() const { return lowater_; }
     void clear_lowwatermark() { lowater_ = length(); }
@@ -162,9 +175,9 @@ class ThreadCache {
     }
   };
 
-// we've deliberately introduced unused extra_ field into FreeList
-// to pad the size. Lets ensure that it is still working as
-// intended.
+// A FreeList size of 32 bytes on 64 bit machines helps the compiler generate
+// faster code for indexing the array of lists.  Lets ensure that it is still
+// working as intended.
 #ifdef _LP64
   static_assert(sizeof(FreeList) == 32, "Freelist size has changed");
 #endif
@@ -19,22 +19,48 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
 #include <string>
 #include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "benchmark/benchmark.h"
 #include "gtest/gtest.h"
 #include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
+#include "tcmalloc/common.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/memory_stats.h"
 #include "tcmalloc/internal/parameter_accessors.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/tcmalloc_policy.h"
+#include "tcmalloc/thread_cache.h"
 
 namespace tcmalloc {
+namespace tcmalloc_internal {
+
+class ThreadCachePeer {
+ public:
+  static size_t ListLength(const ThreadCache& cache, size_t size_class) {
+    return cache.list_[size_class].length();
+  }
+
+  static size_t MaxLength(const ThreadCache& cache, size_t size_class) {
+    return cache.list_[size_class].max_length();
+  }
+};
+
+}  // namespace tcmalloc_internal
 namespace {
 
+using tcmalloc_internal::CppPolicy;
+using tcmalloc_internal::kMaxIdleScavenges;
+using tcmalloc_internal::tc_globals;
+using tcmalloc_internal::ThreadCache;
+using tcmalloc_internal::ThreadCachePeer;
+
 int64_t MemoryUsageSlow(pid_t pid) {
   int64_t ret = 0;
 
@@ -132,5 +158,88 @@ TEST_F(ThreadCacheTest, NoLeakOnThreadDestruction) {
       << "Before: " << start_size << " After: " << end_size;
 }
 
+// Make sure that a thread whose working set moves between size classes keeps
+// its cache within its budget, and returns what it no longer uses.
+TEST_F(ThreadCacheTest, ShiftingSizeClasses) {
+  // Test only valid in per-thread mode
+  ASSERT_FALSE(MallocExtension::PerCpuCachesActive());
+
+  std::thread t([]() {
+    constexpr size_t kSizes[] = {16, 256, 4096, 256, 16};
+    constexpr int kObjects = 4096;
+    std::vector<void*> v(kObjects);
+    for (size_t size : kSizes) {
+      for (int round = 0; round < 16; ++round) {
+        for (void*& p : v) {
+          p = ::operator new(size);
+        }
+        for (void* p : v) {
+          ::operator delete(p, size);
+        }
+      }
+
+      // The caches of all threads share this budget.
+      const size_t cached =
+          *MallocExtension::GetNumericProperty("tcmalloc.thread_cache_free");
+      EXPECT_LE(cached, MallocExtension::GetMaxTotalThreadCacheBytes())
+          << "size " << size;
+    }
+
+    // Warm up a size class, then leave it idle.
+    constexpr size_t kSize = 64;
+    constexpr int kWarmObjects = 1024;
+    const size_t size_class =
+        tc_globals.sizemap().SizeClass(CppPolicy(), kSize);
+    const size_t batch_size =
+        tc_globals.sizemap().num_objects_to_move(size_class);
+    ThreadCache* cache = ThreadCache::GetCache();
+    for (int round = 0; round < 16; ++round) {
+      for (int i = 0; i < kWarmObjects; ++i) {
+        v[i] = ::operator new(kSize);
+      }
+      for (int i = 0; i < kWarmObjects; ++i) {
+        ::operator delete(v[i], kSize);
+      }
+    }
+    ASSERT_GT(ThreadCachePeer::ListLength(*cache, size_class), 1);
+
+    // The first Scavenge() still sees the warm-up's misses.  The list then
+    // counts as idle, and is drained after kMaxIdleScavenges more, with its
+    // max_length halved.  That includes an object freed to it just before the
+    // last one, above its low-water mark.
+    void* late = ::operator new(kSize);
+    cache->Scavenge();
+    size_t max_length = 0;
+    for (int i = 0; i < kMaxIdleScavenges; ++i) {
+      EXPECT_GT(ThreadCachePeer::ListLength(*cache, size_class), 0) << i;
+      max_length = ThreadCachePeer::MaxLength(*cache, size_class);
+      if (i == kMaxIdleScavenges - 1) {
+        ::operator delete(late, kSize);
+      }
+      cache->Scavenge();
+    }
+    EXPECT_EQ(ThreadCachePeer::ListLength(*cache, size_class), 0);
+    EXPECT_EQ(ThreadCachePeer::MaxLength(*cache, size_class),
+              std::max<size_t>(max_length / 2, 1));
+    ASSERT_GT(ThreadCachePeer::MaxLength(*cache, size_class), batch_size);
+
+    // The first miss after that fetches a single batch.  A second miss
+    // before the next Scavenge() fetches several.
+    std::vector<void*> held;
+    held.push_back(::operator new(kSize));
+    EXPECT_LT(ThreadCachePeer::ListLength(*cache, size_class), batch_size);
+    while (ThreadCachePeer::ListLength(*cache, size_class) > 0) {
+      held.push_back(::operator new(kSize));
+    }
+    held.push_back(::operator new(kSize));
+    EXPECT_GT(ThreadCachePeer::ListLength(*cache, size_class), batch_size);
+
+    for (void* p : held) {
+      ::operator delete(p, kSize);
+    }
+  });
+  t.join();
+}
+
 }  // namespace
 }  // namespace tcmalloc
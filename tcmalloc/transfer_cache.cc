@@ -32,6 +32,7 @@
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/optimization.h"
 #include "tcmalloc/internal/util.h"
+#include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
 GOOGLE_MALLOC_SECTION_BEGIN
@@ -65,6 +66,11 @@ void *StaticForwarder::Alloc(size_t size, std::align_val_t alignment) {
 ABSL_CONST_INIT bool ShardedStaticForwarder::use_generic_cache_(false);
 ABSL_CONST_INIT bool
     ShardedStaticForwarder::enable_cache_for_large_classes_only_(false);
+ABSL_CONST_INIT bool ShardedStaticForwarder::use_numa_aware_sharding_(false);
+
+int ShardedStaticForwarder::RemoteStealThreshold() {
+  return Parameters::sharded_transfer_cache_remote_steal_threshold();
+}
 
 void BackingTransferCache::InsertRange(absl::Span<void *> batch) const {
   tc_globals.transfer_cache().InsertRange(size_class_, batch);
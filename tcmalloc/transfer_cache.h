@@ -35,9 +35,11 @@
 #include "absl/types/span.h"
 #include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/cache_topology.h"
 #include "tcmalloc/internal/environment.h"
 #include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/numa.h"
 #include "tcmalloc/internal/percpu.h"
 #include "tcmalloc/transfer_cache_stats.h"
 
@@ -74,8 +76,8 @@ class StaticForwarder {
 
   static size_t class_to_size(int size_class);
   static size_t num_objects_to_move(int size_class);
-  static void *Alloc(size_t size, std::align_val_t alignment = kAlignment)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Allocates from the Arena, which takes its own lock.
+  static void *Alloc(size_t size, std::align_val_t alignment = kAlignment);
 };
 
 class ShardedStaticForwarder : public StaticForwarder {
@@ -93,6 +95,8 @@ class ShardedStaticForwarder : public StaticForwarder {
     // classes alone.
     enable_cache_for_large_classes_only_ = IsExperimentActive(
         Experiment::TEST_ONLY_TCMALLOC_SHARDED_TRANSFER_CACHE);
+    use_numa_aware_sharding_ =
+        IsExperimentActive(Experiment::TCMALLOC_NUMA_SHARDED_TRANSFER_CACHE);
   }
 
   static bool UseGenericCache() { return use_generic_cache_; }
@@ -101,9 +105,14 @@ class ShardedStaticForwarder : public StaticForwarder {
     return enable_cache_for_large_classes_only_;
   }
 
+  static bool UseNumaAwareSharding() { return use_numa_aware_sharding_; }
+
+  static int RemoteStealThreshold();
+
  private:
   static bool use_generic_cache_;
   static bool enable_cache_for_large_classes_only_;
+  static bool use_numa_aware_sharding_;
 };
 
 class ProdCpuLayout {
@@ -112,6 +121,9 @@ class ProdCpuLayout {
   static int BuildCacheMap(uint8_t l3_cache_index[CPU_SETSIZE]) {
     return BuildCpuToL3CacheMap(l3_cache_index);
   }
+  static int BuildNodeMap(uint8_t numa_node_index[CPU_SETSIZE]) {
+    return BuildCpuToNumaNodeMap(numa_node_index);
+  }
 };
 
 // Forwards calls to the unsharded TransferCache.
@@ -128,6 +140,12 @@ class BackingTransferCache {
 
 // This transfer-cache is set up to be sharded per L3 cache. It is backed by
 // the non-sharded "normal" TransferCacheManager.
+//
+// With NUMA-aware sharding, a shard that misses first takes objects from the
+// other shards on its NUMA node.  Objects cached on other nodes are likely to
+// be remote memory, so it only takes from those shards once it has missed
+// RemoteStealThreshold() times in a row.  Only if that fails too does it go to
+// the backing cache.
 template <typename Manager, typename CpuLayout, typename FreeList>
 class ShardedTransferCacheManagerBase {
  public:
@@ -155,6 +173,19 @@ class ShardedTransferCacheManagerBase {
     for (int shard = 0; shard < num_shards_; ++shard) {
       new (&shards_[shard]) Shard;
     }
+    numa_aware_ = Manager::UseNumaAwareSharding();
+    if (numa_aware_) {
+      // Each shard is placed on the node of the first cpu that uses it.
+      uint8_t numa_node_index[CPU_SETSIZE] = {0};
+      CpuLayout::BuildNodeMap(numa_node_index);
+      bool placed[std::numeric_limits<uint8_t>::max() + 1] = {false};
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        const uint8_t shard = l3_cache_index_[cpu];
+        if (shard >= num_shards_ || placed[shard]) continue;
+        shards_[shard].node = numa_node_index[cpu];
+        placed[shard] = true;
+      }
+    }
     for (int size_class = 0; size_class < kNumClasses; ++size_class) {
       const int size_per_object = Manager::class_to_size(size_class);
       // We enable sharded transfer cache for all the size classes when a
@@ -206,7 +237,7 @@ class ShardedTransferCacheManagerBase {
   void *Pop(int size_class) {
     ASSERT(subtle::percpu::IsFastNoInit());
     void *batch[1];
-    const int got = get_cache(size_class).RemoveRange(size_class, batch, 1);
+    const int got = RemoveRange(size_class, batch, 1);
     return got == 1 ? batch[0] : nullptr;
   }
 
@@ -247,6 +278,19 @@ class ShardedTransferCacheManagerBase {
           stats.max_capacity, stats.insert_hits, stats.insert_misses,
           stats.remove_hits, stats.remove_misses);
     }
+    if (!numa_aware_) return;
+    out->printf("------------------------------------------------\n");
+    out->printf("NUMA-aware sharding: remote steal threshold %d\n",
+                Manager::RemoteStealThreshold());
+    for (int index = 0; index < num_shards_; ++index) {
+      if (!shard_initialized(index)) continue;
+      const ShardStats stats = GetShardStats(index);
+      out->printf(
+          "shard %3d [ node %2d ] : %12u hits; %12u misses; %12u steals;"
+          " %12u remote steals\n",
+          index, stats.numa_node, stats.hits, stats.misses, stats.steals,
+          stats.remote_steals);
+    }
   }
 
   void PrintInPbtxt(PbtxtRegion *region) const {
@@ -263,6 +307,41 @@ class ShardedTransferCacheManagerBase {
       entry.PrintI64("max_capacity", stats.max_capacity);
     }
     region->PrintI64("active_sharded_transfer_caches", NumActiveShards());
+    region->PrintBool("numa_aware_sharding", numa_aware_);
+    if (!numa_aware_) return;
+    for (int index = 0; index < num_shards_; ++index) {
+      if (!shard_initialized(index)) continue;
+      const ShardStats stats = GetShardStats(index);
+      PbtxtRegion entry =
+          region->CreateSubRegion("sharded_transfer_cache_shard");
+      entry.PrintI64("shard", index);
+      entry.PrintI64("numa_node", stats.numa_node);
+      entry.PrintI64("hits", stats.hits);
+      entry.PrintI64("misses", stats.misses);
+      entry.PrintI64("steals", stats.steals);
+      entry.PrintI64("remote_steals", stats.remote_steals);
+    }
+  }
+
+  // Per-shard counters, maintained only with NUMA-aware sharding.  hits and
+  // misses count removals from the shard's own caches; steals and
+  // remote_steals count misses served by another shard on the same node or on
+  // another node.
+  struct ShardStats {
+    int numa_node;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t steals;
+    uint64_t remote_steals;
+  };
+
+  ShardStats GetShardStats(int index) const {
+    ASSERT(index >= 0 && index < num_shards_);
+    const Shard &shard = shards_[index];
+    return {shard.node, static_cast<uint64_t>(shard.hits.value()),
+            static_cast<uint64_t>(shard.misses.value()),
+            static_cast<uint64_t>(shard.steals.value()),
+            static_cast<uint64_t>(shard.remote_steals.value())};
   }
 
   // Returns cumulative stats over all the shards of the sharded transfer cache.
@@ -285,7 +364,12 @@ class ShardedTransferCacheManagerBase {
   }
 
   int RemoveRange(int size_class, void **batch, size_t count) {
-    return get_cache(size_class).RemoveRange(size_class, batch, count);
+    const int index = shard_index();
+    TransferCache &cache = get_shard(index).transfer_caches[size_class];
+    if (!numa_aware_) {
+      return cache.RemoveRange(size_class, batch, count);
+    }
+    return RemoveRangeNumaAware(index, size_class, batch, count);
   }
 
   void InsertRange(int size_class, absl::Span<void *> batch) {
@@ -338,13 +422,22 @@ class ShardedTransferCacheManagerBase {
       // The constructor of atomic values is not atomic. Set the value
       // explicitly and atomically here.
       initialized.store(false, std::memory_order_release);
+      consecutive_misses.store(0, std::memory_order_relaxed);
     }
     TransferCache *transfer_caches = nullptr;
     absl::once_flag once_flag;
     // We need to be able to tell whether a given shard is initialized, which
     // the `once_flag` API doesn't offer.
     std::atomic<bool> initialized;
-  };
+    // The NUMA node of the cpus using this shard.
+    int node = 0;
+    // Updated only with NUMA-aware sharding.
+    std::atomic<int> consecutive_misses;
+    StatsCounter hits;
+    StatsCounter misses;
+    StatsCounter steals;
+    StatsCounter remote_steals;
+  } ABSL_CACHELINE_ALIGNED;
 
   struct Capacity {
     int capacity;
@@ -384,17 +477,77 @@ class ShardedTransferCacheManagerBase {
     shard.initialized.store(true, std::memory_order_release);
   }
 
-  // Returns the cache shard corresponding to the given size class and the
-  // current cpu's L3 node. The cache will be initialized if required.
-  TransferCache &get_cache(int size_class) {
+  // Returns the index of the shard for the current cpu's L3 cache.
+  int shard_index() const {
     const int cpu = cpu_layout_->CurrentCpu();
     ASSERT(cpu < ABSL_ARRAYSIZE(l3_cache_index_));
     ASSERT(cpu >= 0);
     const uint8_t shard_index = l3_cache_index_[cpu];
     ASSERT(shard_index < num_shards_);
-    Shard &shard = shards_[shard_index];
+    return shard_index;
+  }
+
+  // Returns the shard with the given index, initializing it if required.
+  Shard &get_shard(int index) {
+    Shard &shard = shards_[index];
     absl::call_once(shard.once_flag, [this, &shard]() { InitShard(shard); });
-    return shard.transfer_caches[size_class];
+    return shard;
+  }
+
+  // Returns the cache shard corresponding to the given size class and the
+  // current cpu's L3 node. The cache will be initialized if required.
+  TransferCache &get_cache(int size_class) {
+    return get_shard(shard_index()).transfer_caches[size_class];
+  }
+
+  int RemoveRangeNumaAware(int index, int size_class, void **batch,
+                           size_t count) {
+    Shard &shard = shards_[index];
+    TransferCache &cache = shard.transfer_caches[size_class];
+    int got = cache.RemoveCachedRange(batch, count);
+    if (got > 0) {
+      shard.hits.LossyAdd(1);
+      shard.consecutive_misses.store(0, std::memory_order_relaxed);
+      return got;
+    }
+    shard.misses.LossyAdd(1);
+
+    got = Steal(index, size_class, batch, count, /*remote=*/false);
+    if (got > 0) {
+      shard.steals.LossyAdd(1);
+      return got;
+    }
+
+    const int misses =
+        shard.consecutive_misses.load(std::memory_order_relaxed) + 1;
+    shard.consecutive_misses.store(misses, std::memory_order_relaxed);
+    if (misses >= Manager::RemoteStealThreshold()) {
+      got = Steal(index, size_class, batch, count, /*remote=*/true);
+      if (got > 0) {
+        shard.remote_steals.LossyAdd(1);
+        return got;
+      }
+    }
+
+    return cache.RemoveRange(size_class, batch, count);
+  }
+
+  // Takes objects of size_class from the caches of other initialized shards,
+  // either on the same NUMA node as shard `index` or, if remote, on other
+  // nodes.  Returns the number of objects taken.
+  int Steal(int index, int size_class, void **batch, size_t count,
+            bool remote) {
+    const int node = shards_[index].node;
+    for (int i = 1; i < num_shards_; ++i) {
+      const int victim = (index + i) % num_shards_;
+      if (!shard_initialized(victim)) continue;
+      if ((shards_[victim].node != node) != remote) continue;
+      const int got =
+          shards_[victim].transfer_caches[size_class].RemoveCachedRange(
+              batch, count);
+      if (got > 0) return got;
+    }
+    return 0;
   }
 
   // Mapping from cpu to the L3 cache used.
@@ -402,6 +555,7 @@ class ShardedTransferCacheManagerBase {
 
   Shard *shards_ = nullptr;
   int num_shards_ = 0;
+  bool numa_aware_ = false;
   std::atomic<int> active_shards_ = 0;
   bool active_for_class_[kNumClasses] = {false};
   Manager *const owner_;
@@ -184,29 +184,38 @@ class TransferCache {
   // batch.
   ABSL_MUST_USE_RESULT int RemoveRange(int size_class, void **batch, int N)
       ABSL_LOCKS_EXCLUDED(lock_) {
-    ASSERT(0 < N && N <= kMaxObjectsToMove);
-    auto info = slot_info_.load(std::memory_order_relaxed);
-    if (info.used) {
-      absl::base_internal::SpinLockHolder h(&lock_);
-      // Refetch with the lock
-      info = slot_info_.load(std::memory_order_relaxed);
-      int got = std::min(N, info.used);
-      if (got) {
-        info.used -= got;
-        SetSlotInfo(info);
-        void **entry = GetSlot(info.used);
-        memcpy(batch, entry, sizeof(void *) * got);
-        remove_hits_.LossyAdd(1);
-        low_water_mark_ = std::min(low_water_mark_, info.used);
-        return got;
-      }
-    }
+    const int got = RemoveCachedRange(batch, N);
+    if (got) return got;
 
     remove_misses_.LossyAdd(1);
     remove_object_misses_.Inc(N);
     return freelist().RemoveRange(batch, N);
   }
 
+  // Like RemoveRange, but only removes objects held in the cache itself, and
+  // returns 0 rather than falling back to the freelist.  A miss is not
+  // recorded.
+  ABSL_MUST_USE_RESULT int RemoveCachedRange(void **batch, int N)
+      ABSL_LOCKS_EXCLUDED(lock_) {
+    ASSERT(0 < N && N <= kMaxObjectsToMove);
+    auto info = slot_info_.load(std::memory_order_relaxed);
+    if (!info.used) return 0;
+
+    absl::base_internal::SpinLockHolder h(&lock_);
+    // Refetch with the lock
+    info = slot_info_.load(std::memory_order_relaxed);
+    int got = std::min(N, info.used);
+    if (got) {
+      info.used -= got;
+      SetSlotInfo(info);
+      void **entry = GetSlot(info.used);
+      memcpy(batch, entry, sizeof(void *) * got);
+      remove_hits_.LossyAdd(1);
+      low_water_mark_ = std::min(low_water_mark_, info.used);
+    }
+    return got;
+  }
+
   // We record the lowest value of info.used in a low water mark since the last
   // call to TryPlunder. We plunder all those objects to the freelist, as the
   // objects not used within a full cycle are unlikely to be used again.
@@ -664,6 +664,66 @@ TEST(ShardedTransferCacheManagerTest, ShardsOnDemand) {
   }
 }
 
+TEST(ShardedTransferCacheManagerTest, NumaAwareStealing) {
+  if (!subtle::percpu::IsFast()) {
+    return;
+  }
+
+  using ShardedManager = FakeShardedTransferCacheEnvironment::ShardedManager;
+  // Shards 0 and 1 (cpus 0-3) are on node 0, shards 2 and 3 (cpus 4-7) on
+  // node 1.
+  constexpr int kNumShards = 4;
+  FakeShardedTransferCacheEnvironment env(kNumShards,
+                                          /*use_generic_cache=*/true,
+                                          /*shards_per_node=*/2);
+  ShardedManager& manager = env.sharded_manager();
+  env.transfer_cache_manager().SetPartialLegacyTransferCache(true);
+  env.transfer_cache_manager().SetRemoteStealThreshold(2);
+  ASSERT_TRUE(manager.should_use(kSizeClass));
+
+  auto push = [&](int cpu) {
+    void* ptr;
+    env.central_freelist().AllocateBatch(&ptr, 1);
+    env.SetCurrentCpu(cpu);
+    manager.Push(kSizeClass, ptr);
+  };
+  auto pop = [&](int cpu) {
+    env.SetCurrentCpu(cpu);
+    void* ptr = manager.Pop(kSizeClass);
+    ASSERT_NE(ptr, nullptr);
+    env.central_freelist().FreeBatch({&ptr, 1});
+  };
+
+  // A hit in the local shard.
+  push(0);
+  pop(0);
+  EXPECT_EQ(manager.GetShardStats(0).hits, 1);
+  EXPECT_EQ(manager.GetShardStats(0).misses, 0);
+
+  // Shard 1 is on the same node, so shard 0 takes its objects right away.
+  push(2);
+  pop(0);
+  EXPECT_EQ(manager.tc_length(2, kSizeClass), 0);
+  EXPECT_EQ(manager.GetShardStats(0).misses, 1);
+  EXPECT_EQ(manager.GetShardStats(0).steals, 1);
+
+  // Shard 2 is on the other node.  The first miss goes to the backing cache,
+  // the second one, reaching the threshold, takes from shard 2.
+  push(4);
+  pop(0);
+  EXPECT_EQ(manager.tc_length(4, kSizeClass), 1);
+  EXPECT_EQ(manager.GetShardStats(0).remote_steals, 0);
+  pop(0);
+  EXPECT_EQ(manager.tc_length(4, kSizeClass), 0);
+  EXPECT_EQ(manager.GetShardStats(0).misses, 3);
+  EXPECT_EQ(manager.GetShardStats(0).remote_steals, 1);
+
+  EXPECT_EQ(manager.GetShardStats(0).numa_node, 0);
+  EXPECT_EQ(manager.GetShardStats(1).numa_node, 0);
+  EXPECT_EQ(manager.GetShardStats(2).numa_node, 1);
+  EXPECT_EQ(manager.GetShardStats(3).numa_node, 1);
+}
+
 namespace unit_tests {
 using Env = FakeTransferCacheEnvironment<internal_transfer_cache::TransferCache<
     MockCentralFreeList, FakeTransferCacheManager>>;
@@ -40,6 +40,14 @@ build_variants = [
         "name": "numa_aware",
         "copts": ["-DTCMALLOC_NUMA_AWARE"],
     },
+    {
+        "name": "la57",
+        "copts": ["-DTCMALLOC_LA57"],
+    },
+    {
+        "name": "size_class_regions",
+        "copts": ["-DTCMALLOC_SIZE_CLASS_REGIONS"],
+    },
 ]
 
 test_variants = [
@@ -96,6 +104,18 @@ test_variants = [
         ],
         "copts": ["-DTCMALLOC_NUMA_AWARE"],
     },
+    {
+        "name": "la57",
+        "malloc": "//tcmalloc:tcmalloc_la57",
+        "deps": ["//tcmalloc:common_la57"],
+        "copts": ["-DTCMALLOC_LA57"],
+    },
+    {
+        "name": "size_class_regions",
+        "malloc": "//tcmalloc:tcmalloc_size_class_regions",
+        "deps": ["//tcmalloc:common_size_class_regions"],
+        "copts": ["-DTCMALLOC_SIZE_CLASS_REGIONS"],
+    },
     {
         "name": "256k_pages_pow2_sharded_transfer_cache",
         "malloc": "//tcmalloc:tcmalloc_256k_pages",
@@ -120,6 +140,18 @@ test_variants = [
         "deps": ["//tcmalloc:common_8k_pages"],
         "env": {"BORG_EXPERIMENTS": "TEST_ONLY_TCMALLOC_FILLER_CHUNKS_PER_ALLOC"},
     },
+    {
+        "name": "sharded_central_freelist",
+        "malloc": "//tcmalloc",
+        "deps": ["//tcmalloc:common_8k_pages"],
+        "env": {"BORG_EXPERIMENTS": "TCMALLOC_SHARDED_CENTRAL_FREELIST"},
+    },
+    {
+        "name": "hugepage_cpu_slabs",
+        "malloc": "//tcmalloc",
+        "deps": ["//tcmalloc:common_8k_pages"],
+        "env": {"BORG_EXPERIMENTS": "TCMALLOC_HUGEPAGE_CPU_SLABS"},
+    },
     {
         "name": "no_hpaa",
         "malloc": "//tcmalloc",